@@ -0,0 +1,410 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/ABI.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+#include <remill/Version/Version.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+DEFINE_string(os, REMILL_OS,
+              "Operating system name of the semantics to profile. Valid "
+              "OSes: linux, macos, windows, solaris.");
+DEFINE_string(arch, REMILL_ARCH,
+              "Architecture of the semantics to profile. Valid "
+              "architectures: x86, amd64 (with or without `_avx` or "
+              "`_avx512` appended), aarch64, aarch32, sparc32, sparc64, "
+              "thumb2, ppc");
+
+DEFINE_string(filter, "",
+              "Only profile the ISELs whose names contain this string.");
+
+DEFINE_string(sort_by, "optimized",
+              "Rank the ISELs by their `optimized` instruction count, their "
+              "`unoptimized` instruction count, or their number of "
+              "`memory` intrinsic calls.");
+
+DEFINE_uint32(top, 50,
+              "Number of ISELs to print in the ranked report. Zero prints "
+              "all of them.");
+
+DEFINE_string(json_out, "",
+              "Path to a file where the profile of every ISEL should be "
+              "saved as JSON.");
+
+DEFINE_string(baseline, "",
+              "Path to a profile saved by an earlier run with `--json_out`. "
+              "ISELs whose optimized instruction count grew since then are "
+              "reported, and make this program exit with an error.");
+
+namespace {
+
+// Operands of an ISEL are read from, or written to, the `State` structure,
+// as if they were registers. Each operand gets its own slot, which is big
+// enough for the widest vector registers.
+static constexpr uint64_t kOperandSlotSize = 64u;
+
+// The cost of one ISEL.
+struct ISelCost {
+  std::string name;
+
+  // Number of instructions in a lifted function that calls the ISEL, once
+  // the semantics have been inlined, but before optimization.
+  uint64_t unoptimized_insts{0u};
+
+  // Number of instructions and basic blocks in the same function after
+  // optimization.
+  uint64_t optimized_insts{0u};
+  uint64_t optimized_blocks{0u};
+
+  // Number of calls to memory access intrinsics, e.g.
+  // `__remill_read_memory_32`, after optimization.
+  uint64_t memory_calls{0u};
+};
+
+static bool IsMemoryIntrinsic(llvm::StringRef name) {
+  return name.startswith("__remill_read_memory_") ||
+         name.startswith("__remill_write_memory_") ||
+         name.startswith("__remill_compare_exchange_memory_") ||
+         name.startswith("__remill_fetch_and_");
+}
+
+// Measures the cost of ISELs by calling each one from its own lifted
+// function, inlining it, and optimizing the lifted function with the
+// standard function simplification pipeline.
+class ISelProfiler {
+ public:
+  ISelProfiler(const remill::Arch *arch_, llvm::Module *module_)
+      : arch(arch_),
+        module(module_) {
+    pb.registerModuleAnalyses(mam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.registerCGSCCAnalyses(cam);
+    pb.crossRegisterProxies(lam, fam, cam, mam);
+    fpm = pb.buildFunctionSimplificationPipeline(
+        llvm::OptimizationLevel::O2, llvm::ThinOrFullLTOPhase::None);
+  }
+
+  ~ISelProfiler(void) {
+    mam.clear();
+    fam.clear();
+    lam.clear();
+    cam.clear();
+  }
+
+  ISelCost Profile(llvm::StringRef isel_name, llvm::Function *sem) {
+    ISelCost cost;
+    cost.name = isel_name.str();
+
+    auto func = arch->DeclareLiftedFunction(
+        "isel_cost_" + isel_name.str(), module);
+    auto &context = module->getContext();
+    auto state_ptr = remill::NthArgument(func, remill::kStatePointerArgNum);
+    auto memory = remill::NthArgument(func, remill::kMemoryPointerArgNum);
+
+    llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", func));
+    const auto sem_type = sem->getFunctionType();
+    std::vector<llvm::Value *> args = {memory, state_ptr};
+    for (auto i = 2u; i < sem_type->getNumParams(); ++i) {
+      const auto op_type = sem_type->getParamType(i);
+      const auto op_ptr = ir.CreateConstInBoundsGEP1_64(
+          ir.getInt8Ty(), state_ptr, kOperandSlotSize * (i - 2u));
+      if (op_type->isPointerTy()) {
+        args.push_back(op_ptr);
+      } else {
+        args.push_back(ir.CreateLoad(op_type, op_ptr));
+      }
+    }
+
+    llvm::Value *new_memory = ir.CreateCall(sem, args);
+    if (new_memory->getType() != func->getReturnType()) {
+      new_memory = memory;
+    }
+    ir.CreateRet(new_memory);
+
+    remill::InlineSemantics(func);
+    cost.unoptimized_insts = func->getInstructionCount();
+
+    fpm.run(*func, fam);
+    cost.optimized_insts = func->getInstructionCount();
+    cost.optimized_blocks = func->size();
+    for (auto &inst : llvm::instructions(*func)) {
+      if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
+        if (auto callee = call->getCalledFunction();
+            callee && IsMemoryIntrinsic(callee->getName())) {
+          cost.memory_calls += 1u;
+        }
+      }
+    }
+
+    fam.clear(*func, func->getName());
+    func->eraseFromParent();
+    return cost;
+  }
+
+ private:
+  const remill::Arch *const arch;
+  llvm::Module *const module;
+
+  llvm::ModuleAnalysisManager mam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::LoopAnalysisManager lam;
+  llvm::CGSCCAnalysisManager cam;
+  llvm::PassBuilder pb;
+  llvm::FunctionPassManager fpm;
+};
+
+static void PrintReport(const std::vector<ISelCost> &costs) {
+  const auto num_printed =
+      FLAGS_top ? std::min<size_t>(FLAGS_top, costs.size()) : costs.size();
+
+  std::cout << std::setw(6) << "Rank" << std::setw(11) << "Optimized"
+            << std::setw(13) << "Unoptimized" << std::setw(8) << "Blocks"
+            << std::setw(8) << "Memory"
+            << "  ISEL" << std::endl;
+
+  for (size_t i = 0u; i < num_printed; ++i) {
+    const auto &cost = costs[i];
+    std::cout << std::setw(6) << (i + 1u) << std::setw(11)
+              << cost.optimized_insts << std::setw(13)
+              << cost.unoptimized_insts << std::setw(8)
+              << cost.optimized_blocks << std::setw(8) << cost.memory_calls
+              << "  " << cost.name << std::endl;
+  }
+
+  uint64_t total_unoptimized = 0u;
+  uint64_t total_optimized = 0u;
+  for (const auto &cost : costs) {
+    total_unoptimized += cost.unoptimized_insts;
+    total_optimized += cost.optimized_insts;
+  }
+
+  std::cout << std::endl
+            << "Profiled " << costs.size() << " ISELs: "
+            << total_unoptimized << " unoptimized and " << total_optimized
+            << " optimized instructions in total" << std::endl;
+}
+
+static bool StoreProfile(const std::vector<ISelCost> &costs) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(FLAGS_json_out, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open " << FLAGS_json_out << ": " << ec.message();
+    return false;
+  }
+
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attribute("os", FLAGS_os);
+    json.attribute("arch", FLAGS_arch);
+    if (remill::version::HasVersionData()) {
+      json.attribute("remill_commit",
+                     llvm::StringRef(remill::version::GetCommitHash()));
+    }
+    json.attributeArray("isels", [&] {
+      for (const auto &cost : costs) {
+        json.object([&] {
+          json.attribute("name", cost.name);
+          json.attribute("unoptimized_instructions",
+                         static_cast<int64_t>(cost.unoptimized_insts));
+          json.attribute("optimized_instructions",
+                         static_cast<int64_t>(cost.optimized_insts));
+          json.attribute("optimized_blocks",
+                         static_cast<int64_t>(cost.optimized_blocks));
+          json.attribute("memory_intrinsic_calls",
+                         static_cast<int64_t>(cost.memory_calls));
+        });
+      }
+    });
+  });
+  os << '\n';
+  os.close();
+  if (os.has_error()) {
+    LOG(ERROR) << "Unable to write " << FLAGS_json_out << ": "
+               << os.error().message();
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+// Compare `costs` against the profile in `--baseline`. Returns the number of
+// ISELs whose optimized instruction count grew, or `-1` on error.
+static int64_t CompareToBaseline(const std::vector<ISelCost> &costs) {
+  auto buffer = llvm::MemoryBuffer::getFile(FLAGS_baseline);
+  if (!buffer) {
+    LOG(ERROR) << "Unable to read " << FLAGS_baseline << ": "
+               << buffer.getError().message();
+    return -1;
+  }
+
+  auto profile = llvm::json::parse((*buffer)->getBuffer());
+  if (!profile) {
+    LOG(ERROR) << "Unable to parse " << FLAGS_baseline << ": "
+               << llvm::toString(profile.takeError());
+    return -1;
+  }
+
+  const llvm::json::Array *isels = nullptr;
+  if (auto obj = profile->getAsObject()) {
+    isels = obj->getArray("isels");
+  }
+  if (!isels) {
+    LOG(ERROR) << "Missing `isels` array in " << FLAGS_baseline;
+    return -1;
+  }
+
+  std::unordered_map<std::string, uint64_t> baseline;
+  for (const auto &isel : *isels) {
+    if (auto obj = isel.getAsObject()) {
+      auto name = obj->getString("name");
+      auto count = obj->getInteger("optimized_instructions");
+      if (name && count) {
+        baseline.emplace(name->str(), static_cast<uint64_t>(*count));
+      }
+    }
+  }
+
+  std::vector<std::pair<const ISelCost *, uint64_t>> regressions;
+  for (const auto &cost : costs) {
+    auto it = baseline.find(cost.name);
+    if (it != baseline.end() && cost.optimized_insts > it->second) {
+      regressions.emplace_back(&cost, it->second);
+    }
+  }
+
+  std::sort(regressions.begin(), regressions.end(),
+            [](const auto &a, const auto &b) {
+              return (a.first->optimized_insts - a.second) >
+                     (b.first->optimized_insts - b.second);
+            });
+
+  if (!regressions.empty()) {
+    std::cout << std::endl
+              << regressions.size() << " ISELs grew since "
+              << FLAGS_baseline << ':' << std::endl;
+    for (const auto &[cost, old_count] : regressions) {
+      std::cout << std::setw(11) << old_count << " -> " << std::setw(6)
+                << cost->optimized_insts << "  " << cost->name << std::endl;
+    }
+  }
+
+  return static_cast<int64_t>(regressions.size());
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  using Ranking = bool (*)(const ISelCost &, const ISelCost &);
+  Ranking ranking = nullptr;
+  if (FLAGS_sort_by == "optimized") {
+    ranking = [](const ISelCost &a, const ISelCost &b) {
+      return a.optimized_insts > b.optimized_insts;
+    };
+  } else if (FLAGS_sort_by == "unoptimized") {
+    ranking = [](const ISelCost &a, const ISelCost &b) {
+      return a.unoptimized_insts > b.unoptimized_insts;
+    };
+  } else if (FLAGS_sort_by == "memory") {
+    ranking = [](const ISelCost &a, const ISelCost &b) {
+      return a.memory_calls > b.memory_calls;
+    };
+  } else {
+    std::cerr << "Invalid value " << FLAGS_sort_by << " passed to --sort_by. "
+              << "Valid values: optimized, unoptimized, memory." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  llvm::LLVMContext context;
+  auto arch = remill::Arch::Get(context, FLAGS_os, FLAGS_arch);
+  if (!arch) {
+    std::cerr << "Unable to build architecture " << FLAGS_arch << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<llvm::Module> module(remill::LoadArchSemantics(arch.get()));
+
+  // NOTE(pag): `COND_` variables, which are also visited, point to the
+  //            condition code helpers rather than to instruction semantics.
+  std::vector<std::pair<std::string, llvm::Function *>> isels;
+  remill::ForEachISel(module.get(), [&](llvm::GlobalVariable *isel,
+                                        llvm::Function *sem) {
+    const auto name = isel->getName();
+    if (!sem || !name.startswith("ISEL_") ||
+        sem->getFunctionType()->getNumParams() < 2u) {
+      return;
+    }
+    if (FLAGS_filter.empty() || name.contains(FLAGS_filter)) {
+      isels.emplace_back(name.drop_front(5).str(), sem);
+    }
+  });
+
+  std::vector<ISelCost> costs;
+  costs.reserve(isels.size());
+  {
+    ISelProfiler profiler(arch.get(), module.get());
+    for (const auto &[name, sem] : isels) {
+      costs.emplace_back(profiler.Profile(name, sem));
+    }
+  }
+
+  std::stable_sort(costs.begin(), costs.end(), ranking);
+  PrintReport(costs);
+
+  auto ret = EXIT_SUCCESS;
+  if (!FLAGS_json_out.empty() && !StoreProfile(costs)) {
+    ret = EXIT_FAILURE;
+  }
+
+  if (!FLAGS_baseline.empty() && CompareToBaseline(costs) != 0) {
+    ret = EXIT_FAILURE;
+  }
+
+  return ret;
+}
@@ -0,0 +1,527 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Binary.h"
+
+#include <glog/logging.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/BinaryFormat/ELF.h>
+#include <llvm/BinaryFormat/Magic.h>
+#include <llvm/Object/ELFObjectFile.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/DataExtractor.h>
+#include <llvm/Support/Alignment.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <algorithm>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+// The file range of a loadable, executable program header.
+struct ExecutableLoad {
+  uint64_t address;
+  uint64_t offset;
+  uint64_t size;
+};
+
+template <typename ELFT>
+static void
+GetExecutableLoads(const llvm::object::ELFFile<ELFT> &elf,
+                   std::vector<ExecutableLoad> &loads) {
+  auto phdrs = elf.program_headers();
+  if (!phdrs) {
+    llvm::consumeError(phdrs.takeError());
+    return;
+  }
+
+  for (const auto &phdr : *phdrs) {
+    if (phdr.p_type == llvm::ELF::PT_LOAD &&
+        (phdr.p_flags & llvm::ELF::PF_X)) {
+      loads.push_back({phdr.p_vaddr, phdr.p_offset, phdr.p_filesz});
+    }
+  }
+}
+
+static std::vector<ExecutableLoad>
+GetExecutableLoads(const llvm::object::ObjectFile *obj) {
+  std::vector<ExecutableLoad> loads;
+  if (auto elf32le = llvm::dyn_cast<llvm::object::ELF32LEObjectFile>(obj)) {
+    GetExecutableLoads(elf32le->getELFFile(), loads);
+  } else if (auto elf32be =
+                 llvm::dyn_cast<llvm::object::ELF32BEObjectFile>(obj)) {
+    GetExecutableLoads(elf32be->getELFFile(), loads);
+  } else if (auto elf64le =
+                 llvm::dyn_cast<llvm::object::ELF64LEObjectFile>(obj)) {
+    GetExecutableLoads(elf64le->getELFFile(), loads);
+  } else if (auto elf64be =
+                 llvm::dyn_cast<llvm::object::ELF64BEObjectFile>(obj)) {
+    GetExecutableLoads(elf64be->getELFFile(), loads);
+  }
+  return loads;
+}
+
+// Read a pointer encoded with `encoding`, one of the `DW_EH_PE_*` values,
+// from `data` at `*offset`, and advance `*offset` past it. Returns `false`
+// if the pointer can't be resolved without more context, e.g. because it is
+// relative to the data or text segment.
+static bool ReadEncodedPointer(const llvm::DataExtractor &data,
+                               uint64_t *offset, uint8_t encoding,
+                               uint64_t section_addr, uint64_t *ptr) {
+  if (encoding == llvm::dwarf::DW_EH_PE_omit) {
+    return false;
+  }
+
+  const auto field_addr = section_addr + *offset;
+  uint64_t val = 0;
+  switch (encoding & 0x0fu) {
+    case llvm::dwarf::DW_EH_PE_absptr:
+      val = data.getUnsigned(offset, data.getAddressSize());
+      break;
+    case llvm::dwarf::DW_EH_PE_uleb128: val = data.getULEB128(offset); break;
+    case llvm::dwarf::DW_EH_PE_udata2: val = data.getU16(offset); break;
+    case llvm::dwarf::DW_EH_PE_udata4: val = data.getU32(offset); break;
+    case llvm::dwarf::DW_EH_PE_udata8: val = data.getU64(offset); break;
+    case llvm::dwarf::DW_EH_PE_sleb128:
+      val = static_cast<uint64_t>(data.getSLEB128(offset));
+      break;
+    case llvm::dwarf::DW_EH_PE_sdata2:
+      val = static_cast<uint64_t>(data.getSigned(offset, 2));
+      break;
+    case llvm::dwarf::DW_EH_PE_sdata4:
+      val = static_cast<uint64_t>(data.getSigned(offset, 4));
+      break;
+    case llvm::dwarf::DW_EH_PE_sdata8:
+      val = static_cast<uint64_t>(data.getSigned(offset, 8));
+      break;
+    default: return false;
+  }
+
+  if (encoding & llvm::dwarf::DW_EH_PE_indirect) {
+    return false;
+  }
+
+  switch (encoding & 0x70u) {
+    case llvm::dwarf::DW_EH_PE_absptr: break;
+    case llvm::dwarf::DW_EH_PE_pcrel: val += field_addr; break;
+    default: return false;
+  }
+
+  if (data.getAddressSize() == 4u) {
+    val &= 0xffffffffu;
+  }
+
+  *ptr = val;
+  return true;
+}
+
+// Parse the augmentation data of the common information entry at `*offset`,
+// just after its CIE ID, and return how the FDEs that use this CIE encode
+// their initial locations.
+static uint8_t ParseCIE(const llvm::DataExtractor &data, uint64_t *offset,
+                        uint64_t section_addr) {
+  uint8_t fde_encoding = llvm::dwarf::DW_EH_PE_absptr;
+  const auto version = data.getU8(offset);
+  const auto augmentation = data.getCStrRef(offset);
+  if (augmentation.contains("eh")) {
+    (void) data.getUnsigned(offset, data.getAddressSize());
+  }
+  (void) data.getULEB128(offset);  // Code alignment factor.
+  (void) data.getSLEB128(offset);  // Data alignment factor.
+  if (version == 1u) {
+    (void) data.getU8(offset);  // Return address register.
+  } else {
+    (void) data.getULEB128(offset);
+  }
+
+  if (!augmentation.startswith("z")) {
+    return fde_encoding;
+  }
+
+  (void) data.getULEB128(offset);  // Augmentation data length.
+  for (auto aug : augmentation.drop_front()) {
+    switch (aug) {
+      case 'R': fde_encoding = data.getU8(offset); break;
+      case 'L': (void) data.getU8(offset); break;
+      case 'P': {
+        const auto personality_encoding = data.getU8(offset);
+        uint64_t personality = 0;
+        (void) ReadEncodedPointer(data, offset, personality_encoding,
+                                  section_addr, &personality);
+        break;
+      }
+      case 'S':
+      case 'B': break;
+      default: return fde_encoding;
+    }
+  }
+
+  return fde_encoding;
+}
+
+// Collect the initial locations of the FDEs in the `.eh_frame` section
+// `data`, which is located at `section_addr`.
+static void ParseEHFrame(const llvm::DataExtractor &data,
+                         uint64_t section_addr,
+                         std::vector<uint64_t> &starts) {
+
+  // Maps the offset of each CIE to its FDE pointer encoding.
+  std::unordered_map<uint64_t, uint8_t> fde_encodings;
+
+  for (uint64_t offset = 0; data.isValidOffsetForDataOfSize(offset, 4);) {
+    const auto record_offset = offset;
+    uint64_t length = data.getU32(&offset);
+    if (!length) {
+      break;  // Terminator.
+    } else if (length == 0xffffffffu) {
+      length = data.getU64(&offset);
+    }
+
+    if (!data.isValidOffsetForDataOfSize(offset, length) || length < 4u) {
+      break;
+    }
+
+    const auto id_offset = offset;
+    const auto next_offset = offset + length;
+    const auto cie_pointer = data.getU32(&offset);
+
+    if (!cie_pointer) {
+      fde_encodings[record_offset] = ParseCIE(data, &offset, section_addr);
+
+    // The CIE pointer of an FDE is relative to the pointer itself.
+    } else if (cie_pointer <= id_offset) {
+      auto encoding_it = fde_encodings.find(id_offset - cie_pointer);
+      uint64_t start = 0;
+      if (encoding_it != fde_encodings.end() &&
+          ReadEncodedPointer(data, &offset, encoding_it->second, section_addr,
+                             &start) &&
+          start) {
+        starts.push_back(start);
+      }
+    }
+
+    offset = next_offset;
+  }
+}
+
+}  // namespace
+
+Binary::Binary(void) {}
+
+Binary::~Binary(void) {}
+
+// Memory-map the file at `path`.
+static std::unique_ptr<llvm::MemoryBuffer> MapFile(const std::string &path) {
+
+  // NOTE(pag): Large files are `mmap`ed, rather than read into memory.
+  auto maybe_buffer = llvm::MemoryBuffer::getFile(
+      path, false /* IsText */, false /* RequiresNullTerminator */);
+  if (!maybe_buffer) {
+    LOG(ERROR) << "Unable to open " << path << ": "
+               << maybe_buffer.getError().message();
+    return nullptr;
+  }
+  return std::move(*maybe_buffer);
+}
+
+std::unique_ptr<Binary> Binary::Open(const std::string &path,
+                                     uint64_t base_address) {
+  auto buffer = MapFile(path);
+  if (!buffer) {
+    return nullptr;
+  }
+
+  std::unique_ptr<Binary> binary(new Binary);
+  binary->buffer = std::move(buffer);
+
+  switch (llvm::identify_magic(binary->buffer->getBuffer())) {
+    case llvm::file_magic::elf:
+    case llvm::file_magic::elf_relocatable:
+    case llvm::file_magic::elf_executable:
+    case llvm::file_magic::elf_shared_object:
+    case llvm::file_magic::elf_core:
+      if (!binary->LoadELF(base_address)) {
+        LOG(ERROR) << "Unable to parse ELF file " << path;
+        return nullptr;
+      }
+      return binary;
+
+    // NOTE(pag): Only ELF files are parsed, so treating these as raw flat
+    //            binaries would lift their headers as code, and place their
+    //            code at the wrong addresses.
+    case llvm::file_magic::pecoff_executable:
+    case llvm::file_magic::coff_object:
+    case llvm::file_magic::coff_import_library:
+      LOG(ERROR) << "PE/COFF file " << path << " is not supported";
+      return nullptr;
+
+    case llvm::file_magic::macho_object:
+    case llvm::file_magic::macho_executable:
+    case llvm::file_magic::macho_fixed_virtual_memory_shared_lib:
+    case llvm::file_magic::macho_core:
+    case llvm::file_magic::macho_preload_executable:
+    case llvm::file_magic::macho_dynamically_linked_shared_lib:
+    case llvm::file_magic::macho_dynamic_linker:
+    case llvm::file_magic::macho_bundle:
+    case llvm::file_magic::macho_dynamically_linked_shared_lib_stub:
+    case llvm::file_magic::macho_dsym_companion:
+    case llvm::file_magic::macho_kext_bundle:
+    case llvm::file_magic::macho_universal_binary:
+      LOG(ERROR) << "Mach-O file " << path << " is not supported";
+      return nullptr;
+
+    default:
+      LOG(ERROR) << path << " is not an ELF file; use --raw to lift it as a "
+                 << "raw flat binary";
+      return nullptr;
+  }
+}
+
+std::unique_ptr<Binary> Binary::OpenRaw(const std::string &path,
+                                        uint64_t address) {
+  auto buffer = MapFile(path);
+  if (!buffer) {
+    return nullptr;
+  }
+
+  std::unique_ptr<Binary> binary(new Binary);
+  binary->buffer = std::move(buffer);
+  (void) binary->AddSegment(address, binary->buffer->getBuffer());
+  return binary;
+}
+
+std::unique_ptr<Binary> Binary::FromBytes(std::string bytes,
+                                          uint64_t address) {
+  std::unique_ptr<Binary> binary(new Binary);
+  binary->bytes = std::move(bytes);
+  (void) binary->AddSegment(address, binary->bytes);
+  return binary;
+}
+
+bool Binary::LoadELF(uint64_t base_address) {
+  auto maybe_object =
+      llvm::object::ObjectFile::createObjectFile(buffer->getMemBufferRef());
+  if (!maybe_object) {
+    LOG(ERROR) << llvm::toString(maybe_object.takeError());
+    return false;
+  }
+
+  object = std::move(*maybe_object);
+
+  const auto file_data = llvm::StringRef(buffer->getBuffer());
+  for (auto load : GetExecutableLoads(object.get())) {
+    if (load.offset > file_data.size() ||
+        load.size > (file_data.size() - load.offset)) {
+      LOG(ERROR) << "Executable segment at " << std::hex << load.address
+                 << std::dec << " is out of bounds of the file";
+      return false;
+    }
+    if (!AddSegment(load.address, file_data.substr(load.offset, load.size))) {
+      return false;
+    }
+  }
+
+  // Relocatable files don't have program headers, and their sections are all
+  // at address zero, so lay out their executable sections one after another,
+  // starting at `base_address`. Their relocations aren't applied.
+  const auto is_relocatable = object->isRelocatableObject();
+  std::unordered_map<uint64_t, uint64_t> section_addresses;
+  if (segments.empty()) {
+    auto next_address = base_address;
+    for (const auto &section : object->sections()) {
+      if (!section.isText()) {
+        continue;
+      }
+      auto contents = section.getContents();
+      if (!contents) {
+        llvm::consumeError(contents.takeError());
+        continue;
+      }
+
+      auto address = section.getAddress();
+      if (is_relocatable) {
+        address = llvm::alignTo(
+            next_address,
+            llvm::MaybeAlign(section.getAlignment()).valueOrOne());
+        next_address = address + contents->size();
+        section_addresses[section.getIndex()] = address;
+      }
+
+      if (!AddSegment(address, *contents)) {
+        return false;
+      }
+    }
+  }
+
+  auto add_symbol = [&](const llvm::object::SymbolRef &sym) {
+    auto type = sym.getType();
+    if (!type) {
+      llvm::consumeError(type.takeError());
+      return;
+    } else if (*type != llvm::object::SymbolRef::ST_Function) {
+      return;
+    }
+
+    auto flags = sym.getFlags();
+    if (!flags) {
+      llvm::consumeError(flags.takeError());
+      return;
+    } else if (*flags & llvm::object::SymbolRef::SF_Undefined) {
+      return;
+    }
+
+    auto address = sym.getAddress();
+    if (!address) {
+      llvm::consumeError(address.takeError());
+      return;
+    }
+
+    // The symbols of relocatable files are relative to their sections.
+    if (is_relocatable) {
+      auto section = sym.getSection();
+      if (!section) {
+        llvm::consumeError(section.takeError());
+        return;
+      }
+      auto section_it = section_addresses.end();
+      if (*section != object->section_end()) {
+        section_it = section_addresses.find((*section)->getIndex());
+      }
+      if (section_it == section_addresses.end()) {
+        return;
+      }
+      *address += section_it->second;
+    }
+
+    auto name = sym.getName();
+    if (!name) {
+      llvm::consumeError(name.takeError());
+      return;
+    }
+
+    symbols.push_back({*address, name->str()});
+  };
+
+  for (const auto &sym : object->symbols()) {
+    add_symbol(sym);
+  }
+
+  auto elf = llvm::cast<llvm::object::ELFObjectFileBase>(object.get());
+  for (const auto &sym : elf->getDynamicSymbolIterators()) {
+    add_symbol(sym);
+  }
+
+  std::stable_sort(symbols.begin(), symbols.end(),
+                   [](const FunctionSymbol &a, const FunctionSymbol &b) {
+                     return a.address < b.address;
+                   });
+  symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                            [](const FunctionSymbol &a,
+                               const FunctionSymbol &b) {
+                              return a.address == b.address;
+                            }),
+                symbols.end());
+
+  if (auto start = object->getStartAddress()) {
+    entry_point = *start;
+  } else {
+    llvm::consumeError(start.takeError());
+  }
+
+  return true;
+}
+
+std::vector<uint64_t> Binary::EHFrameFunctionStarts(void) const {
+  std::vector<uint64_t> starts;
+  if (!object || object->isRelocatableObject()) {
+    return starts;
+  }
+
+  for (const auto &section : object->sections()) {
+    auto name = section.getName();
+    if (!name) {
+      llvm::consumeError(name.takeError());
+      continue;
+    } else if (*name != ".eh_frame") {
+      continue;
+    }
+
+    auto contents = section.getContents();
+    if (!contents) {
+      llvm::consumeError(contents.takeError());
+      continue;
+    }
+
+    llvm::DataExtractor data(*contents, object->isLittleEndian(),
+                             static_cast<uint8_t>(object->getBytesInAddress()));
+    ParseEHFrame(data, section.getAddress(), starts);
+  }
+
+  std::sort(starts.begin(), starts.end());
+  starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+  return starts;
+}
+
+// Add an executable segment, keeping `segments` sorted by address. Returns
+// `false` if the segment overlaps an existing segment.
+bool Binary::AddSegment(uint64_t address, std::string_view data) {
+  if (data.empty()) {
+    return true;
+  }
+
+  auto it = std::upper_bound(
+      segments.begin(), segments.end(), address,
+      [](uint64_t addr, const ExecutableSegment &seg) {
+        return addr < seg.address;
+      });
+
+  const auto overlaps_prev =
+      it != segments.begin() &&
+      (address - std::prev(it)->address) < std::prev(it)->data.size();
+  const auto overlaps_next =
+      it != segments.end() && (it->address - address) < data.size();
+
+  if (overlaps_prev || overlaps_next) {
+    LOG(ERROR) << "Executable segment at " << std::hex << address << std::dec
+               << " overlaps another segment";
+    return false;
+  }
+
+  segments.insert(it, {address, data});
+  return true;
+}
+
+std::string_view Binary::Read(uint64_t addr, size_t max_size) const {
+  auto it = std::upper_bound(
+      segments.begin(), segments.end(), addr,
+      [](uint64_t a, const ExecutableSegment &seg) {
+        return a < seg.address;
+      });
+  if (it == segments.begin()) {
+    return {};
+  }
+
+  --it;
+  const auto offset = addr - it->address;
+  if (offset >= it->data.size()) {
+    return {};
+  }
+
+  return it->data.substr(offset, max_size);
+}
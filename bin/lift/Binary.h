@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace llvm {
+class MemoryBuffer;
+namespace object {
+class ObjectFile;
+}  // namespace object
+}  // namespace llvm
+
+// A contiguous range of executable bytes, located at `address` in the
+// virtual address space of the program.
+struct ExecutableSegment {
+  uint64_t address;
+  std::string_view data;
+};
+
+// A function symbol of an ELF file.
+struct FunctionSymbol {
+  uint64_t address;
+  std::string name;
+};
+
+// The code of a program that we want to lift. The bytes of the program are
+// never copied: the executable segments are views into a memory-mapped file,
+// or into the buffer holding the bytes passed to `--bytes`.
+class Binary {
+ public:
+  ~Binary(void);
+
+  // Memory-map the ELF file at `path`, and place its executable segments at
+  // their virtual addresses. The executable sections of relocatable files
+  // are instead laid out one after another, starting at `base_address`, and
+  // are not relocated. Returns `nullptr` on failure, or if `path` isn't an
+  // ELF file, e.g. if it's a PE or Mach-O file.
+  static std::unique_ptr<Binary> Open(const std::string &path,
+                                      uint64_t base_address);
+
+  // Memory-map the file at `path`, and treat it as a raw flat binary, all of
+  // which is executable, located at `address`. Returns `nullptr` on failure.
+  static std::unique_ptr<Binary> OpenRaw(const std::string &path,
+                                         uint64_t address);
+
+  // Treat `bytes` as executable code located at `address`.
+  static std::unique_ptr<Binary> FromBytes(std::string bytes,
+                                           uint64_t address);
+
+  // Returns a view of at most `max_size` executable bytes starting at
+  // `addr`, or an empty view if `addr` isn't executable.
+  std::string_view Read(uint64_t addr, size_t max_size) const;
+
+  // Returns `true` if this is an ELF file.
+  inline bool IsELF(void) const {
+    return object != nullptr;
+  }
+
+  // Executable segments, sorted by address.
+  const std::vector<ExecutableSegment> &Segments(void) const {
+    return segments;
+  }
+
+  // Defined function symbols from the static and dynamic symbol tables,
+  // sorted by address, with one symbol per address.
+  const std::vector<FunctionSymbol> &FunctionSymbols(void) const {
+    return symbols;
+  }
+
+  // Initial locations of the frame description entries in the `.eh_frame`
+  // section of an ELF file, i.e. the start addresses of the functions that
+  // have unwind info. Relocatable files are skipped, as their `.eh_frame`
+  // sections haven't been relocated.
+  std::vector<uint64_t> EHFrameFunctionStarts(void) const;
+
+  // Address of the entrypoint of the program, or zero if unknown.
+  inline uint64_t EntryPoint(void) const {
+    return entry_point;
+  }
+
+ private:
+  Binary(void);
+
+  bool LoadELF(uint64_t base_address);
+  bool AddSegment(uint64_t address, std::string_view data);
+
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  std::unique_ptr<llvm::object::ObjectFile> object;
+
+  // Backing storage of the bytes passed to `--bytes`.
+  std::string bytes;
+
+  std::vector<ExecutableSegment> segments;
+  std::vector<FunctionSymbol> symbols;
+  uint64_t entry_point{0};
+};
@@ -16,6 +16,8 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
@@ -32,9 +34,12 @@
 #include <remill/Arch/Instruction.h>
 #include <remill/Arch/Name.h>
 #include <remill/BC/ABI.h>
+#include <remill/BC/CodeDiscovery.h>
 #include <remill/BC/IntrinsicTable.h>
 #include <remill/BC/Lifter.h>
 #include <remill/BC/Optimizer.h>
+#include <remill/BC/Statistics.h>
+#include <remill/BC/Transplant.h>
 #include <remill/BC/Util.h>
 #include <remill/BC/Version.h>
 #include <remill/OS/OS.h>
@@ -45,11 +50,15 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
-#include <map>
 #include <memory>
+#include <optional>
+#include <set>
 #include <sstream>
 #include <string>
 #include <system_error>
+#include <vector>
+
+#include "Binary.h"
 
 DEFINE_string(os, REMILL_OS,
               "Operating system name of the code being "
@@ -60,32 +69,104 @@ DEFINE_string(arch, REMILL_ARCH,
               "`_avx` or `_avx512` appended), aarch64, aarch32");
 
 DEFINE_uint64(address, 0,
-              "Address at which we should assume the bytes are"
-              "located in virtual memory.");
+              "Address at which we should assume the bytes are "
+              "located in virtual memory. This applies to --bytes, "
+              "to raw flat binaries passed to --binary with --raw, and to "
+              "the code of relocatable ELF files passed to --binary.");
 
 DEFINE_uint64(entry_address, 0,
               "Address of instruction that should be "
               "considered the entrypoint of this code. "
-              "Defaults to the value of --address.");
+              "Defaults to the entrypoint of the ELF file passed to "
+              "--binary, or otherwise to the value of --address.");
+
+DEFINE_string(entry_addresses, "",
+              "Comma-separated list of additional addresses from which to "
+              "lift. Addresses are decimal, or hexadecimal with a `0x` "
+              "prefix.");
+
+DEFINE_bool(lift_all_symbols, false,
+            "Lift from the address of every function symbol in the ELF "
+            "file passed to --binary.");
+
+DEFINE_bool(whole_binary, false,
+            "Lift all code reachable from the entrypoint(s), function "
+            "symbols, and `.eh_frame` unwind entries of the binary passed "
+            "to --binary. All trace heads, including the targets of calls, "
+            "are discovered before lifting, so that lifted traces call each "
+            "other rather than duplicating code. Prints per-phase timings "
+            "and counters.");
+
+DEFINE_uint32(num_threads, 0,
+              "Number of threads used to discover code with "
+              "--whole_binary. Zero means one per hardware thread.");
 
 DEFINE_string(bytes, "", "Hex-encoded byte string to lift.");
 
+DEFINE_string(binary, "",
+              "Path to an ELF file, or to a raw flat binary located at "
+              "--address when using --raw, whose code should be lifted. The "
+              "file is memory-mapped, rather than read into memory.");
+
+DEFINE_bool(raw, false,
+            "Treat the file passed to --binary as a raw flat binary, all of "
+            "which is executable code, even if it is an ELF file.");
+
 DEFINE_string(ir_out, "", "Path to file where the LLVM IR should be saved.");
 DEFINE_string(bc_out, "",
               "Path to file where the LLVM bitcode should be "
               "saved.");
 
+DEFINE_uint32(bc_partitions, 0,
+              "Number of bitcode files to split the lifted code into, and "
+              "write in parallel. The files are named `<bc_out>.<N>.bc`, and "
+              "`<bc_out>.manifest.json` lists the definitions in each. Zero "
+              "writes a single bitcode file to `--bc_out`.");
+DEFINE_bool(verify_partitions, false,
+            "Verify each partition before writing it with "
+            "`--bc_partitions`.");
+
+DEFINE_string(verified_stamp_dir, "",
+              "Directory of stamps recording which semantics bitcode files "
+              "were already verified. If set, the semantics are only verified "
+              "the first time that they are loaded. If empty, they are "
+              "always verified.");
+
+DEFINE_string(stats_out, "",
+              "Path to a JSON file where counters, histograms, and timers "
+              "collected while decoding, lifting, and optimizing should be "
+              "saved.");
+
 DEFINE_string(slice_inputs, "",
               "Comma-separated list of registers to treat as inputs.");
 DEFINE_string(slice_outputs, "",
               "Comma-separated list of registers to treat as outputs.");
 
-using Memory = std::map<uint64_t, uint8_t>;
+DEFINE_bool(promote_registers, false,
+            "Promote the registers used by each lifted trace out of the "
+            "`State` structure and into SSA values.");
+
+DEFINE_bool(register_alias_analysis, false,
+            "Tell the optimizer that accesses to distinct registers in the "
+            "`State` structure never alias.");
 
-// Unhexlify the data passed to `--bytes`, and fill in `memory` with each
-// such byte.
-static Memory UnhexlifyInputBytes(uint64_t addr_mask) {
-  Memory memory;
+DEFINE_bool(fuse_idioms, true,
+            "Decode common instruction idioms, e.g. `cmp; jcc` on x86, as "
+            "single instructions with simpler semantics.");
+
+DEFINE_uint32(inline_cache_size, 0,
+              "Number of entries in the inline cache emitted at each "
+              "indirect jump, call, and return. Zero disables inline "
+              "caches.");
+
+DEFINE_uint32(shadow_return_stack_size, 0,
+              "Number of entries in the shadow return stack, which must be "
+              "a power of two. Zero disables the shadow return stack.");
+
+// Unhexlify the data passed to `--bytes`.
+static std::string UnhexlifyInputBytes(void) {
+  std::string bytes;
+  bytes.reserve(FLAGS_bytes.size() / 2);
 
   for (size_t i = 0; i < FLAGS_bytes.size(); i += 2) {
     char nibbles[] = {FLAGS_bytes[i], FLAGS_bytes[i + 1], '\0'};
@@ -98,34 +179,137 @@ static Memory UnhexlifyInputBytes(uint64_t addr_mask) {
       exit(EXIT_FAILURE);
     }
 
-    auto byte_addr = FLAGS_address + (i / 2);
-    auto masked_addr = byte_addr & addr_mask;
+    bytes.push_back(static_cast<char>(byte_val));
+  }
 
-    // Make sure that if a really big number is specified for `--address`,
-    // that we don't accidentally wrap around and start filling out low
-    // byte addresses.
-    if (masked_addr < byte_addr) {
-      std::cerr << "Too many bytes specified to --bytes, would result "
-                << "in a 32-bit overflow.";
-      exit(EXIT_FAILURE);
+  return bytes;
+}
 
-    } else if (masked_addr < FLAGS_address) {
-      std::cerr << "Too many bytes specified to --bytes, would result "
-                << "in a 64-bit overflow.";
-      exit(EXIT_FAILURE);
-    }
+// Make sure that the executable segments of `binary` fit into the address
+// space, e.g. that a really big number specified for `--address` doesn't
+// make us wrap around and start filling out low byte addresses.
+static bool SegmentsFitAddressSpace(const Binary &binary, uint64_t addr_mask) {
+  for (const auto &segment : binary.Segments()) {
+    const auto last_addr = segment.address + (segment.data.size() - 1u);
+    if (last_addr < segment.address) {
+      std::cerr << "Too many bytes at address " << std::hex
+                << segment.address << std::dec
+                << ", would result in a 64-bit overflow." << std::endl;
+      return false;
 
-    memory[byte_addr] = static_cast<uint8_t>(byte_val);
+    } else if ((last_addr & addr_mask) != last_addr) {
+      std::cerr << "Too many bytes at address " << std::hex
+                << segment.address << std::dec
+                << ", would result in a 32-bit overflow." << std::endl;
+      return false;
+    }
   }
+  return true;
+}
 
-  return memory;
+// Parse the addresses passed to `--entry_addresses`.
+static bool ParseEntryAddresses(std::vector<uint64_t> &addrs) {
+  llvm::SmallVector<llvm::StringRef, 8> addr_strs;
+  llvm::StringRef(FLAGS_entry_addresses)
+      .split(addr_strs, ',', -1, false /* KeepEmpty */);
+  for (auto addr_str : addr_strs) {
+    uint64_t addr = 0;
+    if (addr_str.trim().getAsInteger(0, addr)) {
+      std::cerr << "Invalid address '" << addr_str.str()
+                << "' specified in --entry_addresses." << std::endl;
+      return false;
+    }
+    addrs.push_back(addr);
+  }
+  return true;
 }
 
+// Where the trace heads of `--whole_binary` came from.
+enum TraceHeadSource : unsigned {
+  kTraceHeadFromEntrypoint,
+  kTraceHeadFromSymbol,
+  kTraceHeadFromEHFrame,
+  kTraceHeadFromCallTarget,
+  kNumTraceHeadSources
+};
+
+static const char *const kTraceHeadSourceNames[] = {
+    "entrypoints", "symbols", "eh_frame", "call_targets"};
+
+// Counters and timers of each phase of lifting with `--whole_binary`. These
+// are recorded like the rest of Remill's statistics, and so are also saved to
+// `--stats_out`. Decoding is timed by `CodeDiscovery`, which also counts the
+// blocks and instructions that it decodes.
+struct LiftStatistics {
+  const remill::StatisticArray num_trace_heads{
+      "remill_lift.trace_heads", kNumTraceHeadSources,
+      [](unsigned source) { return kTraceHeadSourceNames[source]; }};
+  const remill::Statistic num_failed_traces{"remill_lift.failed_traces"};
+  const remill::Timer lift_timer{"remill_lift.lift"};
+  const remill::Timer optimize_timer{"remill_lift.optimize"};
+  const remill::Timer extract_timer{"remill_lift.extract"};
+  const remill::Timer write_timer{"remill_lift.write"};
+
+  void Print(std::ostream &os) const {
+    auto per_second = [](uint64_t count, double seconds) {
+      return seconds > 0 ? static_cast<uint64_t>(count / seconds) : 0u;
+    };
+    auto num_heads = [](TraceHeadSource source) {
+      return remill::ReadStatistic(std::string("remill_lift.trace_heads.") +
+                                   kTraceHeadSourceNames[source]);
+    };
+
+    const auto num_insts = remill::ReadStatistic("code_discovery.instructions");
+    const auto num_traces = remill::ReadStatistic("trace_lifter.traces");
+    const auto decode_seconds =
+        remill::ReadTimerSeconds("code_discovery.discover");
+    const auto lift_seconds = remill::ReadTimerSeconds("remill_lift.lift");
+
+    os << "Trace heads: " << remill::ReadStatistic("remill_lift.trace_heads")
+       << " (" << num_heads(kTraceHeadFromEntrypoint) << " entrypoints, "
+       << num_heads(kTraceHeadFromSymbol) << " symbols, "
+       << num_heads(kTraceHeadFromEHFrame) << " .eh_frame entries, "
+       << num_heads(kTraceHeadFromCallTarget) << " call targets)\n"
+       << "Decode:   " << decode_seconds << "s; " << num_insts
+       << " instructions (" << per_second(num_insts, decode_seconds)
+       << "/s) in " << remill::ReadStatistic("code_discovery.blocks")
+       << " blocks; "
+       << remill::ReadStatistic("code_discovery.invalid_instructions")
+       << " invalid instructions; "
+       << remill::ReadStatistic("code_discovery.missing_blocks")
+       << " missing blocks\n"
+       << "Lift:     " << lift_seconds << "s; " << num_traces << " traces ("
+       << per_second(num_traces, lift_seconds) << "/s); "
+       << per_second(num_insts, lift_seconds) << " instructions/s; "
+       << remill::ReadStatistic("remill_lift.failed_traces")
+       << " failed traces\n"
+       << "Optimize: " << remill::ReadTimerSeconds("remill_lift.optimize")
+       << "s\n"
+       << "Extract:  " << remill::ReadTimerSeconds("remill_lift.extract")
+       << "s\n"
+       << "Write:    " << remill::ReadTimerSeconds("remill_lift.write") << "s"
+       << std::endl;
+  }
+};
+
 class SimpleTraceManager : public remill::TraceManager {
  public:
   virtual ~SimpleTraceManager(void) = default;
 
-  explicit SimpleTraceManager(Memory &memory_) : memory(memory_) {}
+  explicit SimpleTraceManager(const Binary &binary_) : binary(binary_) {}
+
+  // Pre-declare the traces starting at `addrs`, so that the trace lifter
+  // calls or tail-calls them, rather than lifting their code into the
+  // traces that reach them.
+  void DeclareTraces(const remill::Arch *arch, llvm::Module *module,
+                     const std::vector<uint64_t> &addrs) {
+    for (auto addr : addrs) {
+      if (!declarations.count(addr)) {
+        declarations.emplace(
+            addr, arch->DeclareLiftedFunction(TraceName(addr), module));
+      }
+    }
+  }
 
  protected:
   // Called when we have lifted, i.e. defined the contents, of a new trace.
@@ -143,9 +327,12 @@ class SimpleTraceManager : public remill::TraceManager {
   //
   // NOTE: This is permitted to return a function from an arbitrary module.
   llvm::Function *GetLiftedTraceDeclaration(uint64_t addr) override {
-    auto trace_it = traces.find(addr);
-    if (trace_it != traces.end()) {
-      return trace_it->second;
+    if (auto trace = GetLiftedTraceDefinition(addr)) {
+      return trace;
+    }
+    auto decl_it = declarations.find(addr);
+    if (decl_it != declarations.end()) {
+      return decl_it->second;
     } else {
       return nullptr;
     }
@@ -155,25 +342,38 @@ class SimpleTraceManager : public remill::TraceManager {
   //
   // NOTE: This is permitted to return a function from an arbitrary module.
   llvm::Function *GetLiftedTraceDefinition(uint64_t addr) override {
-    return GetLiftedTraceDeclaration(addr);
+    auto trace_it = traces.find(addr);
+    if (trace_it != traces.end()) {
+      return trace_it->second;
+    } else {
+      return nullptr;
+    }
   }
 
   // Try to read an executable byte of memory. Returns `true` of the byte
   // at address `addr` is executable and readable, and updates the byte
   // pointed to by `byte` with the read value.
   bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override {
-    auto byte_it = memory.find(addr);
-    if (byte_it != memory.end()) {
-      *byte = byte_it->second;
+    auto view = binary.Read(addr, 1u);
+    if (!view.empty()) {
+      *byte = static_cast<uint8_t>(view.front());
       return true;
     } else {
       return false;
     }
   }
 
+  // Try to get a view of the executable bytes starting at `addr`. This points
+  // directly into the memory-mapped binary.
+  std::string_view TryReadExecutableBytes(uint64_t addr,
+                                          size_t max_size) override {
+    return binary.Read(addr, max_size);
+  }
+
  public:
-  Memory &memory;
+  const Binary &binary;
   std::unordered_map<uint64_t, llvm::Function *> traces;
+  std::unordered_map<uint64_t, llvm::Function *> declarations;
 };
 
 // Looks for calls to a function like `__remill_function_return`, and
@@ -224,10 +424,13 @@ int main(int argc, char *argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
   google::InitGoogleLogging(argv[0]);
 
+  if (!FLAGS_stats_out.empty() || FLAGS_whole_binary) {
+    remill::EnableStatistics();
+  }
 
-  if (FLAGS_bytes.empty()) {
-    std::cerr << "Please specify a sequence of hex bytes to --bytes."
-              << std::endl;
+  if (FLAGS_bytes.empty() == FLAGS_binary.empty()) {
+    std::cerr << "Please specify either a sequence of hex bytes to --bytes, "
+              << "or the path of a binary to --binary." << std::endl;
     return EXIT_FAILURE;
   }
 
@@ -237,10 +440,6 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  if (!FLAGS_entry_address) {
-    FLAGS_entry_address = FLAGS_address;
-  }
-
   // Make sure `--address` and `--entry_address` are in-bounds for the target
   // architecture's address size.
   llvm::LLVMContext context;
@@ -253,6 +452,27 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
+  std::unique_ptr<Binary> binary;
+  if (!FLAGS_bytes.empty()) {
+    binary = Binary::FromBytes(UnhexlifyInputBytes(), FLAGS_address);
+  } else if (FLAGS_raw) {
+    binary = Binary::OpenRaw(FLAGS_binary, FLAGS_address);
+  } else {
+    binary = Binary::Open(FLAGS_binary, FLAGS_address);
+  }
+
+  if (!binary || !SegmentsFitAddressSpace(*binary, addr_mask)) {
+    return EXIT_FAILURE;
+  }
+
+  if (!FLAGS_entry_address) {
+    if (binary->EntryPoint()) {
+      FLAGS_entry_address = binary->EntryPoint();
+    } else {
+      FLAGS_entry_address = FLAGS_address;
+    }
+  }
+
   if (FLAGS_entry_address != (FLAGS_entry_address & addr_mask)) {
     std::cerr
         << "Value " << std::hex << FLAGS_entry_address
@@ -261,26 +481,112 @@ int main(int argc, char *argv[]) {
     return EXIT_FAILURE;
   }
 
-  std::unique_ptr<llvm::Module> module(remill::LoadArchSemantics(arch.get()));
+  std::vector<uint64_t> entry_addrs = {FLAGS_entry_address};
+  if (!ParseEntryAddresses(entry_addrs)) {
+    return EXIT_FAILURE;
+  }
+
+  if (FLAGS_lift_all_symbols && !binary->IsELF()) {
+    std::cerr << "Please specify an ELF file to --binary when using "
+              << "--lift_all_symbols." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Collect the entrypoints, and find out where each came from. Only the
+  // first occurrence of each address counts.
+  LiftStatistics stats;
+  std::set<uint64_t> seen_addrs;
+  std::vector<uint64_t> trace_heads;
+  auto add_trace_heads = [&](const std::vector<uint64_t> &addrs) -> size_t {
+    size_t num_added = 0;
+    for (auto addr : addrs) {
+      addr &= addr_mask;
+      if (!seen_addrs.insert(addr).second) {
+        continue;
+      } else if (binary->Read(addr, 1u).empty()) {
+        LOG(WARNING) << "Entrypoint " << std::hex << addr << std::dec
+                     << " is not in an executable segment";
+        continue;
+      }
+      trace_heads.push_back(addr);
+      ++num_added;
+    }
+    return num_added;
+  };
+
+  stats.num_trace_heads.Add(kTraceHeadFromEntrypoint,
+                            add_trace_heads(entry_addrs));
+
+  if (FLAGS_lift_all_symbols || FLAGS_whole_binary) {
+    std::vector<uint64_t> symbol_addrs;
+    for (const auto &sym : binary->FunctionSymbols()) {
+      symbol_addrs.push_back(sym.address);
+    }
+    stats.num_trace_heads.Add(kTraceHeadFromSymbol,
+                              add_trace_heads(symbol_addrs));
+  }
+
+  if (FLAGS_whole_binary) {
+    stats.num_trace_heads.Add(kTraceHeadFromEHFrame,
+                              add_trace_heads(binary->EHFrameFunctionStarts()));
+  }
+
+  std::unique_ptr<llvm::Module> module(
+      remill::LoadArchSemantics(arch.get(), {}, FLAGS_verified_stamp_dir));
 
   const auto mem_ptr_type = arch->MemoryPointerType();
 
-  Memory memory = UnhexlifyInputBytes(addr_mask);
-  SimpleTraceManager manager(memory);
+  SimpleTraceManager manager(*binary);
   remill::IntrinsicTable intrinsics(module.get());
 
 
   auto inst_lifter = arch->DefaultLifter(intrinsics);
 
-  remill::TraceLifter trace_lifter(arch.get(), manager);
+  remill::TraceLifterOptions lifter_options;
+  lifter_options.inline_cache_size = FLAGS_inline_cache_size;
+  lifter_options.shadow_return_stack_size = FLAGS_shadow_return_stack_size;
+  lifter_options.fuse_idioms = FLAGS_fuse_idioms;
+
+  remill::TraceLifter trace_lifter(arch.get(), manager, lifter_options);
+
+  // Decode all code reachable from the trace heads, using many threads, to
+  // find the rest of the trace heads, e.g. the targets of function calls.
+  // Declaring all of them up-front means that no trace inlines the code of
+  // a trace head that is only found later.
+  if (FLAGS_whole_binary) {
+    remill::CodeDiscoveryOptions discovery_options;
+    discovery_options.num_threads = FLAGS_num_threads;
+    discovery_options.fuse_idioms = FLAGS_fuse_idioms;
+    remill::CodeDiscovery discovery(arch.get(), manager, discovery_options);
+    const auto graph = discovery.Discover(trace_heads);
+    stats.num_trace_heads.Add(
+        kTraceHeadFromCallTarget,
+        graph.trace_heads.size() -
+            std::min(graph.trace_heads.size(), trace_heads.size()));
+
+    trace_heads.assign(graph.trace_heads.begin(), graph.trace_heads.end());
+    manager.DeclareTraces(arch.get(), module.get(), trace_heads);
+  }
 
-  // Lift all discoverable traces starting from `--entry_address` into
-  // `module`.
-  trace_lifter.Lift(FLAGS_entry_address);
+  // Lift all discoverable traces starting from `--entry_address`, and from
+  // any other trace heads, into `module`. Traces that were already lifted
+  // from a prior trace head are reused.
+  //
+  // NOTE(pag): Each phase is timed until the next one starts.
+  std::optional<remill::ScopedTimer> phase_timer;
+  phase_timer.emplace(stats.lift_timer);
+  for (auto trace_head : trace_heads) {
+    if (!trace_lifter.Lift(trace_head)) {
+      stats.num_failed_traces.Add();
+    }
+  }
 
   // Optimize the module, but with a particular focus on only the functions
   // that we actually lifted.
+  phase_timer.emplace(stats.optimize_timer);
   remill::OptimizationGuide guide = {};
+  guide.promote_registers = FLAGS_promote_registers;
+  guide.register_alias_analysis = FLAGS_register_alias_analysis;
   remill::OptimizeModule(arch, module, manager.traces, guide);
 
   // Create a new module in which we will move all the lifted functions. Prepare
@@ -293,23 +599,42 @@ int main(int argc, char *argv[]) {
   const auto make_slice =
       !FLAGS_slice_inputs.empty() || !FLAGS_slice_outputs.empty();
 
-  // Move the lifted code into a new module. This module will be much smaller
-  // because it won't be bogged down with all of the semantics definitions.
-  // This is a good JITing strategy: optimize the lifted code in the semantics
-  // module, move it to a new module, instrument it there, then JIT compile it.
+  // Extract the lifted code into a new module. This module will be much
+  // smaller because it will only have the semantics definitions that the
+  // lifted code still references, if any. This is a good JITing strategy:
+  // optimize the lifted code in the semantics module, extract it to a new
+  // module, instrument it there, then JIT compile it.
+  phase_timer.emplace(stats.extract_timer);
+  std::vector<uint64_t> trace_addrs;
+  std::vector<llvm::Function *> trace_funcs;
   for (auto &lifted_entry : manager.traces) {
-    if (lifted_entry.first == FLAGS_entry_address) {
-      entry_trace = lifted_entry.second;
+    trace_addrs.push_back(lifted_entry.first);
+    trace_funcs.push_back(lifted_entry.second);
+  }
+
+  const auto source_funcs = trace_funcs;
+  trace_funcs = remill::ExtractTraceClosure(trace_funcs, &dest_module);
+
+  // Extracting copies the traces, so leave behind declarations, as moving
+  // them would have. This frees the original code before `dest_module` is
+  // optimized and written.
+  for (auto source_func : source_funcs) {
+    source_func->deleteBody();
+  }
+
+  for (size_t i = 0; i < trace_funcs.size(); ++i) {
+    const auto lifted_func = trace_funcs[i];
+    if (trace_addrs[i] == FLAGS_entry_address) {
+      entry_trace = lifted_func;
     }
-    remill::MoveFunctionIntoModule(lifted_entry.second, &dest_module);
 
     // If we are providing a prototype, then we'll be re-optimizing the new
     // module, and we want everything to get inlined.
     if (make_slice) {
-      lifted_entry.second->setLinkage(llvm::GlobalValue::InternalLinkage);
-      lifted_entry.second->removeFnAttr(llvm::Attribute::NoInline);
-      lifted_entry.second->addFnAttr(llvm::Attribute::InlineHint);
-      lifted_entry.second->addFnAttr(llvm::Attribute::AlwaysInline);
+      lifted_func->setLinkage(llvm::GlobalValue::InternalLinkage);
+      lifted_func->removeFnAttr(llvm::Attribute::NoInline);
+      lifted_func->addFnAttr(llvm::Attribute::InlineHint);
+      lifted_func->addFnAttr(llvm::Attribute::AlwaysInline);
     }
   }
 
@@ -439,6 +764,7 @@ int main(int argc, char *argv[]) {
     remill::OptimizeBareModule(&dest_module, guide);
   }
 
+  phase_timer.emplace(stats.write_timer);
   int ret = EXIT_SUCCESS;
 
   if (!FLAGS_ir_out.empty()) {
@@ -448,11 +774,30 @@ int main(int argc, char *argv[]) {
     }
   }
   if (!FLAGS_bc_out.empty()) {
-    if (!remill::StoreModuleToFile(&dest_module, FLAGS_bc_out, true)) {
+    if (FLAGS_bc_partitions) {
+      if (!remill::StoreModulePartitionsToFiles(
+              &dest_module, FLAGS_bc_out, FLAGS_bc_partitions,
+              FLAGS_verify_partitions, true)) {
+        LOG(ERROR) << "Could not save LLVM bitcode partitions to "
+                   << FLAGS_bc_out;
+        ret = EXIT_FAILURE;
+      }
+    } else if (!remill::StoreModuleToFile(&dest_module, FLAGS_bc_out, true)) {
       LOG(ERROR) << "Could not save LLVM bitcode to " << FLAGS_bc_out;
       ret = EXIT_FAILURE;
     }
   }
+  phase_timer.reset();
+
+  if (FLAGS_whole_binary) {
+    stats.Print(std::cerr);
+  }
+
+  if (!FLAGS_stats_out.empty() &&
+      !remill::StoreStatisticsToFile(FLAGS_stats_out)) {
+    LOG(ERROR) << "Could not save statistics to " << FLAGS_stats_out;
+    ret = EXIT_FAILURE;
+  }
 
   return ret;
 }
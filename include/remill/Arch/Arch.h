@@ -167,6 +167,36 @@ struct Register {
                            llvm::StructType *state_type);
 };
 
+// A compact description of one instruction, as produced by
+// `Arch::DecodeRange`. Unlike an `Instruction`, this has no operands or
+// semantics function name.
+struct InstructionSummary {
+
+  // Address of the instruction.
+  uint64_t pc{0};
+
+  // Address of the instruction that follows this one in memory, i.e. the
+  // fall-through of a conditional branch, or the return address of a call.
+  uint64_t next_pc{0};
+
+  // Target of a direct jump, call, or conditional branch, wrapped around
+  // to the address size of the architecture. Only meaningful when
+  // `has_direct_target` is `true`.
+  uint64_t direct_target{0};
+
+  // Size of the instruction in bytes. Undecodable bytes are reported as
+  // instructions of size `MinInstructionAlign`, with an invalid category.
+  uint32_t size{0};
+
+  bool has_direct_target{false};
+
+  Instruction::Category category{Instruction::kCategoryInvalid};
+};
+
+// Called by `Arch::DecodeRange` for each instruction. Return `false` to stop
+// decoding.
+using DecodeRangeCallback = std::function<bool(const InstructionSummary &)>;
+
 class Arch {
  public:
   using ArchPtr = std::unique_ptr<const Arch>;
@@ -246,6 +276,10 @@ class Arch {
   // should contain.
   void InitializeEmptyLiftedFunction(llvm::Function *func) const;
 
+  // Clean up a lifted function once nothing more will be lifted into it, e.g.
+  // by removing architecture-specific variables that it never used.
+  virtual void FinishLiftedFunction(llvm::Function *func) const;
+
   // Converts an LLVM module object to have the right triple / data layout
   // information for the target architecture and ensures remill required
   // functions have the appropriate prototype and internal variables
@@ -282,11 +316,10 @@ class Arch {
   //            opportunistically look for opportunities to recognize some
   //            simple idioms and fuse them (e.g. `call; pop` on x86,
   //            `sethi; or` on sparc). If you don't want to decode idioms, then
-  //            one usage pattern to avoid them is to start with
-  //            `MinInstructionSize()` bytes, and if that fails to decode, then
-  //            walk up, one byte at a time, to `MaxInstructionSize(false)`
-  //            bytes being passed to the decoder, until you successfully decode
-  //            or ultimately fail.
+  //            pass at most `MaxInstructionSize(context, false)` bytes. On
+  //            x86 and AArch64, idioms are only fused when given more bytes
+  //            than that, so code near the end of the readable bytes may not
+  //            be fused.
 
 
   virtual bool DecodeInstruction(uint64_t address, std::string_view instr_bytes,
@@ -302,6 +335,23 @@ class Arch {
                                    std::move(context));
   }
 
+  // Linearly sweep `bytes`, which are located at `address`, and call `cb`
+  // with a summary of each instruction. Idioms are not fused. Returns the
+  // number of bytes swept, which is less than `bytes.size()` if `cb` stopped
+  // the sweep or if the bytes end with a partial instruction.
+  //
+  // This is meant for recovering instruction boundaries and control-flow
+  // over whole code sections, and so architectures may override it with a
+  // faster decoder that skips operand decoding.
+  virtual uint64_t DecodeRange(uint64_t address, std::string_view bytes,
+                               const DecodingContext &context,
+                               const DecodeRangeCallback &cb) const;
+
+  inline uint64_t DecodeRange(uint64_t address, std::string_view bytes,
+                              const DecodeRangeCallback &cb) const {
+    return DecodeRange(address, bytes, CreateInitialContext(), cb);
+  }
+
   // Minimum alignment of an instruction for this particular architecture.
   virtual uint64_t
   MinInstructionAlign(const DecodingContext &context) const = 0;
@@ -313,9 +363,14 @@ class Arch {
   //
   // `permit_fuse_idioms` is `true` if Remill is allowed to decode multiple
   // instructions at a time and look for instruction fusing idioms that are
-  // common to this architecture.
-  virtual uint64_t MaxInstructionSize(const DecodingContext &context,
-                                      bool permit_fuse_idioms = true) const = 0;
+  // common to this architecture. Decoders don't fuse idioms if they are given
+  // no more than `MaxInstructionSize(context, false)` bytes.
+  //
+  // NOTE(pag): Fusing idioms changes instruction boundaries and ISEL names,
+  //            e.g. `cmp; jcc` decodes as one instruction, so it is opt-in.
+  virtual uint64_t
+  MaxInstructionSize(const DecodingContext &context,
+                     bool permit_fuse_idioms = false) const = 0;
 
   // Default calling convention for this architecture.
   virtual llvm::CallingConv::ID DefaultCallingConv(void) const = 0;
@@ -396,9 +451,10 @@ class Arch {
                                       const char *parent_reg_name) const = 0;
 
   // Returns a lock on global state. In general, Remill doesn't use global
-  // variables for storing state; however, SLEIGH sometimes does, and so when
-  // using SLEIGH-backed architectures, it can be necessary to acquire this
-  // lock.
+  // variables for storing state; however, SLEIGH does when it parses a spec,
+  // and so SLEIGH-backed architectures acquire this lock while they load their
+  // specs. Decoding and lifting use per-thread SLEIGH contexts, and so don't
+  // need this lock.
   static ArchLocker Lock(ArchName arch_name_);
 
  protected:
@@ -20,6 +20,7 @@
 #include <remill/Arch/Context.h>
 
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
@@ -30,6 +31,7 @@ class StructType;
 }  // namespace llvm
 namespace remill {
 
+class Statistic;
 struct Register;
 
 
@@ -99,6 +101,12 @@ class ArchBase : public remill::Arch {
   // Metadata type ID for remill registers.
   mutable unsigned reg_md_id{0};
 
+  // Registers are added while the architecture is built, and the types above
+  // are filled in when a semantics module is loaded. Both can be triggered
+  // through a `const Arch *`, so this serializes them. Lookups don't take
+  // this lock, and so must not race with adding registers.
+  mutable std::mutex init_lock;
+
   mutable std::vector<std::unique_ptr<Register>> registers;
   mutable std::vector<const Register *> reg_by_offset;
   mutable std::unordered_map<std::string, const Register *> reg_by_name;
@@ -131,10 +139,18 @@ class DefaultContextAndLifter : virtual public remill::ArchBase {
   DefaultContextAndLifter(llvm::LLVMContext *context_, OSName os_name_,
                           ArchName arch_name_);
 
+  virtual ~DefaultContextAndLifter(void);
+
  protected:
   virtual bool ArchDecodeInstruction(uint64_t address,
                                      std::string_view instr_bytes,
                                      Instruction &inst) const = 0;
+
+ private:
+  // Number of instructions decoded by this architecture, and number of
+  // decoding failures.
+  const std::unique_ptr<const Statistic> num_decoded_insts;
+  const std::unique_ptr<const Statistic> num_decode_failures;
 };
 
 
@@ -27,7 +27,8 @@ class X86ArchBase : public virtual ArchBase {
 
   uint64_t MinInstructionSize(const DecodingContext &context) const override;
 
-  uint64_t MaxInstructionSize(const DecodingContext &, bool) const override;
+  uint64_t MaxInstructionSize(const DecodingContext &,
+                              bool permit_fuse_idioms) const override;
 
   llvm::CallingConv::ID DefaultCallingConv(void) const override;
 
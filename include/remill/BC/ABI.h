@@ -42,4 +42,7 @@ extern const std::string_view kInvalidInstructionISelName;
 extern const std::string_view kUnsupportedInstructionISelName;
 extern const std::string_view kIgnoreNextPCVariableName;
 
+extern const std::string_view kInlineCacheMissVariableName;
+extern const std::string_view kShadowReturnStackVariableName;
+
 }  // namespace remill
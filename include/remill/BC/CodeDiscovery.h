@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <remill/Arch/Instruction.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace remill {
+
+class Arch;
+class TraceManager;
+
+// A basic block found by `CodeDiscovery`.
+struct DiscoveredBlock {
+
+  // Address of the first instruction in the block.
+  uint64_t pc{0};
+
+  // The `next_pc` of the last instruction in the block. This follows the
+  // delay slot of the last instruction, if any.
+  uint64_t end_pc{0};
+
+  // Number of instructions in the block, including the delay slot of the
+  // last instruction.
+  unsigned num_instructions{0};
+
+  // Does the last instruction have a delay slot, e.g. a SPARC branch? If so,
+  // then the delayed instruction at `delayed_pc` is part of this block, and
+  // isn't a block of its own. A delay slot that can't be decoded makes the
+  // `terminator` a `kCategoryError`, just like in the `TraceLifter`.
+  bool has_delay_slot{false};
+  uint64_t delayed_pc{0};
+
+  // Category of the last instruction in the block. Blocks that fall through
+  // into another block end with a `kCategoryNormal` or `kCategoryNoOp`
+  // instruction.
+  Instruction::Category terminator{Instruction::kCategoryInvalid};
+
+  // Blocks that control can flow to from this block within the same trace,
+  // e.g. the targets of a conditional branch, or the return address of a
+  // function call.
+  std::vector<uint64_t> successors;
+
+  // Trace heads targeted by this block, e.g. the targets of function calls,
+  // or the devirtualized trace head targets of an indirect jump.
+  std::vector<uint64_t> callees;
+};
+
+// The control-flow graph found by `CodeDiscovery`.
+struct CodeGraph {
+
+  // Every block, ordered by address.
+  std::map<uint64_t, DiscoveredBlock> blocks;
+
+  // Addresses of every trace head, i.e. the addresses given to
+  // `CodeDiscovery::Discover`, and the addresses that the `TraceLifter` would
+  // lift as traces, e.g. the targets of direct function calls.
+  std::set<uint64_t> trace_heads;
+
+  // Addresses that control reaches, but that have no executable bytes. The
+  // trace lifter calls `__remill_missing_block` at these.
+  std::set<uint64_t> missing_blocks;
+};
+
+struct CodeDiscoveryOptions {
+
+  // Number of threads that decode instructions. Zero means one thread per
+  // hardware thread.
+  unsigned num_threads{0};
+
+  // Whether to let the decoder fuse instruction idioms. This should match
+  // `TraceLifterOptions::fuse_idioms` of the lifter of the discovered code.
+  bool fuse_idioms{false};
+};
+
+// Recursively decodes all code reachable from some trace heads, without
+// lifting it, using many threads. This follows control flow in the same way
+// as the `TraceLifter`, and so the resulting graph tells a lifter up-front
+// about every trace head. For example, a `TraceManager` can return
+// declarations for every trace head in `CodeGraph::trace_heads`, so that the
+// `TraceLifter` never inlines a trace that is later found to be a trace head,
+// and then the traces can be lifted in any order, or in parallel, one
+// `TraceLifter` per thread.
+//
+// The `TraceLifter` doesn't run discovery itself; it is up to the caller to
+// do so before lifting, e.g. `remill-lift --whole_binary` discovers the code
+// of the whole binary, and then its `TraceManager` declares every trace head
+// before any trace is lifted.
+//
+// NOTE: `TraceManager::TryReadExecutableByte` and
+//       `TraceManager::ForEachDevirtualizedTarget` are called concurrently
+//       from many threads, so they must be thread-safe. No other methods of
+//       the `TraceManager` are used.
+class CodeDiscovery {
+ public:
+  ~CodeDiscovery(void);
+
+  inline CodeDiscovery(const Arch *arch_, TraceManager &manager_,
+                       CodeDiscoveryOptions options_ = {})
+      : CodeDiscovery(arch_, &manager_, options_) {}
+
+  CodeDiscovery(const Arch *arch_, TraceManager *manager_,
+                CodeDiscoveryOptions options_ = {});
+
+  // Discover all code reachable from `trace_heads`.
+  CodeGraph Discover(const std::vector<uint64_t> &trace_heads);
+
+ private:
+  CodeDiscovery(void) = delete;
+
+  class Impl;
+
+  std::unique_ptr<Impl> impl;
+};
+
+}  // namespace remill
@@ -46,6 +46,15 @@ struct OptimizationGuide {
   bool loop_vectorize;
   bool verify_input;
   bool verify_output;
+
+  // Promote the architectural registers accessed by each optimized trace out
+  // of `State` and into SSA values. See `PromoteRegistersToSSA`.
+  bool promote_registers;
+
+  // Add `RegisterAA` to the alias analysis pipeline, and tag the `State`
+  // accesses of the inlined semantics of each optimized trace with
+  // `!remill_register_alias` metadata. See `AddRegisterAliasAnalysis`.
+  bool register_alias_analysis;
 };
 
 template <typename T>
@@ -164,6 +173,20 @@ inline static void OptimizeModule(const remill::Arch *arch,
   return OptimizeModule(arch, module, trace_func_gen, guide);
 }
 
+// Promote the architectural registers accessed by the lifted function `func`
+// into SSA values. Each register touched by `func` is loaded out of `State`
+// once on entry to the function, and is only written back to `State` before
+// returns and around instructions that can observe `State` directly, e.g.
+// calls to `__remill_jump` or to other lifted functions. Accesses to
+// sub-registers (e.g. `AL`, `AX`, `EAX` of `RAX`, or `Wn` of `Xn`) are
+// redirected into their enclosing register's promoted copy.
+//
+// NOTE(pag): This is most effective after the semantics functions have been
+//            inlined into `func`, e.g. after `OptimizeModule`.
+//
+// Returns `true` if `func` was transformed.
+bool PromoteRegistersToSSA(const remill::Arch *arch, llvm::Function *func);
+
 // Optimize a normal module. This might not contain special Remill-specific
 // intrinsics functions like `__remill_jump`, etc.
 void OptimizeBareModule(llvm::Module *module, OptimizationGuide guide = {});
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+// clang-format off
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wconversion"
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#pragma clang diagnostic ignored "-Wdocumentation"
+#pragma clang diagnostic ignored "-Wswitch-enum"
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/IR/PassManager.h>
+#pragma clang diagnostic pop
+
+// clang-format on
+
+#include <optional>
+
+#include "Version.h"
+
+namespace llvm {
+class DataLayout;
+class Function;
+class Instruction;
+class LLVMContext;
+class MDNode;
+class PassBuilder;
+class Value;
+}  // namespace llvm
+
+namespace remill {
+
+class Arch;
+struct Register;
+
+// Pointers into the `State` structure that name (part of) an architectural
+// register carry `!remill_register_alias` metadata of the form:
+//
+//    !{!"<enclosing register name>",
+//      i64 <byte offset of the pointer in `State`>,
+//      i64 <byte offset of the enclosing register in `State`>,
+//      i64 <size in bytes of the enclosing register>}
+//
+// The enclosing register names the alias set, e.g. `AL`, `AX`, `EAX`, and
+// `RAX` are all in the `RAX` set, and `XMM0` and `YMM0` are in the `ZMM0` set
+// when AVX-512 is enabled. The two offsets give the position of the accessed
+// lanes within the enclosing register, e.g. `Vn` is the low 16 bytes of its
+// set, whereas `AH` starts one byte into its set.
+llvm::MDNode *RegisterAliasMetadata(const Register *reg, uint64_t offset);
+
+// Returns the metadata kind ID of `!remill_register_alias`.
+unsigned RegisterAliasMdID(llvm::LLVMContext &context);
+
+// Returns the byte offset into `State`, as described by the
+// `!remill_register_alias` metadata attached to (or derived from) `ptr`, if
+// it has any.
+std::optional<int64_t> RegisterAliasOffset(const llvm::DataLayout &dl,
+                                           llvm::Value *ptr);
+
+// Tag every `getelementptr` in `func` that indexes to a constant offset of a
+// register in the `State` structure with `!remill_register_alias` metadata.
+// Pointers produced by `Register::AddressOf` are already tagged; this is
+// meant to tag the pointers that come from inlined semantics functions.
+//
+// Returns the number of instructions tagged.
+unsigned AnnotateRegisterAccesses(const Arch *arch, llvm::Function *func);
+
+// An alias analysis that uses `!remill_register_alias` metadata to prove
+// that accesses to distinct registers, or distinct lanes of one register,
+// never alias. Both accesses must be based on the same `State` structure,
+// e.g. the same state pointer argument; accesses based on different state
+// pointers, or on a copy of `State`, may alias.
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(16, 0)
+class RegisterAAResult : public llvm::AAResultBase<RegisterAAResult> {
+  friend llvm::AAResultBase<RegisterAAResult>;
+#else
+class RegisterAAResult : public llvm::AAResultBase {
+#endif
+ public:
+  explicit RegisterAAResult(const llvm::DataLayout &dl_) : dl(dl_) {}
+
+  bool invalidate(llvm::Function &, const llvm::PreservedAnalyses &,
+                  llvm::FunctionAnalysisManager::Invalidator &) {
+    return false;
+  }
+
+  llvm::AliasResult alias(const llvm::MemoryLocation &loc_a,
+                          const llvm::MemoryLocation &loc_b,
+                          llvm::AAQueryInfo &aaqi
+#if LLVM_VERSION_NUMBER >= LLVM_VERSION(17, 0)
+                          ,
+                          const llvm::Instruction *ctx_inst
+#endif
+  );
+
+ private:
+  const llvm::DataLayout &dl;
+};
+
+class RegisterAA : public llvm::AnalysisInfoMixin<RegisterAA> {
+ public:
+  using Result = RegisterAAResult;
+
+  RegisterAAResult run(llvm::Function &func, llvm::FunctionAnalysisManager &);
+
+ private:
+  friend llvm::AnalysisInfoMixin<RegisterAA>;
+
+  static llvm::AnalysisKey Key;
+};
+
+// Register `RegisterAA` with `fam`, and add it to the default alias analysis
+// pipeline of `pb`. This must be called before `pb.registerFunctionAnalyses`.
+void AddRegisterAliasAnalysis(llvm::PassBuilder &pb,
+                              llvm::FunctionAnalysisManager &fam);
+
+}  // namespace remill
@@ -39,7 +39,6 @@ struct BranchTakenVar {
 using MaybeBranchTakenVar = std::optional<BranchTakenVar>;
 
 class SleighDecoder;
-class SingleInstructionSleighContext;
 }  // namespace sleigh
 
 
@@ -47,7 +46,6 @@ class SleighLifter : public InstructionLifter {
  private:
   class PcodeToLLVMEmitIntoBlock;
 
-  std::unique_ptr<sleigh::SingleInstructionSleighContext> sleigh_context;
   // Architecture being used for lifting.
   // Decoder being used for disassembly
 
@@ -80,8 +78,6 @@ class SleighLifter : public InstructionLifter {
       Instruction &inst, llvm::Module *target_mod, bool is_delayed,
       const sleigh::MaybeBranchTakenVar &btaken,
       const ContextValues &context_values);
-
-  ::Sleigh &GetEngine(void) const;
 };
 
 
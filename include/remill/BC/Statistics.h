@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace llvm {
+class raw_ostream;
+}  // namespace llvm
+
+// Statistics about decoding, lifting, and optimizing, e.g. the number of
+// instructions decoded per architecture, or the time spent in each phase.
+//
+// Statistics are always compiled in, but are only collected once enabled
+// with `EnableStatistics`. When disabled, recording a statistic costs one
+// relaxed atomic load and a branch.
+//
+// Each thread records into its own slots, so recording never takes a lock or
+// contends on shared cache lines. Reading a statistic sums the slots of every
+// thread, including those of threads that have since exited.
+//
+// Statistics are named with dot-separated paths, e.g.
+// `trace_lifter.instructions_per_trace`. Statistic objects are meant to be
+// created once, e.g. as function-local `static`s or members, and then used
+// from any thread. Creating two statistics with the same name gives two
+// handles to the same statistic.
+namespace remill {
+namespace detail {
+
+extern std::atomic<bool> gStatisticsEnabled;
+
+void AddToStatistic(unsigned slot, uint64_t amount);
+void RecordInHistogram(unsigned first_slot, uint64_t value);
+
+}  // namespace detail
+
+// Start or stop collecting statistics.
+void EnableStatistics(bool enabled = true);
+
+// Returns `true` if statistics are being collected.
+inline bool StatisticsEnabled(void) {
+  return detail::gStatisticsEnabled.load(std::memory_order_relaxed);
+}
+
+// A counter.
+class Statistic {
+ public:
+  explicit Statistic(std::string_view name);
+
+  inline void Add(uint64_t amount = 1u) const {
+    if (StatisticsEnabled()) {
+      detail::AddToStatistic(slot, amount);
+    }
+  }
+
+ private:
+  unsigned slot;
+};
+
+// A family of counters, indexed by a small integer key, e.g. an `ArchName`
+// or a `LiftStatus`. The counter for key `k` is named `<name>.<key_name(k)>`.
+class StatisticArray {
+ public:
+  StatisticArray(std::string_view name, unsigned num_keys,
+                 const std::function<std::string(unsigned)> &key_name);
+
+  inline void Add(unsigned key, uint64_t amount = 1u) const {
+    if (StatisticsEnabled() && key < num_keys) {
+      detail::AddToStatistic(first_slot + key, amount);
+    }
+  }
+
+ private:
+  unsigned first_slot;
+  unsigned num_keys;
+};
+
+// A histogram of values, e.g. of the number of instructions in each lifted
+// trace. Values are counted in power-of-two buckets, i.e. `0`, `1`, `[2, 4)`,
+// `[4, 8)`, and so on.
+class Histogram {
+ public:
+  explicit Histogram(std::string_view name);
+
+  inline void Record(uint64_t value) const {
+    if (StatisticsEnabled()) {
+      detail::RecordInHistogram(first_slot, value);
+    }
+  }
+
+ private:
+  unsigned first_slot;
+};
+
+// The number of times that some phase ran, and the total time spent in it.
+// Use a `ScopedTimer` to time a phase.
+class Timer {
+ public:
+  explicit Timer(std::string_view name);
+
+ private:
+  friend class ScopedTimer;
+
+  unsigned first_slot;
+};
+
+// Times the scope in which it lives, and adds it to a `Timer`. The scope isn't
+// timed if statistics aren't being collected when it is entered.
+class ScopedTimer {
+ public:
+  inline explicit ScopedTimer(const Timer &timer_)
+      : timer(timer_),
+        enabled(StatisticsEnabled()) {
+    if (enabled) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  inline ~ScopedTimer(void) {
+    if (enabled) {
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      detail::AddToStatistic(timer.first_slot, 1u);
+      detail::AddToStatistic(
+          timer.first_slot + 1u,
+          static_cast<uint64_t>(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                  .count()));
+    }
+  }
+
+ private:
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  const Timer &timer;
+  const bool enabled;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Returns the value of the counter named `name`, summed across all threads,
+// or zero if there is no such counter. For a histogram, this returns the
+// number of recorded values, and for a timer, the number of timed scopes.
+uint64_t ReadStatistic(std::string_view name);
+
+// Returns the total time, in seconds, spent in the scopes timed by the timer
+// named `name`, summed across all threads, or zero if there is no such timer.
+double ReadTimerSeconds(std::string_view name);
+
+// Zero out all statistics.
+//
+// NOTE(pag): Values recorded concurrently with a reset may be lost or kept.
+void ResetStatistics(void);
+
+// Print all statistics to `os` as a JSON object with `counters`,
+// `histograms`, and `timers` keys.
+void PrintStatisticsAsJSON(llvm::raw_ostream &os);
+
+// Print all statistics as JSON to the file `file_name`. Returns `false` if
+// the file can't be written.
+bool StoreStatisticsToFile(std::string_view file_name);
+
+}  // namespace remill
@@ -19,8 +19,12 @@
 #include <remill/BC/Lifter.h>
 
 #include <functional>
+#include <string_view>
 #include <unordered_map>
 
+namespace llvm {
+class GlobalVariable;
+}  // namespace llvm
 namespace remill {
 
 using TraceMap = std::unordered_map<uint64_t, llvm::Function *>;
@@ -79,6 +83,106 @@ class TraceManager {
   // at address `addr` is executable and readable, and updates the byte
   // pointed to by `byte` with the read value.
   virtual bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) = 0;
+
+  // Try to get a view of at most `max_size` contiguous executable bytes,
+  // starting at address `addr`. The view must remain valid for the lifetime
+  // of the trace manager, e.g. because it points into a memory-mapped file.
+  //
+  // By default, this returns an empty view, which tells the lifter to read
+  // the bytes one-at-a-time via `TryReadExecutableByte`. A derived class
+  // that has the code in contiguous buffers, e.g. segments of an executable,
+  // should override this so that the lifter can read whole instructions
+  // without per-byte lookups.
+  virtual std::string_view TryReadExecutableBytes(uint64_t addr,
+                                                  size_t max_size);
+};
+
+// The kind of control-flow transfer that an inline cache speeds up.
+enum class InlineCacheKind : uint32_t {
+  kJump,
+  kFunctionCall,
+  kFunctionReturn
+};
+
+// One entry of an inline cache. Empty entries have a `pc` of
+// `kEmptyInlineCacheEntry`.
+struct InlineCacheEntry {
+  uint64_t pc;
+
+  // Lifted function to call or tail-call when the target is `pc`.
+  void *target;
+};
+
+static constexpr uint64_t kEmptyInlineCacheEntry = ~0ULL;
+
+// Layout of the inline cache that the trace lifter emits for every indirect
+// jump, indirect function call, and function return when
+// `TraceLifterOptions::inline_cache_size` is non-zero.
+//
+// The lifted code compares `NEXT_PC` against the `pc` of each entry in turn.
+// On a hit, it increments `hits` and calls (or tail-calls) the entry's
+// `target` directly. On a miss, it increments `misses`, stores the address of
+// the inline cache into `__remill_inline_cache_miss`, and then falls back to
+// the usual `__remill_jump`, `__remill_function_call`, or
+// `__remill_function_return` intrinsic. The implementation of the intrinsic
+// can use this to fill in an entry.
+//
+// Entries are seeded with the trace heads given to us by
+// `TraceManager::ForEachDevirtualizedTarget`. Trace-local targets of an
+// indirect jump become direct branches, checked before the inline cache.
+struct InlineCache {
+  uint64_t hits;
+  uint64_t misses;
+  InlineCacheKind kind;
+  uint32_t num_entries;
+
+  // Address of the instruction performing the control-flow transfer.
+  uint64_t site_pc;
+
+  // NOTE: There are really `num_entries` entries.
+  InlineCacheEntry entries[1];
+};
+
+// Returns `true` if `global` is an inline cache emitted by the trace lifter.
+bool IsInlineCache(const llvm::GlobalVariable &global);
+
+// Layout of the `__remill_shadow_return_stack` global variable, which the
+// trace lifter uses when `TraceLifterOptions::shadow_return_stack_size` is
+// non-zero. The lifted code only declares this variable; it is up to the
+// runtime to define it, with room for `shadow_return_stack_size` entries.
+//
+// Before every function call, the lifted code stores `RETURN_PC` into
+// `return_pcs[depth % size]` and increments `depth`, and after the call, it
+// restores `depth` to its old value. A function return whose `NEXT_PC`
+// matches the top of the stack returns directly, without calling
+// `__remill_function_return`. All other returns, e.g. because the return
+// address was overwritten, or because the stack wrapped around, fall back to
+// calling `__remill_function_return`.
+//
+// NOTE: The lifted code does not synchronize its accesses to this variable,
+//       so a runtime executing lifted code on multiple threads should make it
+//       thread-local.
+struct ShadowReturnStack {
+  uint64_t depth;
+
+  // NOTE: There are really `shadow_return_stack_size` entries.
+  uint64_t return_pcs[1];
+};
+
+// Options that change the code emitted by the trace lifter.
+struct TraceLifterOptions {
+
+  // Number of entries in the inline cache at each indirect control-flow
+  // transfer. Zero disables inline caches.
+  unsigned inline_cache_size{0};
+
+  // Number of entries in the shadow return stack. Zero disables the shadow
+  // return stack; otherwise this must be a power of two.
+  unsigned shadow_return_stack_size{0};
+
+  // Whether to let the decoder fuse instruction idioms, e.g. `cmp; jcc` into
+  // one instruction. See `Arch::MaxInstructionSize`.
+  bool fuse_idioms{false};
 };
 
 // Implements a recursive decoder that lifts a trace of instructions to bitcode.
@@ -86,10 +190,12 @@ class TraceLifter {
  public:
   ~TraceLifter(void);
 
-  inline TraceLifter(const Arch *arch_, TraceManager &manager_)
-      : TraceLifter(arch_, &manager_) {}
+  inline TraceLifter(const Arch *arch_, TraceManager &manager_,
+                     TraceLifterOptions options_ = {})
+      : TraceLifter(arch_, &manager_, options_) {}
 
-  TraceLifter(const Arch *arch_, TraceManager *manager_);
+  TraceLifter(const Arch *arch_, TraceManager *manager_,
+              TraceLifterOptions options_ = {});
 
   static void NullCallback(uint64_t, llvm::Function *);
 
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+namespace llvm {
+class Function;
+class GlobalValue;
+class Module;
+}  // namespace llvm
+
+namespace remill {
+
+// Copies functions, along with everything that they depend upon, from one or
+// more source modules into a destination module. The source modules can
+// belong to other `llvm::LLVMContext`s than the destination module, e.g. the
+// per-thread modules of a parallel lifter being merged into one module.
+//
+// The dependency closure of a function is copied in one pass over each
+// function body. Definitions that might not otherwise exist in the
+// destination module, i.e. those with local, `linkonce`, or
+// `available_externally` linkage, are copied along with the code that uses
+// them; all other referenced globals are declared. Globals with external
+// linkage that already exist in the destination module are reused.
+//
+// Types, constants, globals, and attributes are memoized for the lifetime of
+// the transplanter, so copying many functions from the same source module, or
+// from many source modules in the same context, only maps each of these once.
+// Metadata is only memoized while copying one function or global. Debug info
+// is not copied.
+//
+// Source and destination globals can be deleted between copies, e.g. when
+// optimizing either module. The memoized mappings of deleted values are
+// forgotten, so a later copy re-copies whatever they were used for. However,
+// a definition is only copied once, so changes to the body of a source
+// function, or to the initializer of a source variable, after it was copied
+// are not seen by later copies.
+//
+// NOTE(pag): A transplanter is not thread-safe, and the source and destination
+//            contexts must not be used by other threads while it copies.
+class FunctionTransplanter {
+ public:
+  ~FunctionTransplanter(void);
+
+  explicit FunctionTransplanter(llvm::Module *dest_module_);
+
+  // Copy `func` into the destination module, and return the copy. If `func`
+  // is a declaration, then this returns a declaration. If the destination
+  // module already declares a function with the same name, then that
+  // declaration becomes the copy.
+  llvm::Function *Copy(llvm::Function *func);
+
+  // Copy `gv`, e.g. a global variable and its initializer, into the
+  // destination module, and return the copy.
+  llvm::GlobalValue *Copy(llvm::GlobalValue *gv);
+
+  // Copy every function and global variable definition in `source_module`
+  // into the destination module.
+  void CopyAll(llvm::Module *source_module);
+
+ private:
+  FunctionTransplanter(void) = delete;
+
+  class Impl;
+
+  std::unique_ptr<Impl> impl;
+};
+
+// Finds the definitions that lifted trace functions transitively depend upon,
+// e.g. the semantics functions that they call, and the internal globals that
+// those reference, and extracts traces along with only those definitions into
+// lean modules that can be optimized, cached, or compiled independently.
+//
+// The direct dependencies of each definition are found once, and cached, so
+// the closures of many traces can be computed without rescanning the
+// semantics functions that they share, e.g. those of common ISELs. This lets
+// tools group traces, or key caches of extracted modules, before extracting
+// anything.
+//
+// NOTE(pag): The cache is invalidated by changes to the code of the source
+//            module(s), e.g. by optimizing them.
+class TraceClosureExtractor {
+ public:
+  ~TraceClosureExtractor(void);
+
+  TraceClosureExtractor(void);
+
+  // Returns `funcs`, followed by every definition that they transitively
+  // depend upon and that must be copied along with them, in the order in
+  // which they are found. Following the rules of `FunctionTransplanter`,
+  // other definitions, e.g. other lifted traces or intrinsics, are only
+  // declared in an extracted module, and so are not part of the closure.
+  std::vector<llvm::GlobalValue *>
+  Closure(const std::vector<llvm::Function *> &funcs);
+
+  // Like `Closure`, but of any definitions, e.g. of global variables whose
+  // initializers reference internal globals.
+  std::vector<llvm::GlobalValue *>
+  DefinitionClosure(const std::vector<llvm::GlobalValue *> &gvs);
+
+  // Copy `funcs` and their closure, as returned by `Closure`, into
+  // `dest_module`, and return the copies of `funcs`. The source functions are
+  // left as they are.
+  std::vector<llvm::Function *>
+  Extract(const std::vector<llvm::Function *> &funcs,
+          llvm::Module *dest_module);
+
+ private:
+  class Impl;
+
+  std::unique_ptr<Impl> impl;
+};
+
+// Copy the lifted trace functions `funcs`, along with the semantics functions,
+// globals, and intrinsic declarations that they transitively reference, into
+// `dest_module`, and return the copies of `funcs`.
+std::vector<llvm::Function *>
+ExtractTraceClosure(const std::vector<llvm::Function *> &funcs,
+                    llvm::Module *dest_module);
+
+}  // namespace remill
@@ -69,6 +69,10 @@ class IntrinsicTable;
 // Initialize the attributes for a lifted function.
 void InitFunctionAttributes(llvm::Function *F);
 
+// Inline all semantics functions called by `func`, leaving only calls to
+// intrinsics and to other traces, i.e. to declarations.
+void InlineSemantics(llvm::Function *func);
+
 // Create a call from one lifted function to another.
 llvm::CallInst *AddCall(llvm::IRBuilder<> &builder,
                         llvm::BasicBlock *source_block, llvm::Value *dest_func,
@@ -176,6 +180,20 @@ std::optional<std::string> VerifyFunctionMsg(llvm::Function *func);
 std::unique_ptr<llvm::Module>
 LoadModuleFromFile(llvm::LLVMContext *context, std::filesystem::path file_name);
 
+// Like `LoadModuleFromFile`, but only verifies the module if there is no
+// stamp in `stamp_dir` recording that this version of LLVM already verified
+// identical bitcode. After verifying the module, a stamp is recorded. This is
+// meant for build artifacts that don't change between runs, e.g. semantics.
+// The bitcode is still parsed, and hashed to find its stamp, on every load;
+// only the verification is skipped.
+//
+// NOTE: Anyone who can write to `stamp_dir` can make unverified bitcode be
+//       trusted, so it should only be writable by the user.
+std::unique_ptr<llvm::Module>
+LoadTrustedModuleFromFile(llvm::LLVMContext *context,
+                          std::filesystem::path file_name,
+                          const std::filesystem::path &stamp_dir);
+
 // Loads the semantics for the `arch`-specific machine, i.e. the machine of the
 // code that we want to lift.
 std::unique_ptr<llvm::Module> LoadArchSemantics(const Arch *arch);
@@ -184,10 +202,41 @@ std::unique_ptr<llvm::Module>
 LoadArchSemantics(const Arch *arch,
                   const std::vector<std::filesystem::path> &sem_dirs);
 
+// Opt in to only verifying the semantics module if there is no stamp for it
+// in `verified_stamp_dir`; see `LoadTrustedModuleFromFile`. An empty
+// `verified_stamp_dir` always verifies the module.
+std::unique_ptr<llvm::Module>
+LoadArchSemantics(const Arch *arch,
+                  const std::vector<std::filesystem::path> &sem_dirs,
+                  const std::filesystem::path &verified_stamp_dir);
+
 // Store an LLVM module into a file.
 bool StoreModuleToFile(llvm::Module *module, std::string_view file_name,
                        bool allow_failure = false);
 
+// Split `module` into `num_partitions` modules, and store them into the
+// bitcode files `<file_name_prefix>.<N>.bc` in parallel. Every function and
+// global definition with non-local linkage is written to exactly one
+// partition, along with copies of the internal semantics definitions that it
+// depends upon. Mutable internal or linkonce global variables are not copied;
+// each is defined by one partition, and declared by the others, with external,
+// hidden linkage. Such variables must be named. A manifest of which partition
+// defines each symbol is written to `<file_name_prefix>.manifest.json`, so that
+// consumers can load or link partitions lazily.
+//
+// Partitions are verified before they are written if `verify` is `true`.
+//
+// NOTE(pag): `module` must not be used by other threads while this runs. The
+//            partitions are copied out of `module` one at a time, under a
+//            lock, because copying touches the context of `module`, e.g. to
+//            create value handles. Only verifying and writing the partitions
+//            happen in parallel, so the copying doesn't get any faster with
+//            more partitions.
+bool StoreModulePartitionsToFiles(llvm::Module *module,
+                                  std::string_view file_name_prefix,
+                                  unsigned num_partitions, bool verify = false,
+                                  bool allow_failure = false);
+
 // Store a module, serialized to LLVM IR, into a file.
 bool StoreModuleIRToFile(llvm::Module *module, std::string_view file_name,
                          bool allow_failure = false);
@@ -254,7 +303,9 @@ std::string ModuleName(const std::unique_ptr<llvm::Module> &module);
 unsigned ReplaceAllUsesOfConstant(llvm::Constant *old_c, llvm::Constant *new_c,
                                   llvm::Module *module);
 
-// Move a function from one module into another module.
+// Move a function from one module into another module. If the modules belong
+// to different contexts, then `func` is copied with a `FunctionTransplanter`,
+// and remains as a declaration in its source module.
 void MoveFunctionIntoModule(llvm::Function *func, llvm::Module *dest_module);
 
 // Get an instance of `type` that belongs to `context`.
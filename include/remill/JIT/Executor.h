@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "remill/Arch/Name.h"
+#include "remill/OS/OS.h"
+
+namespace remill {
+
+class Arch;
+class GuestMemory;
+struct InlineCache;
+
+// Why `Executor::Run` stopped.
+enum class ExecutorStatus : uint32_t {
+
+  // The code returned from the function that `Run` was started in.
+  kReturned,
+
+  // The code reached `__remill_error`, e.g. an invalid instruction.
+  kError,
+
+  // A memory access, or an instruction fetch, went outside of the guest
+  // address space.
+  kMemoryFault,
+
+  // Unable to lift or compile the trace at the current program counter.
+  kLiftFailed,
+
+  // A hyper call was reached, but there is no handler for it. The program
+  // counter is the address following the hyper call.
+  kHyperCall,
+
+  // `ExecutorOptions::max_traces` traces were executed.
+  kTraceLimit,
+
+  // Guest function calls nested deeper than `ExecutorOptions::max_call_depth`.
+  kCallDepthLimit,
+};
+
+const char *ExecutorStatusName(ExecutorStatus status);
+
+struct ExecutorOptions {
+
+  // Stop after executing this many traces. Zero means there is no limit.
+  uint64_t max_traces{0};
+
+  // Guest function calls are executed on the host stack, via a nested
+  // dispatch loop, so bound how deeply they can nest.
+  unsigned max_call_depth{1024};
+
+  // Promote `State` structure fields to SSA values in each trace. See
+  // `PromoteRegistersToSSA`.
+  bool promote_registers{false};
+
+  // Number of entries in the inline cache of each indirect jump. On a hit,
+  // one trace tail-calls the next without going through the dispatch loop.
+  // See `TraceLifterOptions::inline_cache_size`.
+  //
+  // NOTE: Inline caches are not filled in when `max_traces` is set, because
+  //       chained traces would not be counted.
+  unsigned inline_cache_size{0};
+
+  // Number of entries in the shadow return stack, which lets returns that go
+  // back to their caller skip the dispatch loop. Zero disables the shadow
+  // return stack; otherwise this must be a power of two. See
+  // `TraceLifterOptions::shadow_return_stack_size`.
+  unsigned shadow_return_stack_size{0};
+};
+
+// Called on `__remill_sync_hyper_call`. Return `false` to stop execution.
+using SyncHyperCallHandler =
+    std::function<bool(void *state, GuestMemory &memory, uint32_t call)>;
+
+// Called on `__remill_async_hyper_call`, where `ret_addr` is the address
+// following the instruction. Return `false` to stop execution.
+using AsyncHyperCallHandler =
+    std::function<bool(void *state, GuestMemory &memory, uint64_t ret_addr)>;
+
+// Executes machine code by lifting it, one trace at a time, and compiling the
+// lifted traces to host code with ORC's `LLJIT`.
+//
+// Traces are lifted and compiled lazily, the first time that control reaches
+// their entry address, and are then kept in a cache keyed by program counter.
+// Indirect jumps and returns (`__remill_jump`, `__remill_function_return`,
+// `__remill_missing_block`) exit from the trace back into a dispatch loop that
+// looks up the next trace in this cache. Function calls
+// (`__remill_function_call`, and direct calls to other traces) run a nested
+// dispatch loop until the callee returns. Memory intrinsics read from and
+// write to a `GuestMemory` address space.
+//
+// The `state` pointer passed to `Run` must point to the architecture's
+// `State` structure, e.g. the one from `remill/Arch/X86/Runtime/State.h`.
+// An `Executor` is not thread-safe, and must only be used by one thread at a
+// time.
+class Executor {
+ public:
+  ~Executor(void);
+
+  // Create an executor for code of the architecture `arch_name` running on
+  // the operating system `os_name`. Returns `nullptr` on failure.
+  static std::unique_ptr<Executor> Create(OSName os_name, ArchName arch_name,
+                                          GuestMemory &memory,
+                                          ExecutorOptions options = {});
+
+  // Execute guest code starting at `pc`, until the code returns from the
+  // entry function or something goes wrong.
+  ExecutorStatus Run(void *state, uint64_t pc);
+
+  // Returns the program counter at which the last call to `Run` stopped. If
+  // the code returned, then this is the return address. If the code faulted,
+  // then this is the program counter of the faulting trace.
+  uint64_t LastProgramCounter(void) const;
+
+  // Returns the faulting guest address, if `Run` returned
+  // `ExecutorStatus::kMemoryFault`.
+  uint64_t LastFaultAddress(void) const;
+
+  // Install handlers for hyper calls.
+  void SetSyncHyperCallHandler(SyncHyperCallHandler handler);
+  void SetAsyncHyperCallHandler(AsyncHyperCallHandler handler);
+
+  // Throw away all cached traces, e.g. because guest code was modified. This
+  // also frees the host code of the traces.
+  void FlushTraceCache(void);
+
+  // Number of traces in the trace cache.
+  size_t NumCachedTraces(void) const;
+
+  // Apply `cb` to the inline cache of every cached trace, e.g. to report
+  // their hit rates.
+  void ForEachInlineCache(std::function<void(const InlineCache &)> cb) const;
+
+  // Returns the architecture of the guest code.
+  const Arch *GetArch(void) const;
+
+  class Impl;
+
+ private:
+  explicit Executor(std::unique_ptr<Impl> impl_);
+
+  std::unique_ptr<Impl> impl;
+};
+
+}  // namespace remill
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace remill {
+
+// A flat guest address space backed by a single anonymous `mmap`. The guest
+// addresses `[base, base + size)` map one-to-one onto a contiguous range of
+// host memory, so translating a guest address is a subtraction and a bounds
+// check. The host pages are reserved lazily by the kernel, so it is fine to
+// back the whole 4 GiB of a 32-bit guest.
+//
+// Multi-byte loads and stores are performed in the byte order of the guest.
+class GuestMemory {
+ public:
+  GuestMemory(uint64_t base_, uint64_t size_, bool little_endian_);
+  ~GuestMemory(void);
+
+  GuestMemory(const GuestMemory &) = delete;
+  GuestMemory &operator=(const GuestMemory &) = delete;
+
+  // Returns `true` if the mapping was successfully created.
+  inline bool IsValid(void) const {
+    return host != nullptr;
+  }
+
+  // Returns `true` if `[addr, addr + num_bytes)` is part of the guest address
+  // space.
+  inline bool Contains(uint64_t addr, uint64_t num_bytes) const {
+    const auto offset = addr - base;
+    return addr >= base && offset <= size && num_bytes <= (size - offset);
+  }
+
+  // Returns the host address of the guest address `addr`. This does not
+  // check that `addr` is in bounds.
+  inline uint8_t *ToHost(uint64_t addr) const {
+    return &(host[addr - base]);
+  }
+
+  // Copy `num_bytes` bytes from `data` into guest memory at `addr`. Returns
+  // `false` if any of the bytes are out of bounds.
+  bool Write(uint64_t addr, const void *data, size_t num_bytes);
+
+  // Copy `num_bytes` bytes from guest memory at `addr` into `data`. Returns
+  // `false` if any of the bytes are out of bounds.
+  bool Read(uint64_t addr, void *data, size_t num_bytes) const;
+
+  // Zero out `num_bytes` bytes of guest memory starting at `addr`.
+  bool Clear(uint64_t addr, size_t num_bytes);
+
+  // Load an integer or floating-point value of type `T`, in guest byte order,
+  // from `addr`. The caller is responsible for bounds checking.
+  template <typename T>
+  inline T Load(uint64_t addr) const {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T val;
+    memcpy(&val, ToHost(addr), sizeof(T));
+    return needs_swap ? Swap(val) : val;
+  }
+
+  // Store an integer or floating-point value of type `T`, in guest byte order,
+  // to `addr`. The caller is responsible for bounds checking.
+  template <typename T>
+  inline void Store(uint64_t addr, T val) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (needs_swap) {
+      val = Swap(val);
+    }
+    memcpy(ToHost(addr), &val, sizeof(T));
+  }
+
+  // First guest address of the address space.
+  const uint64_t base;
+
+  // Number of bytes in the address space.
+  const uint64_t size;
+
+  // Are multi-byte values stored in little endian byte order?
+  const bool little_endian;
+
+ private:
+  template <typename T>
+  static T Swap(T val) {
+    uint8_t bytes[sizeof(T)];
+    memcpy(bytes, &val, sizeof(T));
+    for (size_t i = 0; i < sizeof(T) / 2; ++i) {
+      const auto b = bytes[i];
+      bytes[i] = bytes[sizeof(T) - i - 1];
+      bytes[sizeof(T) - i - 1] = b;
+    }
+    memcpy(&val, bytes, sizeof(T));
+    return val;
+  }
+
+  // Does the guest byte order differ from the host byte order?
+  const bool needs_swap;
+
+  uint8_t *host{nullptr};
+};
+
+}  // namespace remill
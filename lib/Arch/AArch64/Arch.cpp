@@ -25,11 +25,13 @@
 
 #include <algorithm>
 #include <cctype>
+#include <iterator>
 #include <iomanip>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 #include "remill/Arch/AArch64/AArch64Base.h"
 
@@ -37,6 +39,7 @@
 
 #include <remill/Arch/ArchBase.h>
 
+#include "../IdiomFusion.h"
 #include "Decode.h"
 #include "remill/Arch/Instruction.h"
 #include "remill/Arch/Name.h"
@@ -114,12 +117,30 @@ class AArch64Arch final : public AArch64ArchBase, DefaultContextAndLifter {
 
   virtual ~AArch64Arch(void);
 
+  // Maximum number of bytes in an instruction for this particular
+  // architecture. We look at the next instruction for fusing idioms like
+  // `adrp; add`.
+  uint64_t MaxInstructionSize(const DecodingContext &,
+                              bool permit_fuse_idioms) const final {
+    return permit_fuse_idioms ? 8 : 4;
+  }
+
   // Decode an instruction.
   bool ArchDecodeInstruction(uint64_t address, std::string_view instr_bytes,
                              Instruction &inst) const final;
 
+  // Linearly sweep `bytes` using only the instruction extractor, i.e.
+  // without decoding operands.
+  uint64_t DecodeRange(uint64_t address, std::string_view bytes,
+                       const DecodingContext &context,
+                       const DecodeRangeCallback &cb) const final;
+
  private:
   AArch64Arch(void) = delete;
+
+  // Decode an instruction, without fusing it with the instructions around it.
+  bool DecodeUnfusedInstruction(uint64_t address, std::string_view instr_bytes,
+                                Instruction &inst) const;
 };
 
 AArch64Arch::AArch64Arch(llvm::LLVMContext *context_, OSName os_name_,
@@ -221,75 +242,74 @@ static Operand::ShiftRegister::Shift GetOperandShift(Shift s) {
   return Operand::ShiftRegister::kShiftInvalid;
 }
 
+#define REG_NAMES(p) \
+  { \
+    p "0", p "1", p "2", p "3", p "4", p "5", p "6", p "7", p "8", p "9", \
+        p "10", p "11", p "12", p "13", p "14", p "15", p "16", p "17", \
+        p "18", p "19", p "20", p "21", p "22", p "23", p "24", p "25", \
+        p "26", p "27", p "28", p "29", p "30", p "31" \
+  }
+
+// Register names, indexed by `RegClass` and then by register number. Register
+// operands are created several times per decoded instruction, so we don't
+// want to format these names on the fly.
+//
+// NOTE(pag): Entry `31` of the integer register classes is never used; it
+//            is either `SP` or the zero register, depending on the usage.
+static constexpr std::string_view kRegNames[][32] = {
+    REG_NAMES("X"), REG_NAMES("W"), REG_NAMES("B"), REG_NAMES("H"),
+    REG_NAMES("S"), REG_NAMES("D"), REG_NAMES("Q"), REG_NAMES("V")};
+
+#undef REG_NAMES
+
+static_assert(kRegV + 1 == sizeof(kRegNames) / sizeof(kRegNames[0]));
+
 // Get the name of an integer register.
-static std::string RegNameXW(Action action, RegClass rclass, RegUsage rtype,
-                             aarch64::RegNum number_) {
+//
+// NOTE(pag): `IGNORE_WRITE_TO_XZR` (and `SUPPRESS_WRITEBACK`) are longer than
+//            the inline buffer of `std::string`, so the operands that use
+//            them still allocate when their names are copied. These names are
+//            the names of variables in lifted functions, so we can't shorten
+//            them.
+static std::string_view RegNameXW(Action action, RegClass rclass,
+                                  RegUsage rtype, aarch64::RegNum number_) {
   auto number = static_cast<uint8_t>(number_);
   CHECK_LE(number, 31U);
-
-  std::stringstream ss;
   CHECK(kActionReadWrite != action);
 
   if (31 == number) {
     if (rtype == kUseAsValue) {
       if (action == kActionWrite) {
-        ss << "IGNORE_WRITE_TO_XZR";
+        return "IGNORE_WRITE_TO_XZR";
       } else {
-        ss << (rclass == kRegX ? "XZR" : "WZR");
+        return rclass == kRegX ? "XZR" : "WZR";
       }
     } else {
       if (action == kActionWrite) {
-        ss << "SP";
+        return "SP";
       } else {
-        ss << (rclass == kRegX ? "SP" : "WSP");
+        return rclass == kRegX ? "SP" : "WSP";
       }
     }
-  } else {
-    if (action == kActionWrite) {
-      ss << "X";
-    } else {
-      ss << (rclass == kRegX ? "X" : "W");
-    }
-    ss << static_cast<unsigned>(number);
   }
-  return ss.str();
+
+  // Writes to `W` registers zero-extend into the whole `X` register.
+  return kRegNames[action == kActionWrite ? kRegX : rclass][number];
 }
 
 // Get the name of a floating point register.
-static std::string RegNameFP(Action action, RegClass rclass, RegUsage rtype,
-                             aarch64::RegNum number_) {
+static std::string_view RegNameFP(Action action, RegClass rclass,
+                                  RegUsage rtype, aarch64::RegNum number_) {
   auto number = static_cast<uint8_t>(number_);
   CHECK_LE(number, 31U);
-
-  std::stringstream ss;
   CHECK(kActionReadWrite != action);
 
-  if (kActionRead == action) {
-    if (kRegB == rclass) {
-      ss << "B";
-    } else if (kRegH == rclass) {
-      ss << "H";
-    } else if (kRegS == rclass) {
-      ss << "S";
-    } else if (kRegD == rclass) {
-      ss << "D";
-    } else if (kRegQ == rclass) {
-      ss << "Q";
-    } else {
-      CHECK(kRegV == rclass);
-      ss << "V";
-    }
-  } else {
-    ss << "V";
-  }
-
-  ss << static_cast<unsigned>(number);
-
-  return ss.str();
+  // Writes always go to the whole vector register.
+  return kRegNames[kActionRead == action ? rclass : kRegV][number];
 }
 
-static std::string RegName(Action action, RegClass rclass, RegUsage rtype,
-                           aarch64::RegNum number) {
+static std::string_view RegName(Action action, RegClass rclass,
+                                RegUsage rtype, aarch64::RegNum number) {
   switch (rclass) {
     case kRegX:
     case kRegW: return RegNameXW(action, rclass, rtype, number);
@@ -801,10 +821,154 @@ static uint64_t VFPExpandImmToFloat64(uint64_t imm) {
   return result;
 }
 
+// Returns `true` if `a` and `b` name the same general purpose register, e.g.
+// `X3` and `W3`.
+static bool IsSameGPR(const Operand::Register &a, const Operand::Register &b) {
+  return a.name.size() >= 2 && b.name.size() >= 2 &&
+         std::string_view(a.name).substr(1) ==
+             std::string_view(b.name).substr(1);
+}
 
+// Returns the operand width, in bits, of an instruction from its ISEL name,
+// e.g. `32` for `LDR_32_LDST_POS` or `SUBS_32S_ADDSUB_IMM`.
+//
+// NOTE(pag): The sizes of written register operands can't be used for this,
+//            as writes to `W` registers are zero-extended to `64` bits.
+static unsigned IselOperandWidth(std::string_view isel) {
+  return isel.find("_32") != std::string_view::npos ? 32u : 64u;
+}
+
+// Returns the address computed by an `adrp`.
+static uint64_t AdrpTargetPage(const Instruction &adrp) {
+  const auto disp = adrp.operands[1].addr.displacement;
+  return (adrp.pc + static_cast<uint64_t>(disp)) & ~4095ULL;
+}
+
+static bool IsAdrp(const Instruction &inst) {
+  return inst.function == "ADRP_ONLY_PCRELADDR" && 2u == inst.operands.size();
+}
+
+// `adrp xN, page; add xN, xN, #lo12`, which materializes an address.
+static bool IsFusableAdrpAdd(const Instruction &adrp, const Instruction &add) {
+  if (add.function != "ADD_64_ADDSUB_IMM" || 3u != add.operands.size()) {
+    return false;
+  }
+  const auto &dst = adrp.operands[0].reg;
+  return add.operands[0].reg.name == dst.name &&
+         add.operands[1].reg.name == dst.name &&
+         Operand::kTypeImmediate == add.operands[2].type;
+}
+
+// The fused `adrp+add` acts like an `adr` with a larger range, and the semantic
+// is located in `DATAXFER`. Like with x86's `call+pop`, this is beneficial to
+// downstream users that identify cross-references from `PC`-relative
+// address computations.
+static void FuseAdrpAdd(Instruction &adrp, const Instruction *add) {
+  const auto target = AdrpTargetPage(adrp) + add->operands[2].imm.val;
+  adrp.operands[1].addr.displacement = static_cast<int64_t>(target - adrp.pc);
+  adrp.function = "ADRP_ADD_FUSED";
+}
+
+// `adrp xN, page; ldr xN, [xN, #lo12]`, which loads from a `PC`-relative
+// address. The loaded register must be the one holding the page, as the fused
+// instruction doesn't write the page address anywhere.
+static bool IsFusableAdrpLdr(const Instruction &adrp, const Instruction &ldr) {
+  if ((ldr.function != "LDR_64_LDST_POS" &&
+       ldr.function != "LDR_32_LDST_POS") ||
+      2u != ldr.operands.size()) {
+    return false;
+  }
+  const auto &dst = adrp.operands[0].reg;
+  return ldr.operands[1].addr.base_reg.name == dst.name &&
+         IsSameGPR(ldr.operands[0].reg, dst);
+}
+
+// The fused `adrp+ldr` acts like a literal `ldr`, and the semantics are located
+// in `DATAXFER`.
+//
+// NOTE(pag): If the load faults, then the register holding the page won't
+//            have been updated, whereas it would have been if the `adrp` were
+//            lifted separately.
+static void FuseAdrpLdr(Instruction &adrp, const Instruction *ldr) {
+  const auto target = AdrpTargetPage(adrp) +
+                      static_cast<uint64_t>(ldr->operands[1].addr.displacement);
+  auto mem = ldr->operands[1];
+  mem.addr.base_reg = adrp.operands[1].addr.base_reg;
+  mem.addr.displacement = static_cast<int64_t>(target - adrp.pc);
+
+  adrp.operands.clear();
+  adrp.operands.push_back(ldr->operands[0]);
+  adrp.operands.push_back(mem);
+  adrp.function = 32u == IselOperandWidth(ldr->function)
+                      ? "ADRP_LDR_FUSED_32"
+                      : "ADRP_LDR_FUSED_64";
+}
+
+// A `subs`, e.g. `cmp`, of a register against a register or an immediate.
+static bool IsFusableCompare(const Instruction &inst) {
+  return HasPrefix(inst.function, "SUBS_") && 3u == inst.operands.size();
+}
+
+// Conditions that can be decided directly from the compared values.
+static constexpr std::string_view kFusableConditions[] = {
+    "EQ", "NE", "CS", "CC", "HI", "LS", "GE", "LT", "GT", "LE"};
+
+// Returns the condition code of a `b.<cond>`, e.g. `EQ` for `b.eq`.
+static std::string_view BranchConditionCode(const Instruction &inst) {
+  static constexpr std::string_view kPrefix = "B_ONLY_CONDBRANCH_";
+  std::string_view name(inst.function);
+  return HasPrefix(name, kPrefix) ? name.substr(kPrefix.size())
+                                  : std::string_view();
+}
+
+static bool IsFusableCompareBranch(const Instruction &, const Instruction &b) {
+  const auto cc = BranchConditionCode(b);
+  return std::find(std::begin(kFusableConditions),
+                   std::end(kFusableConditions),
+                   cc) != std::end(kFusableConditions);
+}
+
+// Fuse a `subs` with the following `b.<cond>`. The semantics are located in
+// `BRANCH`, and take the operands of both instructions. They still compute
+// `NZCV`, as those are architecturally visible, but decide the branch directly
+// from the compared values.
+static void FuseCompareBranch(Instruction &subs, const Instruction *b) {
+  std::string name = "SUBS_B_";
+  name += BranchConditionCode(*b);
+  name += "_FUSED_";
+  name += std::to_string(IselOperandWidth(subs.function));
+  subs.function = std::move(name);
+
+  subs.operands.insert(subs.operands.end(), b->operands.begin(),
+                       b->operands.end());
+  subs.category = b->category;
+  subs.branch_taken_pc = b->branch_taken_pc;
+  subs.branch_not_taken_pc = b->branch_not_taken_pc;
+  subs.branch_taken_arch_name = b->branch_taken_arch_name;
+}
+
+static const IdiomFusionRule kIdiomFusionRules[] = {
+    {"adrp+add", IsAdrp, IsFusableAdrpAdd, FuseAdrpAdd},
+    {"adrp+ldr", IsAdrp, IsFusableAdrpLdr, FuseAdrpLdr},
+    {"subs+b.cond", IsFusableCompare, IsFusableCompareBranch,
+     FuseCompareBranch},
+};
+
+// Decode an instruction, and then look for instruction fusing opportunities.
+// Fusion needs more than the `4` bytes of one instruction.
 bool AArch64Arch::ArchDecodeInstruction(uint64_t address,
                                         std::string_view inst_bytes,
                                         Instruction &inst) const {
+  return DecodeAndFuseIdioms(
+      address, inst_bytes, 4u, inst, kIdiomFusionRules,
+      [this](uint64_t pc, std::string_view bytes, Instruction &decoded) {
+        return DecodeUnfusedInstruction(pc, bytes, decoded);
+      });
+}
+
+bool AArch64Arch::DecodeUnfusedInstruction(uint64_t address,
+                                           std::string_view inst_bytes,
+                                           Instruction &inst) const {
 
   aarch64::InstData dinst = {};
   auto bytes = reinterpret_cast<const uint8_t *>(inst_bytes.data());
@@ -817,7 +981,7 @@ bool AArch64Arch::ArchDecodeInstruction(uint64_t address,
   inst.next_pc = address + kInstructionSize;
   inst.category = Instruction::kCategoryInvalid;
 
-  if (kInstructionSize != inst_bytes.size()) {
+  if (kInstructionSize > inst_bytes.size()) {
     inst.category = Instruction::kCategoryInvalid;
     return false;
 
@@ -872,6 +1036,75 @@ bool AArch64Arch::ArchDecodeInstruction(uint64_t address,
   return true;
 }
 
+// Returns the PC-relative displacement of a direct branch, or `false` if
+// `dinst` is not a direct branch.
+static bool DirectBranchDisplacement(const aarch64::InstData &dinst,
+                                     int64_t &disp) {
+  switch (dinst.iclass) {
+    case aarch64::InstName::B:
+      if (aarch64::InstForm::B_ONLY_CONDBRANCH == dinst.iform) {
+        disp = dinst.imm19.simm19 << 2;
+      } else {
+        disp = dinst.imm26.simm26 << 2;
+      }
+      return true;
+    case aarch64::InstName::BL: disp = dinst.imm26.simm26 << 2; return true;
+    case aarch64::InstName::CBZ:
+    case aarch64::InstName::CBNZ: disp = dinst.imm19.simm19 << 2; return true;
+    case aarch64::InstName::TBZ:
+    case aarch64::InstName::TBNZ: disp = dinst.imm14.simm14 << 2; return true;
+    default: return false;
+  }
+}
+
+// Linearly sweep `bytes`. Every instruction is four bytes, so this only runs
+// the extractor, which identifies the instruction form, and skips operand
+// decoding.
+//
+// NOTE(pag): Some instruction forms extract but are then rejected by
+//            `aarch64::TryDecode`. Those are reported with the category of
+//            their instruction class, rather than as invalid.
+uint64_t AArch64Arch::DecodeRange(uint64_t address, std::string_view bytes,
+                                  const DecodingContext &context,
+                                  const DecodeRangeCallback &cb) const {
+  if (0 != (address % kInstructionSize)) {
+    return Arch::DecodeRange(address, bytes, context, cb);
+  }
+
+  const auto data = reinterpret_cast<const uint8_t *>(bytes.data());
+  const uint64_t num_bytes = bytes.size() & ~uint64_t(kInstructionSize - 1);
+
+  aarch64::InstData dinst;
+  InstructionSummary summary;
+  summary.size = kInstructionSize;
+
+  uint64_t offset = 0;
+  while (offset < num_bytes) {
+    summary.pc = address + offset;
+    summary.next_pc = summary.pc + kInstructionSize;
+    summary.has_direct_target = false;
+    summary.direct_target = 0;
+    summary.category = Instruction::kCategoryInvalid;
+
+    dinst = {};
+    if (aarch64::TryExtract(&(data[offset]), dinst)) {
+      int64_t disp = 0;
+      summary.category = InstCategory(dinst);
+      if (DirectBranchDisplacement(dinst, disp)) {
+        summary.has_direct_target = true;
+        summary.direct_target =
+            static_cast<uint64_t>(static_cast<int64_t>(summary.pc) + disp);
+      }
+    }
+
+    offset += kInstructionSize;
+    if (!cb(summary)) {
+      break;
+    }
+  }
+  return offset;
+}
+
 }  // namespace
 
 namespace aarch64 {
@@ -237,3 +237,70 @@ DEF_ISEL(TBZ_ONLY_TESTBRANCH_64) = TBZ<R64>;
 DEF_ISEL(TBZ_ONLY_TESTBRANCH_32) = TBZ<R32>;
 DEF_ISEL(TBNZ_ONLY_TESTBRANCH_64) = TBNZ<R64>;
 DEF_ISEL(TBNZ_ONLY_TESTBRANCH_32) = TBNZ<R32>;
+
+namespace {
+
+// Conditions of a `b.<cond>` fused with a preceding `subs` (e.g. `cmp`),
+// decided directly from the compared values rather than from `NZCV`. See
+// `FuseCompareBranch` in `lib/Arch/AArch64/Arch.cpp`.
+#define MAKE_FUSED_COND(cc, compare, ...) \
+  struct FusedCond##cc { \
+    template <typename T> \
+    ALWAYS_INLINE static bool Check(T lhs, T rhs) { \
+      return __remill_compare_##compare(__VA_ARGS__); \
+    } \
+  };
+
+MAKE_FUSED_COND(EQ, eq, UCmpEq(lhs, rhs))
+MAKE_FUSED_COND(NE, neq, UCmpNeq(lhs, rhs))
+MAKE_FUSED_COND(CS, uge, UCmpGte(lhs, rhs))
+MAKE_FUSED_COND(CC, ult, UCmpLt(lhs, rhs))
+MAKE_FUSED_COND(HI, ugt, UCmpGt(lhs, rhs))
+MAKE_FUSED_COND(LS, ule, UCmpLte(lhs, rhs))
+MAKE_FUSED_COND(GE, sge, SCmpGte(Signed(lhs), Signed(rhs)))
+MAKE_FUSED_COND(LT, slt, SCmpLt(Signed(lhs), Signed(rhs)))
+MAKE_FUSED_COND(GT, sgt, SCmpGt(Signed(lhs), Signed(rhs)))
+MAKE_FUSED_COND(LE, sle, SCmpLte(Signed(lhs), Signed(rhs)))
+
+#undef MAKE_FUSED_COND
+
+template <typename Cond, typename D, typename S1, typename S2>
+DEF_SEM(SUBS_B_COND, D dst, S1 src1, S2 src2, R8W cond, PC taken,
+        PC not_taken, R64W pc_dst) {
+  using T = typename BaseType<S2>::BT;
+  auto lhs = Read(src1);
+  auto rhs = Read(src2);
+  auto res = AddWithCarryNZCV(state, lhs, UNot(rhs), rhs, T(1));
+  WriteZExt(dst, res);
+
+  addr_t taken_pc = Read(taken);
+  addr_t not_taken_pc = Read(not_taken);
+  uint8_t take_branch = Cond::Check(lhs, rhs);
+  Write(cond, take_branch);
+
+  const auto new_pc = Select<addr_t>(take_branch, taken_pc, not_taken_pc);
+  Write(REG_PC, new_pc);
+  Write(pc_dst, new_pc);
+  return memory;
+}
+
+}  // namespace
+
+// E.g. `SUBS_B_EQ_FUSED_64` for `cmp x0, x1; b.eq`.
+#define DEF_ISEL_FUSED_B_COND(cc) \
+  DEF_ISEL(SUBS_B_##cc##_FUSED_32) = \
+      SUBS_B_COND<FusedCond##cc, R32W, R32, I32>; \
+  DEF_ISEL(SUBS_B_##cc##_FUSED_64) = SUBS_B_COND<FusedCond##cc, R64W, R64, I64>;
+
+DEF_ISEL_FUSED_B_COND(EQ)
+DEF_ISEL_FUSED_B_COND(NE)
+DEF_ISEL_FUSED_B_COND(CS)
+DEF_ISEL_FUSED_B_COND(CC)
+DEF_ISEL_FUSED_B_COND(HI)
+DEF_ISEL_FUSED_B_COND(LS)
+DEF_ISEL_FUSED_B_COND(GE)
+DEF_ISEL_FUSED_B_COND(LT)
+DEF_ISEL_FUSED_B_COND(GT)
+DEF_ISEL_FUSED_B_COND(LE)
+
+#undef DEF_ISEL_FUSED_B_COND
@@ -479,6 +479,12 @@ DEF_ISEL(ADRP_ONLY_PCRELADDR) = ADRP;
 
 DEF_ISEL(ADR_ONLY_PCRELADDR) = Load<R64W, I64>;
 
+// `adrp` fused with an `add` or `ldr` of the low 12 bits of the address. See
+// `FuseAdrpAdd` and `FuseAdrpLdr` in `lib/Arch/AArch64/Arch.cpp`.
+DEF_ISEL(ADRP_ADD_FUSED) = Load<R64W, I64>;
+DEF_ISEL(ADRP_LDR_FUSED_32) = Load<R32W, M32>;
+DEF_ISEL(ADRP_LDR_FUSED_64) = Load<R64W, M64>;
+
 namespace {
 
 DEF_SEM(LDR_B, V128W dst, MV8 src) {
@@ -33,11 +33,14 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
 #include "remill/Arch/Name.h"
 #include "remill/BC/ABI.h"
+#include "remill/BC/RegisterAlias.h"
+#include "remill/BC/Statistics.h"
 #include "remill/BC/Util.h"
 #include "remill/BC/Version.h"
 #include "remill/OS/OS.h"
@@ -100,14 +103,70 @@ bool Arch::NextInstructionIsDelayed(const Instruction &, const Instruction &,
   return false;
 }
 
+// Linearly sweep `bytes`, calling `cb` on each instruction. This is the slow
+// path, which fully decodes each instruction.
+uint64_t Arch::DecodeRange(uint64_t address, std::string_view bytes,
+                           const DecodingContext &context,
+                           const DecodeRangeCallback &cb) const {
+  const auto max_size = MaxInstructionSize(context, false);
+  const auto align = std::max<uint64_t>(1u, MinInstructionAlign(context));
+
+  Instruction inst;
+  InstructionSummary summary;
+  uint64_t offset = 0;
+  while (offset < bytes.size()) {
+    const auto remaining = bytes.size() - offset;
+    summary.pc = address + offset;
+    summary.has_direct_target = false;
+    summary.direct_target = 0;
+
+    inst.Reset();
+    if (DecodeInstruction(summary.pc, bytes.substr(offset, max_size), inst,
+                          context)) {
+      summary.size = static_cast<uint32_t>(inst.bytes.size());
+      summary.next_pc = inst.next_pc;
+      summary.category = inst.category;
+      switch (inst.category) {
+        case Instruction::kCategoryDirectJump:
+        case Instruction::kCategoryDirectFunctionCall:
+        case Instruction::kCategoryConditionalDirectFunctionCall:
+        case Instruction::kCategoryConditionalBranch:
+          summary.has_direct_target = true;
+          summary.direct_target = inst.branch_taken_pc;
+          if (address_size < 64) {
+            summary.direct_target &= (1ull << address_size) - 1ull;
+          }
+          break;
+        default: break;
+      }
+
+    // The bytes might end with the prefix of a valid instruction.
+    } else if (remaining < max_size) {
+      break;
+
+    } else {
+      summary.size = static_cast<uint32_t>(align);
+      summary.next_pc = summary.pc + align;
+      summary.category = Instruction::kCategoryInvalid;
+    }
+
+    offset += summary.size;
+    if (!cb(summary)) {
+      break;
+    }
+  }
+  return std::min<uint64_t>(offset, bytes.size());
+}
+
 namespace {
 static std::mutex gSleighArchLock;
 }  // namespace
 
 // Returns a lock on global state. In general, Remill doesn't use global
-// variables for storing state; however, SLEIGH sometimes does, and so when
-// using SLEIGH-backed architectures, it can be necessary to acquire this
-// lock.
+// variables for storing state; however, SLEIGH does when it parses a spec,
+// and so SLEIGH-backed architectures acquire this lock while they load their
+// specs. Decoding and lifting use per-thread SLEIGH contexts, and so don't
+// need this lock.
 ArchLocker Arch::Lock(ArchName arch_name_) {
   switch (arch_name_) {
     case ArchName::kArchAArch32LittleEndian:
@@ -338,11 +397,12 @@ void ArchBase::ForEachRegister(std::function<void(const Register *)> cb) const {
 const Register *ArchBase::RegisterByName(std::string_view name_) const {
   std::string name(name_.data(), name_.size());
 
-  auto [curr_val_it, added] = reg_by_name.emplace(std::move(name), nullptr);
-  if (added) {
-    return nullptr;
+  // NOTE(pag): This doesn't modify `reg_by_name`, as many threads can look up
+  //            registers at once.
+  if (auto reg_it = reg_by_name.find(name); reg_it != reg_by_name.end()) {
+    return reg_it->second;
   }
-  return curr_val_it->second;
+  return nullptr;
 }
 
 namespace {
@@ -355,18 +415,30 @@ struct AvailableArchs {
   using ArchMap =
       std::unordered_map<llvm::LLVMContext *, std::unique_ptr<const Arch>>;
 
+  static std::mutex lock;
   static ArchMap cached;
 
+  // NOTE(pag): Building an architecture is slow, so it's done without
+  //            holding `lock`. If two threads race to build one for the same
+  //            context, then the first one to finish wins, and the other's
+  //            architecture is discarded.
   static const Arch *GetOrCreate(llvm::LLVMContext *ctx, OSName os,
                                  ArchName name) {
-    auto &arch = cached[ctx];
+    if (auto arch = Get(ctx)) {
+      return arch;
+    }
+
+    auto arch = Create(ctx, os, name);
     if (!arch) {
-      arch = Create(ctx, os, name);
+      return nullptr;
     }
-    return arch.get();
+
+    std::lock_guard<std::mutex> locker(lock);
+    return cached.try_emplace(ctx, std::move(arch)).first->second.get();
   }
 
   static const Arch *Get(llvm::LLVMContext *ctx) {
+    std::lock_guard<std::mutex> locker(lock);
     if (auto arch_it = cached.find(ctx); arch_it != cached.end())
       return arch_it->second.get();
     return nullptr;
@@ -378,6 +450,7 @@ struct AvailableArchs {
   }
 };
 
+std::mutex AvailableArchs::lock;
 AvailableArchs::ArchMap AvailableArchs::cached = {};
 
 }  // namespace
@@ -675,6 +748,8 @@ llvm::Value *Register::AddressOf(llvm::Value *state_ptr,
     auto reg_name_md = llvm::ValueAsMetadata::get(constant_name);
     auto reg_name_node = llvm::MDNode::get(context, reg_name_md);
     inst->setMetadata(arch->RegMdID(), reg_name_node);
+    inst->setMetadata(RegisterAliasMdID(context),
+                      RegisterAliasMetadata(this, offset));
     inst->setName(name);
   }
 
@@ -775,6 +850,9 @@ void Arch::InitializeEmptyLiftedFunction(llvm::Function *func) const {
   CHECK(BlockHasSpecialVars(func));
 }
 
+// Clean up a lifted function once nothing more will be lifted into it.
+void Arch::FinishLiftedFunction(llvm::Function *) const {}
+
 void Arch::PrepareModule(llvm::Module *mod) const {
   PrepareModuleDataLayout(mod);
 }
@@ -785,6 +863,7 @@ const Register *ArchBase::AddRegister(const char *reg_name_,
 
   CHECK_NOTNULL(val_type);
 
+  std::lock_guard<std::mutex> locker(init_lock);
   const std::string reg_name(reg_name_);
   if (auto reg = reg_by_name.find(reg_name); reg != reg_by_name.end()) {
     return reg->second;
@@ -841,6 +920,7 @@ const Register *ArchBase::AddRegister(const char *reg_name_,
 
 // Get all of the register information from the prepared module.
 void ArchBase::InitFromSemanticsModule(llvm::Module *module) const {
+  std::lock_guard<std::mutex> locker(init_lock);
   if (state_type) {
     return;
   }
@@ -957,12 +1037,24 @@ bool DefaultContextAndLifter::DecodeInstruction(uint64_t address,
                                                 std::string_view instr_bytes,
                                                 Instruction &inst,
                                                 DecodingContext context) const {
+  static const Statistic num_empty_inputs("decode.failure_reasons.no_bytes");
+  static const Statistic num_invalid_encodings(
+      "decode.failure_reasons.invalid_encoding");
+
   inst.SetLifter(std::make_unique<remill::InstructionLifter>(
       this, this->GetInstrinsicTable()));
 
   auto res = this->ArchDecodeInstruction(address, instr_bytes, inst);
   if (res) {
     inst.flows = this->FillInFlowFromCategoryAndDefaultContext(inst);
+    num_decoded_insts->Add();
+  } else {
+    num_decode_failures->Add();
+    if (instr_bytes.empty()) {
+      num_empty_inputs.Add();
+    } else {
+      num_invalid_encodings.Add();
+    }
   }
 
   return res;
@@ -978,7 +1070,13 @@ OperandLifter::OpLifterPtr DefaultContextAndLifter::DefaultLifter(
 DefaultContextAndLifter::DefaultContextAndLifter(llvm::LLVMContext *context_,
                                                  OSName os_name_,
                                                  ArchName arch_name_)
-    : ArchBase(context_, os_name_, arch_name_) {}
+    : ArchBase(context_, os_name_, arch_name_),
+      num_decoded_insts(std::make_unique<Statistic>(
+          "decode.instructions." + std::string(GetArchName(arch_name_)))),
+      num_decode_failures(std::make_unique<Statistic>(
+          "decode.failures." + std::string(GetArchName(arch_name_)))) {}
+
+DefaultContextAndLifter::~DefaultContextAndLifter(void) {}
 
 
 }  // namespace remill
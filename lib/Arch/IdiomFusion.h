@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <remill/Arch/Instruction.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace remill {
+
+// Describes an instruction idiom that a decoder rewrites into a single
+// instruction with its own semantics. Most idioms are pairs of adjacent
+// instructions, e.g. a `cmp` followed by a conditional branch, and are
+// fused into one instruction covering the bytes of both. Some idioms are a
+// single instruction, e.g. `xor eax, eax`, and are only renamed.
+//
+// Decoders keep a table of these, and apply it with `DecodeAndFuseIdioms`.
+struct IdiomFusionRule {
+
+  // Name of the idiom, for debugging.
+  const char *name;
+
+  // Returns `true` if `first` could start this idiom.
+  bool (*first_matches)(const Instruction &first);
+
+  // Returns `true` if `second` completes the idiom started by `first`. This
+  // is `nullptr` for single-instruction idioms.
+  bool (*second_matches)(const Instruction &first, const Instruction &second);
+
+  // Rewrite `first` into the fused instruction, i.e. change its function name,
+  // operands, and category. `second` is `nullptr` for single-instruction
+  // idioms.
+  //
+  // When this is called, `first.bytes` and `first.next_pc` still describe
+  // only the first instruction, the `PC`-relative address operands of `second`
+  // have been rebased to the address of `first`, and the `NEXT_PC`-relative
+  // address operands of `first` have been rebased to the end of `second`.
+  void (*fuse)(Instruction &first, const Instruction *second);
+};
+
+// Returns `true` if `str` begins with `prefix`. Fusion rules mostly match on
+// the names of the semantic functions of instructions.
+inline static bool HasPrefix(std::string_view str, std::string_view prefix) {
+  return str.substr(0, prefix.size()) == prefix;
+}
+
+namespace detail {
+
+// Adjust the displacement of the address operands in `ops` whose base is the
+// `base_reg` register.
+inline static void RebaseAddressOperands(std::vector<Operand> &ops,
+                                         std::string_view base_reg,
+                                         int64_t delta) {
+  for (auto &op : ops) {
+    if (Operand::kTypeAddress == op.type && op.addr.base_reg.name == base_reg) {
+      op.addr.displacement += delta;
+    }
+  }
+}
+
+}  // namespace detail
+
+// Decode the instruction at `address` with `decode`, and then try to fuse it
+// with the instruction that follows it in `inst_bytes` according to `rules`.
+// Rules are tried in order, and at most one is applied.
+//
+// `decode` has the signature of `Arch::ArchDecodeInstruction`, and must
+// tolerate `inst_bytes` holding more bytes than the instruction needs. The
+// instruction following `inst` is only decoded if a pair rule's
+// `first_matches` accepts `inst`, so the common case costs one decode.
+//
+// NOTE(pag): Fusion, including of single-instruction idioms, only happens if
+//            `inst_bytes` holds more than `max_unfused_size` bytes, i.e. more
+//            than `Arch::MaxInstructionSize(context, false)`. That is how
+//            callers ask for unfused instructions.
+template <typename Decoder, size_t kNumRules>
+static bool DecodeAndFuseIdioms(uint64_t address, std::string_view inst_bytes,
+                                uint64_t max_unfused_size, Instruction &inst,
+                                const IdiomFusionRule (&rules)[kNumRules],
+                                Decoder &&decode) {
+
+  // Decoders truncate `inst.bytes` to the size of the decoded instruction,
+  // which clobbers the following bytes if `inst_bytes` is a view of
+  // `inst.bytes`.
+  std::string bytes_copy;
+  if (!inst.bytes.empty() && inst.bytes.data() == inst_bytes.data()) {
+    bytes_copy = inst_bytes;
+    inst_bytes = bytes_copy;
+  }
+
+  if (!decode(address, inst_bytes, inst)) {
+    return false;
+  } else if (inst_bytes.size() <= max_unfused_size) {
+    return true;
+  }
+
+  Instruction next;
+  auto next_status = 0;  // `0` untried, `1` decoded, `-1` undecodable.
+
+  for (const auto &rule : rules) {
+    if (!rule.first_matches(inst)) {
+      continue;
+    }
+
+    // Single-instruction idiom.
+    if (!rule.second_matches) {
+      rule.fuse(inst, nullptr);
+      return true;
+    }
+
+    if (!next_status) {
+      const auto len = inst.bytes.size();
+      next_status = -1;
+      if (len < inst_bytes.size() &&
+          decode(inst.next_pc, inst_bytes.substr(len), next)) {
+        next_status = 1;
+      }
+    }
+
+    if (0 > next_status || !rule.second_matches(inst, next)) {
+      continue;
+    }
+
+    const auto first_len = static_cast<int64_t>(inst.bytes.size());
+    const auto next_len = static_cast<int64_t>(next.bytes.size());
+    detail::RebaseAddressOperands(next.operands, "PC", first_len);
+    detail::RebaseAddressOperands(inst.operands, "NEXT_PC", -next_len);
+
+    rule.fuse(inst, &next);
+    inst.bytes.append(next.bytes);
+    inst.next_pc = next.next_pc;
+    return true;
+  }
+
+  return true;
+}
+
+}  // namespace remill
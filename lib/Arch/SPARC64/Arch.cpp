@@ -84,6 +84,9 @@ class SPARC64Arch final : public DefaultContextAndLifter {
   FinishLiftedFunctionInitialization(llvm::Module *module,
                                      llvm::Function *bb_func) const override;
 
+  // Remove the register window variables of functions that never used them.
+  void FinishLiftedFunction(llvm::Function *bb_func) const final;
+
   llvm::Triple Triple(void) const final;
   llvm::DataLayout DataLayout(void) const final;
 
@@ -380,14 +383,20 @@ void SPARC64Arch::FinishLiftedFunctionInitialization(
   const auto window_type = RegisterWindowType();
   CHECK(window_type->isStructTy());
 
+  auto nullptr_window = llvm::Constant::getNullValue(prev_window_link->type);
   auto window = ir.CreateAlloca(window_type, nullptr, "WINDOW");
-  ir.CreateAlloca(prev_window_link->type, nullptr, "PREV_WINDOW");
+
+  // A `RESTORE` without a `SAVE` in the same function falls back on
+  // `state.window`, and so `PREV_WINDOW` must start off as `nullptr`.
+  ir.CreateStore(nullptr_window,
+                 ir.CreateAlloca(prev_window_link->type, nullptr,
+                                 "PREV_WINDOW"),
+                 false);
 
   // `WINDOW_LINK = &(WINDOW->prev_window);`
   llvm::Value *gep_indexes[2] = {zero_u32, llvm::ConstantInt::get(u32, 33)};
   auto window_link =
       ir.CreateInBoundsGEP(window_type, window, gep_indexes, "WINDOW_LINK");
-  auto nullptr_window = llvm::Constant::getNullValue(prev_window_link->type);
   ir.CreateStore(nullptr_window, window_link, false);
 
   ir.CreateStore(zero_u8, ir.CreateAlloca(u8, nullptr, "IGNORE_BRANCH_TAKEN"),
@@ -408,6 +417,52 @@ void SPARC64Arch::FinishLiftedFunctionInitialization(
                  false);
 }
 
+namespace {
+
+// Returns `true` if `var`, or any address derived from it, is only ever
+// stored to, i.e. if nothing ever observes its value.
+static bool IsOnlyStoredTo(llvm::Value *var) {
+  for (auto user : var->users()) {
+    if (auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+      if (store->getValueOperand() == var) {
+        return false;
+      }
+    } else if (auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(user)) {
+      if (!IsOnlyStoredTo(gep)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void EraseWithUsers(llvm::Instruction *inst) {
+  while (!inst->use_empty()) {
+    EraseWithUsers(llvm::cast<llvm::Instruction>(inst->user_back()));
+  }
+  inst->eraseFromParent();
+}
+
+}  // namespace
+
+// Remove the register window variables of functions that never used them.
+//
+// NOTE(pag): Only `SAVE` passes `WINDOW` to its semantics, and only `SAVE`,
+//            `RESTORE` and `RETURN` pass `PREV_WINDOW`. Leaf functions
+//            execute none of these, and so they would otherwise carry a
+//            33-word window and its initialization for nothing.
+void SPARC64Arch::FinishLiftedFunction(llvm::Function *bb_func) const {
+  for (auto name : {"WINDOW", "PREV_WINDOW"}) {
+    auto var = FindVarInFunction(bb_func, name, true).first;
+    auto alloca = llvm::dyn_cast_or_null<llvm::AllocaInst>(var);
+    if (alloca && IsOnlyStoredTo(alloca)) {
+      EraseWithUsers(alloca);
+    }
+  }
+}
+
 llvm::Triple SPARC64Arch::Triple(void) const {
   auto triple = BasicTriple();
   triple.setArch(llvm::Triple::sparcv9);
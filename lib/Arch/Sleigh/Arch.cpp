@@ -21,6 +21,9 @@
 #include <remill/Arch/Name.h>
 #include <remill/BC/SleighLifter.h>
 
+#include <map>
+#include <utility>
+
 namespace remill::sleigh {
 
 namespace {
@@ -83,10 +86,10 @@ std::vector<std::string> SingleInstructionSleighContext::getUserOpNames() {
   return res;
 }
 
-SingleInstructionSleighContext::SingleInstructionSleighContext(
-    std::string sla_name, std::string pspec_name)
-    : engine(&image, &ctx) {
+SleighSpec::SleighSpec(const std::string &sla_name,
+                       const std::string &pspec_name) {
 
+  // Parsing the spec uses global state within SLEIGH.
   auto guard = Arch::Lock(ArchName::kArchX86_SLEIGH);
 
   const std::optional<std::filesystem::path> sla_path =
@@ -112,9 +115,45 @@ SingleInstructionSleighContext::SingleInstructionSleighContext(
 
   auto pspec = storage.openDocument(pspec_path->string());
   storage.registerTag(pspec->getRoot());
+}
+
+std::shared_ptr<SleighSpec> SleighSpec::Get(const std::string &sla_name,
+                                            const std::string &pspec_name) {
+  static std::mutex gSpecCacheLock;
+  static std::map<std::pair<std::string, std::string>,
+                  std::weak_ptr<SleighSpec>>
+      gSpecCache;
+
+  // NOTE(pag): The lock is held while parsing so that two threads asking for
+  //            the same spec don't both parse it.
+  std::lock_guard<std::mutex> locker(gSpecCacheLock);
+  auto &cached = gSpecCache[{sla_name, pspec_name}];
+  if (auto spec = cached.lock()) {
+    return spec;
+  }
+
+  auto spec = std::make_shared<SleighSpec>(sla_name, pspec_name);
+  cached = spec;
+  return spec;
+}
+
+DocumentStorage &SleighSpec::GetStorage(void) {
+  return storage;
+}
+
+SingleInstructionSleighContext::SingleInstructionSleighContext(
+    std::string sla_name, std::string pspec_name)
+    : SingleInstructionSleighContext(SleighSpec::Get(sla_name, pspec_name)) {}
+
+SingleInstructionSleighContext::SingleInstructionSleighContext(
+    std::shared_ptr<SleighSpec> spec_)
+    : engine(&image, &ctx),
+      spec(std::move(spec_)) {
   this->restoreEngineFromStorage();
 }
+
 void SingleInstructionSleighContext::restoreEngineFromStorage() {
+  auto &storage = spec->GetStorage();
   this->ctx = ContextInternal();
   engine.initialize(storage);
   const Element *el = storage.getTag("processor_spec");
@@ -176,28 +215,77 @@ std::string CustomLoadImage::getArchType(void) const {
 
 void CustomLoadImage::adjustVma(long) {}
 
+SleighContextPool::Lease::Lease(
+    SleighContextPool *pool_,
+    std::unique_ptr<SingleInstructionSleighContext> context_)
+    : pool(pool_),
+      context(std::move(context_)) {}
+
+SleighContextPool::Lease::~Lease(void) {
+  if (context) {
+    pool->Release(std::move(context));
+  }
+}
+
+SleighContextPool::SleighContextPool(std::shared_ptr<SleighSpec> spec_)
+    : spec(std::move(spec_)) {
+
+  // Make the first context up-front, so that a broken spec is found when the
+  // architecture is created, and not on the first decode.
+  free_contexts.emplace_back(new SingleInstructionSleighContext(spec));
+}
+
+SleighContextPool::Lease SleighContextPool::Acquire(void) {
+  std::unique_ptr<SingleInstructionSleighContext> context;
+  {
+    std::lock_guard<std::mutex> locker(lock);
+    if (!free_contexts.empty()) {
+      context = std::move(free_contexts.back());
+      free_contexts.pop_back();
+    }
+  }
+
+  // Make the new context outside of the lock, as initializing the engine from
+  // the spec is slow.
+  if (!context) {
+    context.reset(new SingleInstructionSleighContext(spec));
+  }
+  return Lease(this, std::move(context));
+}
+
+void SleighContextPool::Release(
+    std::unique_ptr<SingleInstructionSleighContext> context) {
+  std::lock_guard<std::mutex> locker(lock);
+  free_contexts.push_back(std::move(context));
+}
+
 std::shared_ptr<remill::OperandLifter> SleighDecoder::GetOpLifter() const {
   return this->GetLifter();
 }
 
 std::shared_ptr<remill::SleighLifter> SleighDecoder::GetLifter() const {
-  if (this->lifter) {
-    return this->lifter;
-  }
 
-  if (!this->arch.GetInstrinsicTable()) {
-    LOG(FATAL)
-        << "Architecture was not initialized before asking for a lifting";
-  }
+  // Many threads can be decoding at once, and each decoded instruction gets
+  // the lifter.
+  std::call_once(this->lifter_init, [this](void) {
+    if (!this->arch.GetInstrinsicTable()) {
+      LOG(FATAL)
+          << "Architecture was not initialized before asking for a lifting";
+    }
 
-  auto tab = this->arch.GetInstrinsicTable();
+    auto tab = this->arch.GetInstrinsicTable();
 
-  this->lifter =
-      std::make_shared<remill::SleighLifter>(this->arch, *this, *tab);
+    this->lifter =
+        std::make_shared<remill::SleighLifter>(this->arch, *this, *tab);
+  });
 
   return this->lifter;
 }
 
+SleighContextPool::Lease SleighDecoder::AcquireContext(void) const {
+  return this->context_pool.Acquire();
+}
+
 bool SleighDecoder::DecodeInstruction(uint64_t address,
                                       std::string_view instr_bytes,
                                       Instruction &inst,
@@ -205,8 +293,8 @@ bool SleighDecoder::DecodeInstruction(uint64_t address,
 
 
   auto context_values = context.GetContextValues();
-  auto res_cat = const_cast<SleighDecoder *>(this)->DecodeInstructionImpl(
-      address, instr_bytes, inst, std::move(context));
+  auto res_cat = this->DecodeInstructionImpl(address, instr_bytes, inst,
+                                             std::move(context));
 
   if (res_cat.has_value()) {
     if (!res_cat->second &&
@@ -219,8 +307,10 @@ bool SleighDecoder::DecodeInstruction(uint64_t address,
     inst.SetLifter(std::make_shared<SleighLifterWithState>(
         res_cat->second, std::move(context_values), this->GetLifter()));
     CHECK(inst.GetLifter() != nullptr);
+    num_decoded_insts.Add();
     return true;
   } else {
+    num_decode_failures.Add();
     return false;
   }
 }
@@ -230,13 +320,17 @@ SleighDecoder::SleighDecoder(
     const remill::Arch &arch_, std::string sla_name, std::string pspec_name,
     ContextRegMappings context_reg_map_,
     std::unordered_map<std::string, std::string> state_reg_map_)
-    : sleigh_ctx(sla_name, pspec_name),
+    : context_pool(SleighSpec::Get(sla_name, pspec_name)),
       sla_name(std::move(sla_name)),
       pspec_name(std::move(pspec_name)),
       lifter(nullptr),
       arch(arch_),
       context_reg_mapping(std::move(context_reg_map_)),
-      state_reg_remappings(std::move(state_reg_map_)) {}
+      state_reg_remappings(std::move(state_reg_map_)),
+      num_decoded_insts("decode.instructions." +
+                        std::string(GetArchName(arch_.arch_name))),
+      num_decode_failures("decode.failures." +
+                          std::string(GetArchName(arch_.arch_name))) {}
 
 
 const ContextRegMappings &SleighDecoder::GetContextRegisterMapping() const {
@@ -252,16 +346,17 @@ ControlFlowStructureAnalysis::SleighDecodingResult
 SleighDecoder::DecodeInstructionImpl(uint64_t address,
                                      std::string_view instr_bytes,
                                      Instruction &inst,
-                                     DecodingContext curr_context) {
+                                     DecodingContext curr_context) const {
 
   // The SLEIGH engine will query this image when we try to decode an instruction. Append the bytes so SLEIGH has data to read.
 
 
   // Now decode the instruction.
-  this->sleigh_ctx.resetContext();
-  this->InitializeSleighContext(address, this->sleigh_ctx,
+  auto sleigh_ctx = this->AcquireContext();
+  sleigh_ctx->resetContext();
+  this->InitializeSleighContext(address, *sleigh_ctx,
                                 curr_context.GetContextValues());
-  PcodeDecoder pcode_handler(this->sleigh_ctx.GetEngine());
+  PcodeDecoder pcode_handler(sleigh_ctx->GetEngine());
 
 
   inst.arch = &this->arch;
@@ -273,7 +368,7 @@ SleighDecoder::DecodeInstructionImpl(uint64_t address,
   inst.category = Instruction::kCategoryInvalid;
 
   auto instr_len =
-      this->sleigh_ctx.oneInstruction(address, pcode_handler, inst.bytes);
+      sleigh_ctx->oneInstruction(address, pcode_handler, inst.bytes);
 
   if (!instr_len || instr_len > instr_bytes.size()) {
     return std::nullopt;
@@ -284,18 +379,21 @@ SleighDecoder::DecodeInstructionImpl(uint64_t address,
 
   InstructionFunctionSetter setter(inst);
 
-  this->sleigh_ctx.oneInstruction(address, setter, inst.bytes);
+  sleigh_ctx->oneInstruction(address, setter, inst.bytes);
   uint64_t fallthrough = address + *instr_len;
   inst.next_pc = fallthrough;
 
   ControlFlowStructureAnalysis analysis(
       this->context_reg_mapping.GetInternalRegMapping(),
-      this->sleigh_ctx.GetEngine());
+      sleigh_ctx->GetEngine());
 
 
   auto cat =
       analysis.ComputeCategory(pcode_handler.ops, fallthrough, curr_context);
   if (!cat) {
+    static const Statistic num_unknown_categories(
+        "decode.unknown_flow_category");
+    num_unknown_categories.Add();
     LOG(ERROR) << "Failed to compute category for inst at " << std::hex
                << inst.pc;
     inst.flows = Instruction::InvalidInsn();
@@ -341,6 +439,13 @@ void SingleInstructionSleighContext::resetContext() {
 std::optional<int32_t> SingleInstructionSleighContext::oneInstruction(
     uint64_t address, const std::function<int32_t(Address addr)> &decode_func,
     std::string_view instr_bytes) {
+  static const Statistic num_bad_lengths(
+      "decode.failure_reasons.sleigh_bad_length");
+  static const Statistic num_bad_data(
+      "decode.failure_reasons.sleigh_bad_data");
+  static const Statistic num_unimplemented(
+      "decode.failure_reasons.sleigh_unimplemented");
+
   this->image.SetInstruction(address, instr_bytes);
   try {
     const int32_t instr_len = decode_func(this->GetAddressFromOffset(address));
@@ -349,17 +454,20 @@ std::optional<int32_t> SingleInstructionSleighContext::oneInstruction(
         static_cast<size_t>(instr_len) <= instr_bytes.length()) {
       return instr_len;
     } else {
+      num_bad_lengths.Add();
       LOG(ERROR) << "Instr too long " << instr_len << " vs "
                  << instr_bytes.length();
       return std::nullopt;
     }
   } catch (BadDataError e) {
+    num_bad_data.Add();
     LOG(ERROR) << "Bad data error: " << e.explain;
     // NOTE (Ian): if sleigh cant find a constructor it throws an exception... yay for unrolling.
     return std::nullopt;
   } catch (UnimplError e) {
     // NOTE(Ian): Similar... except sleigh did decode we just dont have pcode semantics. unfortunately since we rely on those to correctly decode
     // the remill instruction we need to treat it as a decoding failure.
+    num_unimplemented.Add();
     std::stringstream ss;
     for (auto bt : instr_bytes) {
       ss << std::hex << (int) bt;
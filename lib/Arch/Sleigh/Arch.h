@@ -18,9 +18,13 @@
 #include <lib/Arch/Sleigh/ControlFlowStructuring.h>
 #include <remill/Arch/ArchBase.h>
 #include <remill/BC/SleighLifter.h>
+#include <remill/BC/Statistics.h>
 
+#include <memory>
+#include <mutex>
 #include <sleigh/libsleigh.hh>
 #include <unordered_set>
+#include <vector>
 
 // Unifies shared functionality between sleigh architectures
 
@@ -58,6 +62,26 @@ class CustomLoadImage final : public LoadImage {
   uint64_t current_offset{0};
 };
 
+// A compiled SLEIGH spec and its processor spec. These are parsed once, and
+// then shared read-only by every `SingleInstructionSleighContext` made from
+// them.
+class SleighSpec {
+ public:
+  SleighSpec(const std::string &sla_name, const std::string &pspec_name);
+
+  // Returns the spec for `sla_name` and `pspec_name`, parsing it only if no
+  // other user in this process currently holds onto it. Every `Arch`, in
+  // every `LLVMContext`, shares one parsed copy of each spec, and the copy
+  // is freed when the last of them goes away.
+  static std::shared_ptr<SleighSpec> Get(const std::string &sla_name,
+                                         const std::string &pspec_name);
+
+  DocumentStorage &GetStorage(void);
+
+ private:
+  DocumentStorage storage;
+};
+
 // Holds onto contextual sleigh information in order to provide an interface with which you can decode single instructions
 // Give me bytes and i give you pcode (maybe)
 class SingleInstructionSleighContext {
@@ -65,7 +89,7 @@ class SingleInstructionSleighContext {
   CustomLoadImage image;
   ContextInternal ctx;
   ::Sleigh engine;
-  DocumentStorage storage;
+  std::shared_ptr<SleighSpec> spec;
 
   std::optional<int32_t>
   oneInstruction(uint64_t address,
@@ -90,11 +114,62 @@ class SingleInstructionSleighContext {
 
   SingleInstructionSleighContext(std::string sla_name, std::string pspec_name);
 
+  explicit SingleInstructionSleighContext(std::shared_ptr<SleighSpec> spec_);
+
 
   // Builds sleigh decompiler arch. Allows access to useropmanager and other internal sleigh info mantained by the arch.
   std::vector<std::string> getUserOpNames();
 };
 
+// A pool of contexts for one spec. Decoding mutates a
+// `SingleInstructionSleighContext`, so each thread that decodes or lifts
+// leases a context of its own from the pool, and the lease returns it to the
+// pool. New contexts are made on demand from the already-parsed spec, so the
+// pool grows to the number of threads that use it at once, and only parsing
+// the spec needs the global SLEIGH lock.
+class SleighContextPool {
+ public:
+  class Lease {
+   public:
+    ~Lease(void);
+
+    Lease(Lease &&that) noexcept = default;
+
+    inline SingleInstructionSleighContext &operator*(void) const {
+      return *context;
+    }
+
+    inline SingleInstructionSleighContext *operator->(void) const {
+      return context.get();
+    }
+
+   private:
+    friend class SleighContextPool;
+
+    Lease(SleighContextPool *pool_,
+          std::unique_ptr<SingleInstructionSleighContext> context_);
+
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    Lease &operator=(Lease &&) = delete;
+
+    SleighContextPool *pool;
+    std::unique_ptr<SingleInstructionSleighContext> context;
+  };
+
+  explicit SleighContextPool(std::shared_ptr<SleighSpec> spec_);
+
+  Lease Acquire(void);
+
+ private:
+  void Release(std::unique_ptr<SingleInstructionSleighContext> context);
+
+  const std::shared_ptr<SleighSpec> spec;
+
+  std::mutex lock;
+  std::vector<std::unique_ptr<SingleInstructionSleighContext>> free_contexts;
+};
+
 struct ContextRegMappings {
 
  private:
@@ -150,13 +225,16 @@ class SleighDecoder {
 
   std::shared_ptr<remill::OperandLifter> GetOpLifter() const;
 
+  // Lease a context for decoding. The context is not reset.
+  SleighContextPool::Lease AcquireContext(void) const;
+
  protected:
   ControlFlowStructureAnalysis::SleighDecodingResult
   DecodeInstructionImpl(uint64_t address, std::string_view instr_bytes,
-                        Instruction &inst, DecodingContext context);
+                        Instruction &inst, DecodingContext context) const;
 
 
-  SingleInstructionSleighContext sleigh_ctx;
+  mutable SleighContextPool context_pool;
   std::string sla_name;
   std::string pspec_name;
 
@@ -166,10 +244,16 @@ class SleighDecoder {
   void ApplyFlowToInstruction(remill::Instruction &) const;
 
 
+  mutable std::once_flag lifter_init;
   mutable std::shared_ptr<remill::SleighLifter> lifter;
   const remill::Arch &arch;
   ContextRegMappings context_reg_mapping;
   std::unordered_map<std::string, std::string> state_reg_remappings;
+
+  // Number of instructions decoded by this decoder, and number of decoding
+  // failures.
+  const Statistic num_decoded_insts;
+  const Statistic num_decode_failures;
 };
 
 uint64_t GetContextRegisterValue(const char *remill_reg_name,
@@ -24,12 +24,16 @@
 #include <remill/Arch/ArchBase.h>  // For `Arch` and `ArchImpl`.
 #include <remill/Arch/X86/X86Base.h>
 
+#include <algorithm>
 #include <iomanip>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <vector>
 
+#include "../IdiomFusion.h"
 #include "XED.h"
 #include "remill/Arch/Instruction.h"
 #include "remill/Arch/Name.h"
@@ -52,113 +56,101 @@ static bool Is64Bit(ArchName arch_name) {
          kArchAMD64_AVX512 == arch_name;
 }
 
-static bool IsFunctionReturn(const xed_decoded_inst_t *xedd) {
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
+// NOTE(pag): The following predicates only depend on the iform, so that we
+//            can compute the category of each iform once, up-front. See
+//            `GetIFormInfoTable`.
+
+static bool IsFunctionReturn(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
   return XED_ICLASS_RET_NEAR == iclass || XED_ICLASS_RET_FAR == iclass;
 }
 
 // TODO(pag): Should far calls be treated as syscalls or indirect calls?
-static bool IsSystemCall(const xed_decoded_inst_t *xedd) {
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
+static bool IsSystemCall(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
   return XED_ICLASS_SYSCALL == iclass || XED_ICLASS_SYSCALL_AMD == iclass ||
          XED_ICLASS_SYSENTER == iclass;
 }
 
-static bool IsSystemReturn(const xed_decoded_inst_t *xedd) {
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
+static bool IsSystemReturn(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
   return XED_ICLASS_SYSRET == iclass || XED_ICLASS_SYSRET_AMD == iclass ||
          XED_ICLASS_SYSEXIT == iclass;
 }
 
-static bool IsInterruptCall(const xed_decoded_inst_t *xedd) {
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
+static bool IsInterruptCall(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
   return XED_ICLASS_INT == iclass || XED_ICLASS_INT1 == iclass ||
          XED_ICLASS_INT3 == iclass;
 }
 
-static bool IsConditionalInterruptCall(const xed_decoded_inst_t *xedd) {
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
+static bool IsConditionalInterruptCall(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
   return XED_ICLASS_INTO == iclass || XED_ICLASS_BOUND == iclass;
 }
 
-static bool IsInterruptReturn(const xed_decoded_inst_t *xedd) {
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
+static bool IsInterruptReturn(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
   return XED_ICLASS_IRET <= iclass && XED_ICLASS_IRETQ >= iclass;
 }
 
 // This includes `JRCXZ`.
-static bool IsConditionalBranch(const xed_decoded_inst_t *xedd) {
-  return XED_CATEGORY_COND_BR == xed_decoded_inst_get_category(xedd);
+static bool IsConditionalBranch(xed_iform_enum_t iform) {
+  return XED_CATEGORY_COND_BR == xed_iform_to_category(iform);
 }
 
-static bool IsDirectFunctionCall(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return XED_ICLASS_CALL_NEAR == iclass && XED_OPERAND_RELBR == op_name;
+// Is the first operand of this iform a relative branch displacement?
+static bool HasRelativeBranchOperand(xed_iform_enum_t iform) {
+  switch (iform) {
+    case XED_IFORM_CALL_NEAR_RELBRd:
+    case XED_IFORM_CALL_NEAR_RELBRz:
+    case XED_IFORM_JMP_RELBRb:
+    case XED_IFORM_JMP_RELBRd:
+    case XED_IFORM_JMP_RELBRz: return true;
+    default: return false;
+  }
 }
 
-static bool IsDirectFunctionCallFar(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return XED_ICLASS_CALL_FAR == iclass && XED_OPERAND_PTR == op_name;
+static bool IsDirectFunctionCall(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
+  return XED_ICLASS_CALL_NEAR == iclass && HasRelativeBranchOperand(iform);
 }
 
-static bool IsIndirectFunctionCall(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return XED_ICLASS_CALL_NEAR == iclass && XED_OPERAND_RELBR != op_name;
+static bool IsDirectFunctionCallFar(xed_iform_enum_t iform) {
+  return XED_IFORM_CALL_FAR_PTRp_IMMw == iform;
 }
 
-static bool IsIndirectFunctionCallFar(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return XED_ICLASS_CALL_FAR == iclass && XED_OPERAND_MEM0 == op_name;
+static bool IsIndirectFunctionCall(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
+  return XED_ICLASS_CALL_NEAR == iclass && !HasRelativeBranchOperand(iform);
 }
 
-static bool IsDirectJump(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return XED_ICLASS_JMP == iclass && XED_OPERAND_RELBR == op_name;
+static bool IsIndirectFunctionCallFar(xed_iform_enum_t iform) {
+  return XED_IFORM_CALL_FAR_MEMp2 == iform;
 }
 
-static bool IsDirectJumpFar(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return XED_ICLASS_JMP_FAR == iclass && XED_OPERAND_PTR == op_name;
+static bool IsDirectJump(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
+  return XED_ICLASS_JMP == iclass && HasRelativeBranchOperand(iform);
 }
 
-static bool IsIndirectJump(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return (XED_ICLASS_JMP == iclass && XED_OPERAND_RELBR != op_name) ||
+static bool IsDirectJumpFar(xed_iform_enum_t iform) {
+  return XED_IFORM_JMP_FAR_PTRp_IMMw == iform;
+}
+
+static bool IsIndirectJump(xed_iform_enum_t iform) {
+  auto iclass = xed_iform_to_iclass(iform);
+  return (XED_ICLASS_JMP == iclass && !HasRelativeBranchOperand(iform)) ||
          XED_ICLASS_XEND == iclass || XED_ICLASS_XABORT == iclass;
 }
 
-static bool IsIndirectJumpFar(const xed_decoded_inst_t *xedd) {
-  auto xedi = xed_decoded_inst_inst(xedd);
-  auto xedo = xed_inst_operand(xedi, 0);
-  auto op_name = xed_operand_name(xedo);
-  auto iclass = xed_decoded_inst_get_iclass(xedd);
-  return XED_ICLASS_JMP_FAR == iclass && XED_OPERAND_MEM0 == op_name;
+static bool IsIndirectJumpFar(xed_iform_enum_t iform) {
+  return XED_IFORM_JMP_FAR_MEMp2 == iform;
 }
 
 //It checks if the instruction might fault and uses StopFailure to recover
-static bool UsesStopFailure(const xed_decoded_inst_t *xedd) {
-  switch (xed_decoded_inst_get_iclass(xedd)) {
+static bool UsesStopFailure(xed_iform_enum_t iform) {
+  switch (xed_iform_to_iclass(iform)) {
     case XED_ICLASS_DIV:
     case XED_ICLASS_IDIV:
     case XED_ICLASS_XEND:
@@ -167,16 +159,16 @@ static bool UsesStopFailure(const xed_decoded_inst_t *xedd) {
   }
 }
 
-static bool IsNoOp(const xed_decoded_inst_t *xedd) {
-  switch (xed_decoded_inst_get_category(xedd)) {
+static bool IsNoOp(xed_iform_enum_t iform) {
+  switch (xed_iform_to_category(iform)) {
     case XED_CATEGORY_NOP:
     case XED_CATEGORY_WIDENOP: return true;
     default: return false;
   }
 }
 
-static bool IsError(const xed_decoded_inst_t *xedd) {
-  switch (xed_decoded_inst_get_iclass(xedd)) {
+static bool IsError(xed_iform_enum_t iform) {
+  switch (xed_iform_to_iclass(iform)) {
     case XED_ICLASS_HLT:
     case XED_ICLASS_UD0:
     case XED_ICLASS_UD1:
@@ -185,60 +177,61 @@ static bool IsError(const xed_decoded_inst_t *xedd) {
   }
 }
 
-static bool IsInvalid(const xed_decoded_inst_t *xedd) {
-  return XED_ICLASS_INVALID == xed_decoded_inst_get_iclass(xedd);
+static bool IsInvalid(xed_iform_enum_t iform) {
+  return XED_ICLASS_INVALID == xed_iform_to_iclass(iform);
 }
 
 // Return the category of this instuction.
-static Instruction::Category CreateCategory(const xed_decoded_inst_t *xedd) {
-  if (IsInvalid(xedd)) {
+static Instruction::Category CreateCategory(xed_iform_enum_t iform) {
+  if (IsInvalid(iform)) {
     return Instruction::kCategoryInvalid;
 
-  } else if (IsError(xedd)) {
+  } else if (IsError(iform)) {
     return Instruction::kCategoryError;
 
-  } else if (IsDirectJump(xedd)) {
+  } else if (IsDirectJump(iform)) {
     return Instruction::kCategoryDirectJump;
 
-  } else if (IsIndirectJump(xedd)) {
+  } else if (IsIndirectJump(iform)) {
     return Instruction::kCategoryIndirectJump;
 
-  } else if (IsDirectFunctionCall(xedd)) {
+  } else if (IsDirectFunctionCall(iform)) {
     return Instruction::kCategoryDirectFunctionCall;
 
-  } else if (IsIndirectFunctionCall(xedd)) {
+  } else if (IsIndirectFunctionCall(iform)) {
     return Instruction::kCategoryIndirectFunctionCall;
 
-  } else if (IsFunctionReturn(xedd)) {
+  } else if (IsFunctionReturn(iform)) {
     return Instruction::kCategoryFunctionReturn;
 
-  } else if (IsConditionalBranch(xedd)) {
+  } else if (IsConditionalBranch(iform)) {
     return Instruction::kCategoryConditionalBranch;
 
     // Instruction implementation handles syscall emulation.
-  } else if (IsSystemCall(xedd)) {
+  } else if (IsSystemCall(iform)) {
     return Instruction::kCategoryAsyncHyperCall;
 
-  } else if (IsSystemReturn(xedd)) {
+  } else if (IsSystemReturn(iform)) {
     return Instruction::kCategoryAsyncHyperCall;
 
     // Instruction implementation handles syscall (x86, x32) emulation. This is
     // invoked even for conditional interrupt, where a special flag is used to
     // denote that the interrupt should happen.
-  } else if (IsInterruptCall(xedd)) {
+  } else if (IsInterruptCall(iform)) {
     return Instruction::kCategoryAsyncHyperCall;
 
-  } else if (IsConditionalInterruptCall(xedd)) {
+  } else if (IsConditionalInterruptCall(iform)) {
     return Instruction::kCategoryConditionalAsyncHyperCall;
 
-  } else if (IsInterruptReturn(xedd)) {
+  } else if (IsInterruptReturn(iform)) {
     return Instruction::kCategoryAsyncHyperCall;
 
-  } else if (IsDirectJumpFar(xedd) || IsIndirectJumpFar(xedd) ||
-             IsDirectFunctionCallFar(xedd) || IsIndirectFunctionCallFar(xedd)) {
+  } else if (IsDirectJumpFar(iform) || IsIndirectJumpFar(iform) ||
+             IsDirectFunctionCallFar(iform) ||
+             IsIndirectFunctionCallFar(iform)) {
     return Instruction::kCategoryAsyncHyperCall;
 
-  } else if (IsNoOp(xedd)) {
+  } else if (IsNoOp(iform)) {
     return Instruction::kCategoryNoOp;
 
   } else {
@@ -246,7 +239,7 @@ static Instruction::Category CreateCategory(const xed_decoded_inst_t *xedd) {
   }
 }
 
-std::map<xed_iform_enum_t, xed_iform_enum_t> kUnlockedIform = {
+static const std::map<xed_iform_enum_t, xed_iform_enum_t> kUnlockedIform = {
     {XED_IFORM_ADC_LOCK_MEMb_IMMb_80r2, XED_IFORM_ADC_MEMb_IMMb_80r2},
     {XED_IFORM_ADC_LOCK_MEMv_IMMz, XED_IFORM_ADC_MEMv_IMMz},
     {XED_IFORM_ADC_LOCK_MEMb_IMMb_82r2, XED_IFORM_ADC_MEMb_IMMb_82r2},
@@ -314,43 +307,68 @@ std::map<xed_iform_enum_t, xed_iform_enum_t> kUnlockedIform = {
     {XED_IFORM_XCHG_MEMb_GPR8, XED_IFORM_XCHG_MEMb_GPR8},
 };
 
-// Name of this instruction function.
-static std::string InstructionFunctionName(const xed_decoded_inst_t *xedd) {
+// Information about an iform that doesn't depend on the operands of any one
+// instruction. We compute this once for every iform, so that decoding an
+// instruction doesn't need to go and query XED, or format strings, for this
+// information.
+struct IFormInfo {
 
-  // If this instuction is marked as atomic via the `LOCK` prefix then we want
-  // to remove it because we will already be surrounding the call to the
-  // semantics function with the atomic begin/end intrinsics.
-  auto iform = xed_decoded_inst_get_iform_enum(xedd);
+  // Name of the iform, e.g. `ADD_GPRv_GPRv_01`.
+  std::string name;
+
+  // Name of the equivalent iform without a `LOCK` prefix, if this iform has a
+  // `LOCK` prefix. If this instuction is marked as atomic via the `LOCK`
+  // prefix then we want to remove it because we will already be surrounding
+  // the call to the semantics function with the atomic begin/end intrinsics.
+  std::string unlocked_name;
+
+  Instruction::Category category{Instruction::kCategoryInvalid};
+
+  // Is the iform part of the AVX or AVX512 ISA sets or categories?
+  bool is_avx{false};
+  bool is_avx512{false};
+
+  // Does this instruction use `StopFailure` to recover from faults?
+  bool uses_stop_failure{false};
+
+  // Should the ISEL name be suffixed with the name of the first register
+  // operand?
+  bool has_register_suffix{false};
+};
+
+static const std::vector<IFormInfo> &GetIFormInfoTable(void);
+
+// Name of this instruction function.
+static std::string InstructionFunctionName(const xed_decoded_inst_t *xedd,
+                                           const IFormInfo &info) {
+  std::string name;
   if (xed_operand_values_has_lock_prefix(xedd)) {
-    CHECK(kUnlockedIform.count(iform))
-        << xed_iform_enum_t2str(iform) << " has no unlocked iform mapping.";
-    iform = kUnlockedIform[iform];
+    CHECK(!info.unlocked_name.empty())
+        << info.name << " has no unlocked iform mapping.";
+    name = info.unlocked_name;
+  } else {
+    name = info.name;
   }
 
-  std::stringstream ss;
-  std::string iform_name = xed_iform_enum_t2str(iform);
-  ss << iform_name;
-
   // Some instructions are "scalable", i.e. there are variants of the
   // instruction for each effective operand size. We represent these in
   // the semantics files with `_<size>`, so we need to look up the correct
   // selection.
   if (xed_decoded_inst_get_attribute(xedd, XED_ATTRIBUTE_SCALABLE)) {
-    ss << "_";
-    ss << xed_decoded_inst_get_operand_width(xedd);
+    name += '_';
+    name += std::to_string(xed_decoded_inst_get_operand_width(xedd));
   }
 
   // Suffix the ISEL function name with the segment or control register names,
   // as a runtime may need to perform complex actions that are specific to
   // the register used.
-  if (XED_IFORM_MOV_SEG_MEMw == iform || XED_IFORM_MOV_SEG_GPR16 == iform ||
-      XED_IFORM_MOV_CR_CR_GPR32 == iform ||
-      XED_IFORM_MOV_CR_CR_GPR64 == iform) {
-    ss << "_";
-    ss << xed_reg_enum_t2str(xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG0));
+  if (info.has_register_suffix) {
+    name += '_';
+    name +=
+        xed_reg_enum_t2str(xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG0));
   }
 
-  return ss.str();
+  return name;
 }
 
 // Decode an instruction into the XED instuction format.
@@ -790,24 +808,28 @@ class X86Arch final : public X86ArchBase, public DefaultContextAndLifter {
   bool ArchDecodeInstruction(uint64_t address, std::string_view inst_bytes,
                              Instruction &inst) const final;
 
+  // Linearly sweep `bytes` using only XED, i.e. without decoding operands.
+  uint64_t DecodeRange(uint64_t address, std::string_view bytes,
+                       const DecodingContext &context,
+                       const DecodeRangeCallback &cb) const final;
 
  private:
   X86Arch(void) = delete;
+
+  // Decode an instruction, without fusing it with the instructions around it.
+  bool DecodeUnfusedInstruction(uint64_t address, std::string_view inst_bytes,
+                                Instruction &inst) const;
+
+  // Indexed by `xed_iform_enum_t`.
+  const std::vector<IFormInfo> &iform_info;
 };
 
 X86Arch::X86Arch(llvm::LLVMContext *context_, OSName os_name_,
                  ArchName arch_name_)
     : ArchBase(context_, os_name_, arch_name_),
       X86ArchBase(context_, os_name_, arch_name_),
-      DefaultContextAndLifter(context_, os_name_, arch_name_) {
-
-  static bool xed_is_initialized = false;
-  if (!xed_is_initialized) {
-    DLOG(INFO) << "Initializing XED tables";
-    xed_tables_init();
-    xed_is_initialized = true;
-  }
-}
+      DefaultContextAndLifter(context_, os_name_, arch_name_),
+      iform_info(GetIFormInfoTable()) {}
 
 X86Arch::~X86Arch(void) {}
 
@@ -904,41 +926,71 @@ static bool IsAVX512(xed_isa_set_enum_t isa_set, xed_category_enum_t category) {
   }
 }
 
-// Decode the destination register of a `pop <reg>`, where `byte` is the only
-// byte of a 1-byte opcode. On 64-bit, the same decoded by maps to a 64-bit
-// register. We apply a fixup below in `FillFusedCallPopRegOperands` to account
-// for upgrading the register.
-static const char *FusablePopReg32(char byte) {
-  switch (static_cast<uint8_t>(byte)) {
-    case 0x58: return "EAX";
-    case 0x59: return "ECX";
-    case 0x5a: return "EDX";
-    case 0x5b: return "EBX";
-    // NOTE(pag): We ignore `0x5c`, which is `pop rsp`, as that has funny
-    //            semantics and would be unusual to fuse.
-    case 0x5d: return "EBP";
-    case 0x5e: return "ESI";
-    case 0x5f: return "EDI";
-
-    default: return nullptr;
+// Compute the information about every iform. This also initializes XED.
+static const std::vector<IFormInfo> &GetIFormInfoTable(void) {
+  static const std::vector<IFormInfo> table = [] {
+    DLOG(INFO) << "Initializing XED tables";
+    xed_tables_init();
+
+    std::vector<IFormInfo> infos(XED_IFORM_LAST);
+    for (auto i = 0u; i < XED_IFORM_LAST; ++i) {
+      const auto iform = static_cast<xed_iform_enum_t>(i);
+      const auto isa_set = xed_iform_to_isa_set(iform);
+      const auto category = xed_iform_to_category(iform);
+      auto &info = infos[i];
+      info.name = xed_iform_enum_t2str(iform);
+      if (auto it = kUnlockedIform.find(iform); it != kUnlockedIform.end()) {
+        info.unlocked_name = xed_iform_enum_t2str(it->second);
+      }
+      info.category = CreateCategory(iform);
+      info.is_avx = IsAVX(isa_set, category);
+      info.is_avx512 = IsAVX512(isa_set, category);
+      info.uses_stop_failure = UsesStopFailure(iform);
+      info.has_register_suffix = XED_IFORM_MOV_SEG_MEMw == iform ||
+                                 XED_IFORM_MOV_SEG_GPR16 == iform ||
+                                 XED_IFORM_MOV_CR_CR_GPR32 == iform ||
+                                 XED_IFORM_MOV_CR_CR_GPR64 == iform;
+    }
+    return infos;
+  }();
+  return table;
+}
+
+// Classify a decoded instruction to the sub-architecture whose semantics are
+// needed to lift it.
+static ArchName SubArchName(const xed_decoded_inst_t *xedd,
+                            const IFormInfo &info, unsigned address_size) {
+  if (info.is_avx512) {
+    return 32 == address_size ? kArchX86_AVX512 : kArchAMD64_AVX512;
+  } else if (info.is_avx) {
+    return 32 == address_size ? kArchX86_AVX : kArchAMD64_AVX;
+  } else if (xed_classify_avx512(xedd) || xed_classify_avx512_maskop(xedd)) {
+    return 32 == address_size ? kArchX86_AVX512 : kArchAMD64_AVX512;
+  } else if (xed_classify_avx(xedd)) {
+    return 32 == address_size ? kArchX86_AVX : kArchAMD64_AVX;
+  } else {
+    return 32 == address_size ? kArchX86 : kArchAMD64;
   }
 }
 
-// Decode the destination register of a `pop r8` through `pop r10`, assuming
-// that we've already decoded the `0x41` prefix, and `byte` is the second byte
-// of the two-byte opcode.
-static const char *FusablePopReg64(char byte) {
-  switch (static_cast<uint8_t>(byte)) {
-    case 0x58: return "R8";
-    case 0x59: return "R9";
-    case 0x5a: return "R10";
-    case 0x5b: return "R11";
-    case 0x5c: return "R12";
-    case 0x5d: return "R13";
-    case 0x5e: return "R14";
-    case 0x5f: return "R15";
-    default: return nullptr;
+// A `call` to the next instruction, which is how position-independent x86 code
+// reads the program counter.
+static bool IsCallToNextPC(const Instruction &inst) {
+  return Instruction::kCategoryDirectFunctionCall == inst.category &&
+         HasPrefix(inst.function, "CALL_NEAR_RELBR") &&
+         inst.branch_taken_pc == inst.next_pc;
+}
+
+// A `pop` of the return address pushed by `call`. We ignore `pop rsp`, as
+// that has funny semantics and would be unusual to fuse.
+static bool IsFusablePop(const Instruction &call, const Instruction &pop) {
+  if (!HasPrefix(pop.function, "POP_GPRv_") || pop.operands.empty()) {
+    return false;
   }
+  const auto &dest = pop.operands[0];
+  return Operand::kTypeRegister == dest.type &&
+         dest.reg.size == call.arch->address_size && dest.reg.name != "ESP" &&
+         dest.reg.name != "RSP";
 }
 
 // Fill in the operands for a fused `call+pop` pair. This ends up acting like
@@ -948,53 +1000,149 @@ static const char *FusablePopReg64(char byte) {
 // instruction. Downstream users like McSema and Anvill benefit from seeing this
 // as a MOV-variant because of how they identify cross-references related to
 // uses of the program counter (`PC`) register.
-static void
-FillFusedCallPopRegOperands(Instruction &inst, unsigned address_size,
-                            const char *dest_reg_name, unsigned call_inst_len) {
-  inst.operands.resize(2);
-  auto &dest = inst.operands[0];
-  auto &src = inst.operands[1];
-
-  dest.type = Operand::kTypeRegister;
-  dest.reg.name = dest_reg_name;
-  dest.reg.size = address_size;
-  dest.size = address_size;
-  dest.action = Operand::kActionWrite;
+static void FuseCallPop(Instruction &call, const Instruction *pop) {
+  const auto address_size = call.arch->address_size;
 
+  Operand src = {};
   src.type = Operand::kTypeAddress;
   src.size = address_size;
   src.action = Operand::kActionRead;
   src.addr.address_size = address_size;
   src.addr.base_reg.name = "PC";
   src.addr.base_reg.size = address_size;
-  src.addr.displacement = static_cast<int64_t>(call_inst_len);
+  src.addr.displacement = static_cast<int64_t>(call.bytes.size());
   src.addr.kind = Operand::Address::kAddressCalculation;
 
-  if (32 == address_size) {
-    inst.function = "CALL_POP_FUSED_32";
+  call.operands.clear();
+  call.operands.push_back(pop->operands[0]);
+  call.operands.push_back(src);
+  call.function =
+      32 == address_size ? "CALL_POP_FUSED_32" : "CALL_POP_FUSED_64";
+
+  // Users should no longer interpret this instruction as semantically being
+  // a call.
+  call.category = Instruction::kCategoryNormal;
+}
+
+// A `cmp` or `test` of a register against a register or an immediate.
+static bool IsFusableCompare(const Instruction &inst) {
+  if ((!HasPrefix(inst.function, "CMP_") &&
+       !HasPrefix(inst.function, "TEST_")) ||
+      2u != inst.operands.size()) {
+    return false;
+  }
+  const auto &lhs = inst.operands[0];
+  const auto &rhs = inst.operands[1];
+  return Operand::kTypeRegister == lhs.type &&
+         (Operand::kTypeRegister == rhs.type ||
+          Operand::kTypeImmediate == rhs.type);
+}
+
+// Returns the condition code of a conditional branch, e.g. `NZ` for `jnz`, or
+// an empty string if `inst` isn't a conditional branch.
+static std::string_view BranchConditionCode(const Instruction &inst) {
+  std::string_view name(inst.function);
+  if (Instruction::kCategoryConditionalBranch != inst.category ||
+      !HasPrefix(name, "J")) {
+    return {};
+  }
+  const auto pos = name.find("_RELBR");
+  if (pos == std::string_view::npos) {
+    return {};
+  }
+  return name.substr(1, pos - 1);
+}
+
+// Conditions that can be decided directly from the compared values. After a
+// `cmp`, these are the conditions that fuse on modern Intel and AMD cores.
+// After a `test`, `CF` and `OF` are always zero, so all conditions reduce to
+// signed comparisons of the `and` of the values against zero.
+static constexpr std::string_view kFusableCmpConditions[] = {
+    "Z", "NZ", "B", "NB", "BE", "NBE", "L", "NL", "LE", "NLE"};
+static constexpr std::string_view kFusableTestConditions[] = {
+    "Z", "NZ", "S", "NS", "L", "NL", "LE", "NLE"};
+
+template <size_t kNumConditions>
+static bool IsOneOf(std::string_view cc,
+                    const std::string_view (&conditions)[kNumConditions]) {
+  return std::find(std::begin(conditions), std::end(conditions), cc) !=
+         std::end(conditions);
+}
 
+static bool IsFusableCompareBranch(const Instruction &cmp,
+                                   const Instruction &jcc) {
+  const auto cc = BranchConditionCode(jcc);
+  if (cc.empty()) {
+    return false;
+  } else if (HasPrefix(cmp.function, "CMP_")) {
+    return IsOneOf(cc, kFusableCmpConditions);
   } else {
-    inst.function = "CALL_POP_FUSED_64";
-
-    // Rename the register to be a 64-bit register. `pop eax` when decoded as
-    // a 32-bit instruction, and `pop rax` when decoded as a 64-bit instruction,
-    // both have the same binary representation. So for these cases, we store
-    // a 32-bit register name, such as `EAX` in `dest_reg_name`. If we're doing
-    // a fuse on 64-bit, then we want to upgrade the destination register to
-    // its `R`-prefixed variant, lest we accidentally discard the high 32 bits.
-    //
-    // For the case of `pop r8` et al. on 64 bit, `dest_reg_name` contains the
-    // 64-bit register name, and so the injection of `R` acts as a no-op.
-    //
-    // NOTE(pag): See `FusablePopReg32` and `FusablePopReg64`.
-    dest.reg.name[0] = 'R';
+    return IsOneOf(cc, kFusableTestConditions);
   }
 }
 
-// Decode an instuction.
+// Fuse a `cmp` or `test` with the following conditional branch. The semantics
+// are located in `COND_BR`, and take the operands of both instructions. They
+// still compute the flags, as those are architecturally visible, but decide
+// the branch directly from the compared values.
+static void FuseCompareBranch(Instruction &cmp, const Instruction *jcc) {
+  std::string name = HasPrefix(cmp.function, "CMP_") ? "CMP_" : "TEST_";
+  name += Operand::kTypeImmediate == cmp.operands[1].type ? "IMM_J" : "GPR_J";
+  name += BranchConditionCode(*jcc);
+  name += "_FUSED_";
+  name += std::to_string(cmp.operands[0].size);
+  cmp.function = std::move(name);
+
+  cmp.operands.insert(cmp.operands.end(), jcc->operands.begin(),
+                      jcc->operands.end());
+  cmp.category = jcc->category;
+  cmp.branch_taken_pc = jcc->branch_taken_pc;
+  cmp.branch_not_taken_pc = jcc->branch_not_taken_pc;
+  cmp.branch_taken_arch_name = jcc->branch_taken_arch_name;
+}
+
+// `xor r, r` zeroes `r` regardless of its prior value.
+static bool IsZeroIdiom(const Instruction &inst) {
+  if (!HasPrefix(inst.function, "XOR_GPR") || 3u != inst.operands.size()) {
+    return false;
+  }
+  const auto &src1 = inst.operands[1];
+  const auto &src2 = inst.operands[2];
+  return Operand::kTypeRegister == src1.type &&
+         Operand::kTypeRegister == src2.type &&
+         src1.reg.name == src2.reg.name;
+}
+
+// The semantics of the zero idiom are located in `LOGICAL`, and only take the
+// destination register, so that the lifted code doesn't read the register.
+static void RenameZeroIdiom(Instruction &inst, const Instruction *) {
+  inst.operands.resize(1);
+  inst.function = "XOR_ZERO_IDIOM_" + std::to_string(inst.operands[0].size);
+}
+
+static const IdiomFusionRule kIdiomFusionRules[] = {
+    {"call+pop", IsCallToNextPC, IsFusablePop, FuseCallPop},
+    {"cmp/test+jcc", IsFusableCompare, IsFusableCompareBranch,
+     FuseCompareBranch},
+    {"xor zero idiom", IsZeroIdiom, nullptr, RenameZeroIdiom},
+};
+
+// Decode an instuction, and then look for instruction fusing opportunities.
+// Fusion needs more than the `15` bytes of the longest x86 instruction.
 bool X86Arch::ArchDecodeInstruction(uint64_t address,
                                     std::string_view inst_bytes,
                                     Instruction &inst) const {
+  return DecodeAndFuseIdioms(
+      address, inst_bytes, 15u, inst, kIdiomFusionRules,
+      [this](uint64_t pc, std::string_view bytes, Instruction &decoded) {
+        return DecodeUnfusedInstruction(pc, bytes, decoded);
+      });
+}
+
+// Decode an instuction.
+bool X86Arch::DecodeUnfusedInstruction(uint64_t address,
+                                       std::string_view inst_bytes,
+                                       Instruction &inst) const {
 
   inst.pc = address;
   inst.arch = this;
@@ -1012,28 +1160,16 @@ bool X86Arch::ArchDecodeInstruction(uint64_t address,
   }
 
   auto len = xed_decoded_inst_get_length(xedd);
-  auto extra_len = 0u;  // From fusing.
   const auto iform = xed_decoded_inst_get_iform_enum(xedd);
   const auto xedi = xed_decoded_inst_inst(xedd);
   const auto num_operands = xed_decoded_inst_noperands(xedd);
   const auto xedv = xed_decoded_inst_operands_const(xedd);
   const auto isa_set = xed_decoded_inst_get_isa_set(xedd);
   const auto category = xed_decoded_inst_get_category(xedd);
+  const auto &info = iform_info[iform];
 
   // Re-classify this instruction to its sub-architecture.
-  if (IsAVX512(isa_set, category)) {
-    inst.sub_arch_name =
-        32 == address_size ? kArchX86_AVX512 : kArchAMD64_AVX512;
-  } else if (IsAVX(isa_set, category)) {
-    inst.sub_arch_name = 32 == address_size ? kArchX86_AVX : kArchAMD64_AVX;
-  } else if (xed_classify_avx512(xedd) || xed_classify_avx512_maskop(xedd)) {
-    inst.sub_arch_name =
-        32 == address_size ? kArchX86_AVX512 : kArchAMD64_AVX512;
-  } else if (xed_classify_avx(xedd)) {
-    inst.sub_arch_name = 32 == address_size ? kArchX86_AVX : kArchAMD64_AVX;
-  } else {
-    inst.sub_arch_name = 32 == address_size ? kArchX86 : kArchAMD64;
-  }
+  inst.sub_arch_name = SubArchName(xedd, info, address_size);
 
   // Make sure we know about
   if (static_cast<unsigned>(inst.arch_name) <
@@ -1048,42 +1184,16 @@ bool X86Arch::ArchDecodeInstruction(uint64_t address,
     return false;
   }
 
-  inst.category = CreateCategory(xedd);
-
-  // Look for instruction fusing opportunities. For now, just `call; pop`.
-  const char *is_fused_call_pop = nullptr;
-  if (len < inst_bytes.size() &&
-      (iform == XED_IFORM_CALL_NEAR_RELBRd ||
-       iform == XED_IFORM_CALL_NEAR_RELBRz) &&
-      !xed_decoded_inst_get_branch_displacement(xedd)) {
-    is_fused_call_pop = FusablePopReg32(inst_bytes[len]);
-
-    // Change the instruction length (to influence `next_pc` calculation) and
-    // the instruction category, so that users no longer interpret this
-    // instruction as semantically being a call.
-    if (is_fused_call_pop) {
-      extra_len = 1u;
-      inst.category = Instruction::kCategoryNormal;
-
-      // Look for `pop r8` et al.
-    } else if (64 == address_size && (2 + len) <= inst_bytes.size() &&
-               inst_bytes[len] == 0x41) {
-      is_fused_call_pop = FusablePopReg64(inst_bytes[len + 1]);
-      if (is_fused_call_pop) {
-        extra_len = 2u;
-        inst.category = Instruction::kCategoryNormal;
-      }
-    }
-  }
+  inst.category = info.category;
 
-  inst.next_pc = address + len + extra_len;
+  inst.next_pc = address + len;
 
   // Fiddle with the size of the bytes.
   if (!inst.bytes.empty() && inst.bytes.data() == inst_bytes.data()) {
-    CHECK_LE(len + extra_len, inst.bytes.size());
-    inst.bytes.resize(len + extra_len);
+    CHECK_LE(len, inst.bytes.size());
+    inst.bytes.resize(len);
   } else {
-    inst.bytes = inst_bytes.substr(0, len + extra_len);
+    inst.bytes = inst_bytes.substr(0, len);
   }
 
   // Wrap an instruction in atomic begin/end if it accesses memory with RMW
@@ -1105,16 +1215,11 @@ bool X86Arch::ArchDecodeInstruction(uint64_t address,
     inst.segment_override = RegisterByName(reg_name);
   }
 
-  if (is_fused_call_pop) {
-    FillFusedCallPopRegOperands(inst, address_size, is_fused_call_pop, len);
-
-  } else {
-    inst.function = InstructionFunctionName(xedd);
-    for (auto i = 0U; i < num_operands; ++i) {
-      auto xedo = xed_inst_operand(xedi, i);
-      if (XED_OPVIS_SUPPRESSED != xed_operand_operand_visibility(xedo)) {
-        DecodeOperand(inst, xedd, xedo);
-      }
+  inst.function = InstructionFunctionName(xedd, info);
+  for (auto i = 0U; i < num_operands; ++i) {
+    auto xedo = xed_inst_operand(xedi, i);
+    if (XED_OPVIS_SUPPRESSED != xed_operand_operand_visibility(xedo)) {
+      DecodeOperand(inst, xedd, xedo);
     }
   }
 
@@ -1144,7 +1249,7 @@ bool X86Arch::ArchDecodeInstruction(uint64_t address,
     dst_ret_pc.reg.size = address_size;
   }
 
-  if (UsesStopFailure(xedd)) {
+  if (info.uses_stop_failure) {
 
     // These instructions might fault and uses the StopFailure to recover.
     // The new operand `next_pc` is added and the REG_PC is set to next_pc
@@ -1193,6 +1298,77 @@ bool X86Arch::ArchDecodeInstruction(uint64_t address,
 
   return true;
 }
+
+// Linearly sweep `bytes`. This only asks XED for the length, iform, and
+// branch displacement of each instruction, and so is much faster than
+// decoding each instruction into an `Instruction`.
+uint64_t X86Arch::DecodeRange(uint64_t address, std::string_view bytes,
+                              const DecodingContext &,
+                              const DecodeRangeCallback &cb) const {
+  const auto mode = 32 == address_size ? &kXEDState32 : &kXEDState64;
+  const auto data = reinterpret_cast<const uint8_t *>(bytes.data());
+  const uint64_t num_bytes = bytes.size();
+
+  xed_decoded_inst_t xedd;
+  InstructionSummary summary;
+  uint64_t offset = 0;
+  while (offset < num_bytes) {
+    const auto max_len =
+        std::min<uint64_t>(num_bytes - offset, XED_MAX_INSTRUCTION_BYTES);
+    summary.pc = address + offset;
+    summary.has_direct_target = false;
+    summary.direct_target = 0;
+
+    xed_decoded_inst_zero_set_mode(&xedd, mode);
+    xed_decoded_inst_set_input_chip(&xedd, XED_CHIP_INVALID);
+    const auto err =
+        xed_decode(&xedd, &(data[offset]), static_cast<uint32_t>(max_len));
+
+    // The bytes end with the prefix of a valid instruction.
+    if (XED_ERROR_BUFFER_TOO_SHORT == err) {
+      break;
+    }
+
+    const auto &info = iform_info[xed_decoded_inst_get_iform_enum(&xedd)];
+
+    // Treat instructions that need a bigger sub-architecture in the same way
+    // as `DecodeUnfusedInstruction`.
+    if (XED_ERROR_NONE != err ||
+        static_cast<unsigned>(arch_name) <
+            static_cast<unsigned>(SubArchName(&xedd, info, address_size))) {
+      summary.size = 1u;
+      summary.next_pc = summary.pc + 1u;
+      summary.category = Instruction::kCategoryInvalid;
+
+    } else {
+      summary.size = xed_decoded_inst_get_length(&xedd);
+      summary.next_pc = summary.pc + summary.size;
+      summary.category = info.category;
+      switch (info.category) {
+        case Instruction::kCategoryDirectJump:
+        case Instruction::kCategoryDirectFunctionCall:
+        case Instruction::kCategoryConditionalBranch:
+          summary.has_direct_target = true;
+          summary.direct_target = static_cast<uint64_t>(
+              static_cast<int64_t>(summary.next_pc) +
+              xed_decoded_inst_get_branch_displacement(&xedd));
+
+          // Branches wrap around the 32-bit address space.
+          if (32 == address_size) {
+            summary.direct_target &= 0xffffffffull;
+          }
+          break;
+        default: break;
+      }
+    }
+
+    offset += summary.size;
+    if (!cb(summary)) {
+      break;
+    }
+  }
+  return offset;
+}
 }  // namespace
 
 // TODO(pag): We pretend that these are singletons, but they aren't really!
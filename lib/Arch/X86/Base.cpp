@@ -30,8 +30,11 @@ uint64_t X86ArchBase::MinInstructionSize(const DecodingContext &) const {
   return 1;
 }
 
-uint64_t X86ArchBase::MaxInstructionSize(const DecodingContext &, bool) const {
-  return 15;
+// The longest x86 instruction is `15` bytes. We look at the next instruction
+// for fusing idioms like `cmp; jcc`.
+uint64_t X86ArchBase::MaxInstructionSize(const DecodingContext &,
+                                         bool permit_fuse_idioms) const {
+  return permit_fuse_idioms ? 30 : 15;
 }
 
 llvm::CallingConv::ID X86ArchBase::DefaultCallingConv(void) const {
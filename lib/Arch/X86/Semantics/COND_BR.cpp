@@ -370,3 +370,106 @@ IF_64BIT(DEF_ISEL(JRCXZ_RELBRb) = JRCXZ;)
 DEF_ISEL(LOOP_RELBRb) = LOOP;
 DEF_ISEL(LOOPE_RELBRb) = LOOPE;
 DEF_ISEL(LOOPNE_RELBRb) = LOOPNE;
+
+namespace {
+
+// Conditions of a conditional branch fused with a preceding `cmp` or `test`,
+// decided directly from the compared values rather than from the flags. See
+// `FuseCompareBranch` in `lib/Arch/X86/Arch.cpp`.
+#define MAKE_FUSED_COND(cc, compare, ...) \
+  struct FusedCond##cc { \
+    template <typename T> \
+    ALWAYS_INLINE static bool Check(T lhs, T rhs) { \
+      return __remill_compare_##compare(__VA_ARGS__); \
+    } \
+  };
+
+MAKE_FUSED_COND(Z, eq, UCmpEq(lhs, rhs))
+MAKE_FUSED_COND(NZ, neq, UCmpNeq(lhs, rhs))
+MAKE_FUSED_COND(B, ult, UCmpLt(lhs, rhs))
+MAKE_FUSED_COND(NB, uge, UCmpGte(lhs, rhs))
+MAKE_FUSED_COND(BE, ule, UCmpLte(lhs, rhs))
+MAKE_FUSED_COND(NBE, ugt, UCmpGt(lhs, rhs))
+MAKE_FUSED_COND(L, slt, SCmpLt(Signed(lhs), Signed(rhs)))
+MAKE_FUSED_COND(NL, sge, SCmpGte(Signed(lhs), Signed(rhs)))
+MAKE_FUSED_COND(LE, sle, SCmpLte(Signed(lhs), Signed(rhs)))
+MAKE_FUSED_COND(NLE, sgt, SCmpGt(Signed(lhs), Signed(rhs)))
+
+#undef MAKE_FUSED_COND
+
+// A `test` always clears `OF`, so `js` and `jns` compare the result of the
+// `test` against zero like `jl` and `jnl` do.
+using FusedCondS = FusedCondL;
+using FusedCondNS = FusedCondNL;
+
+template <typename Cond, typename S1, typename S2>
+DEF_SEM(CMP_JCC, S1 src1, S2 src2, R8W cond, PC taken, PC not_taken,
+        IF_32BIT_ELSE(R32W, R64W) pc_dst) {
+  auto lhs = Read(src1);
+  auto rhs = Read(src2);
+  auto sum = USub(lhs, rhs);
+  WriteFlagsAddSub<tag_sub>(state, lhs, rhs, sum);
+  addr_t taken_pc = Read(taken);
+  addr_t not_taken_pc = Read(not_taken);
+  auto take_branch = Cond::Check(lhs, rhs);
+  Write(cond, take_branch);
+  Write(pc_dst, Select<addr_t>(take_branch, taken_pc, not_taken_pc));
+  return memory;
+}
+
+template <typename Cond, typename S1, typename S2>
+DEF_SEM(TEST_JCC, S1 src1, S2 src2, R8W cond, PC taken, PC not_taken,
+        IF_32BIT_ELSE(R32W, R64W) pc_dst) {
+  auto lhs = Read(src1);
+  auto rhs = Read(src2);
+  auto res = UAnd(lhs, rhs);
+  state.aflag.cf = false;
+  state.aflag.pf = ParityFlag(res);
+  state.aflag.zf = ZeroFlag(res, lhs, rhs);
+  state.aflag.sf = SignFlag(res, lhs, rhs);
+  state.aflag.of = false;
+  UndefFlag(af);
+  addr_t taken_pc = Read(taken);
+  addr_t not_taken_pc = Read(not_taken);
+  auto take_branch = Cond::Check(res, decltype(res)(0));
+  Write(cond, take_branch);
+  Write(pc_dst, Select<addr_t>(take_branch, taken_pc, not_taken_pc));
+  return memory;
+}
+
+}  // namespace
+
+// E.g. `CMP_GPR_JZ_FUSED_32` for `cmp eax, ebx; jz`, or `TEST_IMM_JS_FUSED_8`
+// for `test al, 0x80; js`.
+#define DEF_ISEL_FUSED_JCC(op, cc) \
+  _DEF_ISEL_FUSED_JCC(op##_GPR_J##cc##_FUSED, op##_JCC, FusedCond##cc, R) \
+  _DEF_ISEL_FUSED_JCC(op##_IMM_J##cc##_FUSED, op##_JCC, FusedCond##cc, I)
+
+#define _DEF_ISEL_FUSED_JCC(name, sem, cond, Y) \
+  DEF_ISEL(name##_8) = sem<cond, R8, Y##8>; \
+  DEF_ISEL(name##_16) = sem<cond, R16, Y##16>; \
+  DEF_ISEL(name##_32) = sem<cond, R32, Y##32>; \
+  IF_64BIT(DEF_ISEL(name##_64) = sem<cond, R64, Y##64>;)
+
+DEF_ISEL_FUSED_JCC(CMP, Z)
+DEF_ISEL_FUSED_JCC(CMP, NZ)
+DEF_ISEL_FUSED_JCC(CMP, B)
+DEF_ISEL_FUSED_JCC(CMP, NB)
+DEF_ISEL_FUSED_JCC(CMP, BE)
+DEF_ISEL_FUSED_JCC(CMP, NBE)
+DEF_ISEL_FUSED_JCC(CMP, L)
+DEF_ISEL_FUSED_JCC(CMP, NL)
+DEF_ISEL_FUSED_JCC(CMP, LE)
+DEF_ISEL_FUSED_JCC(CMP, NLE)
+
+DEF_ISEL_FUSED_JCC(TEST, Z)
+DEF_ISEL_FUSED_JCC(TEST, NZ)
+DEF_ISEL_FUSED_JCC(TEST, S)
+DEF_ISEL_FUSED_JCC(TEST, NS)
+DEF_ISEL_FUSED_JCC(TEST, L)
+DEF_ISEL_FUSED_JCC(TEST, NL)
+DEF_ISEL_FUSED_JCC(TEST, LE)
+DEF_ISEL_FUSED_JCC(TEST, NLE)
+
+#undef DEF_ISEL_FUSED_JCC
+#undef _DEF_ISEL_FUSED_JCC
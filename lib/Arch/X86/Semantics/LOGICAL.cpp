@@ -135,6 +135,27 @@ DEF_ISEL_RnW_Rn_Mn(XOR_GPRv_MEMv, XOR);
 DEF_ISEL(XOR_AL_IMMb) = XOR<R8W, R8, I8>;
 DEF_ISEL_RnW_Rn_In(XOR_OrAX_IMMz, XOR);
 
+namespace {
+
+// `xor r, r`, which zeroes `r` without reading it. See `RenameZeroIdiom` in
+// `lib/Arch/X86/Arch.cpp`.
+template <typename D>
+DEF_SEM(XOR_ZERO_IDIOM, D dst) {
+  using T = typename BaseType<D>::BT;
+  WriteZExt(dst, T(0));
+  state.aflag.cf = false;
+  state.aflag.pf = true;
+  state.aflag.zf = true;
+  state.aflag.sf = false;
+  state.aflag.of = false;
+  UndefFlag(af);
+  return memory;
+}
+
+}  // namespace
+
+DEF_ISEL_RnW(XOR_ZERO_IDIOM, XOR_ZERO_IDIOM);
+
 DEF_ISEL(NOT_MEMb) = NOT<M8W, M8>;
 DEF_ISEL(NOT_GPR8) = NOT<R8W, R8>;
 DEF_ISEL_MnW_Mn(NOT_MEMv, NOT);
@@ -31,4 +31,10 @@ const std::string_view kUnsupportedInstructionISelName =
 
 const std::string_view kIgnoreNextPCVariableName = "IGNORE_NEXT_PC";
 
+const std::string_view kInlineCacheMissVariableName =
+    "__remill_inline_cache_miss";
+
+const std::string_view kShadowReturnStackVariableName =
+    "__remill_shadow_return_stack";
+
 }  // namespace remill
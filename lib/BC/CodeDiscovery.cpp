@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Instruction.h>
+#include <remill/BC/CodeDiscovery.h>
+#include <remill/BC/Statistics.h>
+#include <remill/BC/TraceLifter.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace remill {
+namespace {
+
+// What we learned from decoding the instruction at some address.
+struct DecodedInstruction {
+  uint64_t next_pc{0};
+  Instruction::Category category{Instruction::kCategoryInvalid};
+
+  // There are no executable bytes at this address.
+  bool is_missing{false};
+
+  // `true` once the instruction has been decoded. Addresses are claimed by
+  // a worker before they are decoded.
+  bool is_decoded{false};
+
+  // The instruction has a delay slot at `delayed_pc`. The delayed instruction
+  // belongs to this one, and isn't itself decoded as part of a block.
+  bool has_delay_slot{false};
+  uint64_t delayed_pc{0};
+
+  std::vector<uint64_t> successors;
+  std::vector<uint64_t> callees;
+};
+
+// Does control only leave this instruction by falling through to the next
+// one?
+static bool FallsThrough(const DecodedInstruction &decoded) {
+  if (decoded.is_missing) {
+    return false;
+  }
+  switch (decoded.category) {
+    case Instruction::kCategoryNormal:
+    case Instruction::kCategoryNoOp: return true;
+    default: return false;
+  }
+}
+
+static void AddUnique(std::vector<uint64_t> &addrs, uint64_t addr) {
+  if (std::find(addrs.begin(), addrs.end(), addr) == addrs.end()) {
+    addrs.push_back(addr);
+  }
+}
+
+// Number of independently locked parts of the decoded instruction map.
+static constexpr size_t kNumShards = 64;
+
+}  // namespace
+
+class CodeDiscovery::Impl {
+ public:
+  Impl(const Arch *arch_, TraceManager *manager_,
+       CodeDiscoveryOptions options_);
+
+  CodeGraph Discover(const std::vector<uint64_t> &trace_heads);
+
+ private:
+
+  // Per-thread decoding state.
+  struct Worker {
+    Instruction inst;
+    Instruction delayed_inst;
+    std::string inst_bytes;
+  };
+
+  // Decodes code until there is no work left.
+  void Work(void);
+
+  // Decode the instructions starting at `addr`, and continuing on until the
+  // first instruction that doesn't fall through to the next one.
+  void DecodeFrom(Worker &worker, uint64_t addr);
+
+  // Decode the instruction at `addr` into `decoded`.
+  void DecodeOne(Worker &worker, uint64_t addr, DecodedInstruction &decoded);
+
+  // Reads the bytes of an instruction at `addr` into `worker.inst_bytes`.
+  bool ReadInstructionBytes(Worker &worker, uint64_t addr);
+
+  // Find the successors and callees of `inst`.
+  void AddFlows(const Instruction &inst, DecodedInstruction &decoded);
+
+  // Claim the instruction at `addr` for decoding. Returns `false` if
+  // another worker already claimed it.
+  bool Claim(uint64_t addr);
+
+  // Store the decoded instruction at `addr`.
+  void Store(uint64_t addr, DecodedInstruction decoded);
+
+  // Add `addr` to the work list.
+  void Push(uint64_t addr);
+
+  // Add `addr` as a trace head, and to the work list if it's new.
+  void AddTraceHead(uint64_t addr);
+
+  // Group the decoded instructions into blocks.
+  CodeGraph BuildGraph(void);
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<uint64_t, DecodedInstruction> insts;
+  };
+
+  Shard &ShardFor(uint64_t addr) {
+    return shards[(addr ^ (addr >> 12)) % kNumShards];
+  }
+
+  const Arch *const arch;
+  TraceManager &manager;
+  const CodeDiscoveryOptions options;
+  const uint64_t addr_mask;
+  const size_t max_inst_bytes;
+
+  Shard shards[kNumShards];
+
+  std::mutex trace_heads_lock;
+  std::set<uint64_t> trace_heads;
+
+  std::mutex work_list_lock;
+  std::condition_variable work_list_cond;
+  std::vector<uint64_t> work_list;
+  unsigned num_busy_workers{0};
+};
+
+CodeDiscovery::Impl::Impl(const Arch *arch_, TraceManager *manager_,
+                          CodeDiscoveryOptions options_)
+    : arch(arch_),
+      manager(*manager_),
+      options(options_),
+      addr_mask(arch->address_size >= 64
+                    ? ~0ULL
+                    : ((1ULL << arch->address_size) - 1ULL)),
+      max_inst_bytes(arch->MaxInstructionSize(arch->CreateInitialContext(),
+                                              options.fuse_idioms)) {}
+
+CodeGraph
+CodeDiscovery::Impl::Discover(const std::vector<uint64_t> &trace_heads_) {
+  static const Timer discover_timer("code_discovery.discover");
+  ScopedTimer timer(discover_timer);
+
+  for (auto &shard : shards) {
+    shard.insts.clear();
+  }
+  trace_heads.clear();
+  work_list.clear();
+  num_busy_workers = 0;
+
+  for (auto addr : trace_heads_) {
+    AddTraceHead(addr & addr_mask);
+  }
+
+  auto num_threads = options.num_threads;
+  if (!num_threads) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  std::vector<std::thread> threads;
+  for (auto i = 1u; i < num_threads; ++i) {
+    threads.emplace_back([this] { Work(); });
+  }
+  Work();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  return BuildGraph();
+}
+
+// Decodes code until there is no work left, i.e. the work list is empty and
+// no other worker can add to it.
+void CodeDiscovery::Impl::Work(void) {
+  Worker worker;
+  worker.inst_bytes.reserve(max_inst_bytes);
+
+  std::unique_lock<std::mutex> locker(work_list_lock);
+  while (true) {
+    work_list_cond.wait(locker, [this] {
+      return !work_list.empty() || !num_busy_workers;
+    });
+
+    if (work_list.empty()) {
+      work_list_cond.notify_all();
+      return;
+    }
+
+    const auto addr = work_list.back();
+    work_list.pop_back();
+    ++num_busy_workers;
+
+    locker.unlock();
+    DecodeFrom(worker, addr);
+    locker.lock();
+
+    if (!--num_busy_workers && work_list.empty()) {
+      work_list_cond.notify_all();
+    }
+  }
+}
+
+void CodeDiscovery::Impl::Push(uint64_t addr) {
+  std::lock_guard<std::mutex> locker(work_list_lock);
+  work_list.push_back(addr);
+  work_list_cond.notify_one();
+}
+
+void CodeDiscovery::Impl::AddTraceHead(uint64_t addr) {
+  {
+    std::lock_guard<std::mutex> locker(trace_heads_lock);
+    if (!trace_heads.insert(addr).second) {
+      return;
+    }
+  }
+  Push(addr);
+}
+
+bool CodeDiscovery::Impl::Claim(uint64_t addr) {
+  auto &shard = ShardFor(addr);
+  std::lock_guard<std::mutex> locker(shard.lock);
+  return shard.insts.emplace(addr, DecodedInstruction()).second;
+}
+
+void CodeDiscovery::Impl::Store(uint64_t addr, DecodedInstruction decoded) {
+  auto &shard = ShardFor(addr);
+  std::lock_guard<std::mutex> locker(shard.lock);
+  decoded.is_decoded = true;
+  shard.insts[addr] = std::move(decoded);
+}
+
+void CodeDiscovery::Impl::DecodeFrom(Worker &worker, uint64_t addr) {
+  for (auto pc = addr & addr_mask; Claim(pc);) {
+    DecodedInstruction decoded;
+    DecodeOne(worker, pc, decoded);
+
+    const auto falls_through = FallsThrough(decoded);
+    const auto next_pc = decoded.next_pc;
+    if (!falls_through) {
+      for (auto succ : decoded.successors) {
+        Push(succ);
+      }
+    }
+    for (auto callee : decoded.callees) {
+      AddTraceHead(callee);
+    }
+
+    Store(pc, std::move(decoded));
+    if (!falls_through) {
+      break;
+    }
+
+    // Keep going in this worker, rather than pushing the next instruction,
+    // so that straight-line code is decoded in order.
+    pc = next_pc;
+  }
+}
+
+// Reads the bytes of an instruction at `addr` into `worker.inst_bytes`.
+bool CodeDiscovery::Impl::ReadInstructionBytes(Worker &worker, uint64_t addr) {
+  worker.inst_bytes.clear();
+
+  // Fast path: the manager can give us a view of the bytes. Don't let the
+  // view wrap around the address space.
+  const auto max_size = static_cast<size_t>(
+      std::min<uint64_t>(max_inst_bytes - 1u, addr_mask - addr) + 1u);
+  if (auto view = manager.TryReadExecutableBytes(addr, max_size);
+      !view.empty()) {
+    worker.inst_bytes.assign(view.data(), std::min(view.size(), max_size));
+    return true;
+  }
+
+  for (size_t i = 0; i < max_inst_bytes; ++i) {
+    const auto byte_addr = (addr + i) & addr_mask;
+    if (byte_addr < addr) {
+      break;  // 32- or 64-bit address overflow.
+    }
+    uint8_t byte = 0;
+    if (!manager.TryReadExecutableByte(byte_addr, &byte)) {
+      break;
+    }
+    worker.inst_bytes.push_back(static_cast<char>(byte));
+  }
+  return !worker.inst_bytes.empty();
+}
+
+void CodeDiscovery::Impl::DecodeOne(Worker &worker, uint64_t addr,
+                                    DecodedInstruction &decoded) {
+  if (!ReadInstructionBytes(worker, addr)) {
+    decoded.is_missing = true;
+    return;
+  }
+
+  auto &inst = worker.inst;
+  inst.Reset();
+  std::ignore = arch->DecodeInstruction(addr, worker.inst_bytes, inst,
+                                        arch->CreateInitialContext());
+
+  decoded.category = inst.category;
+  decoded.next_pc = inst.next_pc & addr_mask;
+
+  // Decode the delay slot in the same way as the `TraceLifter`, which ends
+  // the block with a call to `__remill_error` if it can't.
+  if (arch->MayHaveDelaySlot(inst)) {
+    const auto delayed_pc = inst.delayed_pc & addr_mask;
+    auto &delayed_inst = worker.delayed_inst;
+    delayed_inst.Reset();
+    if (!ReadInstructionBytes(worker, delayed_pc) ||
+        !arch->DecodeDelayedInstruction(delayed_pc, worker.inst_bytes,
+                                        delayed_inst,
+                                        arch->CreateInitialContext())) {
+      decoded.category = Instruction::kCategoryError;
+      return;
+    }
+    decoded.has_delay_slot = true;
+    decoded.delayed_pc = delayed_pc;
+  }
+
+  AddFlows(inst, decoded);
+}
+
+// Find the successors and callees of `inst`, following control flow in the
+// same way as the `TraceLifter`.
+void CodeDiscovery::Impl::AddFlows(const Instruction &inst,
+                                   DecodedInstruction &decoded) {
+  auto &succs = decoded.successors;
+  auto &callees = decoded.callees;
+  const auto taken_pc = inst.branch_taken_pc & addr_mask;
+  const auto not_taken_pc = inst.branch_not_taken_pc & addr_mask;
+
+  // Trace-local devirtualized targets of jumps are successors; everything
+  // else is a trace head, just like the entries of inline caches.
+  auto add_devirtualized_targets = [&](bool is_jump) {
+    manager.ForEachDevirtualizedTarget(
+        inst, [&](uint64_t target, DevirtualizedTargetKind kind) {
+          target &= addr_mask;
+          if (is_jump && kind == DevirtualizedTargetKind::kTraceLocal) {
+            AddUnique(succs, target);
+          } else {
+            AddUnique(callees, target);
+          }
+        });
+  };
+
+  switch (inst.category) {
+    case Instruction::kCategoryInvalid:
+    case Instruction::kCategoryError: break;
+
+    case Instruction::kCategoryNormal:
+    case Instruction::kCategoryNoOp:
+    case Instruction::kCategoryAsyncHyperCall:
+    case Instruction::kCategoryConditionalAsyncHyperCall:
+      succs.push_back(decoded.next_pc);
+      break;
+
+    case Instruction::kCategoryDirectJump: succs.push_back(taken_pc); break;
+
+    case Instruction::kCategoryIndirectJump:
+      add_devirtualized_targets(true);
+      break;
+
+    case Instruction::kCategoryConditionalIndirectJump:
+      succs.push_back(not_taken_pc);
+      add_devirtualized_targets(true);
+      break;
+
+    case Instruction::kCategoryIndirectFunctionCall:
+    case Instruction::kCategoryConditionalIndirectFunctionCall:
+      succs.push_back(not_taken_pc);
+      add_devirtualized_targets(false);
+      break;
+
+    // Calls to the next instruction aren't trace heads, as they're usually
+    // a way of getting the program counter.
+    case Instruction::kCategoryDirectFunctionCall:
+    case Instruction::kCategoryConditionalDirectFunctionCall:
+      succs.push_back(not_taken_pc);
+      if (taken_pc != not_taken_pc) {
+        callees.push_back(taken_pc);
+      }
+      break;
+
+    case Instruction::kCategoryFunctionReturn:
+      add_devirtualized_targets(false);
+      break;
+
+    case Instruction::kCategoryConditionalFunctionReturn:
+      succs.push_back(not_taken_pc);
+      add_devirtualized_targets(false);
+      break;
+
+    case Instruction::kCategoryConditionalBranch:
+      AddUnique(succs, taken_pc);
+      AddUnique(succs, not_taken_pc);
+      break;
+  }
+}
+
+// Group the decoded instructions into blocks. Blocks start at trace heads,
+// at the successors of instructions that don't only fall through, and at
+// addresses without executable bytes.
+CodeGraph CodeDiscovery::Impl::BuildGraph(void) {
+  static const Statistic num_blocks("code_discovery.blocks");
+  static const Statistic num_missing_blocks("code_discovery.missing_blocks");
+  static const Statistic num_insts("code_discovery.instructions");
+  static const Statistic num_invalid_insts(
+      "code_discovery.invalid_instructions");
+
+  std::unordered_map<uint64_t, DecodedInstruction> insts;
+  for (auto &shard : shards) {
+    insts.merge(shard.insts);
+  }
+
+  CodeGraph graph;
+  graph.trace_heads = std::move(trace_heads);
+
+  std::set<uint64_t> leaders(graph.trace_heads.begin(),
+                             graph.trace_heads.end());
+  for (const auto &[pc, decoded] : insts) {
+    CHECK(decoded.is_decoded)
+        << "Instruction at " << std::hex << pc << std::dec
+        << " was claimed but never decoded";
+    if (decoded.is_missing) {
+      leaders.insert(pc);
+      continue;
+    } else if (!FallsThrough(decoded)) {
+      leaders.insert(decoded.successors.begin(), decoded.successors.end());
+    }
+
+    // Count the instructions themselves, including those in delay slots.
+    num_insts.Add(decoded.has_delay_slot ? 2u : 1u);
+    if (decoded.category == Instruction::kCategoryInvalid) {
+      num_invalid_insts.Add();
+    }
+  }
+
+  for (auto leader : leaders) {
+    auto it = insts.find(leader);
+    if (it == insts.end()) {
+      continue;
+    }
+    if (it->second.is_missing) {
+      graph.missing_blocks.insert(leader);
+      continue;
+    }
+
+    auto &block = graph.blocks[leader];
+    block.pc = leader;
+    for (auto pc = leader;;) {
+      const auto &decoded = insts[pc];
+      ++block.num_instructions;
+      block.end_pc = decoded.next_pc;
+      block.terminator = decoded.category;
+      if (!FallsThrough(decoded)) {
+        if (decoded.has_delay_slot) {
+          ++block.num_instructions;
+          block.has_delay_slot = true;
+          block.delayed_pc = decoded.delayed_pc;
+        }
+        block.successors = decoded.successors;
+        block.callees = decoded.callees;
+        break;
+      }
+
+      pc = decoded.next_pc;
+      if (leaders.count(pc) || !insts.count(pc)) {
+        block.successors.push_back(pc);
+        break;
+      }
+    }
+  }
+
+  num_blocks.Add(graph.blocks.size());
+  num_missing_blocks.Add(graph.missing_blocks.size());
+  return graph;
+}
+
+CodeDiscovery::~CodeDiscovery(void) {}
+
+CodeDiscovery::CodeDiscovery(const Arch *arch_, TraceManager *manager_,
+                             CodeDiscoveryOptions options_)
+    : impl(new Impl(arch_, manager_, options_)) {}
+
+// Discover all code reachable from `trace_heads`.
+CodeGraph CodeDiscovery::Discover(const std::vector<uint64_t> &trace_heads) {
+  return impl->Discover(trace_heads);
+}
+
+}  // namespace remill
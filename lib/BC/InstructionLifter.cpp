@@ -16,9 +16,17 @@
 
 #include "InstructionLifter.h"
 
+#include <remill/BC/Statistics.h>
+
+#include <iterator>
+
 namespace remill {
 namespace {
 
+const char *const kLiftStatusNames[] = {
+    "invalid_instruction", "unsupported_instruction", "lifter_error",
+    "unknown_isel",        "mismatched_isel",         "lifted"};
+
 // Try to find the function that implements this semantics.
 llvm::Function *GetInstructionFunction(llvm::Module *module,
                                        std::string_view function) {
@@ -43,6 +51,14 @@ llvm::Function *GetInstructionFunction(llvm::Module *module,
 
 }  // namespace
 
+LiftStatus RecordLiftStatus(LiftStatus status) {
+  static const StatisticArray num_lift_statuses(
+      "lift.status", std::size(kLiftStatusNames),
+      [](unsigned key) { return std::string(kLiftStatusNames[key]); });
+  num_lift_statuses.Add(static_cast<unsigned>(status));
+  return status;
+}
+
 InstructionLifter::Impl::Impl(const Arch *arch_,
                               const IntrinsicTable *intrinsics_)
     : arch(arch_),
@@ -103,6 +119,10 @@ LiftStatus InstructionLifter::LiftIntoBlock(Instruction &arch_inst,
 
   if (arch_inst.IsValid()) {
     isel_func = GetInstructionFunction(module, arch_inst.function);
+    if (!isel_func) {
+      static const Statistic num_isel_misses("lift.isel_lookup_misses");
+      num_isel_misses.Add();
+    }
   } else {
     isel_func = impl->invalid_instruction;
     arch_inst.operands.clear();
@@ -172,7 +192,7 @@ LiftStatus InstructionLifter::LiftIntoBlock(Instruction &arch_inst,
 
   for (auto &op : arch_inst.operands) {
     if (!(arg_num < isel_func_type->getNumParams())) {
-      return kLiftedMismatchedISEL;
+      return RecordLiftStatus(kLiftedMismatchedISEL);
     }
 
     auto arg = NthArgument(isel_func, arg_num);
@@ -221,7 +241,7 @@ LiftStatus InstructionLifter::LiftIntoBlock(Instruction &arch_inst,
                    mem_ptr_ref);
   }
 
-  return status;
+  return RecordLiftStatus(status);
 }
 
 // Load the address of a register.
@@ -82,4 +82,8 @@ class InstructionLifter::Impl {
   llvm::Function *const unsupported_instruction;
 };
 
+// Count the outcome of lifting an instruction in the `lift.status`
+// statistics, and return `status`.
+LiftStatus RecordLiftStatus(LiftStatus status);
+
 }  // namespace remill
@@ -28,8 +28,10 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
 #include <llvm/IR/PassManager.h>
 #include <llvm/IR/Type.h>
 #include <llvm/Pass.h>
@@ -40,25 +42,370 @@
 #include <llvm/Transforms/IPO/Inliner.h>
 #include <llvm/Transforms/IPO/ModuleInliner.h>
 #include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Scalar/EarlyCSE.h>
+#include <llvm/Transforms/Scalar/SROA.h>
 #include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/Local.h>
+#include <llvm/Transforms/Utils/Mem2Reg.h>
 #include <llvm/Transforms/Utils/ValueMapper.h>
 
+#include <map>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "remill/Arch/Arch.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/RegisterAlias.h"
+#include "remill/BC/Statistics.h"
 #include "remill/BC/Util.h"
 #include "remill/BC/Version.h"
 
 namespace remill {
+namespace {
+
+// Run a function pass pipeline, built by `add_passes`, over `func`. Returns
+// `true` if any of the passes changed `func`.
+static bool
+RunFunctionPasses(llvm::Function *func,
+                  std::function<void(llvm::FunctionPassManager &)> add_passes) {
+  llvm::ModuleAnalysisManager mam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::LoopAnalysisManager lam;
+  llvm::CGSCCAnalysisManager cam;
+
+  llvm::PassBuilder pb;
+  pb.registerModuleAnalyses(mam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.registerCGSCCAnalyses(cam);
+  pb.crossRegisterProxies(lam, fam, cam, mam);
+
+  llvm::FunctionPassManager fpm;
+  add_passes(fpm);
+  const auto preserved = fpm.run(*func, fam);
+
+  mam.clear();
+  fam.clear();
+  lam.clear();
+  cam.clear();
+
+  return !preserved.areAllPreserved();
+}
+
+// A load or store whose address is a constant offset into `State` that falls
+// entirely within one architectural register.
+struct PromotableAccess {
+  llvm::Instruction *inst;
+  const Register *reg;  // Enclosing (i.e. largest) register.
+  uint64_t offset;  // Byte offset into `State`.
+};
+
+// An instruction that can observe or modify `State` in a way that we can't
+// redirect into the promoted registers. Promoted registers must be written
+// back to `State` before `inst`, and re-read from `State` after `inst` if
+// `may_write` is `true`.
+struct SyncPoint {
+  llvm::Instruction *inst;
+  bool may_write;
+};
+
+// Returns the enclosing register that fully contains the `size` bytes at
+// `offset` in the `State` structure, or `nullptr`.
+static const Register *EnclosingRegisterAt(const remill::Arch *arch,
+                                           int64_t offset, uint64_t size) {
+  if (offset < 0 || !size) {
+    return nullptr;
+  }
+
+  const auto reg = arch->RegisterAtStateOffset(static_cast<uint64_t>(offset));
+  if (!reg) {
+    return nullptr;
+  }
+
+  const auto enclosing = reg->EnclosingRegister();
+  const auto begin = static_cast<uint64_t>(offset);
+  if (begin < enclosing->offset ||
+      (begin + size) > (enclosing->offset + enclosing->size)) {
+    return nullptr;
+  }
+
+  return enclosing;
+}
+
+// Copy the value of `reg` from `src` to `dest`.
+static void CopyRegister(llvm::IRBuilder<> &ir, const Register *reg,
+                         llvm::Value *dest, llvm::Value *src) {
+  if (reg->type->isSingleValueType()) {
+    ir.CreateStore(ir.CreateLoad(reg->type, src), dest);
+  } else {
+    ir.CreateMemCpy(dest, llvm::MaybeAlign(), src, llvm::MaybeAlign(),
+                    reg->size);
+  }
+}
+
+}  // namespace
 
 void OptimizeModule(const remill::Arch *arch, llvm::Module *module,
                     std::function<llvm::Function *(void)> generator,
                     OptimizationGuide guide) {
+  static const Timer optimize_timer("optimizer.optimize_module");
+  ScopedTimer timer(optimize_timer);
+
+  std::vector<llvm::Function *> traces;
+  while (auto func = generator()) {
+    traces.push_back(func);
+  }
+
   OptimizeBareModule(module, guide);
+
+  // Tag the `State` accesses that came from inlined semantics functions so
+  // that `RegisterAA` can reason about them in later optimizations.
+  if (guide.register_alias_analysis) {
+    for (auto func : traces) {
+      AnnotateRegisterAccesses(arch, func);
+    }
+  }
+
+  if (guide.promote_registers) {
+    for (auto func : traces) {
+      PromoteRegistersToSSA(arch, func);
+    }
+  }
+}
+
+// Promote the architectural registers accessed by the lifted function `func`
+// into SSA values.
+bool PromoteRegistersToSSA(const remill::Arch *arch, llvm::Function *func) {
+  if (func->isDeclaration()) {
+    return false;
+  }
+
+  // Lifted functions stash the state pointer into the `STATE` variable, and
+  // the inlined semantics reload it from there. Get rid of those round trips
+  // so that all `State` accesses are rooted at the state pointer argument.
+  const auto promoted_vars = RunFunctionPasses(
+      func, [](llvm::FunctionPassManager &fpm) {
+        fpm.addPass(llvm::PromotePass());
+      });
+
+  const auto state_ptr = NthArgument(func, kStatePointerArgNum);
+  const auto &dl = func->getParent()->getDataLayout();
+  const auto index_size = dl.getIndexSizeInBits(0);
+
+  std::vector<PromotableAccess> accesses;
+  std::vector<SyncPoint> sync_points;
+
+  // Find every use of `State`, tracking the byte offset into the structure
+  // for as long as it is known.
+  std::vector<std::pair<llvm::Value *, std::optional<int64_t>>> work_list;
+  work_list.emplace_back(state_ptr, 0);
+
+  while (!work_list.empty()) {
+    const auto [ptr, offset] = work_list.back();
+    work_list.pop_back();
+
+    for (auto &use : ptr->uses()) {
+      const auto user = use.getUser();
+
+      if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(user)) {
+        llvm::APInt gep_offset(index_size, 0, false);
+        if (offset && gep->accumulateConstantOffset(dl, gep_offset)) {
+          work_list.emplace_back(gep, *offset + gep_offset.getSExtValue());
+        } else {
+          work_list.emplace_back(gep, std::nullopt);
+        }
+
+      } else if (llvm::isa<llvm::BitCastOperator>(user) ||
+                 llvm::isa<llvm::AddrSpaceCastOperator>(user)) {
+        work_list.emplace_back(user, offset);
+
+      } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(user)) {
+        const auto size = dl.getTypeStoreSize(load->getType()).getFixedValue();
+        const Register *reg = nullptr;
+        if (offset && load->isSimple()) {
+          reg = EnclosingRegisterAt(arch, *offset, size);
+        }
+        if (reg) {
+          accesses.push_back({load, reg, static_cast<uint64_t>(*offset)});
+        } else {
+          sync_points.push_back({load, false});
+        }
+
+      } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+
+        // The pointer itself is being stored somewhere, and so it could be
+        // used by anything.
+        if (use.getOperandNo() != store->getPointerOperandIndex()) {
+          DLOG(WARNING) << "Not promoting registers in "
+                        << func->getName().str()
+                        << ": state pointer escapes via "
+                        << LLVMThingToString(store);
+          return promoted_vars;
+        }
+
+        const auto size =
+            dl.getTypeStoreSize(store->getValueOperand()->getType())
+                .getFixedValue();
+        const Register *reg = nullptr;
+        if (offset && store->isSimple()) {
+          reg = EnclosingRegisterAt(arch, *offset, size);
+        }
+        if (reg) {
+          accesses.push_back({store, reg, static_cast<uint64_t>(*offset)});
+        } else {
+          sync_points.push_back({store, true});
+        }
+
+      } else if (auto call = llvm::dyn_cast<llvm::CallInst>(user)) {
+        sync_points.push_back({call, !call->onlyReadsMemory()});
+
+      // E.g. a `phi`, `select`, `ptrtoint`, or an `invoke`. We can't easily
+      // bound what happens to `State` through these.
+      } else {
+        DLOG(WARNING) << "Not promoting registers in " << func->getName().str()
+                      << ": unsupported use of state pointer "
+                      << LLVMThingToString(user);
+        return promoted_vars;
+      }
+    }
+  }
+
+  if (accesses.empty()) {
+    return promoted_vars;
+  }
+
+  // Order the promoted registers by their `State` offset so that the output
+  // is deterministic.
+  std::map<uint64_t, const Register *> regs;
+  for (const auto &access : accesses) {
+    regs.emplace(access.reg->offset, access.reg);
+  }
+
+  auto &entry_block = func->getEntryBlock();
+  llvm::IRBuilder<> ir(&entry_block, entry_block.getFirstInsertionPt());
+
+  // Make a stack-allocated copy of every promoted register, as well as
+  // pointers to the registers in `State`. Both of these are created in the
+  // entry block so that they dominate all uses. The stack copies are loaded
+  // from `State` before anything else happens in the function.
+  const auto byte_type = llvm::Type::getInt8Ty(func->getContext());
+  std::unordered_map<const Register *,
+                     std::pair<llvm::AllocaInst *, llvm::Value *>>
+      promoted;
+  for (auto [reg_offset, reg] : regs) {
+    (void) reg_offset;
+    auto var = ir.CreateAlloca(reg->type, nullptr, reg->name + "_promoted");
+    promoted.emplace(reg, std::make_pair(var, nullptr));
+  }
+
+  for (auto [reg_offset, reg] : regs) {
+    (void) reg_offset;
+    auto &[var, reg_ptr] = promoted[reg];
+    reg_ptr = reg->AddressOf(state_ptr, ir);
+    CopyRegister(ir, reg, var, reg_ptr);
+  }
+
+  // Write every promoted register back into `State`.
+  auto flush = [&](llvm::Instruction *before) {
+    ir.SetInsertPoint(before);
+    for (auto [reg_offset, reg] : regs) {
+      (void) reg_offset;
+      const auto &[var, reg_ptr] = promoted[reg];
+      CopyRegister(ir, reg, reg_ptr, var);
+    }
+  };
+
+  // Re-read every promoted register from `State`.
+  auto reload = [&](llvm::Instruction *before) {
+    ir.SetInsertPoint(before);
+    for (auto [reg_offset, reg] : regs) {
+      (void) reg_offset;
+      const auto &[var, reg_ptr] = promoted[reg];
+      CopyRegister(ir, reg, var, reg_ptr);
+    }
+  };
+
+  // Redirect the register accesses to the stack-allocated copies.
+  for (const auto &access : accesses) {
+    const auto &[var, reg_ptr] = promoted[access.reg];
+    ir.SetInsertPoint(access.inst);
+    auto var_ptr = ir.CreateConstInBoundsGEP1_64(
+        byte_type, var, access.offset - access.reg->offset);
+
+    if (auto load = llvm::dyn_cast<llvm::LoadInst>(access.inst)) {
+      load->setOperand(load->getPointerOperandIndex(), var_ptr);
+    } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(access.inst)) {
+      store->setOperand(store->getPointerOperandIndex(), var_ptr);
+    }
+  }
+
+  std::unordered_set<llvm::Instruction *> seen_sync_points;
+  for (const auto &sync : sync_points) {
+    if (!seen_sync_points.insert(sync.inst).second) {
+      continue;
+    }
+
+    flush(sync.inst);
+
+    // Nothing after a `musttail` call (or a tail-call that immediately
+    // returns) can observe the reloaded registers.
+    const auto next_inst = sync.inst->getNextNode();
+    if (!sync.may_write || !next_inst ||
+        llvm::isa<llvm::ReturnInst>(next_inst)) {
+      continue;
+    }
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(sync.inst);
+        call && call->isMustTailCall()) {
+      continue;
+    }
+    reload(next_inst);
+  }
+
+  // Write the registers back before each return. If the return immediately
+  // follows a sync point, e.g. `ret` after a call to `__remill_jump` or to
+  // another lifted function, then the registers were already written back
+  // before the sync point, and the callee may have since updated `State`;
+  // writing back again would clobber its updates with stale values.
+  for (auto &block : *func) {
+    auto ret = llvm::dyn_cast<llvm::ReturnInst>(block.getTerminator());
+    if (!ret) {
+      continue;
+    }
+
+    const auto prev_inst = ret->getPrevNode();
+    if (prev_inst && seen_sync_points.count(prev_inst)) {
+      continue;
+    }
+
+    // Nothing may come between a `musttail` call and its `ret`.
+    if (auto call = llvm::dyn_cast_or_null<llvm::CallInst>(prev_inst);
+        call && call->isMustTailCall()) {
+      flush(call);
+    } else {
+      flush(ret);
+    }
+  }
+
+  // Turn the stack-allocated registers into SSA values. SROA takes care of
+  // slicing the enclosing registers to match sub-register accesses.
+  RunFunctionPasses(func, [](llvm::FunctionPassManager &fpm) {
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(16, 0)
+    fpm.addPass(llvm::SROAPass());
+#else
+    fpm.addPass(llvm::SROAPass(llvm::SROAOptions::ModifyCFG));
+#endif
+    fpm.addPass(llvm::EarlyCSEPass(true /* UseMemorySSA */));
+  });
+
+  return true;
 }
 
 // Optimize a normal module. This might not contain special Remill-specific
 // intrinsics functions like `__remill_jump`, etc.
 void OptimizeBareModule(llvm::Module *module, OptimizationGuide guide) {
+  static const Timer optimize_timer("optimizer.optimize_bare_module");
+  ScopedTimer timer(optimize_timer);
 
   llvm::ModuleAnalysisManager mam;
   llvm::FunctionAnalysisManager fam;
@@ -70,6 +417,9 @@ void OptimizeBareModule(llvm::Module *module, OptimizationGuide guide) {
   opts.InlinerThreshold = 250;
   llvm::PassBuilder pb(nullptr, opts);
 
+  if (guide.register_alias_analysis) {
+    AddRegisterAliasAnalysis(pb, fam);
+  }
   pb.registerModuleAnalyses(mam);
   pb.registerFunctionAnalyses(fam);
   pb.registerLoopAnalyses(lam);
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "remill/BC/RegisterAlias.h"
+
+#include <glog/logging.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/Passes/PassBuilder.h>
+
+#include <utility>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/Util.h"
+
+namespace remill {
+
+llvm::AnalysisKey RegisterAA::Key;
+
+// Returns the metadata kind ID of `!remill_register_alias`.
+unsigned RegisterAliasMdID(llvm::LLVMContext &context) {
+  return context.getMDKindID("remill_register_alias");
+}
+
+llvm::MDNode *RegisterAliasMetadata(const Register *reg, uint64_t offset) {
+  auto &context = reg->type->getContext();
+  const auto enclosing = reg->EnclosingRegister();
+  const auto i64 = llvm::Type::getInt64Ty(context);
+  llvm::Metadata *fields[] = {
+      llvm::MDString::get(context, enclosing->name),
+      llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(i64, offset)),
+      llvm::ConstantAsMetadata::get(
+          llvm::ConstantInt::get(i64, enclosing->offset)),
+      llvm::ConstantAsMetadata::get(
+          llvm::ConstantInt::get(i64, enclosing->size))};
+  return llvm::MDNode::get(context, fields);
+}
+
+// Returns the byte offset into `State` of `ptr`, as described by the
+// `!remill_register_alias` metadata attached to `ptr`, or to the nearest
+// pointer from which `ptr` is derived by constant offsets.
+std::optional<int64_t> RegisterAliasOffset(const llvm::DataLayout &dl,
+                                           llvm::Value *ptr) {
+  const auto md_id = RegisterAliasMdID(ptr->getContext());
+  int64_t total_offset = 0;
+
+  while (ptr) {
+    if (auto inst = llvm::dyn_cast<llvm::Instruction>(ptr)) {
+      if (auto md = inst->getMetadata(md_id); md && md->getNumOperands() > 1) {
+        auto offset = llvm::mdconst::dyn_extract<llvm::ConstantInt>(
+            md->getOperand(1));
+        if (!offset) {
+          return std::nullopt;
+        }
+        return offset->getSExtValue() + total_offset;
+      }
+    }
+
+    if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(ptr)) {
+      llvm::APInt gep_offset(dl.getIndexSizeInBits(0), 0, false);
+      if (!gep->accumulateConstantOffset(dl, gep_offset)) {
+        return std::nullopt;
+      }
+      total_offset += gep_offset.getSExtValue();
+      ptr = gep->getPointerOperand();
+
+    } else if (auto bc = llvm::dyn_cast<llvm::BitCastOperator>(ptr)) {
+      ptr = bc->getOperand(0);
+
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  return std::nullopt;
+}
+
+// Tag every `getelementptr` in `func` that indexes to a constant offset of a
+// register in the `State` structure.
+unsigned AnnotateRegisterAccesses(const Arch *arch, llvm::Function *func) {
+  if (func->isDeclaration()) {
+    return 0;
+  }
+
+  const auto md_id = RegisterAliasMdID(func->getContext());
+  const auto &dl = func->getParent()->getDataLayout();
+  const auto index_size = dl.getIndexSizeInBits(0);
+  auto num_tagged = 0u;
+
+  std::vector<std::pair<llvm::Value *, int64_t>> work_list;
+  work_list.emplace_back(NthArgument(func, kStatePointerArgNum), 0);
+
+  while (!work_list.empty()) {
+    const auto [ptr, offset] = work_list.back();
+    work_list.pop_back();
+
+    for (auto user : ptr->users()) {
+      if (auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(user)) {
+        llvm::APInt gep_offset(index_size, 0, false);
+        if (!gep->accumulateConstantOffset(dl, gep_offset)) {
+          continue;
+        }
+
+        const auto gep_state_offset = offset + gep_offset.getSExtValue();
+        work_list.emplace_back(gep, gep_state_offset);
+
+        if (gep_state_offset < 0 || gep->getMetadata(md_id)) {
+          continue;
+        }
+
+        const auto reg = arch->RegisterAtStateOffset(
+            static_cast<uint64_t>(gep_state_offset));
+        if (!reg) {
+          continue;
+        }
+
+        gep->setMetadata(
+            md_id, RegisterAliasMetadata(
+                       reg, static_cast<uint64_t>(gep_state_offset)));
+        ++num_tagged;
+
+      } else if (auto bc = llvm::dyn_cast<llvm::BitCastInst>(user)) {
+        work_list.emplace_back(bc, offset);
+      }
+    }
+  }
+
+  return num_tagged;
+}
+
+namespace {
+
+// Returns the `State` structure into which `ptr` points, if it is the same
+// object everywhere in the function, e.g. the state pointer argument, or a
+// stack-allocated copy of `State`. Two offsets into `State` can only be
+// compared if they are relative to the same such object.
+static const llvm::Value *StateObject(const llvm::Value *ptr) {
+  const auto base = llvm::getUnderlyingObject(ptr);
+  if (llvm::isa<llvm::Argument>(base) || llvm::isa<llvm::AllocaInst>(base) ||
+      llvm::isa<llvm::GlobalVariable>(base)) {
+    return base;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+llvm::AliasResult RegisterAAResult::alias(const llvm::MemoryLocation &loc_a,
+                                          const llvm::MemoryLocation &loc_b,
+                                          llvm::AAQueryInfo &aaqi
+#if LLVM_VERSION_NUMBER >= LLVM_VERSION(17, 0)
+                                          ,
+                                          const llvm::Instruction *ctx_inst
+#endif
+) {
+
+  // We can only reason about precisely sized accesses.
+  if (!loc_a.Size.hasValue() || !loc_b.Size.hasValue()) {
+    return llvm::AliasResult::MayAlias;
+  }
+
+  const auto offset_a =
+      RegisterAliasOffset(dl, const_cast<llvm::Value *>(loc_a.Ptr));
+  if (!offset_a) {
+    return llvm::AliasResult::MayAlias;
+  }
+
+  const auto offset_b =
+      RegisterAliasOffset(dl, const_cast<llvm::Value *>(loc_b.Ptr));
+  if (!offset_b) {
+    return llvm::AliasResult::MayAlias;
+  }
+
+  // The offsets are only comparable if they are into the same `State`
+  // structure. A function may see more than one, e.g. if it is passed two
+  // state pointers, or if it makes a copy of `State`.
+  const auto state_a = StateObject(loc_a.Ptr);
+  if (!state_a || state_a != StateObject(loc_b.Ptr)) {
+    return llvm::AliasResult::MayAlias;
+  }
+
+  // If the byte ranges don't overlap then the two accesses are to different
+  // registers, or different lanes of the same register.
+  const auto size_a = static_cast<int64_t>(loc_a.Size.getValue());
+  const auto size_b = static_cast<int64_t>(loc_b.Size.getValue());
+  if ((*offset_a + size_a) <= *offset_b || (*offset_b + size_b) <= *offset_a) {
+    return llvm::AliasResult::NoAlias;
+  }
+
+  return llvm::AliasResult::MayAlias;
+}
+
+RegisterAAResult RegisterAA::run(llvm::Function &func,
+                                 llvm::FunctionAnalysisManager &) {
+  return RegisterAAResult(func.getParent()->getDataLayout());
+}
+
+// Register `RegisterAA` with `fam`, and add it to the default alias analysis
+// pipeline of `pb`.
+void AddRegisterAliasAnalysis(llvm::PassBuilder &pb,
+                              llvm::FunctionAnalysisManager &fam) {
+  fam.registerPass([] { return RegisterAA(); });
+  fam.registerPass([&pb] {
+    auto aa = pb.buildDefaultAAPipeline();
+    aa.registerFunctionAnalysis<RegisterAA>();
+    return aa;
+  });
+}
+
+}  // namespace remill
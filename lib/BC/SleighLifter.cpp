@@ -17,6 +17,7 @@
 #include <glog/logging.h>
 #include <lib/Arch/Sleigh/Arch.h>
 #include <lib/Arch/Sleigh/ControlFlowStructuring.h>
+#include <lib/BC/InstructionLifter.h>
 #include <llvm/ADT/StringExtras.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constants.h>
@@ -34,6 +35,7 @@
 #include <remill/BC/IntrinsicTable.h>
 #include <remill/BC/PCodeCFG.h>
 #include <remill/BC/SleighLifter.h>
+#include <remill/BC/Statistics.h>
 #include <remill/BC/Util.h>
 
 #include <array>
@@ -352,6 +354,7 @@ class SleighLifter::PcodeToLLVMEmitIntoBlock {
   const Instruction &insn;
   LiftStatus status;
   SleighLifter &insn_lifter_parent;
+  ::Sleigh &engine;
 
 
   class UniqueRegSpace {
@@ -488,7 +491,8 @@ class SleighLifter::PcodeToLLVMEmitIntoBlock {
   PcodeToLLVMEmitIntoBlock(
       llvm::BasicBlock *target_block, llvm::Value *state_pointer,
       const Instruction &insn, SleighLifter &insn_lifter_parent,
-      std::vector<std::string> user_op_names_, llvm::BasicBlock *exit_block_,
+      ::Sleigh &engine_, std::vector<std::string> user_op_names_,
+      llvm::BasicBlock *exit_block_,
       const sleigh::MaybeBranchTakenVar &to_lift_btaken_,
       PcodeToLLVMEmitIntoBlock::DecodingContextConstants context_reg_lifter)
       : target_block(target_block),
@@ -497,6 +501,7 @@ class SleighLifter::PcodeToLLVMEmitIntoBlock {
         insn(insn),
         status(remill::LiftStatus::kLiftedInstruction),
         insn_lifter_parent(insn_lifter_parent),
+        engine(engine_),
         uniques(target_block->getContext()),
         unknown_regs(target_block->getContext()),
         user_op_names(user_op_names_),
@@ -563,7 +568,7 @@ class SleighLifter::PcodeToLLVMEmitIntoBlock {
 
     auto reg_ptr = this->unknown_regs.GetUniquePtr(
         target_vnode.offset, target_vnode.size, entry_bldr);
-    print_vardata(this->insn_lifter_parent.GetEngine(), ss, target_vnode);
+    print_vardata(this->engine, ss, target_vnode);
     DLOG(ERROR) << "Creating unique for unknown register: " << ss.str() << " "
                 << reg_ptr->getName().str();
 
@@ -586,8 +591,8 @@ class SleighLifter::PcodeToLLVMEmitIntoBlock {
 
       return this->CreateMemoryAddress(constant_offset, vnode);
     } else if (space_name == "register") {
-      auto reg_name = this->insn_lifter_parent.GetEngine().getRegisterName(
-          vnode.space, vnode.offset, vnode.size);
+      auto reg_name = this->engine.getRegisterName(vnode.space, vnode.offset,
+                                                   vnode.size);
 
       DLOG(INFO) << "Looking for reg name " << reg_name << " from offset "
                  << vnode.offset;
@@ -1447,6 +1452,11 @@ class SleighLifter::PcodeToLLVMEmitIntoBlock {
   void LiftPcodeOp(llvm::IRBuilder<> &bldr, OpCode opc,
                    std::optional<VarnodeData> outvar, VarnodeData *vars,
                    int4 isize) {
+    static const StatisticArray num_pcode_ops(
+        "sleigh.pcode_ops", OpCode::CPUI_MAX,
+        [](unsigned key) { return std::string(get_opname(OpCode(key))); });
+    num_pcode_ops.Add(opc);
+
     // The MULTIEQUAL op has variadic operands
     if (opc == OpCode::CPUI_MULTIEQUAL || opc == OpCode::CPUI_CPOOLREF) {
       this->UpdateStatus(this->LiftVariadicOp(bldr, opc, outvar, vars, isize),
@@ -1650,8 +1660,6 @@ SleighLifter::SleighLifter(const remill::Arch &arch_,
                            const remill::sleigh::SleighDecoder &dec_,
                            const IntrinsicTable &intrinsics_)
     : InstructionLifter(&arch_, intrinsics_),
-      sleigh_context(new sleigh::SingleInstructionSleighContext(
-          dec_.GetSLAName(), dec_.GetPSpec())),
       decoder(dec_) {}
 
 
@@ -1702,14 +1710,17 @@ SleighLifter::LiftIntoInternalBlockWithSleighState(
     const sleigh::MaybeBranchTakenVar &btaken,
     const ContextValues &context_values) {
 
-  this->sleigh_context->resetContext();
-  this->decoder.InitializeSleighContext(inst.pc, *this->sleigh_context,
+  // Many threads can lift at once, so lease a context of our own.
+  auto sleigh_context = this->decoder.AcquireContext();
+  auto &engine = sleigh_context->GetEngine();
+  sleigh_context->resetContext();
+  this->decoder.InitializeSleighContext(inst.pc, *sleigh_context,
                                         context_values);
 
-  sleigh::PcodeDecoder pcode_record(this->GetEngine());
+  sleigh::PcodeDecoder pcode_record(engine);
   sleigh_context->oneInstruction(inst.pc, pcode_record, inst.bytes);
   for (const auto &op : pcode_record.ops) {
-    DLOG(INFO) << "Pcodeop: " << DumpPcode(this->GetEngine(), op);
+    DLOG(INFO) << "Pcodeop: " << DumpPcode(engine, op);
   }
 
   DLOG(INFO) << "Secondary lift of bytes: " << llvm::toHex(inst.bytes);
@@ -1743,8 +1754,8 @@ SleighLifter::LiftIntoInternalBlockWithSleighState(
                               target_block);
 
   SleighLifter::PcodeToLLVMEmitIntoBlock lifter(
-      target_block, internal_state_pointer, inst, *this,
-      this->sleigh_context->getUserOpNames(), exit_block, btaken,
+      target_block, internal_state_pointer, inst, *this, engine,
+      sleigh_context->getUserOpNames(), exit_block, btaken,
       std::move(decoding_context_lifter));
 
 
@@ -1834,10 +1845,6 @@ LiftStatus SleighLifter::LiftIntoBlockWithSleighState(
   return res.first;
 }
 
-Sleigh &SleighLifter::GetEngine(void) const {
-  return this->sleigh_context->GetEngine();
-}
-
 SleighLifterWithState::SleighLifterWithState(
     sleigh::MaybeBranchTakenVar btaken_, ContextValues context_values_,
     std::shared_ptr<SleighLifter> lifter_)
@@ -1850,8 +1857,8 @@ SleighLifterWithState::SleighLifterWithState(
 LiftStatus
 SleighLifterWithState::LiftIntoBlock(Instruction &inst, llvm::BasicBlock *block,
                                      llvm::Value *state_ptr, bool is_delayed) {
-  return this->lifter->LiftIntoBlockWithSleighState(
-      inst, block, state_ptr, is_delayed, this->btaken, this->context_values);
+  return RecordLiftStatus(this->lifter->LiftIntoBlockWithSleighState(
+      inst, block, state_ptr, is_delayed, this->btaken, this->context_values));
 }
 
 
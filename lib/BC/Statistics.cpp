@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "remill/BC/Statistics.h"
+
+#include <glog/logging.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace remill {
+namespace detail {
+
+std::atomic<bool> gStatisticsEnabled{false};
+
+}  // namespace detail
+namespace {
+
+// Slots are allocated to threads in chunks, so that a thread only pays for
+// the statistics that exist, and so that registering a new statistic never
+// moves the slots that other threads are writing to.
+static constexpr unsigned kSlotsPerChunk = 1024u;
+static constexpr unsigned kMaxNumChunks = 64u;
+static constexpr unsigned kMaxNumSlots = kSlotsPerChunk * kMaxNumChunks;
+
+// Bucket `0` counts zeroes, and bucket `i` counts values in
+// `[2^(i-1), 2^i)`. The last slot holds the sum of all values.
+static constexpr unsigned kNumHistogramBuckets = 65u;
+static constexpr unsigned kNumHistogramSlots = kNumHistogramBuckets + 1u;
+
+// The first slot of a timer counts the timed scopes, and the second holds the
+// total number of nanoseconds spent in them.
+static constexpr unsigned kNumTimerSlots = 2u;
+
+enum class StatisticKind { kCounter, kCounterArray, kHistogram, kTimer };
+
+struct StatisticInfo {
+  std::string name;
+  StatisticKind kind;
+  unsigned first_slot;
+  unsigned num_slots;
+
+  // Names of the keys of a `StatisticArray`.
+  std::vector<std::string> key_names;
+};
+
+struct Chunk {
+  std::atomic<uint64_t> slots[kSlotsPerChunk];
+};
+
+// The slots of one thread. Only the owning thread writes to its slots, and
+// so it can use plain loads and stores rather than read-modify-writes. Other
+// threads only read the slots, when merging.
+class ThreadSlots {
+ public:
+  ~ThreadSlots(void) {
+    for (auto &chunk : chunks) {
+      delete chunk.load(std::memory_order_relaxed);
+    }
+  }
+
+  inline void Add(unsigned slot, uint64_t amount) {
+    auto &chunk_ref = chunks[slot / kSlotsPerChunk];
+    auto chunk = chunk_ref.load(std::memory_order_relaxed);
+    if (!chunk) {
+      chunk = new Chunk();
+      for (auto &val : chunk->slots) {
+        val.store(0u, std::memory_order_relaxed);
+      }
+      chunk_ref.store(chunk, std::memory_order_release);
+    }
+    auto &val = chunk->slots[slot % kSlotsPerChunk];
+    val.store(val.load(std::memory_order_relaxed) + amount,
+              std::memory_order_relaxed);
+  }
+
+  inline uint64_t Read(unsigned slot) const {
+    auto chunk = chunks[slot / kSlotsPerChunk].load(std::memory_order_acquire);
+    if (!chunk) {
+      return 0u;
+    }
+    return chunk->slots[slot % kSlotsPerChunk].load(std::memory_order_relaxed);
+  }
+
+  void Reset(void) {
+    for (auto &chunk_ref : chunks) {
+      if (auto chunk = chunk_ref.load(std::memory_order_acquire)) {
+        for (auto &val : chunk->slots) {
+          val.store(0u, std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+
+ private:
+  std::atomic<Chunk *> chunks[kMaxNumChunks] = {};
+};
+
+class Registry {
+ public:
+  // NOTE(pag): The registry is never destroyed, so that threads that exit
+  //            during static destruction can still detach from it.
+  static Registry &Get(void) {
+    static Registry *const registry = new Registry;
+    return *registry;
+  }
+
+  unsigned Register(std::string_view name, StatisticKind kind,
+                    unsigned num_slots,
+                    std::vector<std::string> key_names = {}) {
+    std::lock_guard<std::mutex> locker(lock);
+    std::string name_str(name.data(), name.size());
+    auto it = index.find(name_str);
+    if (it != index.end()) {
+      const auto &info = stats[it->second];
+      CHECK(info.kind == kind && info.num_slots == num_slots)
+          << "Statistic " << name_str
+          << " was registered twice with different kinds";
+      return info.first_slot;
+    }
+
+    CHECK_LE(next_slot + num_slots, kMaxNumSlots)
+        << "Too many statistics registered";
+
+    const auto first_slot = next_slot;
+    next_slot += num_slots;
+    index.emplace(name_str, stats.size());
+    stats.push_back(
+        {std::move(name_str), kind, first_slot, num_slots,
+         std::move(key_names)});
+    return first_slot;
+  }
+
+  ThreadSlots *Attach(void) {
+    auto slots = new ThreadSlots;
+    std::lock_guard<std::mutex> locker(lock);
+    threads.insert(slots);
+    return slots;
+  }
+
+  // Fold the slots of an exiting thread into `retired`.
+  void Detach(ThreadSlots *slots) {
+    std::lock_guard<std::mutex> locker(lock);
+    retired.resize(next_slot, 0u);
+    for (auto i = 0u; i < next_slot; ++i) {
+      retired[i] += slots->Read(i);
+    }
+    threads.erase(slots);
+    delete slots;
+  }
+
+  // Sum the values of `num_slots` slots, starting at `first_slot`, across
+  // all threads, into `vals`.
+  void Sum(unsigned first_slot, unsigned num_slots,
+           std::vector<uint64_t> &vals) {
+    vals.assign(num_slots, 0u);
+    for (auto i = 0u; i < num_slots; ++i) {
+      const auto slot = first_slot + i;
+      if (slot < retired.size()) {
+        vals[i] = retired[slot];
+      }
+      for (auto thread : threads) {
+        vals[i] += thread->Read(slot);
+      }
+    }
+  }
+
+  std::mutex lock;
+  std::vector<StatisticInfo> stats;
+  std::unordered_map<std::string, size_t> index;
+  unsigned next_slot{0};
+  std::unordered_set<ThreadSlots *> threads;
+
+  // Summed slots of threads that have exited.
+  std::vector<uint64_t> retired;
+};
+
+// Attaches the current thread's slots to the registry on first use, and
+// folds them into the registry when the thread exits.
+struct ThreadSlotsHandle {
+  ~ThreadSlotsHandle(void) {
+    if (slots) {
+      Registry::Get().Detach(slots);
+    }
+  }
+
+  ThreadSlots *slots{nullptr};
+};
+
+static thread_local ThreadSlotsHandle gThreadSlots;
+
+static std::vector<std::string>
+KeyNames(unsigned num_keys,
+         const std::function<std::string(unsigned)> &key_name) {
+  std::vector<std::string> names;
+  names.reserve(num_keys);
+  for (auto i = 0u; i < num_keys; ++i) {
+    names.push_back(key_name(i));
+  }
+  return names;
+}
+
+}  // namespace
+namespace detail {
+
+void AddToStatistic(unsigned slot, uint64_t amount) {
+  auto &handle = gThreadSlots;
+  if (!handle.slots) {
+    handle.slots = Registry::Get().Attach();
+  }
+  handle.slots->Add(slot, amount);
+}
+
+void RecordInHistogram(unsigned first_slot, uint64_t value) {
+  const auto bucket = value ? llvm::Log2_64(value) + 1u : 0u;
+  AddToStatistic(first_slot + bucket, 1u);
+  AddToStatistic(first_slot + kNumHistogramBuckets, value);
+}
+
+}  // namespace detail
+
+void EnableStatistics(bool enabled) {
+  detail::gStatisticsEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+Statistic::Statistic(std::string_view name)
+    : slot(Registry::Get().Register(name, StatisticKind::kCounter, 1u)) {}
+
+StatisticArray::StatisticArray(
+    std::string_view name, unsigned num_keys_,
+    const std::function<std::string(unsigned)> &key_name)
+    : first_slot(Registry::Get().Register(name, StatisticKind::kCounterArray,
+                                          num_keys_,
+                                          KeyNames(num_keys_, key_name))),
+      num_keys(num_keys_) {}
+
+Histogram::Histogram(std::string_view name)
+    : first_slot(Registry::Get().Register(name, StatisticKind::kHistogram,
+                                          kNumHistogramSlots)) {}
+
+Timer::Timer(std::string_view name)
+    : first_slot(Registry::Get().Register(name, StatisticKind::kTimer,
+                                          kNumTimerSlots)) {}
+
+uint64_t ReadStatistic(std::string_view name) {
+  auto &registry = Registry::Get();
+  std::lock_guard<std::mutex> locker(registry.lock);
+  std::vector<uint64_t> vals;
+
+  // Try to find a whole statistic first, then try to find one key of a
+  // counter array.
+  auto it = registry.index.find(std::string(name.data(), name.size()));
+  if (it != registry.index.end()) {
+    const auto &info = registry.stats[it->second];
+    registry.Sum(info.first_slot, info.num_slots, vals);
+    switch (info.kind) {
+      case StatisticKind::kCounter:
+      case StatisticKind::kTimer: return vals[0];
+      case StatisticKind::kCounterArray:
+      case StatisticKind::kHistogram: {
+        const auto num_vals = info.kind == StatisticKind::kHistogram
+                                  ? kNumHistogramBuckets
+                                  : info.num_slots;
+        uint64_t total = 0u;
+        for (auto i = 0u; i < num_vals; ++i) {
+          total += vals[i];
+        }
+        return total;
+      }
+    }
+  }
+
+  for (const auto &info : registry.stats) {
+    if (info.kind != StatisticKind::kCounterArray ||
+        name.size() <= info.name.size() ||
+        name.substr(0, info.name.size()) != info.name ||
+        name[info.name.size()] != '.') {
+      continue;
+    }
+    const auto key = name.substr(info.name.size() + 1u);
+    for (auto i = 0u; i < info.key_names.size(); ++i) {
+      if (info.key_names[i] == key) {
+        registry.Sum(info.first_slot + i, 1u, vals);
+        return vals[0];
+      }
+    }
+  }
+
+  return 0u;
+}
+
+double ReadTimerSeconds(std::string_view name) {
+  auto &registry = Registry::Get();
+  std::lock_guard<std::mutex> locker(registry.lock);
+  auto it = registry.index.find(std::string(name.data(), name.size()));
+  if (it == registry.index.end()) {
+    return 0.0;
+  }
+
+  const auto &info = registry.stats[it->second];
+  if (info.kind != StatisticKind::kTimer) {
+    return 0.0;
+  }
+
+  std::vector<uint64_t> vals;
+  registry.Sum(info.first_slot, info.num_slots, vals);
+  return static_cast<double>(vals[1]) / 1e9;
+}
+
+void ResetStatistics(void) {
+  auto &registry = Registry::Get();
+  std::lock_guard<std::mutex> locker(registry.lock);
+  registry.retired.clear();
+  for (auto thread : registry.threads) {
+    thread->Reset();
+  }
+}
+
+void PrintStatisticsAsJSON(llvm::raw_ostream &os) {
+  auto &registry = Registry::Get();
+  std::lock_guard<std::mutex> locker(registry.lock);
+
+  // Sort by name so that dumps can be diffed.
+  std::map<std::string_view, const StatisticInfo *> sorted;
+  for (const auto &info : registry.stats) {
+    sorted.emplace(info.name, &info);
+  }
+
+  std::vector<uint64_t> vals;
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attributeObject("counters", [&] {
+      for (auto [name, info] : sorted) {
+        if (info->kind == StatisticKind::kCounter) {
+          registry.Sum(info->first_slot, 1u, vals);
+          json.attribute(name, vals[0]);
+
+        } else if (info->kind == StatisticKind::kCounterArray) {
+          registry.Sum(info->first_slot, info->num_slots, vals);
+          for (auto i = 0u; i < info->num_slots; ++i) {
+            if (vals[i]) {
+              json.attribute(info->name + "." + info->key_names[i], vals[i]);
+            }
+          }
+        }
+      }
+    });
+
+    json.attributeObject("histograms", [&] {
+      for (auto [name, info] : sorted) {
+        if (info->kind != StatisticKind::kHistogram) {
+          continue;
+        }
+        registry.Sum(info->first_slot, info->num_slots, vals);
+        uint64_t count = 0u;
+        for (auto i = 0u; i < kNumHistogramBuckets; ++i) {
+          count += vals[i];
+        }
+        json.attributeObject(name, [&] {
+          json.attribute("count", count);
+          json.attribute("sum", vals[kNumHistogramBuckets]);
+          json.attributeArray("buckets", [&] {
+            for (auto i = 0u; i < kNumHistogramBuckets; ++i) {
+              if (!vals[i]) {
+                continue;
+              }
+              const uint64_t min = i ? (1ull << (i - 1u)) : 0u;
+              const uint64_t max =
+                  i ? (i == 64u ? ~0ull : (1ull << i) - 1u) : 0u;
+              json.object([&] {
+                json.attribute("min", min);
+                json.attribute("max", max);
+                json.attribute("count", vals[i]);
+              });
+            }
+          });
+        });
+      }
+    });
+
+    json.attributeObject("timers", [&] {
+      for (auto [name, info] : sorted) {
+        if (info->kind != StatisticKind::kTimer) {
+          continue;
+        }
+        registry.Sum(info->first_slot, info->num_slots, vals);
+        json.attributeObject(name, [&] {
+          json.attribute("count", vals[0]);
+          json.attribute("seconds", static_cast<double>(vals[1]) / 1e9);
+        });
+      }
+    });
+  });
+  os << '\n';
+}
+
+bool StoreStatisticsToFile(std::string_view file_name_) {
+  std::string file_name(file_name_.data(), file_name_.size());
+  std::error_code ec;
+  llvm::raw_fd_ostream os(file_name, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open " << file_name
+               << " for writing statistics: " << ec.message();
+    return false;
+  }
+  PrintStatisticsAsJSON(os);
+  os.close();
+  return !os.has_error();
+}
+
+}  // namespace remill
@@ -15,12 +15,17 @@
  */
 
 #include <glog/logging.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
 #include <llvm/IR/Instructions.h>
 #include <remill/Arch/Instruction.h>
+#include <remill/BC/ABI.h>
 #include <remill/BC/IntrinsicTable.h>
+#include <remill/BC/Statistics.h>
 #include <remill/BC/TraceLifter.h>
 #include <remill/BC/Util.h>
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <sstream>
@@ -52,6 +57,12 @@ void TraceManager::ForEachDevirtualizedTarget(
   // Must be extended.
 }
 
+// Try to get a view of the executable bytes starting at `addr`. An empty
+// view means that bytes must be read via `TryReadExecutableByte`.
+std::string_view TraceManager::TryReadExecutableBytes(uint64_t, size_t) {
+  return {};
+}
+
 // Figure out the name for the trace starting at address `addr`.
 std::string TraceManager::TraceName(uint64_t addr) {
   std::stringstream ss;
@@ -59,6 +70,13 @@ std::string TraceManager::TraceName(uint64_t addr) {
   return ss.str();
 }
 
+static constexpr std::string_view kInlineCachePrefix = "__remill_inline_cache.";
+
+// Returns `true` if `global` is an inline cache emitted by the trace lifter.
+bool IsInlineCache(const llvm::GlobalVariable &global) {
+  return global.getName().startswith(kInlineCachePrefix);
+}
+
 namespace {
 
 using DecoderWorkList = std::set<uint64_t>;  // For ordering.
@@ -67,7 +85,7 @@ using DecoderWorkList = std::set<uint64_t>;  // For ordering.
 
 class TraceLifter::Impl {
  public:
-  Impl(const Arch *arch_, TraceManager *manager_);
+  Impl(const Arch *arch_, TraceManager *manager_, TraceLifterOptions options_);
 
   // Lift one or more traces starting from `addr`. Calls `callback` with each
   // lifted trace.
@@ -91,6 +109,39 @@ class TraceLifter::Impl {
   //       within `module`.
   llvm::Function *GetLiftedTraceDefinition(uint64_t addr);
 
+  // Emit an inline cache for the control-flow transfer to `NEXT_PC` at the
+  // end of `block`. Hits on the inline cache of a function call branch to
+  // `call_cont`. Returns the block in which to perform the transfer when
+  // none of the entries match.
+  llvm::BasicBlock *AddInlineCache(llvm::BasicBlock *block,
+                                   InlineCacheKind kind,
+                                   llvm::BasicBlock *call_cont = nullptr);
+
+  // Call the function at `NEXT_PC` from `block`, going through an inline
+  // cache if they are enabled. Returns the block following the call.
+  llvm::BasicBlock *AddIndirectFunctionCall(llvm::BasicBlock *block);
+
+  // Tail-call `intrinsic` to transfer control to `NEXT_PC`, going through an
+  // inline cache if they are enabled.
+  void AddIndirectTailCall(llvm::BasicBlock *block, InlineCacheKind kind,
+                           llvm::Function *intrinsic);
+
+  // Push `RETURN_PC` onto the shadow return stack at the end of `block`.
+  // Returns the old depth of the stack, or `nullptr` if the shadow return
+  // stack is disabled.
+  llvm::Value *PushReturnAddress(llvm::BasicBlock *block);
+
+  // Restore the depth of the shadow return stack after a function call.
+  void PopReturnAddress(llvm::BasicBlock *block, llvm::Value *old_depth);
+
+  // Return directly if `NEXT_PC` matches the top of the shadow return stack.
+  // Returns the block in which to call `__remill_function_return` when it
+  // doesn't.
+  llvm::BasicBlock *AddShadowReturn(llvm::BasicBlock *block);
+
+  // Returns the type of `__remill_shadow_return_stack`.
+  llvm::StructType *ShadowReturnStackType(void) const;
+
   llvm::BasicBlock *GetOrCreateBlock(uint64_t block_pc) {
     auto &block = blocks[block_pc];
     if (!block) {
@@ -136,6 +187,7 @@ class TraceLifter::Impl {
   llvm::Module *const module;
   const uint64_t addr_mask;
   TraceManager &manager;
+  const TraceLifterOptions options;
 
   llvm::Function *func;
   llvm::BasicBlock *block;
@@ -149,22 +201,31 @@ class TraceLifter::Impl {
   std::map<uint64_t, llvm::BasicBlock *> blocks;
 };
 
-TraceLifter::Impl::Impl(const Arch *arch_, TraceManager *manager_)
+TraceLifter::Impl::Impl(const Arch *arch_, TraceManager *manager_,
+                        TraceLifterOptions options_)
     : arch(arch_),
       intrinsics(arch->GetInstrinsicTable()),
       word_type(arch->AddressType()),
       context(word_type->getContext()),
       module(intrinsics->async_hyper_call->getParent()),
-      addr_mask(arch->address_size >= 64 ? ~0ULL
-                                         : (~0ULL >> arch->address_size)),
+      addr_mask(arch->address_size >= 64
+                    ? ~0ULL
+                    : ((1ULL << arch->address_size) - 1ULL)),
       manager(*manager_),
+      options(options_),
       func(nullptr),
       block(nullptr),
       switch_inst(nullptr),
       // TODO(Ian): The trace lfiter is not supporting contexts
-      max_inst_bytes(arch->MaxInstructionSize(arch->CreateInitialContext())) {
+      max_inst_bytes(arch->MaxInstructionSize(arch->CreateInitialContext(),
+                                              options.fuse_idioms)) {
 
   inst_bytes.reserve(max_inst_bytes);
+
+  CHECK(!(options.shadow_return_stack_size &
+          (options.shadow_return_stack_size - 1u)))
+      << "Shadow return stack size " << options.shadow_return_stack_size
+      << " is not a power of two";
 }
 
 // Return an already lifted trace starting with the code at address
@@ -206,16 +267,296 @@ llvm::Function *TraceLifter::Impl::GetLiftedTraceDefinition(uint64_t addr) {
   return extern_func;
 }
 
+// Emit an inline cache for the control-flow transfer to `NEXT_PC` at the
+// end of `block`.
+llvm::BasicBlock *
+TraceLifter::Impl::AddInlineCache(llvm::BasicBlock *block, InlineCacheKind kind,
+                                  llvm::BasicBlock *call_cont) {
+  if (!options.inline_cache_size) {
+    return block;
+  }
+
+  std::set<uint64_t> local_targets;
+  std::vector<uint64_t> trace_targets;
+  manager.ForEachDevirtualizedTarget(
+      inst, [&](uint64_t target, DevirtualizedTargetKind target_kind) {
+        target &= addr_mask;
+        if (kind == InlineCacheKind::kJump &&
+            target_kind == DevirtualizedTargetKind::kTraceLocal) {
+          local_targets.insert(target);
+        } else if (std::find(trace_targets.begin(), trace_targets.end(),
+                             target) == trace_targets.end()) {
+          trace_targets.push_back(target);
+        }
+      });
+
+  const auto next_pc = LoadNextProgramCounter(block, *intrinsics);
+
+  // Trace-local targets of a jump are branched to directly.
+  if (!local_targets.empty()) {
+    const auto ic_block = llvm::BasicBlock::Create(context, "", func);
+    const auto local_switch = llvm::SwitchInst::Create(
+        next_pc, ic_block, static_cast<unsigned>(local_targets.size()), block);
+    for (auto target : local_targets) {
+      inst_work_list.insert(target);
+      local_switch->addCase(llvm::cast<llvm::ConstantInt>(
+                                llvm::ConstantInt::get(word_type, target)),
+                            GetOrCreateBlock(target));
+    }
+    block = ic_block;
+  }
+
+  const auto i32_type = llvm::Type::getInt32Ty(context);
+  const auto i64_type = llvm::Type::getInt64Ty(context);
+  const auto func_ptr_type = func->getType();
+  const auto entry_type =
+      llvm::StructType::get(context, {i64_type, func_ptr_type});
+  const auto num_entries = options.inline_cache_size;
+  const auto entries_type = llvm::ArrayType::get(entry_type, num_entries);
+  const auto ic_type =
+      llvm::StructType::get(context, {i64_type, i64_type, i32_type, i32_type,
+                                      i64_type, entries_type});
+
+  // Seed the entries with the devirtualized trace heads, which we'll go and
+  // lift, just like the targets of direct function calls.
+  std::vector<llvm::Constant *> entries;
+  for (auto target : trace_targets) {
+    if (entries.size() == num_entries) {
+      DLOG(WARNING) << "Dropping devirtualized target " << std::hex << target
+                    << " of instruction at " << inst.pc << std::dec
+                    << " from full inline cache";
+      continue;
+    }
+    trace_work_list.insert(target);
+    llvm::Function *target_trace = GetLiftedTraceDeclaration(target);
+    if (!target_trace) {
+      target_trace =
+          arch->DeclareLiftedFunction(manager.TraceName(target), module);
+    }
+    entries.push_back(llvm::ConstantStruct::get(
+        entry_type, {llvm::ConstantInt::get(i64_type, target), target_trace}));
+  }
+
+  while (entries.size() < num_entries) {
+    entries.push_back(llvm::ConstantStruct::get(
+        entry_type,
+        {llvm::ConstantInt::get(i64_type, kEmptyInlineCacheEntry),
+         llvm::Constant::getNullValue(func_ptr_type)}));
+  }
+
+  llvm::Constant *ic_fields[] = {
+      llvm::ConstantInt::get(i64_type, 0),
+      llvm::ConstantInt::get(i64_type, 0),
+      llvm::ConstantInt::get(i32_type, static_cast<uint32_t>(kind)),
+      llvm::ConstantInt::get(i32_type, num_entries),
+      llvm::ConstantInt::get(i64_type, inst.pc),
+      llvm::ConstantArray::get(entries_type, entries)};
+
+  std::stringstream ss;
+  ss << kInlineCachePrefix << func->getName().str() << '.' << std::hex
+     << inst.pc;
+
+  const auto ic = new llvm::GlobalVariable(
+      *module, ic_type, false, llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantStruct::get(ic_type, ic_fields), ss.str());
+
+  // Increment the hit or miss counter.
+  auto count = [&](llvm::IRBuilder<> &ir, unsigned field) {
+    const auto counter = ir.CreateStructGEP(ic_type, ic, field);
+    ir.CreateStore(
+        ir.CreateAdd(ir.CreateLoad(i64_type, counter), ir.getInt64(1)),
+        counter);
+  };
+
+  const auto miss_block = llvm::BasicBlock::Create(context, "", func);
+
+  llvm::IRBuilder<> ir(block);
+  const auto target_pc = ir.CreateZExtOrTrunc(next_pc, i64_type);
+
+  for (auto i = 0u; i < num_entries; ++i) {
+    const auto hit_block = llvm::BasicBlock::Create(context, "", func);
+    const auto next_block = (i + 1u) < num_entries
+                                ? llvm::BasicBlock::Create(context, "", func)
+                                : miss_block;
+
+    llvm::Value *entry_pc_indexes[] = {ir.getInt32(0), ir.getInt32(5),
+                                       ir.getInt32(i), ir.getInt32(0)};
+    const auto entry_pc = ir.CreateLoad(
+        i64_type, ir.CreateInBoundsGEP(ic_type, ic, entry_pc_indexes));
+    ir.CreateCondBr(ir.CreateICmpEQ(entry_pc, target_pc), hit_block,
+                    next_block);
+
+    ir.SetInsertPoint(hit_block);
+    count(ir, 0);
+    llvm::Value *entry_target_indexes[] = {ir.getInt32(0), ir.getInt32(5),
+                                           ir.getInt32(i), ir.getInt32(1)};
+    const auto entry_target = ir.CreateLoad(
+        func_ptr_type, ir.CreateInBoundsGEP(ic_type, ic, entry_target_indexes));
+
+    if (kind == InlineCacheKind::kFunctionCall) {
+      CHECK_NOTNULL(call_cont);
+      AddCall(hit_block, entry_target, *intrinsics);
+      llvm::BranchInst::Create(call_cont, hit_block);
+
+    } else {
+
+      // Make sure that chains of traces linked by inline caches don't grow
+      // the stack.
+      const auto call =
+          AddTerminatingTailCall(hit_block, entry_target, *intrinsics);
+      call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+      call->setCallingConv(func->getCallingConv());
+    }
+
+    ir.SetInsertPoint(next_block);
+  }
+
+  ir.SetInsertPoint(miss_block);
+  count(ir, 1);
+  ir.CreateStore(ic, module->getOrInsertGlobal(kInlineCacheMissVariableName,
+                                               ic->getType()));
+  return miss_block;
+}
+
+// Call the function at `NEXT_PC` from `block`, going through an inline
+// cache if they are enabled.
+llvm::BasicBlock *
+TraceLifter::Impl::AddIndirectFunctionCall(llvm::BasicBlock *block) {
+  const auto old_depth = PushReturnAddress(block);
+  if (!options.inline_cache_size) {
+    AddCall(block, intrinsics->function_call, *intrinsics);
+    PopReturnAddress(block, old_depth);
+    return block;
+  }
+
+  const auto call_cont = llvm::BasicBlock::Create(context, "", func);
+  const auto miss_block =
+      AddInlineCache(block, InlineCacheKind::kFunctionCall, call_cont);
+  AddCall(miss_block, intrinsics->function_call, *intrinsics);
+  llvm::BranchInst::Create(call_cont, miss_block);
+  PopReturnAddress(call_cont, old_depth);
+  return call_cont;
+}
+
+// Tail-call `intrinsic` to transfer control to `NEXT_PC`, going through an
+// inline cache if they are enabled.
+void TraceLifter::Impl::AddIndirectTailCall(llvm::BasicBlock *block,
+                                            InlineCacheKind kind,
+                                            llvm::Function *intrinsic) {
+  if (kind == InlineCacheKind::kFunctionReturn) {
+    block = AddShadowReturn(block);
+  }
+  AddTerminatingTailCall(AddInlineCache(block, kind), intrinsic, *intrinsics);
+}
+
+// Returns the type of `__remill_shadow_return_stack`.
+llvm::StructType *TraceLifter::Impl::ShadowReturnStackType(void) const {
+  const auto i64_type = llvm::Type::getInt64Ty(context);
+  return llvm::StructType::get(
+      context, {i64_type, llvm::ArrayType::get(
+                              i64_type, options.shadow_return_stack_size)});
+}
+
+// Push `RETURN_PC` onto the shadow return stack at the end of `block`.
+llvm::Value *TraceLifter::Impl::PushReturnAddress(llvm::BasicBlock *block) {
+  if (!options.shadow_return_stack_size) {
+    return nullptr;
+  }
+
+  const auto ret_pc_ref = LoadReturnProgramCounterRef(block);
+  const auto stack_type = ShadowReturnStackType();
+  const auto stack =
+      module->getOrInsertGlobal(kShadowReturnStackVariableName, stack_type);
+
+  llvm::IRBuilder<> ir(block);
+  const auto depth_ref = ir.CreateStructGEP(stack_type, stack, 0);
+  const auto depth = ir.CreateLoad(ir.getInt64Ty(), depth_ref);
+  llvm::Value *slot_indexes[] = {
+      ir.getInt32(0), ir.getInt32(1),
+      ir.CreateAnd(depth, options.shadow_return_stack_size - 1u)};
+  ir.CreateStore(
+      ir.CreateZExtOrTrunc(ir.CreateLoad(word_type, ret_pc_ref),
+                           ir.getInt64Ty()),
+      ir.CreateInBoundsGEP(stack_type, stack, slot_indexes));
+  ir.CreateStore(ir.CreateAdd(depth, ir.getInt64(1)), depth_ref);
+  return depth;
+}
+
+// Restore the depth of the shadow return stack after a function call. The
+// callee doesn't pop its return address, so that returns that miss don't
+// unbalance the stack.
+void TraceLifter::Impl::PopReturnAddress(llvm::BasicBlock *block,
+                                         llvm::Value *old_depth) {
+  if (!old_depth) {
+    return;
+  }
+
+  const auto stack_type = ShadowReturnStackType();
+  const auto stack =
+      module->getOrInsertGlobal(kShadowReturnStackVariableName, stack_type);
+
+  llvm::IRBuilder<> ir(block);
+  ir.CreateStore(old_depth, ir.CreateStructGEP(stack_type, stack, 0));
+}
+
+// Return directly if `NEXT_PC` matches the top of the shadow return stack.
+llvm::BasicBlock *TraceLifter::Impl::AddShadowReturn(llvm::BasicBlock *block) {
+  if (!options.shadow_return_stack_size) {
+    return block;
+  }
+
+  const auto next_pc = LoadNextProgramCounter(block, *intrinsics);
+  const auto stack_type = ShadowReturnStackType();
+  const auto stack =
+      module->getOrInsertGlobal(kShadowReturnStackVariableName, stack_type);
+
+  llvm::IRBuilder<> ir(block);
+  const auto depth =
+      ir.CreateLoad(ir.getInt64Ty(), ir.CreateStructGEP(stack_type, stack, 0));
+  llvm::Value *top_indexes[] = {
+      ir.getInt32(0), ir.getInt32(1),
+      ir.CreateAnd(ir.CreateSub(depth, ir.getInt64(1)),
+                   options.shadow_return_stack_size - 1u)};
+  const auto top = ir.CreateLoad(
+      ir.getInt64Ty(), ir.CreateInBoundsGEP(stack_type, stack, top_indexes));
+  const auto is_hit = ir.CreateAnd(
+      ir.CreateICmpNE(depth, ir.getInt64(0)),
+      ir.CreateICmpEQ(top, ir.CreateZExtOrTrunc(next_pc, ir.getInt64Ty())));
+
+  const auto hit_block = llvm::BasicBlock::Create(context, "", func);
+  const auto miss_block = llvm::BasicBlock::Create(context, "", func);
+  ir.CreateCondBr(is_hit, hit_block, miss_block);
+
+  // Like `AddTerminatingTailCall`, but without the call.
+  const auto pc_ref = LoadProgramCounterRef(hit_block);
+  ir.SetInsertPoint(hit_block);
+  ir.CreateStore(next_pc, pc_ref);
+  ir.CreateRet(LoadMemoryPointer(hit_block, *intrinsics));
+  return miss_block;
+}
+
 TraceLifter::~TraceLifter(void) {}
 
-TraceLifter::TraceLifter(const Arch *arch_, TraceManager *manager_)
-    : impl(new Impl(arch_, manager_)) {}
+TraceLifter::TraceLifter(const Arch *arch_, TraceManager *manager_,
+                         TraceLifterOptions options_)
+    : impl(new Impl(arch_, manager_, options_)) {}
 
 void TraceLifter::NullCallback(uint64_t, llvm::Function *) {}
 
 // Reads the bytes of an instruction at `addr` into `inst_bytes`.
 bool TraceLifter::Impl::ReadInstructionBytes(uint64_t addr) {
   inst_bytes.clear();
+
+  // Fast path: the manager can give us a view of the bytes. Don't let the
+  // view wrap around the address space.
+  const auto max_size = static_cast<size_t>(
+      std::min<uint64_t>(max_inst_bytes - 1u, addr_mask - addr) + 1u);
+  if (auto view = manager.TryReadExecutableBytes(addr, max_size);
+      !view.empty()) {
+    inst_bytes.assign(view.data(), std::min(view.size(), max_size));
+    return true;
+  }
+
   for (size_t i = 0; i < max_inst_bytes; ++i) {
     const auto byte_addr = (addr + i) & addr_mask;
     if (byte_addr < addr) {
@@ -241,6 +582,16 @@ bool TraceLifter::Lift(
 // Lift one or more traces starting from `addr`.
 bool TraceLifter::Impl::Lift(
     uint64_t addr, std::function<void(uint64_t, llvm::Function *)> callback) {
+  static const Statistic num_traces("trace_lifter.traces");
+  static const Histogram insts_per_trace(
+      "trace_lifter.instructions_per_trace");
+  static const Histogram blocks_per_trace("trace_lifter.blocks_per_trace");
+  static const Timer lift_timer("trace_lifter.lift");
+  static const Timer decode_timer("trace_lifter.decode");
+  static const Timer lift_inst_timer("trace_lifter.lift_instruction");
+
+  ScopedTimer timer(lift_timer);
+
   // Reset the lifting state.
   trace_work_list.clear();
   inst_work_list.clear();
@@ -308,6 +659,7 @@ bool TraceLifter::Impl::Lift(
 
     CHECK(inst_work_list.empty());
     inst_work_list.insert(trace_addr);
+    uint64_t num_insts = 0u;
 
     // Decode instructions.
     while (!inst_work_list.empty()) {
@@ -338,13 +690,20 @@ bool TraceLifter::Impl::Lift(
       }
 
       inst.Reset();
+      num_insts += 1u;
 
       // TODO(Ian): not passing context around in trace lifter
-      std::ignore = arch->DecodeInstruction(inst_addr, inst_bytes, inst,
-                                            this->arch->CreateInitialContext());
+      {
+        ScopedTimer timer(decode_timer);
+        std::ignore = arch->DecodeInstruction(
+            inst_addr, inst_bytes, inst, this->arch->CreateInitialContext());
+      }
 
-      auto lift_status =
-          inst.GetLifter()->LiftIntoBlock(inst, block, state_ptr);
+      LiftStatus lift_status;
+      {
+        ScopedTimer timer(lift_inst_timer);
+        lift_status = inst.GetLifter()->LiftIntoBlock(inst, block, state_ptr);
+      }
       if (kLiftedInstruction != lift_status) {
         AddTerminatingTailCall(block, intrinsics->error, *intrinsics);
         continue;
@@ -407,7 +766,7 @@ bool TraceLifter::Impl::Lift(
 
         case Instruction::kCategoryIndirectJump: {
           try_add_delay_slot(true, block);
-          AddTerminatingTailCall(block, intrinsics->jump, *intrinsics);
+          AddIndirectTailCall(block, InlineCacheKind::kJump, intrinsics->jump);
           break;
         }
 
@@ -428,8 +787,8 @@ bool TraceLifter::Impl::Lift(
           ir.CreateStore(ir.CreateLoad(word_type, ret_pc_ref), next_pc_ref);
           ir.CreateBr(GetOrCreateBranchNotTakenBlock());
 
-          AddCall(block, intrinsics->function_call, *intrinsics);
-          llvm::BranchInst::Create(fall_through_block, block);
+          llvm::BranchInst::Create(fall_through_block,
+                                   AddIndirectFunctionCall(block));
           block = fall_through_block;
           continue;
         }
@@ -455,7 +814,7 @@ bool TraceLifter::Impl::Lift(
           llvm::BranchInst::Create(taken_block, not_taken_block,
                                    LoadBranchTaken(block), block);
 
-          AddCall(taken_block, intrinsics->function_call, *intrinsics);
+          taken_block = AddIndirectFunctionCall(taken_block);
 
           const auto ret_pc_ref = LoadReturnProgramCounterRef(taken_block);
           const auto next_pc_ref = LoadNextProgramCounterRef(taken_block);
@@ -480,7 +839,9 @@ bool TraceLifter::Impl::Lift(
           if (inst.branch_not_taken_pc != inst.branch_taken_pc) {
             trace_work_list.insert(inst.branch_taken_pc);
             auto target_trace = get_trace_decl(inst.branch_taken_pc);
+            const auto old_depth = PushReturnAddress(block);
             AddCall(block, target_trace, *intrinsics);
+            PopReturnAddress(block, old_depth);
           }
 
           const auto ret_pc_ref = LoadReturnProgramCounterRef(block);
@@ -520,8 +881,10 @@ bool TraceLifter::Impl::Lift(
           trace_work_list.insert(inst.branch_taken_pc);
           auto target_trace = get_trace_decl(inst.branch_taken_pc);
 
+          const auto old_depth = PushReturnAddress(taken_block);
           AddCall(taken_block, intrinsics->function_call, *intrinsics);
           AddCall(taken_block, target_trace, *intrinsics);
+          PopReturnAddress(taken_block, old_depth);
 
           const auto ret_pc_ref = LoadReturnProgramCounterRef(taken_block);
           const auto next_pc_ref = LoadNextProgramCounterRef(taken_block);
@@ -567,8 +930,8 @@ bool TraceLifter::Impl::Lift(
 
         case Instruction::kCategoryFunctionReturn:
           try_add_delay_slot(true, block);
-          AddTerminatingTailCall(block, intrinsics->function_return,
-                                 *intrinsics);
+          AddIndirectTailCall(block, InlineCacheKind::kFunctionReturn,
+                              intrinsics->function_return);
           break;
 
         case Instruction::kCategoryConditionalFunctionReturn: {
@@ -592,8 +955,8 @@ bool TraceLifter::Impl::Lift(
           llvm::BranchInst::Create(taken_block, not_taken_block,
                                    LoadBranchTaken(block), block);
 
-          AddTerminatingTailCall(taken_block, intrinsics->function_return,
-                                 *intrinsics);
+          AddIndirectTailCall(taken_block, InlineCacheKind::kFunctionReturn,
+                              intrinsics->function_return);
           block = orig_not_taken_block;
           continue;
         }
@@ -646,7 +1009,8 @@ bool TraceLifter::Impl::Lift(
           llvm::BranchInst::Create(taken_block, not_taken_block,
                                    LoadBranchTaken(block), block);
 
-          AddTerminatingTailCall(taken_block, intrinsics->jump, *intrinsics);
+          AddIndirectTailCall(taken_block, InlineCacheKind::kJump,
+                              intrinsics->jump);
           block = orig_not_taken_block;
           continue;
         }
@@ -659,6 +1023,12 @@ bool TraceLifter::Impl::Lift(
       }
     }
 
+    arch->FinishLiftedFunction(func);
+
+    num_traces.Add();
+    insts_per_trace.Record(num_insts);
+    blocks_per_trace.Record(blocks.size());
+
     callback(trace_addr, func);
     manager.SetLiftedTraceDefinition(trace_addr, func);
   }
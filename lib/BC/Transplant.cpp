@@ -0,0 +1,1208 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Attributes.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/GlobalAlias.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/IR/ValueMap.h>
+#include <remill/BC/Transplant.h>
+#include <remill/BC/Util.h>
+
+#include <utility>
+#include <vector>
+
+namespace remill {
+namespace {
+
+// Returns `true` if the definition of `gv` must be copied along with the code
+// that uses it, because the destination module might not otherwise have it.
+static bool MustCopyDefinition(const llvm::GlobalValue *gv) {
+  return !gv->isDeclaration() && gv->isDiscardableIfUnused();
+}
+
+// Linkage of a global in the destination module before we know if its
+// definition will be copied.
+static llvm::GlobalValue::LinkageTypes
+DeclarationLinkage(const llvm::GlobalValue *gv) {
+  if (gv->hasExternalWeakLinkage()) {
+    return gv->getLinkage();
+  }
+  return llvm::GlobalValue::ExternalLinkage;
+}
+
+}  // namespace
+
+class FunctionTransplanter::Impl {
+ public:
+  explicit Impl(llvm::Module *dest_module_);
+
+  void SetSourceContext(llvm::LLVMContext &source_context_);
+
+  llvm::Type *MapType(llvm::Type *type);
+  llvm::Constant *MapConstant(llvm::Constant *c);
+  llvm::GlobalValue *MapGlobal(llvm::GlobalValue *gv);
+  llvm::Value *MapValue(llvm::Value *val);
+  llvm::Metadata *MapMetadata(llvm::Metadata *md);
+  llvm::AttributeSet MapAttributes(llvm::AttributeSet attrs);
+  llvm::AttributeList MapAttributes(llvm::AttributeList attrs);
+  unsigned MapMetadataKind(unsigned kind);
+  llvm::SyncScope::ID MapSyncScope(llvm::SyncScope::ID id);
+
+  inline llvm::BasicBlock *MapBlock(llvm::BasicBlock *block) {
+    return llvm::cast<llvm::BasicBlock>(local_map.lookup(block));
+  }
+
+  // Make sure that the definition of `source` is copied into `dest`.
+  void RequireDefinition(llvm::GlobalValue *source, llvm::GlobalValue *dest);
+
+  // Copy all pending definitions, then forget the memoized metadata.
+  void Drain(void);
+
+  llvm::Module *const dest_module;
+  llvm::LLVMContext &context;
+
+  // Context of the values being mapped, and whether or not it is `context`.
+  llvm::LLVMContext *source_context{nullptr};
+  bool same_context{false};
+
+ private:
+  llvm::Function *DeclareFunction(llvm::Function *func);
+  llvm::GlobalVariable *DeclareVariable(llvm::GlobalVariable *var);
+  void CopyMetadata(llvm::GlobalObject *source, llvm::GlobalObject *dest);
+  void CopyBody(llvm::Function *source_func, llvm::Function *dest_func);
+  llvm::Instruction *CopyInstruction(llvm::Instruction *inst);
+
+  // Returns the memoized mapping of `val`, or `nullptr` if there is none.
+  llvm::Value *LookupValue(const llvm::Value *val) const;
+
+  // Long-lived, memoized mappings of types and attributes. These are owned
+  // by their contexts, and so never go stale while the contexts are alive.
+  llvm::DenseMap<llvm::Type *, llvm::Type *> type_map;
+  llvm::DenseMap<void *, llvm::AttributeList> attr_map;
+
+  // Long-lived, memoized mappings of constants and globals. The source
+  // values, and their copies, can be deleted between calls, e.g. by
+  // optimizing either module, and a new value can then be allocated at the
+  // same address. `llvm::ValueMap` drops the entries of deleted source
+  // values, and the `llvm::WeakTrackingVH`s become `nullptr` when copies
+  // are deleted, so that neither is mistaken for something else.
+  llvm::ValueMap<const llvm::Value *, llvm::WeakTrackingVH> value_map;
+
+  // Mappings of metadata. Metadata can't be tracked like values, e.g. a
+  // `ConstantAsMetadata` is deleted along with its constant, and so these
+  // are only kept while copying one function or global, and its closure.
+  llvm::DenseMap<const llvm::Metadata *, llvm::Metadata *> md_map;
+
+  // Metadata kind and synchronization scope IDs are numbered per-context, and
+  // so are mapped by name.
+  llvm::SmallVector<unsigned, 0> md_kind_map;
+  llvm::SmallVector<llvm::SyncScope::ID, 0> sync_scope_map;
+
+  // Mappings of the arguments, blocks, and instructions of the function
+  // being copied. These are cleared, but not freed, between functions.
+  llvm::DenseMap<const llvm::Value *, llvm::Value *> local_map;
+
+  // Placeholders for instructions used before they are copied, e.g. by
+  // `phi` nodes.
+  llvm::DenseMap<const llvm::Value *, llvm::Argument *> forward_refs;
+
+  // Definitions that have been, or will be, copied, mapped to where they
+  // were copied.
+  llvm::ValueMap<const llvm::GlobalValue *, llvm::WeakTrackingVH> copied_defs;
+  std::vector<std::pair<llvm::GlobalValue *, llvm::GlobalValue *>> work_list;
+
+  llvm::IRBuilder<> ir;
+};
+
+FunctionTransplanter::Impl::Impl(llvm::Module *dest_module_)
+    : dest_module(dest_module_),
+      context(dest_module->getContext()),
+      ir(context) {}
+
+void FunctionTransplanter::Impl::SetSourceContext(
+    llvm::LLVMContext &source_context_) {
+  CHECK(work_list.empty());
+  if (source_context == &source_context_) {
+    return;
+  }
+
+  source_context = &source_context_;
+  same_context = source_context == &context;
+  md_kind_map.clear();
+  sync_scope_map.clear();
+}
+
+llvm::Type *FunctionTransplanter::Impl::MapType(llvm::Type *type) {
+  if (&(type->getContext()) == &context) {
+    return type;
+  }
+
+  if (auto it = type_map.find(type); it != type_map.end()) {
+    return it->second;
+  }
+
+  llvm::Type *mapped = nullptr;
+  switch (type->getTypeID()) {
+    case llvm::Type::IntegerTyID:
+      mapped = llvm::IntegerType::get(
+          context, llvm::cast<llvm::IntegerType>(type)->getBitWidth());
+      break;
+
+    case llvm::Type::PointerTyID:
+      mapped = llvm::PointerType::get(
+          context, llvm::cast<llvm::PointerType>(type)->getAddressSpace());
+      break;
+
+    case llvm::Type::FunctionTyID: {
+      auto func_type = llvm::cast<llvm::FunctionType>(type);
+      llvm::SmallVector<llvm::Type *, 8> param_types;
+      for (auto param_type : func_type->params()) {
+        param_types.push_back(MapType(param_type));
+      }
+      mapped = llvm::FunctionType::get(MapType(func_type->getReturnType()),
+                                       param_types, func_type->isVarArg());
+      break;
+    }
+
+    case llvm::Type::StructTyID: {
+      auto struct_type = llvm::cast<llvm::StructType>(type);
+      llvm::SmallVector<llvm::Type *, 8> elem_types;
+      for (auto elem_type : struct_type->elements()) {
+        elem_types.push_back(MapType(elem_type));
+      }
+
+      if (struct_type->isLiteral()) {
+        mapped = llvm::StructType::get(context, elem_types,
+                                       struct_type->isPacked());
+        break;
+      }
+
+      // Reuse an identical named structure in the destination context, e.g.
+      // the `State` structure of the same architecture.
+      llvm::StructType *dest_struct_type = nullptr;
+      if (struct_type->hasName()) {
+        dest_struct_type =
+            llvm::StructType::getTypeByName(context, struct_type->getName());
+      }
+
+      if (struct_type->isOpaque()) {
+        if (!dest_struct_type || !dest_struct_type->isOpaque()) {
+          dest_struct_type =
+              llvm::StructType::create(context, struct_type->getName());
+        }
+
+      } else if (!dest_struct_type || dest_struct_type->isOpaque() ||
+                 dest_struct_type->isPacked() != struct_type->isPacked() ||
+                 dest_struct_type->elements() !=
+                     llvm::ArrayRef<llvm::Type *>(elem_types)) {
+        dest_struct_type =
+            llvm::StructType::create(context, elem_types,
+                                     struct_type->getName(),
+                                     struct_type->isPacked());
+      }
+
+      mapped = dest_struct_type;
+      break;
+    }
+
+    case llvm::Type::ArrayTyID: {
+      auto array_type = llvm::cast<llvm::ArrayType>(type);
+      mapped = llvm::ArrayType::get(MapType(array_type->getElementType()),
+                                    array_type->getNumElements());
+      break;
+    }
+
+    case llvm::Type::FixedVectorTyID: {
+      auto vec_type = llvm::cast<llvm::FixedVectorType>(type);
+      mapped = llvm::FixedVectorType::get(MapType(vec_type->getElementType()),
+                                          vec_type->getNumElements());
+      break;
+    }
+
+    case llvm::Type::ScalableVectorTyID: {
+      auto vec_type = llvm::cast<llvm::ScalableVectorType>(type);
+      mapped = llvm::ScalableVectorType::get(
+          MapType(vec_type->getElementType()),
+          vec_type->getMinNumElements());
+      break;
+    }
+
+    default:
+      if (type->isFloatingPointTy() || type->isLabelTy() ||
+          type->isMetadataTy() || type->isTokenTy() || type->isVoidTy() ||
+          type->isX86_MMXTy() || type->isX86_AMXTy()) {
+        mapped = llvm::Type::getPrimitiveType(context, type->getTypeID());
+        break;
+      }
+      LOG(FATAL) << "Cannot transplant type " << LLVMThingToString(type);
+      return nullptr;
+  }
+
+  type_map.try_emplace(type, mapped);
+  return mapped;
+}
+
+llvm::Constant *FunctionTransplanter::Impl::MapConstant(llvm::Constant *c) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+    return MapGlobal(gv);
+  }
+
+  // Constant data doesn't reference anything, and so is context-unique.
+  if (same_context && llvm::isa<llvm::ConstantData>(c)) {
+    return c;
+  }
+
+  if (auto mapped = LookupValue(c)) {
+    return llvm::cast<llvm::Constant>(mapped);
+  }
+
+  const auto type = MapType(c->getType());
+  llvm::Constant *mapped = nullptr;
+
+  if (auto ci = llvm::dyn_cast<llvm::ConstantInt>(c)) {
+    mapped = llvm::ConstantInt::get(type, ci->getValue());
+
+  } else if (auto cf = llvm::dyn_cast<llvm::ConstantFP>(c)) {
+    mapped = llvm::ConstantFP::get(type, cf->getValueAPF());
+
+  } else if (llvm::isa<llvm::PoisonValue>(c)) {
+    mapped = llvm::PoisonValue::get(type);
+
+  } else if (llvm::isa<llvm::UndefValue>(c)) {
+    mapped = llvm::UndefValue::get(type);
+
+  } else if (llvm::isa<llvm::ConstantPointerNull>(c) ||
+             llvm::isa<llvm::ConstantAggregateZero>(c)) {
+    mapped = llvm::Constant::getNullValue(type);
+
+  } else if (llvm::isa<llvm::ConstantTokenNone>(c)) {
+    mapped = llvm::ConstantTokenNone::get(context);
+
+  } else if (auto cda = llvm::dyn_cast<llvm::ConstantDataArray>(c)) {
+    mapped = llvm::ConstantDataArray::getRaw(
+        cda->getRawDataValues(), cda->getNumElements(),
+        MapType(cda->getElementType()));
+
+  } else if (auto cdv = llvm::dyn_cast<llvm::ConstantDataVector>(c)) {
+    mapped = llvm::ConstantDataVector::getRaw(
+        cdv->getRawDataValues(), cdv->getNumElements(),
+        MapType(cdv->getElementType()));
+
+  } else if (auto dso = llvm::dyn_cast<llvm::DSOLocalEquivalent>(c)) {
+    mapped = llvm::DSOLocalEquivalent::get(MapGlobal(dso->getGlobalValue()));
+
+  } else if (auto no_cfi = llvm::dyn_cast<llvm::NoCFIValue>(c)) {
+    mapped = llvm::NoCFIValue::get(MapGlobal(no_cfi->getGlobalValue()));
+
+  } else if (llvm::isa<llvm::ConstantAggregate>(c) ||
+             llvm::isa<llvm::ConstantExpr>(c)) {
+    llvm::SmallVector<llvm::Constant *, 8> ops;
+    auto changed = !same_context;
+    for (auto &op : c->operands()) {
+      auto old_op = llvm::cast<llvm::Constant>(op.get());
+      auto new_op = MapConstant(old_op);
+      changed = changed || new_op != old_op;
+      ops.push_back(new_op);
+    }
+
+    if (!changed) {
+      mapped = c;
+
+    } else if (llvm::isa<llvm::ConstantArray>(c)) {
+      mapped = llvm::ConstantArray::get(llvm::cast<llvm::ArrayType>(type), ops);
+
+    } else if (llvm::isa<llvm::ConstantStruct>(c)) {
+      mapped =
+          llvm::ConstantStruct::get(llvm::cast<llvm::StructType>(type), ops);
+
+    } else if (llvm::isa<llvm::ConstantVector>(c)) {
+      mapped = llvm::ConstantVector::get(ops);
+
+    } else {
+      auto ce = llvm::cast<llvm::ConstantExpr>(c);
+      llvm::Type *source_elem_type = nullptr;
+      if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(ce)) {
+        source_elem_type = MapType(gep->getSourceElementType());
+      }
+      mapped = ce->getWithOperands(ops, type, false, source_elem_type);
+    }
+
+  } else {
+    LOG(FATAL) << "Cannot transplant constant " << LLVMThingToString(c);
+  }
+
+  value_map[c] = mapped;
+  return mapped;
+}
+
+llvm::Function *
+FunctionTransplanter::Impl::DeclareFunction(llvm::Function *func) {
+  auto dest_func = llvm::Function::Create(
+      llvm::cast<llvm::FunctionType>(MapType(func->getFunctionType())),
+      DeclarationLinkage(func), func->getAddressSpace(), func->getName(),
+      dest_module);
+
+  dest_func->setCallingConv(func->getCallingConv());
+  dest_func->setAttributes(MapAttributes(func->getAttributes()));
+  if (func->hasGC()) {
+    dest_func->setGC(func->getGC());
+  }
+  return dest_func;
+}
+
+llvm::GlobalVariable *
+FunctionTransplanter::Impl::DeclareVariable(llvm::GlobalVariable *var) {
+  auto dest_var = new llvm::GlobalVariable(
+      *dest_module, MapType(var->getValueType()), var->isConstant(),
+      DeclarationLinkage(var), nullptr, var->getName(), nullptr,
+      var->getThreadLocalMode(), var->getAddressSpace(),
+      var->isExternallyInitialized());
+
+  dest_var->setAttributes(MapAttributes(var->getAttributes()));
+  return dest_var;
+}
+
+llvm::GlobalValue *
+FunctionTransplanter::Impl::MapGlobal(llvm::GlobalValue *gv) {
+  if (auto mapped = LookupValue(gv)) {
+    return llvm::cast<llvm::GlobalValue>(mapped);
+  }
+
+  if (gv->getParent() == dest_module) {
+    value_map[gv] = gv;
+    return gv;
+  }
+
+  // Globals with local linkage never refer to a global in the destination
+  // module, even if one has the same name.
+  llvm::GlobalValue *dest_gv = nullptr;
+  if (!gv->hasLocalLinkage()) {
+    dest_gv = dest_module->getNamedValue(gv->getName());
+  }
+
+  if (dest_gv) {
+    CHECK_EQ(dest_gv->getValueID(), gv->getValueID())
+        << "Cannot transplant " << gv->getName().str()
+        << " into a module that has a different kind of global with the "
+        << "same name";
+    CHECK_EQ(dest_gv->getValueType(), MapType(gv->getValueType()))
+        << "Cannot transplant " << gv->getName().str()
+        << " into a module where it has a different type";
+    value_map[gv] = dest_gv;
+    if (MustCopyDefinition(gv)) {
+      RequireDefinition(gv, dest_gv);
+    }
+    return dest_gv;
+
+  } else if (auto func = llvm::dyn_cast<llvm::Function>(gv)) {
+    dest_gv = DeclareFunction(func);
+
+  } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+    dest_gv = DeclareVariable(var);
+
+  } else if (auto alias = llvm::dyn_cast<llvm::GlobalAlias>(gv)) {
+    auto dest_alias = llvm::GlobalAlias::create(
+        MapType(alias->getValueType()), alias->getAddressSpace(),
+        alias->getLinkage(), alias->getName(), dest_module);
+    value_map[gv] = dest_alias;
+    dest_alias->setVisibility(alias->getVisibility());
+    dest_alias->setDLLStorageClass(alias->getDLLStorageClass());
+    dest_alias->setUnnamedAddr(alias->getUnnamedAddr());
+    dest_alias->setThreadLocalMode(alias->getThreadLocalMode());
+    dest_alias->setAliasee(MapConstant(alias->getAliasee()));
+    return dest_alias;
+
+  } else {
+    LOG(FATAL) << "Cannot transplant global " << LLVMThingToString(gv);
+    return nullptr;
+  }
+
+  value_map[gv] = dest_gv;
+
+  // NOTE(pag): Properties that only definitions can have, e.g. local linkage
+  //            or comdats, are copied by `RequireDefinition`.
+  dest_gv->setVisibility(gv->getVisibility());
+  dest_gv->setDLLStorageClass(gv->getDLLStorageClass());
+  dest_gv->setUnnamedAddr(gv->getUnnamedAddr());
+  dest_gv->setDSOLocal(gv->isDSOLocal());
+
+  auto dest_go = llvm::cast<llvm::GlobalObject>(dest_gv);
+  auto go = llvm::cast<llvm::GlobalObject>(gv);
+  dest_go->setAlignment(go->getAlign());
+  if (go->hasSection()) {
+    dest_go->setSection(go->getSection());
+  }
+
+  // Metadata can refer back to `gv`, so we copy it after memoizing `dest_gv`.
+  CopyMetadata(go, dest_go);
+
+  if (MustCopyDefinition(gv)) {
+    RequireDefinition(gv, dest_gv);
+  }
+
+  return dest_gv;
+}
+
+void FunctionTransplanter::Impl::RequireDefinition(llvm::GlobalValue *source,
+                                                   llvm::GlobalValue *dest) {
+  // NOTE(pag): Aliases are defined by `MapGlobal`.
+  if (source == dest || source->isDeclaration() ||
+      llvm::isa<llvm::GlobalAlias>(source)) {
+    return;
+  }
+
+  // NOTE(pag): If an earlier copy of `source` was deleted, then `dest` is a
+  //            new declaration that needs its own definition.
+  auto &copied_to = copied_defs[source];
+  if (copied_to == dest) {
+    return;
+  }
+  copied_to = dest;
+
+  if (!dest->isDeclaration()) {
+    LOG_IF(ERROR, !MustCopyDefinition(source) && !MustCopyDefinition(dest))
+        << "Not transplanting " << source->getName().str()
+        << " because it is already defined in "
+        << dest_module->getName().str();
+    return;
+  }
+
+  dest->setLinkage(source->getLinkage());
+  if (auto comdat = source->getComdat()) {
+    auto dest_comdat = dest_module->getOrInsertComdat(comdat->getName());
+    dest_comdat->setSelectionKind(comdat->getSelectionKind());
+    llvm::cast<llvm::GlobalObject>(dest)->setComdat(dest_comdat);
+  }
+
+  work_list.emplace_back(source, dest);
+}
+
+void FunctionTransplanter::Impl::Drain(void) {
+  while (!work_list.empty()) {
+    auto [source, dest] = work_list.back();
+    work_list.pop_back();
+
+    if (auto func = llvm::dyn_cast<llvm::Function>(source)) {
+      CopyBody(func, llvm::cast<llvm::Function>(dest));
+
+    } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(source)) {
+      llvm::cast<llvm::GlobalVariable>(dest)->setInitializer(
+          MapConstant(var->getInitializer()));
+    }
+  }
+
+  md_map.clear();
+}
+
+llvm::Value *
+FunctionTransplanter::Impl::LookupValue(const llvm::Value *val) const {
+  if (auto it = value_map.find(val); it != value_map.end()) {
+    return it->second;
+  }
+  return nullptr;
+}
+
+llvm::Value *FunctionTransplanter::Impl::MapValue(llvm::Value *val) {
+  if (auto c = llvm::dyn_cast<llvm::Constant>(val)) {
+    return MapConstant(c);
+  }
+
+  if (auto it = local_map.find(val); it != local_map.end()) {
+    return it->second;
+  }
+
+  if (auto md = llvm::dyn_cast<llvm::MetadataAsValue>(val)) {
+    return llvm::MetadataAsValue::get(context,
+                                      MapMetadata(md->getMetadata()));
+  }
+
+  if (auto ia = llvm::dyn_cast<llvm::InlineAsm>(val)) {
+    if (auto mapped = LookupValue(ia)) {
+      return mapped;
+    }
+    auto mapped = llvm::InlineAsm::get(
+        llvm::cast<llvm::FunctionType>(MapType(ia->getFunctionType())),
+        ia->getAsmString(), ia->getConstraintString(), ia->hasSideEffects(),
+        ia->isAlignStack(), ia->getDialect(), ia->canThrow());
+    value_map[ia] = mapped;
+    return mapped;
+  }
+
+  // An instruction that we haven't copied yet, e.g. an incoming value of a
+  // `phi` node. This is replaced once the instruction is copied.
+  CHECK(llvm::isa<llvm::Instruction>(val))
+      << "Cannot transplant value " << LLVMThingToString(val);
+
+  auto &placeholder = forward_refs[val];
+  if (!placeholder) {
+    placeholder = new llvm::Argument(MapType(val->getType()));
+  }
+  return placeholder;
+}
+
+llvm::Metadata *FunctionTransplanter::Impl::MapMetadata(llvm::Metadata *md) {
+  if (!md) {
+    return nullptr;
+  }
+
+  if (auto it = md_map.find(md); it != md_map.end()) {
+    return it->second;
+  }
+
+  // Function-local metadata is not memoized.
+  if (auto lam = llvm::dyn_cast<llvm::LocalAsMetadata>(md)) {
+    return llvm::LocalAsMetadata::get(MapValue(lam->getValue()));
+  }
+
+  llvm::Metadata *mapped = nullptr;
+  if (auto str = llvm::dyn_cast<llvm::MDString>(md)) {
+    mapped = llvm::MDString::get(context, str->getString());
+
+  } else if (auto cam = llvm::dyn_cast<llvm::ConstantAsMetadata>(md)) {
+    mapped = llvm::ConstantAsMetadata::get(MapConstant(cam->getValue()));
+
+  } else if (auto tuple = llvm::dyn_cast<llvm::MDTuple>(md)) {
+    llvm::SmallVector<llvm::Metadata *, 8> ops;
+
+    // Distinct nodes can refer to themselves, e.g. loop metadata, so we map
+    // them to a temporary node while mapping their operands.
+    if (tuple->isDistinct()) {
+      auto temp = llvm::MDTuple::getTemporary(context, {});
+      md_map.try_emplace(md, temp.get());
+      for (auto &op : tuple->operands()) {
+        ops.push_back(MapMetadata(op.get()));
+      }
+      mapped = llvm::MDTuple::getDistinct(context, ops);
+      temp->replaceAllUsesWith(mapped);
+      md_map[md] = mapped;
+      return mapped;
+    }
+
+    // Cycles through uniqued nodes are broken by mapping to `nullptr`.
+    md_map.try_emplace(md, nullptr);
+    for (auto &op : tuple->operands()) {
+      ops.push_back(MapMetadata(op.get()));
+    }
+    mapped = llvm::MDTuple::get(context, ops);
+    md_map[md] = mapped;
+    return mapped;
+  }
+
+  // NOTE(pag): Debug info and other specialized nodes are dropped.
+  md_map.try_emplace(md, mapped);
+  return mapped;
+}
+
+void FunctionTransplanter::Impl::CopyMetadata(llvm::GlobalObject *source,
+                                              llvm::GlobalObject *dest) {
+  llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 4> mds;
+  source->getAllMetadata(mds);
+  for (auto [kind, node] : mds) {
+    if (auto new_node = llvm::dyn_cast_or_null<llvm::MDNode>(
+            MapMetadata(node))) {
+      dest->addMetadata(MapMetadataKind(kind), *new_node);
+    }
+  }
+}
+
+unsigned FunctionTransplanter::Impl::MapMetadataKind(unsigned kind) {
+  if (same_context) {
+    return kind;
+  }
+
+  if (kind >= md_kind_map.size()) {
+    llvm::SmallVector<llvm::StringRef, 32> names;
+    source_context->getMDKindNames(names);
+    md_kind_map.clear();
+    for (auto name : names) {
+      md_kind_map.push_back(context.getMDKindID(name));
+    }
+    CHECK_LT(kind, md_kind_map.size());
+  }
+  return md_kind_map[kind];
+}
+
+llvm::SyncScope::ID
+FunctionTransplanter::Impl::MapSyncScope(llvm::SyncScope::ID id) {
+  if (same_context) {
+    return id;
+  }
+
+  if (id >= sync_scope_map.size()) {
+    llvm::SmallVector<llvm::StringRef, 4> names;
+    source_context->getSyncScopeNames(names);
+    sync_scope_map.clear();
+    for (auto name : names) {
+      sync_scope_map.push_back(context.getOrInsertSyncScopeID(name));
+    }
+    CHECK_LT(id, sync_scope_map.size());
+  }
+  return sync_scope_map[id];
+}
+
+llvm::AttributeSet
+FunctionTransplanter::Impl::MapAttributes(llvm::AttributeSet attrs) {
+  if (same_context || !attrs.hasAttributes()) {
+    return attrs;
+  }
+
+  llvm::AttrBuilder builder(context);
+  for (auto attr : attrs) {
+    if (attr.isStringAttribute()) {
+      builder.addAttribute(attr.getKindAsString(), attr.getValueAsString());
+    } else if (attr.isTypeAttribute()) {
+      builder.addTypeAttr(attr.getKindAsEnum(),
+                          MapType(attr.getValueAsType()));
+    } else if (attr.isIntAttribute()) {
+      builder.addRawIntAttr(attr.getKindAsEnum(), attr.getValueAsInt());
+    } else {
+      builder.addAttribute(attr.getKindAsEnum());
+    }
+  }
+  return llvm::AttributeSet::get(context, builder);
+}
+
+llvm::AttributeList
+FunctionTransplanter::Impl::MapAttributes(llvm::AttributeList attrs) {
+  if (same_context || attrs.isEmpty()) {
+    return attrs;
+  }
+
+  if (auto it = attr_map.find(attrs.getRawPointer()); it != attr_map.end()) {
+    return it->second;
+  }
+
+  // The attribute sets of a list are those of the function, the return
+  // value, then each parameter.
+  const auto num_sets = attrs.getNumAttrSets();
+  llvm::SmallVector<llvm::AttributeSet, 8> param_attrs;
+  for (auto i = 2u; i < num_sets; ++i) {
+    param_attrs.push_back(MapAttributes(attrs.getParamAttrs(i - 2u)));
+  }
+
+  auto mapped = llvm::AttributeList::get(
+      context, MapAttributes(attrs.getFnAttrs()),
+      MapAttributes(attrs.getRetAttrs()), param_attrs);
+  attr_map.try_emplace(attrs.getRawPointer(), mapped);
+  return mapped;
+}
+
+void FunctionTransplanter::Impl::CopyBody(llvm::Function *source_func,
+                                          llvm::Function *dest_func) {
+  local_map.clear();
+  CHECK(forward_refs.empty());
+
+  auto dest_arg_it = dest_func->arg_begin();
+  for (auto &arg : source_func->args()) {
+    dest_arg_it->setName(arg.getName());
+    local_map.try_emplace(&arg, &*dest_arg_it++);
+  }
+
+  for (auto &block : *source_func) {
+    local_map.try_emplace(
+        &block, llvm::BasicBlock::Create(context, block.getName(), dest_func));
+  }
+
+  if (source_func->hasPersonalityFn()) {
+    dest_func->setPersonalityFn(MapConstant(source_func->getPersonalityFn()));
+  }
+  if (source_func->hasPrefixData()) {
+    dest_func->setPrefixData(MapConstant(source_func->getPrefixData()));
+  }
+  if (source_func->hasPrologueData()) {
+    dest_func->setPrologueData(MapConstant(source_func->getPrologueData()));
+  }
+
+  for (auto &block : *source_func) {
+    ir.SetInsertPoint(MapBlock(&block));
+    for (auto &inst : block) {
+      if (llvm::isa<llvm::DbgInfoIntrinsic>(inst)) {
+        continue;
+      }
+
+      auto dest_inst = ir.Insert(CopyInstruction(&inst), inst.getName());
+      local_map.try_emplace(&inst, dest_inst);
+
+      if (auto it = forward_refs.find(&inst); it != forward_refs.end()) {
+        it->second->replaceAllUsesWith(dest_inst);
+        delete it->second;
+        forward_refs.erase(it);
+      }
+    }
+  }
+
+  CHECK(forward_refs.empty())
+      << "Instructions used but not defined in "
+      << source_func->getName().str();
+}
+
+llvm::Instruction *
+FunctionTransplanter::Impl::CopyInstruction(llvm::Instruction *inst) {
+  llvm::Instruction *copy = nullptr;
+
+  switch (inst->getOpcode()) {
+    case llvm::Instruction::Ret: {
+      auto val = llvm::cast<llvm::ReturnInst>(inst)->getReturnValue();
+      copy = llvm::ReturnInst::Create(context, val ? MapValue(val) : nullptr);
+      break;
+    }
+
+    case llvm::Instruction::Br: {
+      auto br = llvm::cast<llvm::BranchInst>(inst);
+      if (br->isConditional()) {
+        copy = llvm::BranchInst::Create(MapBlock(br->getSuccessor(0)),
+                                        MapBlock(br->getSuccessor(1)),
+                                        MapValue(br->getCondition()));
+      } else {
+        copy = llvm::BranchInst::Create(MapBlock(br->getSuccessor(0)));
+      }
+      break;
+    }
+
+    case llvm::Instruction::Switch: {
+      auto sw = llvm::cast<llvm::SwitchInst>(inst);
+      auto new_sw = llvm::SwitchInst::Create(MapValue(sw->getCondition()),
+                                             MapBlock(sw->getDefaultDest()),
+                                             sw->getNumCases());
+      for (auto &case_ : sw->cases()) {
+        new_sw->addCase(
+            llvm::cast<llvm::ConstantInt>(MapConstant(case_.getCaseValue())),
+            MapBlock(case_.getCaseSuccessor()));
+      }
+      copy = new_sw;
+      break;
+    }
+
+    case llvm::Instruction::IndirectBr: {
+      auto ibr = llvm::cast<llvm::IndirectBrInst>(inst);
+      auto new_ibr = llvm::IndirectBrInst::Create(MapValue(ibr->getAddress()),
+                                                  ibr->getNumDestinations());
+      for (auto succ : ibr->successors()) {
+        new_ibr->addDestination(MapBlock(succ));
+      }
+      copy = new_ibr;
+      break;
+    }
+
+    case llvm::Instruction::Unreachable:
+      copy = new llvm::UnreachableInst(context);
+      break;
+
+    case llvm::Instruction::FNeg:
+      copy = llvm::UnaryOperator::Create(
+          llvm::Instruction::FNeg, MapValue(inst->getOperand(0)));
+      break;
+
+    case llvm::Instruction::Alloca: {
+      auto alloca = llvm::cast<llvm::AllocaInst>(inst);
+      auto new_alloca = new llvm::AllocaInst(
+          MapType(alloca->getAllocatedType()), alloca->getAddressSpace(),
+          MapValue(alloca->getArraySize()), alloca->getAlign());
+      new_alloca->setUsedWithInAlloca(alloca->isUsedWithInAlloca());
+      new_alloca->setSwiftError(alloca->isSwiftError());
+      copy = new_alloca;
+      break;
+    }
+
+    case llvm::Instruction::Load: {
+      auto load = llvm::cast<llvm::LoadInst>(inst);
+      copy = new llvm::LoadInst(
+          MapType(load->getType()), MapValue(load->getPointerOperand()), "",
+          load->isVolatile(), load->getAlign(), load->getOrdering(),
+          MapSyncScope(load->getSyncScopeID()));
+      break;
+    }
+
+    case llvm::Instruction::Store: {
+      auto store = llvm::cast<llvm::StoreInst>(inst);
+      copy = new llvm::StoreInst(
+          MapValue(store->getValueOperand()),
+          MapValue(store->getPointerOperand()), store->isVolatile(),
+          store->getAlign(), store->getOrdering(),
+          MapSyncScope(store->getSyncScopeID()));
+      break;
+    }
+
+    case llvm::Instruction::Fence: {
+      auto fence = llvm::cast<llvm::FenceInst>(inst);
+      copy = new llvm::FenceInst(context, fence->getOrdering(),
+                                 MapSyncScope(fence->getSyncScopeID()));
+      break;
+    }
+
+    case llvm::Instruction::AtomicCmpXchg: {
+      auto xchg = llvm::cast<llvm::AtomicCmpXchgInst>(inst);
+      auto new_xchg = new llvm::AtomicCmpXchgInst(
+          MapValue(xchg->getPointerOperand()),
+          MapValue(xchg->getCompareOperand()),
+          MapValue(xchg->getNewValOperand()), xchg->getAlign(),
+          xchg->getSuccessOrdering(), xchg->getFailureOrdering(),
+          MapSyncScope(xchg->getSyncScopeID()));
+      new_xchg->setVolatile(xchg->isVolatile());
+      new_xchg->setWeak(xchg->isWeak());
+      copy = new_xchg;
+      break;
+    }
+
+    case llvm::Instruction::AtomicRMW: {
+      auto rmw = llvm::cast<llvm::AtomicRMWInst>(inst);
+      auto new_rmw = new llvm::AtomicRMWInst(
+          rmw->getOperation(), MapValue(rmw->getPointerOperand()),
+          MapValue(rmw->getValOperand()), rmw->getAlign(), rmw->getOrdering(),
+          MapSyncScope(rmw->getSyncScopeID()));
+      new_rmw->setVolatile(rmw->isVolatile());
+      copy = new_rmw;
+      break;
+    }
+
+    case llvm::Instruction::GetElementPtr: {
+      auto gep = llvm::cast<llvm::GetElementPtrInst>(inst);
+      llvm::SmallVector<llvm::Value *, 8> indices;
+      for (auto &index : gep->indices()) {
+        indices.push_back(MapValue(index.get()));
+      }
+      copy = llvm::GetElementPtrInst::Create(
+          MapType(gep->getSourceElementType()),
+          MapValue(gep->getPointerOperand()), indices);
+      break;
+    }
+
+    case llvm::Instruction::ICmp:
+    case llvm::Instruction::FCmp: {
+      auto cmp = llvm::cast<llvm::CmpInst>(inst);
+      copy = llvm::CmpInst::Create(
+          cmp->getOpcode(), cmp->getPredicate(),
+          MapValue(cmp->getOperand(0)), MapValue(cmp->getOperand(1)));
+      break;
+    }
+
+    case llvm::Instruction::PHI: {
+      auto phi = llvm::cast<llvm::PHINode>(inst);
+      auto new_phi = llvm::PHINode::Create(MapType(phi->getType()),
+                                           phi->getNumIncomingValues());
+      for (auto i = 0u, n = phi->getNumIncomingValues(); i < n; ++i) {
+        new_phi->addIncoming(MapValue(phi->getIncomingValue(i)),
+                             MapBlock(phi->getIncomingBlock(i)));
+      }
+      copy = new_phi;
+      break;
+    }
+
+    case llvm::Instruction::Select:
+      copy = llvm::SelectInst::Create(MapValue(inst->getOperand(0)),
+                                      MapValue(inst->getOperand(1)),
+                                      MapValue(inst->getOperand(2)));
+      break;
+
+    case llvm::Instruction::Call: {
+      auto call = llvm::cast<llvm::CallInst>(inst);
+      llvm::SmallVector<llvm::Value *, 8> args;
+      for (auto &arg : call->args()) {
+        args.push_back(MapValue(arg.get()));
+      }
+
+      llvm::SmallVector<llvm::OperandBundleDef, 1> bundles;
+      for (auto i = 0u, n = call->getNumOperandBundles(); i < n; ++i) {
+        auto bundle = call->getOperandBundleAt(i);
+        std::vector<llvm::Value *> inputs;
+        inputs.reserve(bundle.Inputs.size());
+        for (auto &input : bundle.Inputs) {
+          inputs.push_back(MapValue(input.get()));
+        }
+        bundles.emplace_back(bundle.getTagName().str(), std::move(inputs));
+      }
+
+      auto new_call = llvm::CallInst::Create(
+          llvm::cast<llvm::FunctionType>(MapType(call->getFunctionType())),
+          MapValue(call->getCalledOperand()), args, bundles);
+      new_call->setCallingConv(call->getCallingConv());
+      new_call->setAttributes(MapAttributes(call->getAttributes()));
+      new_call->setTailCallKind(call->getTailCallKind());
+      copy = new_call;
+      break;
+    }
+
+    case llvm::Instruction::VAArg:
+      copy = new llvm::VAArgInst(MapValue(inst->getOperand(0)),
+                                 MapType(inst->getType()));
+      break;
+
+    case llvm::Instruction::ExtractElement:
+      copy = llvm::ExtractElementInst::Create(MapValue(inst->getOperand(0)),
+                                              MapValue(inst->getOperand(1)));
+      break;
+
+    case llvm::Instruction::InsertElement:
+      copy = llvm::InsertElementInst::Create(MapValue(inst->getOperand(0)),
+                                             MapValue(inst->getOperand(1)),
+                                             MapValue(inst->getOperand(2)));
+      break;
+
+    case llvm::Instruction::ShuffleVector: {
+      auto shuffle = llvm::cast<llvm::ShuffleVectorInst>(inst);
+      copy = new llvm::ShuffleVectorInst(MapValue(shuffle->getOperand(0)),
+                                         MapValue(shuffle->getOperand(1)),
+                                         shuffle->getShuffleMask());
+      break;
+    }
+
+    case llvm::Instruction::ExtractValue: {
+      auto extract = llvm::cast<llvm::ExtractValueInst>(inst);
+      copy = llvm::ExtractValueInst::Create(
+          MapValue(extract->getAggregateOperand()), extract->getIndices());
+      break;
+    }
+
+    case llvm::Instruction::InsertValue: {
+      auto insert = llvm::cast<llvm::InsertValueInst>(inst);
+      copy = llvm::InsertValueInst::Create(
+          MapValue(insert->getAggregateOperand()),
+          MapValue(insert->getInsertedValueOperand()), insert->getIndices());
+      break;
+    }
+
+    case llvm::Instruction::Freeze:
+      copy = new llvm::FreezeInst(MapValue(inst->getOperand(0)));
+      break;
+
+    default:
+      if (auto binop = llvm::dyn_cast<llvm::BinaryOperator>(inst)) {
+        copy = llvm::BinaryOperator::Create(binop->getOpcode(),
+                                            MapValue(binop->getOperand(0)),
+                                            MapValue(binop->getOperand(1)));
+
+      } else if (auto cast = llvm::dyn_cast<llvm::CastInst>(inst)) {
+        copy = llvm::CastInst::Create(cast->getOpcode(),
+                                      MapValue(cast->getOperand(0)),
+                                      MapType(cast->getType()));
+
+      } else {
+        LOG(FATAL) << "Cannot transplant instruction "
+                   << LLVMThingToString(inst);
+      }
+      break;
+  }
+
+  // Things like `nsw`, `exact`, `inbounds`, and fast-math flags.
+  copy->copyIRFlags(inst);
+
+  llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 4> mds;
+  inst->getAllMetadataOtherThanDebugLoc(mds);
+  for (auto [kind, node] : mds) {
+    if (auto new_node = llvm::dyn_cast_or_null<llvm::MDNode>(
+            MapMetadata(node))) {
+      copy->setMetadata(MapMetadataKind(kind), new_node);
+    }
+  }
+
+  return copy;
+}
+
+FunctionTransplanter::~FunctionTransplanter(void) {}
+
+FunctionTransplanter::FunctionTransplanter(llvm::Module *dest_module_)
+    : impl(new Impl(dest_module_)) {}
+
+// Copy `func` into the destination module, and return the copy.
+llvm::Function *FunctionTransplanter::Copy(llvm::Function *func) {
+  llvm::GlobalValue *gv = func;
+  return llvm::cast<llvm::Function>(Copy(gv));
+}
+
+// Copy `gv` into the destination module, and return the copy.
+llvm::GlobalValue *FunctionTransplanter::Copy(llvm::GlobalValue *gv) {
+  impl->SetSourceContext(gv->getContext());
+  auto dest_gv = impl->MapGlobal(gv);
+  impl->RequireDefinition(gv, dest_gv);
+  impl->Drain();
+  return dest_gv;
+}
+
+// Copy every function and global variable definition in `source_module`.
+void FunctionTransplanter::CopyAll(llvm::Module *source_module) {
+  impl->SetSourceContext(source_module->getContext());
+
+  // NOTE(pag): Special globals, e.g. `llvm.used`, are not copied.
+  for (auto &var : source_module->globals()) {
+    if (!var.isDeclaration() && !var.getName().startswith("llvm.")) {
+      impl->RequireDefinition(&var, impl->MapGlobal(&var));
+    }
+  }
+
+  for (auto &func : *source_module) {
+    if (!func.isDeclaration()) {
+      impl->RequireDefinition(&func, impl->MapGlobal(&func));
+    }
+  }
+
+  for (auto &alias : source_module->aliases()) {
+    (void) impl->MapGlobal(&alias);
+  }
+
+  impl->Drain();
+}
+
+class TraceClosureExtractor::Impl {
+ public:
+  const std::vector<llvm::GlobalValue *> &DirectDeps(llvm::GlobalValue *gv);
+
+  // The globals directly referenced by the code or initializer of each
+  // definition.
+  llvm::DenseMap<const llvm::GlobalValue *, std::vector<llvm::GlobalValue *>>
+      deps;
+};
+
+// Returns the globals that are directly referenced by the code or initializer
+// of `gv`, including through constant expressions.
+const std::vector<llvm::GlobalValue *> &
+TraceClosureExtractor::Impl::DirectDeps(llvm::GlobalValue *gv) {
+  if (auto it = deps.find(gv); it != deps.end()) {
+    return it->second;
+  }
+
+  std::vector<llvm::GlobalValue *> found;
+  llvm::SmallPtrSet<const llvm::Constant *, 32> seen;
+  llvm::SmallVector<llvm::Constant *, 32> work_list;
+
+  auto add = [&](llvm::Value *val) {
+    if (auto c = llvm::dyn_cast_or_null<llvm::Constant>(val);
+        c && !llvm::isa<llvm::ConstantData>(c) && seen.insert(c).second) {
+      work_list.push_back(c);
+    }
+  };
+
+  if (auto func = llvm::dyn_cast<llvm::Function>(gv)) {
+    if (func->hasPersonalityFn()) {
+      add(func->getPersonalityFn());
+    }
+    for (auto &inst : llvm::instructions(func)) {
+      for (auto &op : inst.operands()) {
+        add(op.get());
+      }
+    }
+  } else if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+    if (var->hasInitializer()) {
+      add(var->getInitializer());
+    }
+  } else if (auto alias = llvm::dyn_cast<llvm::GlobalAlias>(gv)) {
+    add(alias->getAliasee());
+  }
+
+  while (!work_list.empty()) {
+    auto c = work_list.pop_back_val();
+    if (auto dep = llvm::dyn_cast<llvm::GlobalValue>(c)) {
+      found.push_back(dep);
+    } else {
+      for (auto &op : c->operands()) {
+        add(op.get());
+      }
+    }
+  }
+
+  return deps.try_emplace(gv, std::move(found)).first->second;
+}
+
+TraceClosureExtractor::~TraceClosureExtractor(void) {}
+
+TraceClosureExtractor::TraceClosureExtractor(void) : impl(new Impl) {}
+
+// Returns `funcs`, followed by every definition that they transitively
+// depend upon and that must be copied along with them.
+std::vector<llvm::GlobalValue *>
+TraceClosureExtractor::Closure(const std::vector<llvm::Function *> &funcs) {
+  return DefinitionClosure({funcs.begin(), funcs.end()});
+}
+
+// Returns `gvs`, followed by every definition that they transitively depend
+// upon and that must be copied along with them.
+std::vector<llvm::GlobalValue *> TraceClosureExtractor::DefinitionClosure(
+    const std::vector<llvm::GlobalValue *> &gvs) {
+  std::vector<llvm::GlobalValue *> closure;
+  llvm::DenseSet<const llvm::GlobalValue *> seen;
+  for (auto gv : gvs) {
+    if (seen.insert(gv).second) {
+      closure.push_back(gv);
+    }
+  }
+
+  // NOTE(pag): `closure` doubles as the work list.
+  for (size_t i = 0; i < closure.size(); ++i) {
+    if (closure[i]->isDeclaration()) {
+      continue;
+    }
+    for (auto dep : impl->DirectDeps(closure[i])) {
+      if (MustCopyDefinition(dep) && seen.insert(dep).second) {
+        closure.push_back(dep);
+      }
+    }
+  }
+
+  return closure;
+}
+
+// Copy `funcs` and their closure into `dest_module`.
+//
+// NOTE(pag): Copying a function also copies the definitions that it needs, so
+//            most of these copies are memoized lookups. Going through
+//            `Closure` keeps what is extracted in lockstep with what `Closure`
+//            reports, and fills the cache of direct dependencies, so that
+//            later calls to `Closure` for the same traces, e.g. to key caches
+//            of extracted modules, don't rescan anything.
+std::vector<llvm::Function *>
+TraceClosureExtractor::Extract(const std::vector<llvm::Function *> &funcs,
+                               llvm::Module *dest_module) {
+  FunctionTransplanter transplanter(dest_module);
+  for (auto gv : Closure(funcs)) {
+    (void) transplanter.Copy(gv);
+  }
+
+  // NOTE(pag): These are memoized, and so don't copy anything again.
+  std::vector<llvm::Function *> copies;
+  copies.reserve(funcs.size());
+  for (auto func : funcs) {
+    copies.push_back(transplanter.Copy(func));
+  }
+  return copies;
+}
+
+// Copy the lifted trace functions `funcs`, along with everything that they
+// transitively reference, into `dest_module`.
+std::vector<llvm::Function *>
+ExtractTraceClosure(const std::vector<llvm::Function *> &funcs,
+                    llvm::Module *dest_module) {
+  return TraceClosureExtractor().Extract(funcs, dest_module);
+}
+
+}  // namespace remill
@@ -17,9 +17,13 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <atomic>
 #include <filesystem>
+#include <mutex>
 #include <sstream>
 #include <system_error>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -29,6 +33,7 @@
 #  include <unistd.h>
 #endif
 
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringExtras.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
@@ -36,6 +41,7 @@
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/LLVMContext.h>
@@ -44,15 +50,22 @@
 #include <llvm/IR/Verifier.h>
 #include <llvm/IRReader/IRReader.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA256.h>
 #include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include "remill/Arch/Arch.h"
 #include "remill/Arch/Name.h"
 #include "remill/BC/ABI.h"
 #include "remill/BC/Annotate.h"
 #include "remill/BC/IntrinsicTable.h"
+#include "remill/BC/Statistics.h"
+#include "remill/BC/Transplant.h"
 #include "remill/BC/Util.h"
 #include "remill/BC/Version.h"
 #include "remill/OS/FileSystem.h"
@@ -142,6 +155,30 @@ void InitFunctionAttributes(llvm::Function *function) {
   function->addFnAttr(llvm::Attribute::InlineHint);
 }
 
+// Inline all semantics functions called by `func`, leaving only calls to
+// intrinsics and to other traces.
+void InlineSemantics(llvm::Function *func) {
+  for (auto changed = true; changed;) {
+    changed = false;
+    std::vector<llvm::CallBase *> calls;
+    for (auto &inst : llvm::instructions(*func)) {
+      if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
+        if (auto callee = call->getCalledFunction();
+            callee && !callee->isDeclaration()) {
+          calls.push_back(call);
+        }
+      }
+    }
+
+    for (auto call : calls) {
+      llvm::InlineFunctionInfo info;
+      if (llvm::InlineFunction(*call, info).isSuccess()) {
+        changed = true;
+      }
+    }
+  }
+}
+
 // Create a call from one lifted function to another.
 llvm::CallInst *AddCall(llvm::BasicBlock *source_block, llvm::Value *dest_func,
                         const IntrinsicTable &intrinsics) {
@@ -402,6 +439,16 @@ std::unique_ptr<llvm::Module> LoadArchSemantics(const Arch *arch) {
 std::unique_ptr<llvm::Module>
 LoadArchSemantics(const Arch *arch,
                   const std::vector<std::filesystem::path> &sem_dirs) {
+  return LoadArchSemantics(arch, sem_dirs, {});
+}
+
+std::unique_ptr<llvm::Module>
+LoadArchSemantics(const Arch *arch,
+                  const std::vector<std::filesystem::path> &sem_dirs,
+                  const std::filesystem::path &verified_stamp_dir) {
+  static const Timer load_timer("semantics.load");
+  ScopedTimer timer(load_timer);
+
   auto arch_name = GetArchName(arch->arch_name);
   // If `sem_dirs` does not contain the dir, fallback to compiled in paths.
   auto path = FindSemanticsBitcodeFile(arch_name, sem_dirs, true);
@@ -413,7 +460,17 @@ LoadArchSemantics(const Arch *arch,
                << " semantics bitcode file.";
 
   DLOG(INFO) << "Loading " << arch_name << " semantics from file " << *path;
-  auto module = LoadModuleFromFile(arch->context, *path);
+
+  // Semantics modules are build artifacts, so if the caller opted in, then
+  // only verify them the first time that we see them.
+  std::unique_ptr<llvm::Module> module;
+  if (!verified_stamp_dir.empty()) {
+    module = LoadTrustedModuleFromFile(arch->context, *path,
+                                       verified_stamp_dir);
+  } else {
+    module = LoadModuleFromFile(arch->context, *path);
+  }
+
   arch->PrepareModule(module);
   arch->InitFromSemanticsModule(module.get());
   for (auto &func : *module) {
@@ -490,9 +547,102 @@ LoadModuleFromFile(llvm::LLVMContext *context,
   return module;
 }
 
+namespace {
+
+// Returns the path of the stamp file that records that the bitcode in
+// `buff` was verified by this version of LLVM. The stamp is named after a
+// SHA-256 of the bitcode, so that a stamp can't be mistaken for that of some
+// other bitcode, whether by accident or on purpose.
+static std::filesystem::path
+VerifiedStampPath(const std::filesystem::path &stamp_dir,
+                  const llvm::MemoryBuffer &buff) {
+  const auto hash =
+      llvm::SHA256::hash(llvm::arrayRefFromStringRef(buff.getBuffer()));
+  return stamp_dir / (llvm::toHex(hash, true /* LowerCase */) + ".verified");
+}
+
+static const char kVerifiedStampContents[] = "LLVM " LLVM_VERSION_STRING "\n";
+
+static bool HasVerifiedStamp(const std::filesystem::path &stamp_path) {
+  auto stamp = llvm::MemoryBuffer::getFile(stamp_path.string());
+  return stamp && (*stamp)->getBuffer() == kVerifiedStampContents;
+}
+
+// Record a stamp. Failing to do so is harmless, and only means that the
+// module will be verified again next time.
+static void AddVerifiedStamp(const std::filesystem::path &stamp_path) {
+  std::error_code ec;
+  std::filesystem::create_directories(stamp_path.parent_path(), ec);
+  if (ec) {
+    return;
+  }
+
+  std::stringstream ss;
+  ss << stamp_path.string() << ".tmp." << nativeGetProcessID();
+  const auto tmp_name = ss.str();
+  {
+    llvm::raw_fd_ostream os(tmp_name, ec, llvm::sys::fs::OF_None);
+    if (ec) {
+      return;
+    }
+    os << kVerifiedStampContents;
+  }
+
+  if (!RenameFile(tmp_name, stamp_path.string())) {
+    RemoveFile(tmp_name);
+  }
+}
+
+}  // namespace
+
+std::unique_ptr<llvm::Module>
+LoadTrustedModuleFromFile(llvm::LLVMContext *context,
+                          std::filesystem::path file_name,
+                          const std::filesystem::path &stamp_dir) {
+  auto maybe_buff = llvm::MemoryBuffer::getFile(file_name.string());
+  if (!maybe_buff) {
+    LOG(ERROR) << "Unable to read module file " << file_name << ": "
+               << maybe_buff.getError().message();
+    return {};
+  }
+
+  const auto &buff = *maybe_buff;
+  llvm::SMDiagnostic err;
+  auto module = llvm::parseIR(buff->getMemBufferRef(), err, *context);
+  if (!module) {
+    LOG(ERROR) << "Unable to parse module file " << file_name << ": "
+               << err.getMessage().str();
+    return {};
+  }
+
+  auto ec = module->materializeAll();  // Just in case.
+  if (ec) {
+    LOG(ERROR) << "Unable to materialize everything from " << file_name;
+    return {};
+  }
+
+  const auto stamp_path = VerifiedStampPath(stamp_dir, *buff);
+  if (HasVerifiedStamp(stamp_path)) {
+    DLOG(INFO) << "Skipping verification of " << file_name
+               << "; already verified according to " << stamp_path;
+    return module;
+  }
+
+  if (!VerifyModule(module.get())) {
+    LOG(ERROR) << "Error verifying module read from file " << file_name;
+    return {};
+  }
+
+  AddVerifiedStamp(stamp_path);
+  return module;
+}
+
 // Store an LLVM module into a file.
-bool StoreModuleToFile(llvm::Module *module, std::string_view file_name,
-                       bool allow_failure) {
+namespace {
+
+// Store an LLVM module into a file, optionally verifying it first.
+static bool WriteModuleToFile(llvm::Module *module, std::string_view file_name,
+                              bool verify, bool allow_failure) {
   DLOG(INFO) << "Saving bitcode to file " << file_name;
 
   std::stringstream ss;
@@ -502,7 +652,7 @@ bool StoreModuleToFile(llvm::Module *module, std::string_view file_name,
   std::string error;
   llvm::raw_string_ostream error_stream(error);
 
-  if (llvm::verifyModule(*module, &error_stream)) {
+  if (verify && llvm::verifyModule(*module, &error_stream)) {
     error_stream.flush();
     LOG_IF(FATAL, !allow_failure)
         << "Error writing module to file " << file_name << ": " << error;
@@ -528,6 +678,207 @@ bool StoreModuleToFile(llvm::Module *module, std::string_view file_name,
   }
 }
 
+// Estimate of how much work it is to write `gv` and the definitions that it
+// drags along into a partition.
+static size_t PartitionCost(llvm::GlobalValue *gv,
+                            TraceClosureExtractor &closures) {
+  auto func = llvm::dyn_cast<llvm::Function>(gv);
+  if (!func) {
+    return 1u;
+  }
+
+  size_t cost = 1u;
+  for (auto dep : closures.Closure({func})) {
+    if (auto dep_func = llvm::dyn_cast<llvm::Function>(dep)) {
+      cost += dep_func->getInstructionCount();
+    }
+  }
+  return cost;
+}
+
+}  // namespace
+
+// Store an LLVM module into a file.
+bool StoreModuleToFile(llvm::Module *module, std::string_view file_name,
+                       bool allow_failure) {
+  return WriteModuleToFile(module, file_name, true, allow_failure);
+}
+
+// Split `module` into partitions, and store them, and a manifest of them, into
+// files, using one thread per partition.
+bool StoreModulePartitionsToFiles(llvm::Module *module,
+                                  std::string_view file_name_prefix,
+                                  unsigned num_partitions, bool verify,
+                                  bool allow_failure) {
+  CHECK_LT(0u, num_partitions);
+  const std::string prefix(file_name_prefix.data(), file_name_prefix.size());
+
+  // The definitions that must exist exactly once across all partitions. The
+  // other definitions, i.e. internal semantics functions and globals, are
+  // copied into every partition that uses them.
+  std::vector<llvm::GlobalValue *> roots;
+  for (auto &func : *module) {
+    if (!func.isDeclaration() && !func.isDiscardableIfUnused()) {
+      roots.push_back(&func);
+    }
+  }
+  for (auto &var : module->globals()) {
+    if (!var.isDeclaration() && !var.isDiscardableIfUnused() &&
+        !var.getName().startswith("llvm.")) {
+      roots.push_back(&var);
+    }
+  }
+  for (auto &alias : module->aliases()) {
+    roots.push_back(&alias);
+  }
+
+  // Split the roots into contiguous runs of roughly equal cost. Neighbouring
+  // functions, e.g. traces lifted from nearby code, tend to call each other,
+  // so this keeps most calls within a partition.
+  TraceClosureExtractor closures;
+  std::vector<size_t> costs;
+  costs.reserve(roots.size());
+  size_t total_cost = 0u;
+  for (auto gv : roots) {
+    costs.push_back(PartitionCost(gv, closures));
+    total_cost += costs.back();
+  }
+
+  std::vector<std::vector<llvm::GlobalValue *>> partitions(num_partitions);
+  size_t cost_so_far = 0u;
+  for (size_t i = 0u; i < roots.size(); ++i) {
+    const auto p = std::min<size_t>(
+        num_partitions - 1u, (cost_so_far * num_partitions) / total_cost);
+    partitions[p].push_back(roots[i]);
+    cost_so_far += costs[i];
+  }
+
+  // Mutable internal or linkonce variables have state, and so can't be copied
+  // into every partition that uses them like the other internal definitions.
+  // Each is instead defined by the first partition that uses it, and declared
+  // by the others. They are given external, hidden linkage, so that linking
+  // the partitions together resolves them all to the one definition.
+  llvm::DenseMap<llvm::GlobalVariable *, unsigned> var_owners;
+  std::vector<std::vector<llvm::GlobalVariable *>> shared_vars(num_partitions);
+  for (auto i = 0u; i < num_partitions; ++i) {
+    for (auto dep : closures.DefinitionClosure(partitions[i])) {
+      auto var = llvm::dyn_cast<llvm::GlobalVariable>(dep);
+      if (!var || var->isConstant() || !var->isDiscardableIfUnused()) {
+        continue;
+      }
+
+      if (!var->hasName()) {
+        LOG_IF(FATAL, !allow_failure)
+            << "Cannot partition module " << module->getModuleIdentifier()
+            << " with unnamed mutable global " << LLVMThingToString(var);
+        return false;
+      }
+
+      shared_vars[i].push_back(var);
+      if (var_owners.try_emplace(var, i).second) {
+        partitions[i].push_back(var);
+      }
+    }
+  }
+
+  std::vector<std::string> file_names;
+  for (auto i = 0u; i < num_partitions; ++i) {
+    file_names.push_back(prefix + "." + std::to_string(i) + ".bc");
+  }
+
+  // Each partition is built in its own context, so that partitions can be
+  // verified and written in parallel.
+  //
+  // NOTE(pag): Copying from `module` is serialized. A transplanter only reads
+  //            the code of `module`, but it tracks the values that it has
+  //            copied with value handles, which are registered with, and
+  //            removed from, the context of `module`. Things like function
+  //            arguments are also lazily created when first read.
+  std::mutex copy_lock;
+  std::vector<char> written(num_partitions, 0);
+  std::atomic<unsigned> next_partition(0u);
+  auto build_partitions = [&](void) {
+    for (auto i = next_partition++; i < num_partitions;
+         i = next_partition++) {
+      llvm::LLVMContext context;
+      llvm::Module partition(module->getModuleIdentifier() + "." +
+                                 std::to_string(i),
+                             context);
+      partition.setSourceFileName(module->getSourceFileName());
+      partition.setDataLayout(module->getDataLayout());
+      partition.setTargetTriple(module->getTargetTriple());
+
+      {
+        std::lock_guard<std::mutex> locker(copy_lock);
+        FunctionTransplanter transplanter(&partition);
+        for (auto gv : partitions[i]) {
+          (void) transplanter.Copy(gv);
+        }
+
+        // NOTE(pag): These are memoized, and so only find the copies.
+        for (auto var : shared_vars[i]) {
+          auto copy = llvm::cast<llvm::GlobalVariable>(transplanter.Copy(var));
+          copy->setLinkage(llvm::GlobalValue::ExternalLinkage);
+          copy->setVisibility(llvm::GlobalValue::HiddenVisibility);
+          copy->setComdat(nullptr);
+          if (var_owners.lookup(var) != i) {
+            copy->setInitializer(nullptr);
+          }
+        }
+      }
+
+      written[i] =
+          WriteModuleToFile(&partition, file_names[i], verify, allow_failure);
+    }
+  };
+
+  const auto num_threads = std::max(
+      1u, std::min(num_partitions, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (auto i = 1u; i < num_threads; ++i) {
+    threads.emplace_back(build_partitions);
+  }
+  build_partitions();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  // The manifest tells consumers which partition defines each symbol, so
+  // that they can load or link partitions lazily.
+  const auto manifest_name = prefix + ".manifest.json";
+  std::error_code ec;
+  llvm::raw_fd_ostream manifest(manifest_name, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG_IF(FATAL, !allow_failure)
+        << "Unable to open manifest file " << manifest_name << ": "
+        << ec.message();
+    return false;
+  }
+
+  llvm::json::OStream json(manifest, 2);
+  json.object([&] {
+    json.attribute("module", module->getModuleIdentifier());
+    json.attributeArray("partitions", [&] {
+      for (auto i = 0u; i < num_partitions; ++i) {
+        json.object([&] {
+          json.attribute("file", llvm::sys::path::filename(file_names[i]));
+          json.attributeArray("definitions", [&] {
+            for (auto gv : partitions[i]) {
+              json.value(gv->getName());
+            }
+          });
+        });
+      }
+    });
+  });
+  manifest << '\n';
+  manifest.close();
+
+  return !manifest.has_error() &&
+         std::all_of(written.begin(), written.end(),
+                     [](char ok) { return ok != 0; });
+}
+
 // Store a module, serialized to LLVM IR, into a file.
 bool StoreModuleIRToFile(llvm::Module *module, std::string_view file_name_,
                          bool allow_failure) {
@@ -1781,17 +2132,23 @@ unsigned ReplaceAllUsesOfConstant(llvm::Constant *old_c, llvm::Constant *new_c,
 
 // Move a function from one module into another module.
 //
-// TODO(pag): Make this work across distinct `llvm::LLVMContext`s.
+// NOTE(pag): Functions can't be moved across distinct `llvm::LLVMContext`s, so
+//            in that case, we copy `func` and then leave it as a declaration
+//            in its source module.
 void MoveFunctionIntoModule(llvm::Function *func, llvm::Module *dest_module) {
   const auto source_context = &(func->getContext());
   const auto dest_context = &(dest_module->getContext());
-  CHECK_EQ(source_context, dest_context)
-      << "Cannot move function across two independent LLVM contexts.";
 
   auto source_module = func->getParent();
   CHECK_NE(source_module, dest_module)
       << "Cannot move function to the same module.";
 
+  if (source_context != dest_context) {
+    FunctionTransplanter(dest_module).Copy(func);
+    func->deleteBody();
+    return;
+  }
+
   const auto func_name = func->getName().str();
   auto existing_decl_in_dest_module = dest_module->getFunction(func_name);
   if (existing_decl_in_dest_module) {
@@ -1805,8 +2162,6 @@ void MoveFunctionIntoModule(llvm::Function *func, llvm::Module *dest_module) {
         llvm::GlobalValue::DefaultVisibility);
   }
 
-  const auto in_same_context = source_context == dest_context;
-
   // We need to possibly preserve `func` as a declaration in its source module.
   func->setName(llvm::Twine::createNull());
   auto replacement_decl_in_source_module = llvm::Function::Create(
@@ -1830,15 +2185,9 @@ void MoveFunctionIntoModule(llvm::Function *func, llvm::Module *dest_module) {
   value_map.emplace(func, func);
 
   // Move `func` into the destination module.
-  if (in_same_context) {
-    func->removeFromParent();
-    func->setName(func_name);
-    dest_module->getFunctionList().push_back(func);
-
-    // TODO(pag): Probably clone it into the destination module.
-  } else {
-    LOG(FATAL) << "TODO: Not yet supported.";
-  }
+  func->removeFromParent();
+  func->setName(func_name);
+  dest_module->getFunctionList().push_back(func);
 
   // There was a prior existing_decl_in_dest_module declaration in out target
   // module, so go and swap all uses of it with `func`. When doing this, we try
@@ -0,0 +1,1047 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/IPO/GlobalDCE.h>
+
+#include <algorithm>
+#include <cfenv>
+#include <csetjmp>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/IntrinsicTable.h"
+#include "remill/BC/Optimizer.h"
+#include "remill/BC/TraceLifter.h"
+#include "remill/BC/Util.h"
+#include "remill/BC/Version.h"
+#include "remill/JIT/Executor.h"
+#include "remill/JIT/GuestMemory.h"
+
+namespace remill {
+namespace {
+
+// Why a trace handed control back to the dispatch loop.
+enum class TraceExit { kNone, kJump, kReturn };
+
+// Signature of a compiled trace, where `AddrT` is the guest's `addr_t`.
+template <typename AddrT>
+using CompiledTrace = void *(*) (void *state, AddrT pc, void *memory);
+
+struct CachedTrace {
+  void *entry;
+  llvm::orc::ResourceTrackerSP tracker;
+  std::vector<InlineCache *> inline_caches;
+};
+
+using TraceCache = std::unordered_map<uint64_t, CachedTrace>;
+
+// Lifts exactly one trace at a time. Every other trace is only declared, and
+// is lifted when control first reaches it.
+class ExecutorTraceManager final : public TraceManager {
+ public:
+  ExecutorTraceManager(const Arch *arch_, llvm::Module *module_,
+                       GuestMemory &memory_, const TraceCache &traces_)
+      : arch(arch_),
+        module(module_),
+        memory(memory_),
+        traces(traces_) {}
+
+  void SetLiftedTraceDefinition(uint64_t addr,
+                                llvm::Function *lifted_func) final {
+    if (addr == head) {
+      lifted = lifted_func;
+    }
+  }
+
+  // Already-compiled traces are tail-called rather than re-lifted inline.
+  llvm::Function *GetLiftedTraceDeclaration(uint64_t addr) final {
+    if (addr != head && traces.count(addr)) {
+      return arch->DeclareLiftedFunction(TraceName(addr), module);
+    }
+    return nullptr;
+  }
+
+  // Pretend that everything other than `head` is already lifted, so that the
+  // trace lifter doesn't follow direct calls.
+  llvm::Function *GetLiftedTraceDefinition(uint64_t addr) final {
+    if (addr != head) {
+      return arch->DeclareLiftedFunction(TraceName(addr), module);
+    }
+    return nullptr;
+  }
+
+  bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) final {
+    return memory.Read(addr, byte, 1);
+  }
+
+  std::string_view TryReadExecutableBytes(uint64_t addr,
+                                          size_t max_size) final {
+    if (!memory.Contains(addr, 1)) {
+      return {};
+    }
+    const auto size = std::min<uint64_t>(max_size,
+                                         memory.size - (addr - memory.base));
+    return {reinterpret_cast<const char *>(memory.ToHost(addr)),
+            static_cast<size_t>(size)};
+  }
+
+  uint64_t head{0};
+  llvm::Function *lifted{nullptr};
+
+ private:
+  const Arch *const arch;
+  llvm::Module *const module;
+  GuestMemory &memory;
+  const TraceCache &traces;
+};
+
+}  // namespace
+
+class Executor::Impl {
+ public:
+  Impl(std::unique_ptr<llvm::orc::LLJIT> jit_,
+       llvm::orc::ThreadSafeContext tsc_, Arch::ArchPtr arch_,
+       std::unique_ptr<llvm::Module> semantics_, GuestMemory &memory_,
+       ExecutorOptions options_);
+
+  ~Impl(void);
+
+  bool BindIntrinsics(void);
+
+  ExecutorStatus Run(void *state, uint64_t pc);
+
+  void FlushTraceCache(void);
+
+  // Stop executing. Only the first reason for stopping is kept. If a trace
+  // is running, then control goes straight back to `Run`, because the trace
+  // would otherwise keep going, e.g. around a loop that faults.
+  //
+  // NOTE(pag): This uses `longjmp`, and so nothing on the host stack between
+  //            `Run` and a call to `Halt` may have a non-trivial destructor.
+  inline void Halt(ExecutorStatus status_, uint64_t pc) {
+    if (!halted) {
+      halted = true;
+      status = status_;
+      stop_pc = pc;
+    }
+    if (trace_depth) {
+      std::longjmp(halt_jmp_buf, 1);
+    }
+  }
+
+  inline void Fault(uint64_t addr) {
+    if (!halted) {
+      fault_addr = addr;
+      Halt(ExecutorStatus::kMemoryFault, trace_pc);
+    }
+  }
+
+  inline void Exit(TraceExit exit_, uint64_t pc) {
+    if (!halted) {
+      exit = exit_;
+      next_pc = pc;
+    }
+  }
+
+  // Run the function at `pc` in a nested dispatch loop.
+  void Call(void *state, uint64_t pc);
+
+  void SyncHyperCall(void *state, uint32_t call);
+  void AsyncHyperCall(void *state, uint64_t ret_addr);
+
+  // NOTE(pag): `tsc` owns the `llvm::LLVMContext` used by `arch`, so it must
+  //            outlive it, and everything else that is declared after it.
+  std::unique_ptr<llvm::orc::LLJIT> jit;
+  llvm::orc::ThreadSafeContext tsc;
+  const Arch::ArchPtr arch;
+  const std::unique_ptr<llvm::Module> semantics;
+  GuestMemory &memory;
+  const ExecutorOptions options;
+
+  TraceCache traces;
+  ExecutorTraceManager manager;
+  TraceLifter lifter;
+
+  // Names of the intrinsics implemented by host functions.
+  std::unordered_set<std::string> host_symbols;
+
+  SyncHyperCallHandler sync_hyper_call_handler;
+  AsyncHyperCallHandler async_hyper_call_handler;
+
+  // Set by lifted code to the inline cache that missed right before it
+  // transferred control back to us.
+  InlineCache *inline_cache_miss{nullptr};
+
+  // Backing storage of `__remill_shadow_return_stack`, i.e. a
+  // `ShadowReturnStack`.
+  std::vector<uint64_t> shadow_return_stack;
+
+  // Offset of the program counter in the `State` structure.
+  const uint64_t pc_offset;
+
+  // Execution state of the current call to `Run`.
+  TraceExit exit{TraceExit::kNone};
+  bool halted{false};
+  ExecutorStatus status{ExecutorStatus::kReturned};
+  uint64_t next_pc{0};
+  uint64_t trace_pc{0};
+  uint64_t stop_pc{0};
+  uint64_t fault_addr{0};
+  uint64_t num_traces{0};
+  unsigned call_depth{0};
+
+  // Number of traces on the host stack, and where `Halt` goes back to when
+  // there are any.
+  unsigned trace_depth{0};
+  std::jmp_buf halt_jmp_buf;
+
+ private:
+  // Run traces starting at `pc`, until one of them returns.
+  void Dispatch(void *state, uint64_t pc);
+
+  // Returns `true` if the trace that just ran returned directly through the
+  // shadow return stack, to the caller of the dispatch loop that began when
+  // the shadow return stack had `depth` entries.
+  bool IsShadowReturn(void *state, uint64_t depth) const;
+
+  // Returns the program counter stored in `state`.
+  uint64_t ProgramCounter(void *state) const;
+
+  void *GetOrCompileTrace(uint64_t pc);
+  void *CompileTrace(uint64_t pc);
+
+  // Add the trace at `next_pc` to `inline_cache_miss`.
+  void FillInlineCache(void);
+
+  void RedirectTraceCalls(llvm::Function *func);
+  void DefineIntrinsicStubs(llvm::Module *module);
+  void OptimizeTrace(llvm::Module *module);
+
+  inline void CallTrace(void *trace, void *state, uint64_t pc) {
+    ++trace_depth;
+    if (arch->address_size == 32) {
+      reinterpret_cast<CompiledTrace<uint32_t>>(trace)(
+          state, static_cast<uint32_t>(pc), this);
+    } else {
+      reinterpret_cast<CompiledTrace<uint64_t>>(trace)(state, pc, this);
+    }
+    --trace_depth;
+  }
+};
+
+namespace {
+
+// Host implementations of the Remill intrinsics. The lifted code passes a
+// pointer to the `Executor::Impl` as its `Memory *`.
+using Runtime = Executor::Impl;
+
+template <typename T, typename AddrT>
+static T ReadMemory(Runtime *rt, AddrT addr) {
+  if (!rt->memory.Contains(addr, sizeof(T))) {
+    rt->Fault(addr);
+    return T{};
+  }
+  return rt->memory.Load<T>(addr);
+}
+
+template <typename T, typename AddrT>
+static Runtime *WriteMemory(Runtime *rt, AddrT addr, T val) {
+  if (!rt->memory.Contains(addr, sizeof(T))) {
+    rt->Fault(addr);
+  } else {
+    rt->memory.Store<T>(addr, val);
+  }
+  return rt;
+}
+
+// `native_float80_t` values are passed by reference, and only the first ten
+// bytes are significant.
+template <typename AddrT>
+static Runtime *ReadMemoryF80(Runtime *rt, AddrT addr, uint8_t *out) {
+  if (!rt->memory.Read(addr, out, 10)) {
+    rt->Fault(addr);
+  }
+  return rt;
+}
+
+template <typename AddrT>
+static Runtime *WriteMemoryF80(Runtime *rt, AddrT addr, const uint8_t *in) {
+  if (!rt->memory.Write(addr, in, 10)) {
+    rt->Fault(addr);
+  }
+  return rt;
+}
+
+// The executor runs guest code on a single thread, so read-modify-write
+// operations don't need to be atomic with respect to anything else.
+template <typename T, typename AddrT>
+static Runtime *CompareExchange(Runtime *rt, AddrT addr, T &expected,
+                                T desired) {
+  if (!rt->memory.Contains(addr, sizeof(T))) {
+    rt->Fault(addr);
+    return rt;
+  }
+  const auto old = rt->memory.Load<T>(addr);
+  if (old == expected) {
+    rt->memory.Store<T>(addr, desired);
+  }
+  expected = old;
+  return rt;
+}
+
+template <typename AddrT>
+static Runtime *CompareExchange128(Runtime *rt, AddrT addr,
+                                   __uint128_t &expected,
+                                   __uint128_t &desired) {
+  return CompareExchange<__uint128_t, AddrT>(rt, addr, expected, desired);
+}
+
+template <typename T>
+struct BitNand {
+  inline T operator()(T a, T b) const {
+    return static_cast<T>(~(a & b));
+  }
+};
+
+template <typename T, typename AddrT, template <typename> class Op>
+static Runtime *FetchAndOp(Runtime *rt, AddrT addr, T &value) {
+  if (!rt->memory.Contains(addr, sizeof(T))) {
+    rt->Fault(addr);
+    return rt;
+  }
+  const auto old = rt->memory.Load<T>(addr);
+  rt->memory.Store<T>(addr, static_cast<T>(Op<T>()(old, value)));
+  value = old;
+  return rt;
+}
+
+template <typename AddrT>
+static Runtime *Jump(void *, AddrT pc, Runtime *rt) {
+  rt->Exit(TraceExit::kJump, pc);
+  return rt;
+}
+
+template <typename AddrT>
+static Runtime *FunctionReturn(void *, AddrT pc, Runtime *rt) {
+  rt->Exit(TraceExit::kReturn, pc);
+  return rt;
+}
+
+template <typename AddrT>
+static Runtime *FunctionCall(void *state, AddrT pc, Runtime *rt) {
+  rt->Call(state, pc);
+  return rt;
+}
+
+template <typename AddrT>
+static Runtime *Error(void *, AddrT pc, Runtime *rt) {
+  rt->Halt(ExecutorStatus::kError, pc);
+  return rt;
+}
+
+template <typename AddrT>
+static Runtime *AsyncHyperCall(void *state, AddrT ret_addr, Runtime *rt) {
+  rt->AsyncHyperCall(state, ret_addr);
+  return rt;
+}
+
+static Runtime *SyncHyperCall(void *state, Runtime *rt, uint32_t call) {
+  rt->SyncHyperCall(state, call);
+  return rt;
+}
+
+static int FPUExceptionTestAndClear(int read_mask, int clear_mask) {
+  const auto except = std::fetestexcept(read_mask);
+  std::feclearexcept(clear_mask);
+  return except;
+}
+
+template <typename F>
+static void *HostAddress(F func) {
+  return reinterpret_cast<void *>(func);
+}
+
+template <typename AddrT>
+static std::vector<std::pair<const char *, void *>> HostIntrinsics(void) {
+  return {
+      {"__remill_read_memory_8", HostAddress(ReadMemory<uint8_t, AddrT>)},
+      {"__remill_read_memory_16", HostAddress(ReadMemory<uint16_t, AddrT>)},
+      {"__remill_read_memory_32", HostAddress(ReadMemory<uint32_t, AddrT>)},
+      {"__remill_read_memory_64", HostAddress(ReadMemory<uint64_t, AddrT>)},
+      {"__remill_read_memory_f32", HostAddress(ReadMemory<float, AddrT>)},
+      {"__remill_read_memory_f64", HostAddress(ReadMemory<double, AddrT>)},
+      {"__remill_read_memory_f80", HostAddress(ReadMemoryF80<AddrT>)},
+      {"__remill_write_memory_8", HostAddress(WriteMemory<uint8_t, AddrT>)},
+      {"__remill_write_memory_16", HostAddress(WriteMemory<uint16_t, AddrT>)},
+      {"__remill_write_memory_32", HostAddress(WriteMemory<uint32_t, AddrT>)},
+      {"__remill_write_memory_64", HostAddress(WriteMemory<uint64_t, AddrT>)},
+      {"__remill_write_memory_f32", HostAddress(WriteMemory<float, AddrT>)},
+      {"__remill_write_memory_f64", HostAddress(WriteMemory<double, AddrT>)},
+      {"__remill_write_memory_f80", HostAddress(WriteMemoryF80<AddrT>)},
+
+      {"__remill_compare_exchange_memory_8",
+       HostAddress(CompareExchange<uint8_t, AddrT>)},
+      {"__remill_compare_exchange_memory_16",
+       HostAddress(CompareExchange<uint16_t, AddrT>)},
+      {"__remill_compare_exchange_memory_32",
+       HostAddress(CompareExchange<uint32_t, AddrT>)},
+      {"__remill_compare_exchange_memory_64",
+       HostAddress(CompareExchange<uint64_t, AddrT>)},
+      {"__remill_compare_exchange_memory_128",
+       HostAddress(CompareExchange128<AddrT>)},
+
+#define MAKE_FETCH_AND_OP(name, op) \
+  {"__remill_fetch_and_" #name "_8", \
+   HostAddress(FetchAndOp<uint8_t, AddrT, op>)}, \
+      {"__remill_fetch_and_" #name "_16", \
+       HostAddress(FetchAndOp<uint16_t, AddrT, op>)}, \
+      {"__remill_fetch_and_" #name "_32", \
+       HostAddress(FetchAndOp<uint32_t, AddrT, op>)}, \
+      {"__remill_fetch_and_" #name "_64", \
+       HostAddress(FetchAndOp<uint64_t, AddrT, op>)}
+
+      MAKE_FETCH_AND_OP(add, std::plus),
+      MAKE_FETCH_AND_OP(sub, std::minus),
+      MAKE_FETCH_AND_OP(and, std::bit_and),
+      MAKE_FETCH_AND_OP(or, std::bit_or),
+      MAKE_FETCH_AND_OP(xor, std::bit_xor),
+      MAKE_FETCH_AND_OP(nand, BitNand),
+
+#undef MAKE_FETCH_AND_OP
+
+      {"__remill_jump", HostAddress(Jump<AddrT>)},
+      {"__remill_missing_block", HostAddress(Jump<AddrT>)},
+      {"__remill_function_return", HostAddress(FunctionReturn<AddrT>)},
+      {"__remill_function_call", HostAddress(FunctionCall<AddrT>)},
+      {"__remill_error", HostAddress(Error<AddrT>)},
+      {"__remill_async_hyper_call", HostAddress(AsyncHyperCall<AddrT>)},
+      {"__remill_sync_hyper_call", HostAddress(SyncHyperCall)},
+      {"__remill_fpu_exception_test_and_clear",
+       HostAddress(FPUExceptionTestAndClear)},
+  };
+}
+
+}  // namespace
+
+Executor::Impl::Impl(std::unique_ptr<llvm::orc::LLJIT> jit_,
+                     llvm::orc::ThreadSafeContext tsc_, Arch::ArchPtr arch_,
+                     std::unique_ptr<llvm::Module> semantics_,
+                     GuestMemory &memory_, ExecutorOptions options_)
+    : jit(std::move(jit_)),
+      tsc(std::move(tsc_)),
+      arch(std::move(arch_)),
+      semantics(std::move(semantics_)),
+      memory(memory_),
+      options(options_),
+      manager(arch.get(), semantics.get(), memory, traces),
+      lifter(arch.get(), manager,
+             TraceLifterOptions{options.inline_cache_size,
+                                options.shadow_return_stack_size}),
+      shadow_return_stack(1u + options.shadow_return_stack_size),
+      pc_offset(arch->RegisterByName(arch->ProgramCounterRegisterName())
+                    ->offset) {}
+
+Executor::Impl::~Impl(void) {
+  FlushTraceCache();
+}
+
+// Tell the JIT about the host implementations of the intrinsics, and let it
+// resolve anything else (e.g. `memcpy` or `fmod`) against this process.
+bool Executor::Impl::BindIntrinsics(void) {
+  auto &jd = jit->getMainJITDylib();
+  auto generator =
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          jit->getDataLayout().getGlobalPrefix());
+  if (!generator) {
+    LOG(ERROR) << "Unable to search for host symbols: "
+               << llvm::toString(generator.takeError());
+    return false;
+  }
+  jd.addGenerator(std::move(*generator));
+
+  const auto intrinsics = arch->address_size == 32
+                              ? HostIntrinsics<uint32_t>()
+                              : HostIntrinsics<uint64_t>();
+  const auto flags =
+      llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+
+  llvm::orc::SymbolMap symbols;
+  auto add_symbol = [&](std::string_view name, void *addr,
+                        llvm::JITSymbolFlags sym_flags) {
+#if LLVM_VERSION_NUMBER < LLVM_VERSION(17, 0)
+    symbols[jit->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(addr), sym_flags);
+#else
+    symbols[jit->mangleAndIntern(name)] = {
+        llvm::orc::ExecutorAddr::fromPtr(addr), sym_flags};
+#endif
+  };
+
+  for (auto [name, addr] : intrinsics) {
+    host_symbols.insert(name);
+    add_symbol(name, addr, flags);
+  }
+
+  add_symbol(kInlineCacheMissVariableName, &inline_cache_miss,
+             llvm::JITSymbolFlags::Exported);
+  add_symbol(kShadowReturnStackVariableName, shadow_return_stack.data(),
+             llvm::JITSymbolFlags::Exported);
+
+  if (auto err = jd.define(llvm::orc::absoluteSymbols(std::move(symbols)))) {
+    LOG(ERROR) << "Unable to define host intrinsics: "
+               << llvm::toString(std::move(err));
+    return false;
+  }
+  return true;
+}
+
+ExecutorStatus Executor::Impl::Run(void *state, uint64_t pc) {
+  exit = TraceExit::kNone;
+  halted = false;
+  status = ExecutorStatus::kReturned;
+  next_pc = pc;
+  trace_pc = pc;
+  stop_pc = pc;
+  fault_addr = 0;
+  num_traces = 0;
+  call_depth = 0;
+  trace_depth = 0;
+  shadow_return_stack[0] = 0;  // `ShadowReturnStack::depth`.
+
+  // A `Halt` from inside of a trace comes back here, with `halted` set.
+  if (!setjmp(halt_jmp_buf)) {
+    Dispatch(state, pc);
+  }
+  trace_depth = 0;
+
+  // Report the return address.
+  if (!halted) {
+    stop_pc = next_pc;
+  }
+  return status;
+}
+
+void Executor::Impl::Dispatch(void *state, uint64_t pc) {
+
+  // The return address that the lifted code pushed before calling us is on
+  // top of the shadow return stack, and nested calls restore the depth when
+  // they return.
+  const auto shadow_depth = shadow_return_stack[0];
+
+  while (!halted) {
+    if (options.max_traces && num_traces >= options.max_traces) {
+      Halt(ExecutorStatus::kTraceLimit, pc);
+      return;
+    }
+
+    const auto trace = GetOrCompileTrace(pc);
+    if (!trace) {
+      return;
+    }
+
+    ++num_traces;
+    trace_pc = pc;
+    exit = TraceExit::kNone;
+    inline_cache_miss = nullptr;
+    CallTrace(trace, state, pc);
+
+    switch (exit) {
+      case TraceExit::kJump:
+        if (inline_cache_miss) {
+          FillInlineCache();
+        }
+        pc = next_pc;
+        continue;
+      case TraceExit::kReturn: return;
+      case TraceExit::kNone:
+        if (halted) {
+          return;
+        }
+
+        // Returned through the shadow return stack.
+        if (IsShadowReturn(state, shadow_depth)) {
+          next_pc = ProgramCounter(state);
+          return;
+        }
+
+        LOG(ERROR) << "Trace at " << std::hex << pc << std::dec
+                   << " returned without transferring control";
+        Halt(ExecutorStatus::kError, pc);
+        return;
+    }
+  }
+}
+
+bool Executor::Impl::IsShadowReturn(void *state, uint64_t depth) const {
+  if (!options.shadow_return_stack_size || !depth ||
+      shadow_return_stack[0] != depth) {
+    return false;
+  }
+  const auto mask = options.shadow_return_stack_size - 1u;
+  const auto top = shadow_return_stack[1u + ((depth - 1u) & mask)];
+  return top == ProgramCounter(state);
+}
+
+uint64_t Executor::Impl::ProgramCounter(void *state) const {
+  const auto pc = &(static_cast<uint8_t *>(state)[pc_offset]);
+  if (arch->address_size == 32) {
+    uint32_t pc32 = 0;
+    memcpy(&pc32, pc, sizeof(pc32));
+    return pc32;
+  } else {
+    uint64_t pc64 = 0;
+    memcpy(&pc64, pc, sizeof(pc64));
+    return pc64;
+  }
+}
+
+void Executor::Impl::Call(void *state, uint64_t pc) {
+  if (halted) {
+    return;
+  }
+
+  if (call_depth >= options.max_call_depth) {
+    Halt(ExecutorStatus::kCallDepthLimit, pc);
+    return;
+  }
+
+  const auto caller_trace_pc = trace_pc;
+  ++call_depth;
+  Dispatch(state, pc);
+  --call_depth;
+
+  // Resume the caller's trace.
+  trace_pc = caller_trace_pc;
+  exit = TraceExit::kNone;
+  inline_cache_miss = nullptr;
+}
+
+// Only jumps are chained. Calls and returns have to go through the dispatch
+// loop, because guest calls are nested host calls.
+void Executor::Impl::FillInlineCache(void) {
+  const auto ic = inline_cache_miss;
+  inline_cache_miss = nullptr;
+  if (ic->kind != InlineCacheKind::kJump || options.max_traces) {
+    return;
+  }
+
+  const auto target = GetOrCompileTrace(next_pc);
+  if (!target || !ic->num_entries) {
+    return;
+  }
+
+  // Replace entries round-robin.
+  const auto entry = &(ic->entries[0]) + (ic->misses % ic->num_entries);
+  entry->target = target;
+  entry->pc = next_pc;
+}
+
+void Executor::Impl::SyncHyperCall(void *state, uint32_t call) {
+  if (halted) {
+    return;
+  }
+  if (!sync_hyper_call_handler ||
+      !sync_hyper_call_handler(state, memory, call)) {
+    Halt(ExecutorStatus::kHyperCall, trace_pc);
+  }
+}
+
+void Executor::Impl::AsyncHyperCall(void *state, uint64_t ret_addr) {
+  if (halted) {
+    return;
+  }
+  if (!async_hyper_call_handler ||
+      !async_hyper_call_handler(state, memory, ret_addr)) {
+    Halt(ExecutorStatus::kHyperCall, ret_addr);
+  }
+}
+
+void *Executor::Impl::GetOrCompileTrace(uint64_t pc) {
+  if (auto it = traces.find(pc); it != traces.end()) {
+    return it->second.entry;
+  }
+
+  if (!memory.Contains(pc, 1)) {
+    fault_addr = pc;
+    Halt(ExecutorStatus::kMemoryFault, pc);
+    return nullptr;
+  }
+
+  const auto entry = CompileTrace(pc);
+  if (!entry) {
+    Halt(ExecutorStatus::kLiftFailed, pc);
+  }
+  return entry;
+}
+
+void *Executor::Impl::CompileTrace(uint64_t pc) {
+  manager.head = pc;
+  manager.lifted = nullptr;
+  if (!lifter.Lift(pc) || !manager.lifted) {
+    LOG(ERROR) << "Unable to lift trace at " << std::hex << pc << std::dec;
+    return nullptr;
+  }
+
+  const auto func = manager.lifted;
+  const auto name = func->getName().str();
+  InlineSemantics(func);
+  if (options.promote_registers) {
+    (void) PromoteRegistersToSSA(arch.get(), func);
+  }
+
+  // The trace is compiled for the host, and the `State` structure is packed,
+  // so its layout doesn't depend on the data layout.
+  auto module = std::make_unique<llvm::Module>(name, *tsc.getContext());
+  module->setTargetTriple(jit->getTargetTriple().str());
+  module->setDataLayout(jit->getDataLayout());
+  MoveFunctionIntoModule(func, module.get());
+  func->setLinkage(llvm::GlobalValue::ExternalLinkage);
+  func->removeFnAttr("target-cpu");
+  func->removeFnAttr("target-features");
+
+  RedirectTraceCalls(func);
+  DefineIntrinsicStubs(module.get());
+  OptimizeTrace(module.get());
+
+  // Make the inline caches visible, so that we can find them.
+  std::vector<std::string> inline_cache_names;
+  for (auto &global : module->globals()) {
+    if (IsInlineCache(global)) {
+      global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+      inline_cache_names.push_back(global.getName().str());
+    }
+  }
+
+  auto tracker = jit->getMainJITDylib().createResourceTracker();
+  if (auto err = jit->addIRModule(
+          tracker, llvm::orc::ThreadSafeModule(std::move(module), tsc))) {
+    LOG(ERROR) << "Unable to add trace at " << std::hex << pc << std::dec
+               << " to the JIT: " << llvm::toString(std::move(err));
+    return nullptr;
+  }
+
+  auto addr = jit->lookup(name);
+  if (!addr) {
+    LOG(ERROR) << "Unable to compile trace at " << std::hex << pc << std::dec
+               << ": " << llvm::toString(addr.takeError());
+    llvm::consumeError(tracker->remove());
+    return nullptr;
+  }
+
+  CachedTrace trace{addr->toPtr<void *>(), std::move(tracker), {}};
+  for (const auto &ic_name : inline_cache_names) {
+    if (auto ic_addr = jit->lookup(ic_name)) {
+      trace.inline_caches.push_back(ic_addr->toPtr<InlineCache *>());
+    } else {
+      llvm::consumeError(ic_addr.takeError());
+    }
+  }
+
+  const auto entry = trace.entry;
+  traces.emplace(pc, std::move(trace));
+  return entry;
+}
+
+// Calls and tail-calls to other lifted traces become calls to
+// `__remill_function_call` and `__remill_jump`, respectively, so that they go
+// through the trace cache. A direct call doesn't return until the callee
+// function returns, which a call to the callee's first trace cannot promise.
+void Executor::Impl::RedirectTraceCalls(llvm::Function *func) {
+  const auto module = func->getParent();
+  const auto lifted_func_type = arch->LiftedFunctionType();
+  auto jump = module->getOrInsertFunction("__remill_jump",
+                                                lifted_func_type);
+  auto function_call = module->getOrInsertFunction(
+      "__remill_function_call", lifted_func_type);
+
+  std::vector<llvm::CallInst *> trace_calls;
+  for (auto &inst : llvm::instructions(*func)) {
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+      auto callee = call->getCalledFunction();
+      if (callee && callee->getFunctionType() == lifted_func_type &&
+          !callee->getName().startswith("__remill_")) {
+        trace_calls.push_back(call);
+      }
+    }
+  }
+
+  for (auto call : trace_calls) {
+    if (llvm::isa<llvm::ReturnInst>(call->getNextNode())) {
+      call->setCalledFunction(jump);
+      continue;
+    }
+
+    // Conditional direct calls are lifted as a call to
+    // `__remill_function_call` followed by a call to the target trace, and
+    // the former already runs the callee.
+    llvm::CallBase *prev_call = nullptr;
+    for (auto prev = call->getPrevNode(); prev && !prev_call;
+         prev = prev->getPrevNode()) {
+      prev_call = llvm::dyn_cast<llvm::CallBase>(prev);
+    }
+    if (prev_call &&
+        prev_call->getCalledOperand() == function_call.getCallee()) {
+      call->replaceAllUsesWith(prev_call);
+      call->eraseFromParent();
+    } else {
+      call->setCalledFunction(function_call);
+    }
+  }
+}
+
+// Give a body to every intrinsic that isn't implemented by the host, so that
+// they can be inlined away. Flag and comparison markers return their first
+// argument, as do intrinsics that only thread the memory pointer through.
+// Anything else returns zero.
+void Executor::Impl::DefineIntrinsicStubs(llvm::Module *module) {
+  auto &context = module->getContext();
+  const auto i64_type = llvm::Type::getInt64Ty(context);
+  const auto i128_type = llvm::Type::getInt128Ty(context);
+  const auto mem_type = arch->MemoryPointerType();
+  const auto addr_type = arch->AddressType();
+  const auto read_64 = module->getOrInsertFunction(
+      "__remill_read_memory_64",
+      llvm::FunctionType::get(i64_type, {mem_type, addr_type}, false));
+  const auto write_64 = module->getOrInsertFunction(
+      "__remill_write_memory_64",
+      llvm::FunctionType::get(mem_type, {mem_type, addr_type, i64_type},
+                              false));
+
+  for (auto &func : *module) {
+    const auto name = func.getName();
+    if (!func.isDeclaration() || !name.startswith("__remill_") ||
+        host_symbols.count(name.str())) {
+      continue;
+    }
+
+    llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", &func));
+    const auto ret_type = func.getReturnType();
+
+    // 128-bit floats are accessed as two 64-bit halves.
+    if (name == "__remill_read_memory_f128" &&
+        ret_type->getPrimitiveSizeInBits() == 128) {
+      llvm::Value *addrs[] = {
+          NthArgument(&func, 1),
+          ir.CreateAdd(NthArgument(&func, 1),
+                       llvm::ConstantInt::get(addr_type, 8))};
+      if (!memory.little_endian) {
+        std::swap(addrs[0], addrs[1]);
+      }
+      auto lo = ir.CreateCall(read_64, {NthArgument(&func, 0), addrs[0]});
+      auto hi = ir.CreateCall(read_64, {NthArgument(&func, 0), addrs[1]});
+      auto val = ir.CreateOr(
+          ir.CreateShl(ir.CreateZExt(hi, i128_type), 64),
+          ir.CreateZExt(lo, i128_type));
+      ir.CreateRet(ir.CreateBitCast(val, ret_type));
+
+    } else if (name == "__remill_write_memory_f128" && func.arg_size() == 3 &&
+               NthArgument(&func, 2)->getType()->getPrimitiveSizeInBits() ==
+                   128) {
+      llvm::Value *addrs[] = {
+          NthArgument(&func, 1),
+          ir.CreateAdd(NthArgument(&func, 1),
+                       llvm::ConstantInt::get(addr_type, 8))};
+      if (!memory.little_endian) {
+        std::swap(addrs[0], addrs[1]);
+      }
+      auto val = ir.CreateBitCast(NthArgument(&func, 2), i128_type);
+      auto lo = ir.CreateTrunc(val, i64_type);
+      auto hi = ir.CreateTrunc(ir.CreateLShr(val, 64), i64_type);
+      llvm::Value *mem = NthArgument(&func, 0);
+      mem = ir.CreateCall(write_64, {mem, addrs[0], lo});
+      mem = ir.CreateCall(write_64, {mem, addrs[1], hi});
+      ir.CreateRet(mem);
+
+    } else if (ret_type->isVoidTy()) {
+      ir.CreateRetVoid();
+
+    } else if (func.arg_size() &&
+               NthArgument(&func, 0)->getType() == ret_type &&
+               (ret_type->isPointerTy() ||
+                name.startswith("__remill_flag_computation_") ||
+                name.startswith("__remill_compare_"))) {
+      ir.CreateRet(NthArgument(&func, 0));
+
+    } else {
+      DLOG_IF(WARNING, !name.startswith("__remill_undefined_"))
+          << "Stubbing out unsupported intrinsic " << name.str();
+      ir.CreateRet(llvm::Constant::getNullValue(ret_type));
+    }
+
+    func.setLinkage(llvm::GlobalValue::InternalLinkage);
+    func.addFnAttr(llvm::Attribute::AlwaysInline);
+  }
+}
+
+void Executor::Impl::OptimizeTrace(llvm::Module *module) {
+  llvm::ModuleAnalysisManager mam;
+  llvm::FunctionAnalysisManager fam;
+  llvm::LoopAnalysisManager lam;
+  llvm::CGSCCAnalysisManager cam;
+
+  llvm::PassBuilder pb;
+  pb.registerModuleAnalyses(mam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.registerCGSCCAnalyses(cam);
+  pb.crossRegisterProxies(lam, fam, cam, mam);
+
+  llvm::ModulePassManager mpm;
+  mpm.addPass(llvm::AlwaysInlinerPass());
+  mpm.addPass(llvm::createModuleToFunctionPassAdaptor(
+      pb.buildFunctionSimplificationPipeline(llvm::OptimizationLevel::O2,
+                                             llvm::ThinOrFullLTOPhase::None)));
+  mpm.addPass(llvm::GlobalDCEPass());
+  mpm.run(*module, mam);
+
+  mam.clear();
+  fam.clear();
+  lam.clear();
+  cam.clear();
+}
+
+void Executor::Impl::FlushTraceCache(void) {
+  for (auto &[pc, trace] : traces) {
+    if (auto err = trace.tracker->remove()) {
+      LOG(ERROR) << "Unable to free trace at " << std::hex << pc << std::dec
+                 << ": " << llvm::toString(std::move(err));
+    }
+  }
+  traces.clear();
+}
+
+const char *ExecutorStatusName(ExecutorStatus status) {
+  switch (status) {
+    case ExecutorStatus::kReturned: return "returned";
+    case ExecutorStatus::kError: return "error";
+    case ExecutorStatus::kMemoryFault: return "memory fault";
+    case ExecutorStatus::kLiftFailed: return "lift failed";
+    case ExecutorStatus::kHyperCall: return "unhandled hyper call";
+    case ExecutorStatus::kTraceLimit: return "trace limit reached";
+    case ExecutorStatus::kCallDepthLimit: return "call depth limit reached";
+  }
+  return "unknown";
+}
+
+Executor::Executor(std::unique_ptr<Impl> impl_) : impl(std::move(impl_)) {}
+
+Executor::~Executor(void) {}
+
+std::unique_ptr<Executor> Executor::Create(OSName os_name, ArchName arch_name,
+                                           GuestMemory &memory,
+                                           ExecutorOptions options) {
+  if (!memory.IsValid()) {
+    LOG(ERROR) << "Cannot execute code in an invalid guest address space";
+    return nullptr;
+  }
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  auto jit = llvm::orc::LLJITBuilder().create();
+  if (!jit) {
+    LOG(ERROR) << "Unable to create JIT: "
+               << llvm::toString(jit.takeError());
+    return nullptr;
+  }
+
+  llvm::orc::ThreadSafeContext tsc(std::make_unique<llvm::LLVMContext>());
+  auto arch = Arch::Build(tsc.getContext(), os_name, arch_name);
+  if (!arch) {
+    LOG(ERROR) << "Unable to build architecture " << GetArchName(arch_name)
+               << " for " << GetOSName(os_name);
+    return nullptr;
+  }
+
+  if (arch->MemoryAccessIsLittleEndian() != memory.little_endian) {
+    LOG(ERROR) << "Byte order of the guest address space doesn't match that of "
+               << GetArchName(arch_name);
+    return nullptr;
+  }
+
+  auto semantics = LoadArchSemantics(arch.get());
+  auto impl = std::make_unique<Impl>(std::move(*jit), std::move(tsc),
+                                     std::move(arch), std::move(semantics),
+                                     memory, options);
+  if (!impl->BindIntrinsics()) {
+    return nullptr;
+  }
+
+  return std::unique_ptr<Executor>(new Executor(std::move(impl)));
+}
+
+ExecutorStatus Executor::Run(void *state, uint64_t pc) {
+  return impl->Run(state, pc);
+}
+
+uint64_t Executor::LastProgramCounter(void) const {
+  return impl->stop_pc;
+}
+
+uint64_t Executor::LastFaultAddress(void) const {
+  return impl->fault_addr;
+}
+
+void Executor::SetSyncHyperCallHandler(SyncHyperCallHandler handler) {
+  impl->sync_hyper_call_handler = std::move(handler);
+}
+
+void Executor::SetAsyncHyperCallHandler(AsyncHyperCallHandler handler) {
+  impl->async_hyper_call_handler = std::move(handler);
+}
+
+void Executor::FlushTraceCache(void) {
+  impl->FlushTraceCache();
+}
+
+size_t Executor::NumCachedTraces(void) const {
+  return impl->traces.size();
+}
+
+void Executor::ForEachInlineCache(
+    std::function<void(const InlineCache &)> cb) const {
+  for (const auto &[pc, trace] : impl->traces) {
+    for (auto ic : trace.inline_caches) {
+      cb(*ic);
+    }
+  }
+}
+
+const Arch *Executor::GetArch(void) const {
+  return impl->arch.get();
+}
+
+}  // namespace remill
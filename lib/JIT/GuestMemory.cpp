@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "remill/JIT/GuestMemory.h"
+
+#ifndef MAP_NORESERVE
+#  define MAP_NORESERVE 0
+#endif
+
+namespace remill {
+namespace {
+
+static bool HostIsLittleEndian(void) {
+  const uint16_t val = 1;
+  uint8_t first_byte = 0;
+  memcpy(&first_byte, &val, 1);
+  return first_byte == 1;
+}
+
+}  // namespace
+
+GuestMemory::GuestMemory(uint64_t base_, uint64_t size_, bool little_endian_)
+    : base(base_),
+      size(size_),
+      little_endian(little_endian_),
+      needs_swap(little_endian_ != HostIsLittleEndian()) {
+  CHECK(size) << "Cannot create an empty guest address space";
+  CHECK_LE(base, base + (size - 1u))
+      << "Guest address space at " << std::hex << base << " with size " << size
+      << std::dec << " wraps around";
+
+  auto ret = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ret == MAP_FAILED) {
+    LOG(ERROR) << "Unable to reserve " << std::hex << size << std::dec
+               << " bytes for the guest address space: " << strerror(errno);
+  } else {
+    host = reinterpret_cast<uint8_t *>(ret);
+  }
+}
+
+GuestMemory::~GuestMemory(void) {
+  if (host) {
+    munmap(host, size);
+  }
+}
+
+bool GuestMemory::Write(uint64_t addr, const void *data, size_t num_bytes) {
+  if (!host || !Contains(addr, num_bytes)) {
+    return false;
+  }
+  memcpy(ToHost(addr), data, num_bytes);
+  return true;
+}
+
+bool GuestMemory::Read(uint64_t addr, void *data, size_t num_bytes) const {
+  if (!host || !Contains(addr, num_bytes)) {
+    return false;
+  }
+  memcpy(data, ToHost(addr), num_bytes);
+  return true;
+}
+
+bool GuestMemory::Clear(uint64_t addr, size_t num_bytes) {
+  if (!host || !Contains(addr, num_bytes)) {
+    return false;
+  }
+  memset(ToHost(addr), 0, num_bytes);
+  return true;
+}
+
+}  // namespace remill
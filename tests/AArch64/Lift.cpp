@@ -25,11 +25,14 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 #include "remill/Arch/Arch.h"
 #include "remill/Arch/Instruction.h"
@@ -81,6 +84,10 @@ class TestTraceManager : public remill::TraceManager {
     return GetLiftedTraceDeclaration(addr);
   }
 
+  std::string TraceName(uint64_t addr) override {
+    return remill::TraceManager::TraceName(addr) + name_suffix;
+  }
+
   bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override {
     auto byte_it = memory.find(addr);
     if (byte_it != memory.end()) {
@@ -94,8 +101,36 @@ class TestTraceManager : public remill::TraceManager {
  public:
   std::unordered_map<uint64_t, uint8_t> memory;
   std::unordered_map<uint64_t, llvm::Function *> traces;
+  std::string name_suffix;
 };
 
+// Tests of fused idioms are named after the semantics of the fused
+// instruction, e.g. `SUBS_B_EQ_FUSED_64`.
+static bool IsFusedTest(const test::TestInfo *test) {
+  return std::string_view(test->isel_name).find("_FUSED") !=
+         std::string_view::npos;
+}
+
+// Returns `true` if decoding the code of `test` with idiom fusion yields an
+// instruction with the semantics of the test.
+static bool FusesIdiom(const remill::Arch *arch, const test::TestInfo *test) {
+  const auto context = arch->CreateInitialContext();
+  const auto max_size = arch->MaxInstructionSize(context, true);
+  remill::Instruction inst;
+  for (auto pc = test->test_begin; pc < test->test_end;
+       pc += inst.bytes.size()) {
+    std::string_view bytes(reinterpret_cast<const char *>(pc),
+                           std::min<uint64_t>(max_size, test->test_end - pc));
+    inst.Reset();
+    if (!arch->DecodeInstruction(pc, bytes, inst, context)) {
+      return false;
+    } else if (inst.function == test->isel_name) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 extern "C" int main(int argc, char *argv[]) {
@@ -129,7 +164,22 @@ extern "C" int main(int argc, char *argv[]) {
   auto module = remill::LoadArchSemantics(arch.get());
 
   remill::IntrinsicTable intrinsics(module.get());
-  remill::TraceLifter trace_lifter(arch.get(), manager);
+  remill::TraceLifterOptions options;
+  options.fuse_idioms = true;
+  remill::TraceLifter trace_lifter(arch.get(), manager, options);
+
+  // Tests of fused idioms are also lifted without fusion, into functions
+  // with their own names.
+  TestTraceManager unfused_manager;
+  unfused_manager.memory = manager.memory;
+  unfused_manager.name_suffix = "_unfused";
+
+  remill::TraceLifterOptions unfused_options;
+  unfused_options.fuse_idioms = false;
+  remill::TraceLifter unfused_trace_lifter(arch.get(), unfused_manager,
+                                           unfused_options);
+
+  auto num_errors = 0u;
 
   for (auto test : tests) {
     if (!trace_lifter.Lift(test->test_begin)) {
@@ -143,6 +193,27 @@ extern "C" int main(int argc, char *argv[]) {
 
     auto lifted_trace = manager.GetLiftedTraceDefinition(test->test_begin);
     lifted_trace->setName(ss.str());
+
+    if (!IsFusedTest(test)) {
+      continue;
+    }
+
+    if (!FusesIdiom(arch.get(), test)) {
+      LOG(ERROR) << "Test " << test->test_name
+                 << " does not fuse an idiom into " << test->isel_name;
+      ++num_errors;
+    }
+
+    if (!unfused_trace_lifter.Lift(test->test_begin)) {
+      LOG(ERROR) << "Unable to lift unfused test " << test->test_name;
+      ++num_errors;
+      continue;
+    }
+
+    std::stringstream unfused_ss;
+    unfused_ss << SYMBOL_PREFIX << test->test_name << "_unfused_lifted";
+    unfused_manager.GetLiftedTraceDefinition(test->test_begin)
+        ->setName(unfused_ss.str());
   }
 
   DLOG(INFO) << "Serializing bitcode to " << FLAGS_bc_out;
@@ -152,5 +223,5 @@ extern "C" int main(int argc, char *argv[]) {
   remill::StoreModuleToFile(module.get(), FLAGS_bc_out);
 
   DLOG(INFO) << "Done.";
-  return 0;
+  return num_errors ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -33,6 +33,7 @@
 #include <limits>
 #include <map>
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <vector>
 
@@ -587,6 +588,10 @@ typedef Memory *(LiftedFunc) (State &, addr_t, Memory *);
 // Mapping of test name to translated function.
 static std::map<uint64_t, LiftedFunc *> gTranslatedFuncs;
 
+// Mapping of test name to the function translated without fusing idioms. Only
+// tests of fused idioms have these.
+static std::map<uint64_t, LiftedFunc *> gUnfusedTranslatedFuncs;
+
 static std::vector<const test::TestInfo *> gTests;
 }  // namespace
 
@@ -602,9 +607,9 @@ inline static bool operator!=(const T &a, const T &b) {
   return !!memcmp(&a, &b, sizeof(a));
 }
 
-static void RunWithFlags(const test::TestInfo *info, NZCV flags,
-                         std::string desc, uint64_t arg1, uint64_t arg2,
-                         uint64_t arg3) {
+static void RunWithFlags(const test::TestInfo *info, LiftedFunc *lifted_func,
+                         NZCV flags, std::string desc, uint64_t arg1,
+                         uint64_t arg2, uint64_t arg3) {
 
   DLOG(INFO) << "Testing instruction: " << info->test_name << ": " << desc;
   if (sigsetjmp(gUnsupportedInstrBuf, true)) {
@@ -641,8 +646,6 @@ static void RunWithFlags(const test::TestInfo *info, NZCV flags,
   memcpy(&gNativeStack, &gLiftedStack, sizeof(gLiftedStack));
   memcpy(&gLiftedStack, &gRandomStack, sizeof(gLiftedStack));
 
-  auto lifted_func = gTranslatedFuncs[info->test_begin];
-
   // Includes the additional injected `adrp` and `add`.
   lifted_state->gpr.pc.aword = static_cast<addr_t>(info->test_begin + 4 + 4);
 
@@ -787,7 +790,15 @@ TEST_P(InstrTest, SemanticsMatchNative) {
       ss2 << desc << " and N=" << flags.n << ", Z=" << flags.z
           << ", C=" << flags.c << ", V=" << flags.v;
 
-      RunWithFlags(info, flags, ss2.str(), args[0], args[1], args[2]);
+      RunWithFlags(info, gTranslatedFuncs[info->test_begin], flags, ss2.str(),
+                   args[0], args[1], args[2]);
+
+      // The fused and unfused idioms must both behave like the native code.
+      auto unfused_it = gUnfusedTranslatedFuncs.find(info->test_begin);
+      if (unfused_it != gUnfusedTranslatedFuncs.end()) {
+        RunWithFlags(info, unfused_it->second, flags, ss2.str() + " unfused",
+                     args[0], args[1], args[2]);
+      }
     }
   }
 }
@@ -941,6 +952,25 @@ int main(int argc, char **argv) {
 
     auto lifted_func = reinterpret_cast<LiftedFunc *>(sym_func);
     gTranslatedFuncs[test.test_begin] = lifted_func;
+
+    // Tests of fused idioms are also lifted without fusion.
+    if (std::string_view(test.isel_name).find("_FUSED") ==
+        std::string_view::npos) {
+      continue;
+    }
+
+    ss.str("");
+    ss << test.test_name << "_unfused_lifted";
+    sym_func = dlsym(this_exe, ss.str().c_str());
+    if (!sym_func) {
+      sym_func = dlsym(this_exe, (std::string("_") + ss.str()).c_str());
+    }
+
+    CHECK(nullptr != sym_func)
+        << "Could not find unfused code for test case " << test.test_name;
+
+    gUnfusedTranslatedFuncs[test.test_begin] =
+        reinterpret_cast<LiftedFunc *>(sym_func);
   }
 
   // Populate the random stack.
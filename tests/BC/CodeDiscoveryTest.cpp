@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/IR/LLVMContext.h>
+
+#include <cstdint>
+#include <set>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Instruction.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/CodeDiscovery.h"
+#include "remill/BC/Statistics.h"
+#include "remill/BC/TraceLifter.h"
+#include "remill/OS/OS.h"
+#include "tests/BC/Test.h"
+
+namespace {
+
+class CodeDiscoveryTest : public testing::Test {
+ protected:
+  remill::CodeGraph Discover(remill::ArchName arch_name,
+                             std::vector<uint64_t> trace_heads,
+                             unsigned num_threads = 1) {
+    const auto arch = remill::Arch::Get(context, remill::kOSLinux, arch_name);
+    CHECK(arch != nullptr);
+    remill::CodeDiscoveryOptions options;
+    options.num_threads = num_threads;
+    remill::CodeDiscovery discovery(arch.get(), manager, options);
+    return discovery.Discover(trace_heads);
+  }
+
+  // Load a small amd64 function that calls another function.
+  void LoadCallAndBranch(void) {
+    manager.Load(0x1000, {
+                             0xe8, 0x06, 0x00, 0x00, 0x00,  // call 0x100b
+                             0x85, 0xc0,  // test eax, eax
+                             0x74, 0x01,  // jz 0x100a
+                             0x90,  // nop
+                             0xc3,  // 0x100a: ret
+                             0xb8, 0x01, 0x00, 0x00, 0x00,  // mov eax, 1
+                             0xc3,  // ret
+                         });
+  }
+
+  llvm::LLVMContext context;
+  test::TraceManager manager;
+};
+
+using Addrs = std::vector<uint64_t>;
+
+TEST_F(CodeDiscoveryTest, CallAndBranch) {
+  LoadCallAndBranch();
+  const auto graph = Discover(remill::kArchAMD64, {0x1000});
+
+  EXPECT_EQ(graph.trace_heads, (std::set<uint64_t>{0x1000, 0x100b}));
+  EXPECT_TRUE(graph.missing_blocks.empty());
+  ASSERT_EQ(graph.blocks.size(), 5u);
+
+  const auto &call = graph.blocks.at(0x1000);
+  EXPECT_EQ(call.end_pc, 0x1005u);
+  EXPECT_EQ(call.num_instructions, 1u);
+  EXPECT_EQ(call.terminator,
+            remill::Instruction::kCategoryDirectFunctionCall);
+  EXPECT_EQ(call.successors, Addrs{0x1005});
+  EXPECT_EQ(call.callees, Addrs{0x100b});
+
+  const auto &branch = graph.blocks.at(0x1005);
+  EXPECT_EQ(branch.num_instructions, 2u);
+  EXPECT_EQ(branch.terminator,
+            remill::Instruction::kCategoryConditionalBranch);
+  EXPECT_EQ(branch.successors, (Addrs{0x100a, 0x1009}));
+
+  // Falls through into the block of the branch target.
+  const auto &nop = graph.blocks.at(0x1009);
+  EXPECT_EQ(nop.end_pc, 0x100au);
+  EXPECT_EQ(nop.successors, Addrs{0x100a});
+
+  const auto &ret = graph.blocks.at(0x100a);
+  EXPECT_EQ(ret.terminator, remill::Instruction::kCategoryFunctionReturn);
+  EXPECT_TRUE(ret.successors.empty());
+
+  const auto &callee = graph.blocks.at(0x100b);
+  EXPECT_EQ(callee.num_instructions, 2u);
+  EXPECT_EQ(callee.end_pc, 0x1011u);
+  EXPECT_FALSE(callee.has_delay_slot);
+}
+
+// Control reaches an address without any executable bytes.
+TEST_F(CodeDiscoveryTest, MissingBlock) {
+  manager.Load(0x1000, {
+                           0xe9, 0xfb, 0x0f, 0x00, 0x00,  // jmp 0x2000
+                       });
+  const auto graph = Discover(remill::kArchAMD64, {0x1000});
+
+  EXPECT_EQ(graph.missing_blocks, std::set<uint64_t>{0x2000});
+  ASSERT_EQ(graph.blocks.size(), 1u);
+  EXPECT_EQ(graph.blocks.at(0x1000).successors, Addrs{0x2000});
+}
+
+// The graph doesn't depend on how many threads decode the code.
+TEST_F(CodeDiscoveryTest, ManyThreads) {
+  LoadCallAndBranch();
+  const auto expected = Discover(remill::kArchAMD64, {0x1000}, 1);
+  const auto actual = Discover(remill::kArchAMD64, {0x1000, 0x1005}, 4);
+
+  EXPECT_EQ(actual.trace_heads,
+            (std::set<uint64_t>{0x1000, 0x1005, 0x100b}));
+  ASSERT_EQ(actual.blocks.size(), expected.blocks.size());
+  for (const auto &[pc, block] : expected.blocks) {
+    const auto &other = actual.blocks.at(pc);
+    EXPECT_EQ(other.end_pc, block.end_pc);
+    EXPECT_EQ(other.num_instructions, block.num_instructions);
+    EXPECT_EQ(other.terminator, block.terminator);
+    EXPECT_EQ(other.successors, block.successors);
+    EXPECT_EQ(other.callees, block.callees);
+  }
+}
+
+// Branch targets wrap around a 32-bit address space.
+TEST_F(CodeDiscoveryTest, AddressWrapAround) {
+  manager.Load(0x1000, {
+                           0xe9, 0x00, 0xe0, 0xff, 0xff,  // jmp 0xfffff005
+                       });
+  manager.Load(0xfffff005, {
+                               0xc3,  // ret
+                           });
+  const auto graph = Discover(remill::kArchX86, {0x1000});
+
+  EXPECT_TRUE(graph.missing_blocks.empty());
+  ASSERT_EQ(graph.blocks.size(), 2u);
+  EXPECT_EQ(graph.blocks.at(0x1000).successors, Addrs{0xfffff005});
+  EXPECT_EQ(graph.blocks.at(0xfffff005).terminator,
+            remill::Instruction::kCategoryFunctionReturn);
+}
+
+// The instruction in a delay slot belongs to the block of the branch, and
+// isn't the start of a block itself.
+TEST_F(CodeDiscoveryTest, DelaySlots) {
+  manager.LoadWords(0x1000, {
+                                0x40000004,  // call 0x1010
+                                0x01000000,  // nop
+                                0x81c3e008,  // 0x1008: retl
+                                0x01000000,  // nop
+                                0x81c3e008,  // 0x1010: retl
+                                0x01000000,  // nop
+                            });
+  const auto graph = Discover(remill::kArchSparc32, {0x1000});
+
+  EXPECT_EQ(graph.trace_heads, (std::set<uint64_t>{0x1000, 0x1010}));
+  ASSERT_EQ(graph.blocks.size(), 3u);
+
+  const auto &call = graph.blocks.at(0x1000);
+  EXPECT_TRUE(call.has_delay_slot);
+  EXPECT_EQ(call.delayed_pc, 0x1004u);
+  EXPECT_EQ(call.end_pc, 0x1008u);
+  EXPECT_EQ(call.num_instructions, 2u);
+  EXPECT_EQ(call.terminator,
+            remill::Instruction::kCategoryDirectFunctionCall);
+  EXPECT_EQ(call.successors, Addrs{0x1008});
+  EXPECT_EQ(call.callees, Addrs{0x1010});
+
+  for (auto pc : {0x1008u, 0x1010u}) {
+    const auto &ret = graph.blocks.at(pc);
+    EXPECT_TRUE(ret.has_delay_slot);
+    EXPECT_EQ(ret.delayed_pc, pc + 4u);
+    EXPECT_EQ(ret.num_instructions, 2u);
+    EXPECT_EQ(ret.terminator, remill::Instruction::kCategoryFunctionReturn);
+  }
+}
+
+// A delay slot without executable bytes is an error, just like when the
+// `TraceLifter` lifts it.
+TEST_F(CodeDiscoveryTest, MissingDelaySlot) {
+  manager.LoadWords(0x1000, {
+                                0x81c3e008,  // retl
+                            });
+  const auto graph = Discover(remill::kArchSparc32, {0x1000});
+
+  ASSERT_EQ(graph.blocks.size(), 1u);
+  const auto &ret = graph.blocks.at(0x1000);
+  EXPECT_FALSE(ret.has_delay_slot);
+  EXPECT_EQ(ret.num_instructions, 1u);
+  EXPECT_EQ(ret.terminator, remill::Instruction::kCategoryError);
+  EXPECT_TRUE(ret.successors.empty());
+}
+
+// Discovery counts the instructions that it decodes, not just the blocks.
+TEST_F(CodeDiscoveryTest, Statistics) {
+  manager.Load(0x1000, {
+                           0x74, 0x01,  // jz 0x1003
+                           0x06,  // Invalid in 64-bit mode.
+                           0xc3,  // 0x1003: ret
+                       });
+  manager.Load(0x2000, {
+                           0xe9, 0xfb, 0x0f, 0x00, 0x00,  // jmp 0x3000
+                       });
+
+  remill::EnableStatistics();
+  remill::ResetStatistics();
+  const auto graph = Discover(remill::kArchAMD64, {0x1000, 0x2000});
+  remill::EnableStatistics(false);
+
+  ASSERT_EQ(graph.blocks.size(), 4u);
+  EXPECT_EQ(graph.blocks.at(0x1002).terminator,
+            remill::Instruction::kCategoryInvalid);
+  EXPECT_EQ(remill::ReadStatistic("code_discovery.blocks"), 4u);
+  EXPECT_EQ(remill::ReadStatistic("code_discovery.missing_blocks"), 1u);
+  EXPECT_EQ(remill::ReadStatistic("code_discovery.instructions"), 4u);
+  EXPECT_EQ(remill::ReadStatistic("code_discovery.invalid_instructions"), 1u);
+  EXPECT_EQ(remill::ReadStatistic("code_discovery.discover"), 1u);
+}
+
+}  // namespace
@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <llvm/IR/LLVMContext.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Instruction.h"
+#include "remill/Arch/Name.h"
+#include "remill/OS/OS.h"
+
+namespace {
+
+// Instructions that mean the same thing in 32- and 64-bit x86 code, unless
+// noted otherwise.
+//
+// NOTE(pag): Undecodable bytes are followed by at least `15` more bytes, as
+//            `DecodeInstruction` can't tell them apart from the prefix of an
+//            instruction that is cut off at the end of the bytes.
+static const std::vector<uint8_t> kX86Code = {
+    0x90,  // nop
+    0x06,  // push es, which is invalid in 64-bit code
+    0xc5, 0xf8, 0x77, 0x00,  // vzeroupper, which needs AVX, or `clc; ja +0`
+    0x89, 0xd8,  // mov eax, ebx
+    0x83, 0xc0, 0x07,  // add eax, 7
+    0xb8, 0x05, 0x00, 0x00, 0x00,  // mov eax, 5
+    0x8b, 0x03,  // mov eax, [ebx] (or [rbx])
+    0x74, 0x02,  // jz +2
+    0x0f, 0x85, 0x00, 0x01, 0x00, 0x00,  // jnz +0x100
+    0xeb, 0xfe,  // jmp -2
+    0xe9, 0x00, 0x00, 0x00, 0x80,  // jmp -0x80000000, wraps in 32-bit code
+    0xe8, 0x00, 0x00, 0x00, 0x00,  // call +0
+    0xe2, 0xfe,  // loop -2
+    0xff, 0xd0,  // call eax (or rax)
+    0xff, 0xe0,  // jmp eax (or rax)
+    0xcc,  // int3
+    0x0f, 0x0b,  // ud2
+    0xc3,  // ret
+};
+
+// Little-endian AArch64 instructions.
+static const std::vector<uint32_t> kAArch64Code = {
+    0xd503201f,  // nop
+    0x91000420,  // add x0, x1, #1
+    0x8b020020,  // add x0, x1, x2
+    0xf9400020,  // ldr x0, [x1]
+    0xf9000020,  // str x0, [x1]
+    0xeb01001f,  // cmp x0, x1
+    0x90000000,  // adrp x0, #0
+    0x14000004,  // b +16
+    0x17fffffc,  // b -16
+    0x97ffffff,  // bl -4
+    0x54000040,  // b.eq +8
+    0xb4000040,  // cbz x0, +8
+    0x37000040,  // tbnz w0, #0, +8
+    0xd63f0000,  // blr x0
+    0xd61f0000,  // br x0
+    0xd65f03c0,  // ret
+};
+
+// Linearly sweep `bytes` with `Arch::DecodeInstruction`. This is the
+// reference that `Arch::DecodeRange` must agree with.
+static uint64_t
+ReferenceDecodeRange(const remill::Arch *arch, uint64_t address,
+                     std::string_view bytes,
+                     std::vector<remill::InstructionSummary> &out) {
+  const auto context = arch->CreateInitialContext();
+  const auto max_size = arch->MaxInstructionSize(context, false);
+  const auto align = std::max<uint64_t>(1u, arch->MinInstructionAlign(context));
+  const auto addr_mask =
+      arch->address_size < 64 ? (1ull << arch->address_size) - 1ull : ~0ull;
+
+  uint64_t offset = 0;
+  remill::Instruction inst;
+  while (offset < bytes.size()) {
+    remill::InstructionSummary summary;
+    summary.pc = address + offset;
+
+    inst.Reset();
+    if (arch->DecodeInstruction(summary.pc, bytes.substr(offset, max_size),
+                                inst, context)) {
+      summary.size = static_cast<uint32_t>(inst.bytes.size());
+      summary.next_pc = inst.next_pc;
+      summary.category = inst.category;
+      switch (inst.category) {
+        case remill::Instruction::kCategoryDirectJump:
+        case remill::Instruction::kCategoryDirectFunctionCall:
+        case remill::Instruction::kCategoryConditionalDirectFunctionCall:
+        case remill::Instruction::kCategoryConditionalBranch:
+          summary.has_direct_target = true;
+          summary.direct_target = inst.branch_taken_pc & addr_mask;
+          break;
+        default: break;
+      }
+
+    // The bytes end with the prefix of an instruction.
+    } else if (bytes.size() - offset < max_size) {
+      break;
+
+    } else {
+      summary.size = static_cast<uint32_t>(align);
+      summary.next_pc = summary.pc + align;
+    }
+
+    out.push_back(summary);
+    offset += summary.size;
+  }
+  return offset;
+}
+
+class DecodeRangeTest : public testing::Test {
+ protected:
+  remill::Arch::ArchPtr Get(remill::ArchName arch_name) {
+    return remill::Arch::Get(context, remill::kOSLinux, arch_name);
+  }
+
+  // Decode `bytes` with `DecodeRange` and with `DecodeInstruction`, and check
+  // that they agree on every instruction.
+  void ExpectEquivalent(const remill::Arch *arch, uint64_t address,
+                        std::string_view bytes) {
+    std::vector<remill::InstructionSummary> expected;
+    const auto expected_size =
+        ReferenceDecodeRange(arch, address, bytes, expected);
+
+    std::vector<remill::InstructionSummary> actual;
+    const auto actual_size = arch->DecodeRange(
+        address, bytes, [&](const remill::InstructionSummary &summary) {
+          actual.push_back(summary);
+          return true;
+        });
+
+    EXPECT_EQ(actual_size, expected_size);
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      const auto &a = actual[i];
+      const auto &e = expected[i];
+      SCOPED_TRACE(testing::Message() << "Instruction at 0x" << std::hex
+                                      << e.pc);
+      EXPECT_EQ(a.pc, e.pc);
+      EXPECT_EQ(a.size, e.size);
+      EXPECT_EQ(a.next_pc, e.next_pc);
+      EXPECT_EQ(a.category, e.category);
+      EXPECT_EQ(a.has_direct_target, e.has_direct_target);
+      if (e.has_direct_target) {
+        EXPECT_EQ(a.direct_target, e.direct_target);
+      }
+    }
+  }
+
+  void ExpectEquivalentX86(remill::ArchName arch_name) {
+    const auto arch = Get(arch_name);
+    ASSERT_NE(arch, nullptr);
+    const std::string code(kX86Code.begin(), kX86Code.end());
+    ExpectEquivalent(arch.get(), 0x1000, code);
+
+    // Ends with a partial `mov eax, 5`.
+    ExpectEquivalent(arch.get(), 0x1000, code + std::string("\xb8\x05\x00", 3));
+  }
+
+  llvm::LLVMContext context;
+};
+
+TEST_F(DecodeRangeTest, X86) {
+  ExpectEquivalentX86(remill::kArchX86);
+}
+
+TEST_F(DecodeRangeTest, AMD64) {
+  ExpectEquivalentX86(remill::kArchAMD64);
+}
+
+TEST_F(DecodeRangeTest, AArch64) {
+  const auto arch = Get(remill::kArchAArch64LittleEndian);
+  ASSERT_NE(arch, nullptr);
+
+  std::string code;
+  for (auto word : kAArch64Code) {
+    for (auto i = 0u; i < 4u; ++i) {
+      code.push_back(static_cast<char>((word >> (i * 8u)) & 0xffu));
+    }
+  }
+  ExpectEquivalent(arch.get(), 0x1000, code);
+
+  // Ends with a partial instruction.
+  ExpectEquivalent(arch.get(), 0x1000, code + "\x1f\x20");
+}
+
+}  // namespace
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/Interpreter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Instruction.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/IntrinsicTable.h"
+#include "remill/BC/Optimizer.h"
+#include "remill/BC/TraceLifter.h"
+#include "remill/BC/Transplant.h"
+#include "remill/BC/Util.h"
+#include "remill/OS/OS.h"
+#include "tests/BC/Test.h"
+
+namespace {
+
+static constexpr uint64_t kJumpAddr = 0x1000;
+static constexpr uint64_t kTargetAddr = 0x2000;
+static constexpr uint64_t kOtherAddr = 0x3000;
+
+// Code at `kJumpAddr` is `jmp rax`, which can go to `kTargetAddr`.
+class JumpTraceManager : public test::TraceManager {
+ public:
+  JumpTraceManager(void) {
+    Load(kJumpAddr, {0xff, 0xe0});
+  }
+
+  void ForEachDevirtualizedTarget(
+      const remill::Instruction &inst,
+      std::function<void(uint64_t, remill::DevirtualizedTargetKind)> func)
+      final {
+    if (inst.pc == kJumpAddr) {
+      func(kTargetAddr, remill::DevirtualizedTargetKind::kTraceHead);
+    }
+  }
+};
+
+class InlineCacheTest : public test::ArchTest {
+ protected:
+  void SetUp(void) override {
+    ASSERT_NO_FATAL_FAILURE(LoadArch(remill::kArchAMD64));
+
+    // The target of the jump is already lifted, and sets `RBX` to `7`.
+    llvm::IRBuilder<> ir(context);
+    target = arch->DeclareLiftedFunction(manager.TraceName(kTargetAddr),
+                                         semantics.get());
+    ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", target));
+    ir.CreateStore(
+        ir.getInt64(7),
+        arch->RegisterByName("RBX")->AddressOf(
+            remill::NthArgument(target, remill::kStatePointerArgNum), ir));
+    ir.CreateRet(remill::NthArgument(target, remill::kMemoryPointerArgNum));
+    manager.traces[kTargetAddr] = target;
+
+    remill::TraceLifterOptions options;
+    options.inline_cache_size = 2;
+    remill::TraceLifter lifter(arch.get(), manager, options);
+    ASSERT_TRUE(lifter.Lift(kJumpAddr));
+    lifted = manager.traces[kJumpAddr];
+    ASSERT_NE(lifted, nullptr);
+  }
+
+  // Returns the inline cache of the indirect jump.
+  llvm::GlobalVariable *InlineCache(llvm::Module *module) {
+    for (auto &global : module->globals()) {
+      if (remill::IsInlineCache(global)) {
+        return &global;
+      }
+    }
+    return nullptr;
+  }
+
+  // Run the lifted `jmp rax`, and return the value of `RBX` afterward.
+  uint64_t Run(uint64_t rax) {
+    auto module = std::make_unique<llvm::Module>("test", context);
+    arch->PrepareModule(module.get());
+    const auto funcs = remill::ExtractTraceClosure({lifted, target},
+                                                   module.get());
+
+    // Record calls to `__remill_jump`.
+    const auto i64_type = llvm::Type::getInt64Ty(context);
+    const auto jumps = new llvm::GlobalVariable(
+        *module, i64_type, false, llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantInt::get(i64_type, 0), "jumps");
+    const auto jump = module->getFunction(
+        arch->GetInstrinsicTable()->jump->getName());
+    CHECK(jump != nullptr);
+    llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", jump));
+    ir.CreateStore(ir.CreateAdd(ir.CreateLoad(i64_type, jumps),
+                                ir.getInt64(1)),
+                   jumps);
+    ir.CreateRet(remill::NthArgument(jump, remill::kMemoryPointerArgNum));
+
+    const auto miss = module->getGlobalVariable(
+        remill::kInlineCacheMissVariableName);
+    CHECK(miss != nullptr);
+    miss->setInitializer(llvm::Constant::getNullValue(miss->getValueType()));
+
+    const auto ic = InlineCache(module.get());
+    CHECK(ic != nullptr);
+    const auto func_name = funcs[0]->getName().str();
+
+    const auto &dl = module->getDataLayout();
+    std::vector<uint8_t> state(
+        dl.getTypeAllocSize(arch->StateStructType()).getFixedValue());
+    std::memcpy(&(state[arch->RegisterByName("RAX")->offset]), &rax,
+                sizeof(rax));
+
+    std::string error;
+    std::unique_ptr<llvm::ExecutionEngine> engine(
+        llvm::EngineBuilder(std::move(module))
+            .setEngineKind(llvm::EngineKind::Interpreter)
+            .setErrorStr(&error)
+            .create());
+    CHECK(engine != nullptr) << error;
+
+    std::vector<llvm::GenericValue> args(3);
+    args[0] = llvm::PTOGV(state.data());
+    args[1].IntVal = llvm::APInt(64, kJumpAddr);
+    args[2] = llvm::PTOGV(nullptr);
+    engine->runFunction(engine->FindFunctionNamed(func_name), args);
+
+    const auto ic_data = reinterpret_cast<const remill::InlineCache *>(
+        engine->getPointerToGlobal(ic));
+    hits = ic_data->hits;
+    misses = ic_data->misses;
+    num_jumps = *reinterpret_cast<const uint64_t *>(
+        engine->getPointerToGlobal(jumps));
+    last_miss = *reinterpret_cast<const void *const *>(
+        engine->getPointerToGlobal(miss));
+    missed_ic = ic_data;
+
+    uint64_t rbx = 0;
+    std::memcpy(&rbx, &(state[arch->RegisterByName("RBX")->offset]),
+                sizeof(rbx));
+    return rbx;
+  }
+
+  JumpTraceManager manager;
+  llvm::Function *target{nullptr};
+  llvm::Function *lifted{nullptr};
+
+  // Results of the last `Run`.
+  uint64_t hits{0};
+  uint64_t misses{0};
+  uint64_t num_jumps{0};
+  const void *last_miss{nullptr};
+  const void *missed_ic{nullptr};
+};
+
+// The cache is seeded with the devirtualized target of the jump.
+TEST_F(InlineCacheTest, Emitted) {
+  const auto ic = InlineCache(semantics.get());
+  ASSERT_NE(ic, nullptr);
+
+  const auto init = llvm::cast<llvm::ConstantStruct>(ic->getInitializer());
+  const auto kind = llvm::cast<llvm::ConstantInt>(init->getOperand(2));
+  EXPECT_EQ(kind->getZExtValue(),
+            static_cast<uint64_t>(remill::InlineCacheKind::kJump));
+  const auto num_entries = llvm::cast<llvm::ConstantInt>(init->getOperand(3));
+  EXPECT_EQ(num_entries->getZExtValue(), 2u);
+  const auto site_pc = llvm::cast<llvm::ConstantInt>(init->getOperand(4));
+  EXPECT_EQ(site_pc->getZExtValue(), kJumpAddr);
+
+  const auto entries = llvm::cast<llvm::ConstantArray>(init->getOperand(5));
+  const auto seeded = llvm::cast<llvm::ConstantStruct>(entries->getOperand(0));
+  EXPECT_EQ(llvm::cast<llvm::ConstantInt>(seeded->getOperand(0))
+                ->getZExtValue(),
+            kTargetAddr);
+  EXPECT_EQ(seeded->getOperand(1), target);
+  const auto empty = llvm::cast<llvm::ConstantStruct>(entries->getOperand(1));
+  EXPECT_EQ(llvm::cast<llvm::ConstantInt>(empty->getOperand(0))
+                ->getZExtValue(),
+            remill::kEmptyInlineCacheEntry);
+
+  EXPECT_FALSE(llvm::verifyFunction(*lifted, &llvm::errs()));
+}
+
+// A jump to a cached target tail-calls it directly.
+TEST_F(InlineCacheTest, Hit) {
+  EXPECT_EQ(Run(kTargetAddr), 7u);
+  EXPECT_EQ(hits, 1u);
+  EXPECT_EQ(misses, 0u);
+  EXPECT_EQ(num_jumps, 0u);
+  EXPECT_EQ(last_miss, nullptr);
+}
+
+// A jump to any other target goes through `__remill_jump`, and tells it which
+// cache missed.
+TEST_F(InlineCacheTest, Miss) {
+  EXPECT_EQ(Run(kOtherAddr), 0u);
+  EXPECT_EQ(hits, 0u);
+  EXPECT_EQ(misses, 1u);
+  EXPECT_EQ(num_jumps, 1u);
+  EXPECT_EQ(last_miss, missed_ic);
+}
+
+// The hits are `musttail` calls, so promoting registers must write them back
+// before the call, and not between the call and the `ret`.
+TEST_F(InlineCacheTest, PromotedRegisters) {
+  remill::PromoteRegistersToSSA(arch.get(), lifted);
+  EXPECT_FALSE(llvm::verifyFunction(*lifted, &llvm::errs()));
+
+  auto num_must_tail = 0u;
+  for (auto &inst : llvm::instructions(*lifted)) {
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst);
+        call && call->isMustTailCall()) {
+      EXPECT_TRUE(llvm::isa<llvm::ReturnInst>(call->getNextNode()));
+      ++num_must_tail;
+    }
+  }
+  EXPECT_EQ(num_must_tail, 2u);
+
+  EXPECT_EQ(Run(kTargetAddr), 7u);
+  EXPECT_EQ(hits, 1u);
+  EXPECT_EQ(Run(kOtherAddr), 0u);
+  EXPECT_EQ(misses, 1u);
+}
+
+}  // namespace
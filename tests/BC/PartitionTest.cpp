@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "remill/BC/Util.h"
+
+namespace {
+
+class PartitionTest : public testing::Test {
+ protected:
+  void SetUp(void) override {
+    const auto *info = testing::UnitTest::GetInstance()->current_test_info();
+    dir = std::filesystem::path(testing::TempDir()) /
+          (std::string("remill_partition_") + info->name());
+    std::filesystem::remove_all(dir);
+    ASSERT_TRUE(std::filesystem::create_directories(dir));
+    prefix = (dir / "lifted").string();
+  }
+
+  void TearDown(void) override {
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+  }
+
+  // Returns the names of the definitions of each partition, as listed by the
+  // manifest.
+  std::vector<std::set<std::string>> ReadManifest(void) {
+    auto buf = llvm::MemoryBuffer::getFile(prefix + ".manifest.json");
+    CHECK(buf) << buf.getError().message();
+    auto json = llvm::json::parse((*buf)->getBuffer());
+    CHECK(json) << llvm::toString(json.takeError());
+
+    std::vector<std::set<std::string>> defs;
+    for (auto &partition : *json->getAsObject()->getArray("partitions")) {
+      auto &names = defs.emplace_back();
+      for (auto &name :
+           *partition.getAsObject()->getArray("definitions")) {
+        names.insert(name.getAsString()->str());
+      }
+    }
+    return defs;
+  }
+
+  std::unique_ptr<llvm::Module> LoadPartition(unsigned i) {
+    return remill::LoadModuleFromFile(
+        &context, prefix + "." + std::to_string(i) + ".bc");
+  }
+
+  llvm::LLVMContext context;
+  std::filesystem::path dir;
+  std::string prefix;
+};
+
+// Internal constants are copied into every partition that uses them, but
+// mutable internal or linkonce variables are defined by exactly one partition.
+TEST_F(PartitionTest, MutableGlobals) {
+  llvm::Module module("lifted", context);
+  llvm::IRBuilder<> ir(context);
+  const auto i32_type = ir.getInt32Ty();
+  const auto void_type = llvm::FunctionType::get(ir.getVoidTy(), false);
+
+  auto state = new llvm::GlobalVariable(
+      module, i32_type, false, llvm::GlobalValue::InternalLinkage,
+      ir.getInt32(0), "state");
+  auto lstate = new llvm::GlobalVariable(
+      module, i32_type, false, llvm::GlobalValue::LinkOnceODRLinkage,
+      ir.getInt32(0), "lstate");
+  auto table = new llvm::GlobalVariable(
+      module, i32_type, true, llvm::GlobalValue::InternalLinkage,
+      ir.getInt32(7), "table");
+
+  // `bump` adds `table` to `state`.
+  auto bump = llvm::Function::Create(
+      void_type, llvm::GlobalValue::InternalLinkage, "bump", &module);
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", bump));
+  ir.CreateStore(ir.CreateAdd(ir.CreateLoad(i32_type, state),
+                              ir.CreateLoad(i32_type, table)),
+                 state);
+  ir.CreateRetVoid();
+
+  auto a = llvm::Function::Create(
+      void_type, llvm::GlobalValue::ExternalLinkage, "a", &module);
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", a));
+  ir.CreateCall(bump);
+  ir.CreateRetVoid();
+
+  auto b = llvm::Function::Create(
+      void_type, llvm::GlobalValue::ExternalLinkage, "b", &module);
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", b));
+  ir.CreateCall(bump);
+  ir.CreateStore(ir.getInt32(1), lstate);
+  ir.CreateRetVoid();
+
+  // `c` is the cheapest root, and so is alone in the second partition. Its
+  // initializer is the only use of `state` in that partition.
+  (void) new llvm::GlobalVariable(
+      module, llvm::PointerType::get(context, 0), true,
+      llvm::GlobalValue::ExternalLinkage, state, "c");
+
+  ASSERT_TRUE(remill::VerifyModule(&module));
+  ASSERT_TRUE(remill::StoreModulePartitionsToFiles(&module, prefix, 2u, true));
+
+  const auto manifest = ReadManifest();
+  ASSERT_EQ(manifest.size(), 2u);
+  EXPECT_EQ(manifest[0],
+            (std::set<std::string>{"a", "b", "state", "lstate"}));
+  EXPECT_EQ(manifest[1], std::set<std::string>{"c"});
+
+  auto first = LoadPartition(0u);
+  auto second = LoadPartition(1u);
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+
+  // The first partition owns the mutable variables.
+  for (auto name : {"state", "lstate"}) {
+    auto var = first->getGlobalVariable(name, true);
+    ASSERT_NE(var, nullptr) << name;
+    EXPECT_FALSE(var->isDeclaration()) << name;
+    EXPECT_TRUE(var->hasExternalLinkage()) << name;
+    EXPECT_TRUE(var->hasHiddenVisibility()) << name;
+  }
+
+  // The second partition only declares `state`, and doesn't need the others.
+  auto state_decl = second->getGlobalVariable("state", true);
+  ASSERT_NE(state_decl, nullptr);
+  EXPECT_TRUE(state_decl->isDeclaration());
+  EXPECT_TRUE(state_decl->hasExternalLinkage());
+  EXPECT_TRUE(state_decl->hasHiddenVisibility());
+  EXPECT_EQ(second->getGlobalVariable("c")->getInitializer(), state_decl);
+  EXPECT_EQ(second->getGlobalVariable("lstate", true), nullptr);
+  EXPECT_EQ(second->getGlobalVariable("table", true), nullptr);
+
+  // Constants and code are still copied as internal definitions.
+  auto table_copy = first->getGlobalVariable("table", true);
+  ASSERT_NE(table_copy, nullptr);
+  EXPECT_TRUE(table_copy->hasInternalLinkage());
+  ASSERT_NE(first->getFunction("bump"), nullptr);
+  EXPECT_TRUE(first->getFunction("bump")->hasInternalLinkage());
+}
+
+// Unnamed mutable variables can't be shared between partitions by name.
+TEST_F(PartitionTest, UnnamedMutableGlobal) {
+  llvm::Module module("lifted", context);
+  llvm::IRBuilder<> ir(context);
+  const auto i32_type = ir.getInt32Ty();
+
+  auto state = new llvm::GlobalVariable(
+      module, i32_type, false, llvm::GlobalValue::PrivateLinkage,
+      ir.getInt32(0));
+  auto a = llvm::Function::Create(
+      llvm::FunctionType::get(i32_type, false),
+      llvm::GlobalValue::ExternalLinkage, "a", &module);
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", a));
+  ir.CreateRet(ir.CreateLoad(i32_type, state));
+
+  ASSERT_TRUE(remill::VerifyModule(&module));
+  EXPECT_FALSE(remill::StoreModulePartitionsToFiles(&module, prefix, 2u, true,
+                                                    true /* allow_failure */));
+}
+
+}  // namespace
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/Interpreter.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/Optimizer.h"
+#include "remill/BC/Util.h"
+#include "remill/OS/OS.h"
+
+namespace {
+
+class PromoteRegistersTest : public testing::Test {
+ protected:
+  void SetUp(void) override {
+    arch = remill::Arch::Get(context, remill::kOSLinux, remill::kArchAMD64);
+    ASSERT_NE(arch, nullptr);
+
+    // Loading the semantics fills in the architecture's registers.
+    semantics = remill::LoadArchSemantics(arch.get());
+    ASSERT_NE(semantics, nullptr);
+
+    module = std::make_unique<llvm::Module>("test", context);
+    arch->PrepareModule(module.get());
+  }
+
+  // Declare a lifted function named `name`, and start building its body.
+  llvm::Function *Begin(const char *name, llvm::IRBuilder<> &ir) {
+    auto func = arch->DeclareLiftedFunction(name, module.get());
+    ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", func));
+    return func;
+  }
+
+  llvm::Value *Reg(llvm::Function *func, const char *name,
+                   llvm::IRBuilder<> &ir) {
+    return arch->RegisterByName(name)->AddressOf(
+        remill::NthArgument(func, remill::kStatePointerArgNum), ir);
+  }
+
+  llvm::Value *Call(llvm::Function *func, llvm::Function *callee,
+                    llvm::IRBuilder<> &ir, bool must_tail = false) {
+    auto call = ir.CreateCall(
+        callee, {remill::NthArgument(func, remill::kStatePointerArgNum),
+                 remill::NthArgument(func, remill::kPCArgNum),
+                 remill::NthArgument(func, remill::kMemoryPointerArgNum)});
+    if (must_tail) {
+      call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    }
+    return call;
+  }
+
+  // Promote the registers of `func`, and make sure that the IR is still well
+  // formed.
+  void Promote(llvm::Function *func) {
+    EXPECT_TRUE(remill::PromoteRegistersToSSA(arch.get(), func));
+    EXPECT_FALSE(llvm::verifyFunction(*func, &llvm::errs()));
+  }
+
+  // Run `func` against a zeroed `State`, and return the value of `reg`
+  // afterward.
+  uint64_t Run(llvm::Function *func, const char *reg) {
+    const auto &dl = module->getDataLayout();
+    std::vector<uint8_t> state(
+        dl.getTypeAllocSize(arch->StateStructType()).getFixedValue());
+
+    const auto func_name = func->getName().str();
+    std::string error;
+    std::unique_ptr<llvm::ExecutionEngine> engine(
+        llvm::EngineBuilder(std::move(module))
+            .setEngineKind(llvm::EngineKind::Interpreter)
+            .setErrorStr(&error)
+            .create());
+    CHECK(engine != nullptr) << error;
+
+    std::vector<llvm::GenericValue> args(3);
+    args[0] = llvm::PTOGV(state.data());
+    args[1].IntVal = llvm::APInt(64, 0);
+    args[2] = llvm::PTOGV(nullptr);
+    engine->runFunction(engine->FindFunctionNamed(func_name), args);
+
+    uint64_t val = 0;
+    std::memcpy(&val, &(state[arch->RegisterByName(reg)->offset]),
+                sizeof(val));
+    return val;
+  }
+
+  llvm::LLVMContext context;
+  remill::Arch::ArchPtr arch;
+  std::unique_ptr<llvm::Module> semantics;
+  std::unique_ptr<llvm::Module> module;
+};
+
+// `RAX = RAX * 10`
+static void MultiplyRAX(llvm::IRBuilder<> &ir, llvm::Value *rax) {
+  ir.CreateStore(ir.CreateMul(ir.CreateLoad(ir.getInt64Ty(), rax),
+                              ir.getInt64(10)),
+                 rax);
+}
+
+// The callee of a call that immediately returns may update `State`, and those
+// updates must not be overwritten by stale promoted registers.
+TEST_F(PromoteRegistersTest, ReturnAfterCall) {
+  llvm::IRBuilder<> ir(context);
+
+  auto callee = Begin("callee", ir);
+  MultiplyRAX(ir, Reg(callee, "RAX", ir));
+  ir.CreateRet(remill::NthArgument(callee, remill::kMemoryPointerArgNum));
+
+  auto caller = Begin("caller", ir);
+  ir.CreateStore(ir.getInt64(1), Reg(caller, "RAX", ir));
+  ir.CreateRet(Call(caller, callee, ir));
+
+  Promote(callee);
+  Promote(caller);
+
+  auto ret = caller->getEntryBlock().getTerminator();
+  ASSERT_TRUE(llvm::isa<llvm::CallInst>(ret->getPrevNode()));
+
+  EXPECT_EQ(Run(caller, "RAX"), 10u);
+}
+
+// Registers are re-read from `State` after a nested call returns, and are
+// written back before the caller returns.
+TEST_F(PromoteRegistersTest, NestedFunctionCall) {
+  llvm::IRBuilder<> ir(context);
+
+  auto inner = Begin("inner", ir);
+  MultiplyRAX(ir, Reg(inner, "RAX", ir));
+  ir.CreateRet(remill::NthArgument(inner, remill::kMemoryPointerArgNum));
+
+  auto middle = Begin("middle", ir);
+  auto middle_rax = Reg(middle, "RAX", ir);
+  ir.CreateStore(
+      ir.CreateAdd(ir.CreateLoad(ir.getInt64Ty(), middle_rax), ir.getInt64(2)),
+      middle_rax);
+  auto middle_mem = Call(middle, inner, ir);
+  MultiplyRAX(ir, middle_rax);
+  ir.CreateRet(middle_mem);
+
+  auto outer = Begin("outer", ir);
+  auto outer_rax = Reg(outer, "RAX", ir);
+  ir.CreateStore(ir.getInt64(1), outer_rax);
+  auto outer_mem = Call(outer, middle, ir);
+  auto rbx = Reg(outer, "RBX", ir);
+  ir.CreateStore(
+      ir.CreateAdd(ir.CreateLoad(ir.getInt64Ty(), outer_rax), ir.getInt64(1)),
+      rbx);
+  ir.CreateStore(ir.CreateLoad(ir.getInt64Ty(), rbx), outer_rax);
+  ir.CreateRet(outer_mem);
+
+  Promote(inner);
+  Promote(middle);
+  Promote(outer);
+
+  // `RAX = ((1 + 2) * 10 * 10) + 1`
+  EXPECT_EQ(Run(outer, "RAX"), 301u);
+}
+
+// Nothing may be placed between a `musttail` call and its `ret`.
+TEST_F(PromoteRegistersTest, MustTailCall) {
+  llvm::IRBuilder<> ir(context);
+
+  auto callee = Begin("callee", ir);
+  MultiplyRAX(ir, Reg(callee, "RAX", ir));
+  ir.CreateRet(remill::NthArgument(callee, remill::kMemoryPointerArgNum));
+
+  auto caller = Begin("caller", ir);
+  auto rax = Reg(caller, "RAX", ir);
+  ir.CreateStore(
+      ir.CreateAdd(ir.CreateLoad(ir.getInt64Ty(), rax), ir.getInt64(3)), rax);
+  ir.CreateRet(Call(caller, callee, ir, true /* must_tail */));
+
+  Promote(caller);
+
+  auto ret = caller->getEntryBlock().getTerminator();
+  auto call = llvm::dyn_cast<llvm::CallInst>(ret->getPrevNode());
+  ASSERT_NE(call, nullptr);
+  EXPECT_TRUE(call->isMustTailCall());
+
+  EXPECT_EQ(Run(caller, "RAX"), 30u);
+}
+
+}  // namespace
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+#include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/Analysis/MemoryLocation.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/RegisterAlias.h"
+#include "remill/BC/Util.h"
+#include "remill/OS/OS.h"
+
+namespace {
+
+class RegisterAliasTest : public testing::Test {
+ protected:
+  void SetUp(void) override {
+    arch = remill::Arch::Get(context, remill::kOSLinux, remill::kArchAMD64);
+    ASSERT_NE(arch, nullptr);
+
+    // Loading the semantics fills in the architecture's registers.
+    semantics = remill::LoadArchSemantics(arch.get());
+    ASSERT_NE(semantics, nullptr);
+
+    module = std::make_unique<llvm::Module>("test", context);
+    arch->PrepareModule(module.get());
+
+    // A function taking two state pointers.
+    const auto ptr_type = llvm::PointerType::get(context, 0);
+    func = llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(context),
+                                {ptr_type, ptr_type}, false),
+        llvm::GlobalValue::ExternalLinkage, "test", module.get());
+    ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", func));
+    ir.CreateRetVoid();
+    ir.SetInsertPoint(func->getEntryBlock().getTerminator());
+  }
+
+  // Returns a pointer to `reg` in the `State` structure at `state`. These are
+  // tagged with `!remill_register_alias` metadata.
+  llvm::Value *Reg(llvm::Value *state, const char *reg) {
+    return arch->RegisterByName(reg)->AddressOf(state, ir);
+  }
+
+  // Ask `RegisterAA`, and only `RegisterAA`, about the accesses to the whole
+  // registers `a` and `b`.
+  llvm::AliasResult Alias(llvm::Value *a, const char *reg_a, llvm::Value *b,
+                          const char *reg_b) {
+    llvm::FunctionAnalysisManager fam;
+    fam.registerPass([] { return remill::RegisterAA(); });
+    fam.registerPass([] { return llvm::TargetLibraryAnalysis(); });
+    fam.registerPass([] {
+      llvm::AAManager aa;
+      aa.registerFunctionAnalysis<remill::RegisterAA>();
+      return aa;
+    });
+
+    auto &aa = fam.getResult<llvm::AAManager>(*func);
+    return aa.alias(
+        llvm::MemoryLocation(a, llvm::LocationSize::precise(
+                                    arch->RegisterByName(reg_a)->size)),
+        llvm::MemoryLocation(b, llvm::LocationSize::precise(
+                                    arch->RegisterByName(reg_b)->size)));
+  }
+
+  llvm::Value *State(void) {
+    return func->getArg(0);
+  }
+
+  llvm::Value *OtherState(void) {
+    return func->getArg(1);
+  }
+
+  llvm::LLVMContext context;
+  llvm::IRBuilder<> ir{context};
+  remill::Arch::ArchPtr arch;
+  std::unique_ptr<llvm::Module> semantics;
+  std::unique_ptr<llvm::Module> module;
+  llvm::Function *func{nullptr};
+};
+
+// Distinct registers, or distinct lanes of one register, in the same `State`.
+TEST_F(RegisterAliasTest, Disjoint) {
+  EXPECT_EQ(Alias(Reg(State(), "RAX"), "RAX", Reg(State(), "RBX"), "RBX"),
+            llvm::AliasResult::NoAlias);
+  EXPECT_EQ(Alias(Reg(State(), "AL"), "AL", Reg(State(), "AH"), "AH"),
+            llvm::AliasResult::NoAlias);
+  EXPECT_EQ(Alias(Reg(State(), "AH"), "AH", Reg(State(), "BL"), "BL"),
+            llvm::AliasResult::NoAlias);
+}
+
+// A register and its sub-registers overlap.
+TEST_F(RegisterAliasTest, Overlapping) {
+  EXPECT_NE(Alias(Reg(State(), "RAX"), "RAX", Reg(State(), "EAX"), "EAX"),
+            llvm::AliasResult::NoAlias);
+  EXPECT_NE(Alias(Reg(State(), "AX"), "AX", Reg(State(), "AH"), "AH"),
+            llvm::AliasResult::NoAlias);
+  EXPECT_NE(Alias(Reg(State(), "RAX"), "RAX", Reg(State(), "RAX"), "RAX"),
+            llvm::AliasResult::NoAlias);
+}
+
+// Offsets into different `State` structures say nothing about whether the
+// accesses alias.
+TEST_F(RegisterAliasTest, DifferentBase) {
+  EXPECT_EQ(Alias(Reg(State(), "RAX"), "RAX", Reg(OtherState(), "RBX"), "RBX"),
+            llvm::AliasResult::MayAlias);
+
+  // E.g. a copy of `State` made with `memcpy`.
+  auto copy = ir.CreateAlloca(arch->StateStructType());
+  EXPECT_EQ(Alias(Reg(State(), "RAX"), "RAX", Reg(copy, "RBX"), "RBX"),
+            llvm::AliasResult::MayAlias);
+  EXPECT_EQ(Alias(Reg(copy, "RAX"), "RAX", Reg(copy, "RBX"), "RBX"),
+            llvm::AliasResult::NoAlias);
+}
+
+}  // namespace
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/Interpreter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Name.h"
+#include "remill/Arch/Runtime/HyperCall.h"
+#include "remill/BC/ABI.h"
+#include "remill/BC/IntrinsicTable.h"
+#include "remill/BC/TraceLifter.h"
+#include "remill/BC/Transplant.h"
+#include "remill/BC/Util.h"
+#include "remill/OS/OS.h"
+#include "tests/BC/Test.h"
+
+namespace {
+
+static constexpr uint64_t kCodeAddr = 0x1000;
+
+// Lifts and runs SPARC64 functions that `SAVE` and `RESTORE` register
+// windows.
+class SPARCWindowTest : public test::ArchTest {
+ protected:
+  void SetUp(void) override {
+    ASSERT_NO_FATAL_FAILURE(LoadArch(remill::kArchSparc64));
+
+    const auto &dl = semantics->getDataLayout();
+    state.resize(dl.getTypeAllocSize(arch->StateStructType()).getFixedValue());
+  }
+
+  // Load big-endian instructions at `kCodeAddr`, and lift them.
+  void Lift(std::initializer_list<uint32_t> insts) {
+    manager.LoadWords(kCodeAddr, insts);
+
+    remill::TraceLifter lifter(arch.get(), manager);
+    ASSERT_TRUE(lifter.Lift(kCodeAddr));
+    lifted = manager.traces[kCodeAddr];
+    ASSERT_NE(lifted, nullptr);
+  }
+
+  // Run the lifted code, and return the last sync hyper call that it made.
+  uint32_t Run(void) {
+    auto module = std::make_unique<llvm::Module>("test", context);
+    arch->PrepareModule(module.get());
+    const auto funcs = remill::ExtractTraceClosure({lifted}, module.get());
+    const auto func_name = funcs[0]->getName().str();
+
+    // Returns just give back the memory pointer.
+    const auto intrinsics = arch->GetInstrinsicTable();
+    if (auto ret = module->getFunction(
+            intrinsics->function_return->getName())) {
+      llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", ret));
+      ir.CreateRet(remill::NthArgument(ret, remill::kMemoryPointerArgNum));
+    }
+
+    // Record the last sync hyper call.
+    const auto i32_type = llvm::Type::getInt32Ty(context);
+    const auto last_hyper_call = new llvm::GlobalVariable(
+        *module, i32_type, false, llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantInt::get(i32_type, SyncHyperCall::kInvalid),
+        "last_hyper_call");
+    if (auto hyper_call = module->getFunction(
+            intrinsics->sync_hyper_call->getName())) {
+      llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", hyper_call));
+      ir.CreateStore(hyper_call->getArg(2), last_hyper_call);
+      ir.CreateRet(hyper_call->getArg(1));
+    }
+
+    std::string error;
+    std::unique_ptr<llvm::ExecutionEngine> engine(
+        llvm::EngineBuilder(std::move(module))
+            .setEngineKind(llvm::EngineKind::Interpreter)
+            .setErrorStr(&error)
+            .create());
+    CHECK(engine != nullptr) << error;
+
+    std::vector<llvm::GenericValue> args(3);
+    args[0] = llvm::PTOGV(state.data());
+    args[1].IntVal = llvm::APInt(64, kCodeAddr);
+    args[2] = llvm::PTOGV(nullptr);
+    engine->runFunction(engine->FindFunctionNamed(func_name), args);
+
+    return *reinterpret_cast<const uint32_t *>(
+        engine->getPointerToGlobal(last_hyper_call));
+  }
+
+  bool HasVar(const char *name) {
+    return remill::FindVarInFunction(lifted, name, true).first != nullptr;
+  }
+
+  uint64_t Reg(const char *name) {
+    uint64_t val = 0;
+    std::memcpy(&val, &(state[arch->RegisterByName(name)->offset]),
+                sizeof(val));
+    return val;
+  }
+
+  void SetReg(const char *name, uint64_t val) {
+    std::memcpy(&(state[arch->RegisterByName(name)->offset]), &val,
+                sizeof(val));
+  }
+
+  test::TraceManager manager;
+  llvm::Function *lifted{nullptr};
+  std::vector<uint8_t> state;
+};
+
+// `SAVE` gives the callee a new window, whose ins are the caller's outs, and
+// `RESTORE` gives the caller back its own window.
+TEST_F(SPARCWindowTest, SaveRestore) {
+  Lift({
+      0x9de3bf40,  // save %sp, -192, %sp
+      0xa0102005,  // mov 5, %l0
+      0xb0062001,  // add %i0, 1, %i0
+      0x81e80000,  // restore
+      0x81c3e008,  // retl
+      0x01000000,  // nop
+  });
+
+  SetReg("sp", 0x8000);
+  SetReg("o0", 3);
+  SetReg("l0", 1);
+  SetReg("i0", 9);
+
+  EXPECT_TRUE(HasVar("WINDOW"));
+  EXPECT_TRUE(HasVar("PREV_WINDOW"));
+
+  EXPECT_EQ(Run(), SyncHyperCall::kInvalid);
+  EXPECT_EQ(Reg("o0"), 4u);
+  EXPECT_EQ(Reg("sp"), 0x8000u);
+  EXPECT_EQ(Reg("l0"), 1u);
+  EXPECT_EQ(Reg("i0"), 9u);
+}
+
+// The callee's stack pointer is the caller's, minus the frame size, and the
+// caller's stack pointer is the callee's frame pointer.
+TEST_F(SPARCWindowTest, SaveNewFrame) {
+  Lift({
+      0x9de3bf40,  // save %sp, -192, %sp
+      0x81c3e008,  // retl
+      0x01000000,  // nop
+  });
+
+  SetReg("sp", 0x8000);
+  EXPECT_EQ(Run(), SyncHyperCall::kInvalid);
+  EXPECT_EQ(Reg("sp"), 0x8000u - 192u);
+  EXPECT_EQ(Reg("fp"), 0x8000u);
+}
+
+// A `RESTORE` without a matching `SAVE` underflows the register windows.
+TEST_F(SPARCWindowTest, RestoreUnderflow) {
+  Lift({
+      0x81e80000,  // restore
+      0x81c3e008,  // retl
+      0x01000000,  // nop
+  });
+
+  EXPECT_FALSE(HasVar("WINDOW"));
+  EXPECT_TRUE(HasVar("PREV_WINDOW"));
+  EXPECT_EQ(Run(), SyncHyperCall::kSPARCWindowUnderflow);
+}
+
+// Leaf functions never `SAVE` or `RESTORE`, and so they have no windows.
+TEST_F(SPARCWindowTest, LeafHasNoWindows) {
+  Lift({
+      0x90022001,  // add %o0, 1, %o0
+      0x81c3e008,  // retl
+      0x01000000,  // nop
+  });
+
+  SetReg("o0", 3);
+
+  EXPECT_FALSE(HasVar("WINDOW"));
+  EXPECT_FALSE(HasVar("PREV_WINDOW"));
+  EXPECT_EQ(Run(), SyncHyperCall::kInvalid);
+  EXPECT_EQ(Reg("o0"), 4u);
+}
+
+}  // namespace
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "remill/BC/Statistics.h"
+
+namespace {
+
+// Statistics are global, so each test starts from zero, and leaves collection
+// disabled for other tests.
+class StatisticsTest : public testing::Test {
+ protected:
+  void SetUp(void) override {
+    remill::EnableStatistics();
+    remill::ResetStatistics();
+  }
+
+  void TearDown(void) override {
+    remill::EnableStatistics(false);
+    remill::ResetStatistics();
+  }
+
+  static llvm::json::Value PrintAsJSON(void) {
+    std::string str;
+    llvm::raw_string_ostream os(str);
+    remill::PrintStatisticsAsJSON(os);
+    auto json = llvm::json::parse(os.str());
+    CHECK(json) << llvm::toString(json.takeError());
+    return std::move(*json);
+  }
+
+  // Returns the integer at `key` in `obj`, or `-1` if there isn't one.
+  static int64_t GetInteger(const llvm::json::Object *obj,
+                            llvm::StringRef key) {
+    const auto val = obj->getInteger(key);
+    return val ? *val : -1;
+  }
+};
+
+TEST_F(StatisticsTest, Counters) {
+  const remill::Statistic counter("test.counter");
+  const remill::Statistic same_counter("test.counter");
+  counter.Add();
+  counter.Add(2);
+  same_counter.Add();
+  EXPECT_EQ(remill::ReadStatistic("test.counter"), 4u);
+  EXPECT_EQ(remill::ReadStatistic("test.no_such_counter"), 0u);
+
+  // Nothing is recorded while collection is disabled.
+  remill::EnableStatistics(false);
+  EXPECT_FALSE(remill::StatisticsEnabled());
+  counter.Add(100);
+  EXPECT_EQ(remill::ReadStatistic("test.counter"), 4u);
+
+  remill::ResetStatistics();
+  EXPECT_EQ(remill::ReadStatistic("test.counter"), 0u);
+}
+
+// Counts from every thread are summed, including from threads that exited.
+TEST_F(StatisticsTest, ManyThreads) {
+  const remill::Statistic counter("test.threaded_counter");
+  std::vector<std::thread> threads;
+  for (auto i = 0; i < 4; ++i) {
+    threads.emplace_back([&counter] {
+      for (auto j = 0; j < 1000; ++j) {
+        counter.Add();
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  counter.Add();
+  EXPECT_EQ(remill::ReadStatistic("test.threaded_counter"), 4001u);
+}
+
+TEST_F(StatisticsTest, CounterArrays) {
+  static const char *const kKeyNames[] = {"red", "green", "blue"};
+  const remill::StatisticArray colors(
+      "test.colors", 3u, [](unsigned key) { return kKeyNames[key]; });
+  colors.Add(0);
+  colors.Add(2, 5);
+  colors.Add(3);  // Out of range, and ignored.
+
+  EXPECT_EQ(remill::ReadStatistic("test.colors.red"), 1u);
+  EXPECT_EQ(remill::ReadStatistic("test.colors.green"), 0u);
+  EXPECT_EQ(remill::ReadStatistic("test.colors.blue"), 5u);
+  EXPECT_EQ(remill::ReadStatistic("test.colors"), 6u);
+
+  // Only non-zero keys are printed.
+  const auto json = PrintAsJSON();
+  const auto *counters = json.getAsObject()->getObject("counters");
+  ASSERT_NE(counters, nullptr);
+  EXPECT_EQ(GetInteger(counters, "test.colors.red"), 1);
+  EXPECT_EQ(GetInteger(counters, "test.colors.blue"), 5);
+  EXPECT_EQ(counters->get("test.colors.green"), nullptr);
+}
+
+// Values are counted in power-of-two buckets.
+TEST_F(StatisticsTest, Histograms) {
+  const remill::Histogram histogram("test.histogram");
+  for (auto val : {0u, 1u, 2u, 3u, 4u, 7u, 8u}) {
+    histogram.Record(val);
+  }
+  EXPECT_EQ(remill::ReadStatistic("test.histogram"), 7u);
+
+  const auto json = PrintAsJSON();
+  const auto *histograms = json.getAsObject()->getObject("histograms");
+  ASSERT_NE(histograms, nullptr);
+  const auto *stats = histograms->getObject("test.histogram");
+  ASSERT_NE(stats, nullptr);
+  EXPECT_EQ(GetInteger(stats, "count"), 7);
+  EXPECT_EQ(GetInteger(stats, "sum"), 25);
+
+  const auto *buckets = stats->getArray("buckets");
+  ASSERT_NE(buckets, nullptr);
+  const std::vector<std::vector<int64_t>> expected = {
+      {0, 0, 1}, {1, 1, 1}, {2, 3, 2}, {4, 7, 2}, {8, 15, 1}};
+  ASSERT_EQ(buckets->size(), expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    const auto *bucket = (*buckets)[i].getAsObject();
+    ASSERT_NE(bucket, nullptr);
+    EXPECT_EQ(GetInteger(bucket, "min"), expected[i][0]) << i;
+    EXPECT_EQ(GetInteger(bucket, "max"), expected[i][1]) << i;
+    EXPECT_EQ(GetInteger(bucket, "count"), expected[i][2]) << i;
+  }
+}
+
+TEST_F(StatisticsTest, Timers) {
+  const remill::Timer timer("test.timer");
+  for (auto i = 0; i < 2; ++i) {
+    remill::ScopedTimer scope(timer);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(remill::ReadStatistic("test.timer"), 2u);
+  EXPECT_GE(remill::ReadTimerSeconds("test.timer"), 0.01);
+  EXPECT_EQ(remill::ReadTimerSeconds("test.no_such_timer"), 0.0);
+
+  // Scopes entered while collection is disabled aren't timed.
+  remill::EnableStatistics(false);
+  {
+    remill::ScopedTimer scope(timer);
+  }
+  EXPECT_EQ(remill::ReadStatistic("test.timer"), 2u);
+
+  const auto json = PrintAsJSON();
+  const auto *timers = json.getAsObject()->getObject("timers");
+  ASSERT_NE(timers, nullptr);
+  const auto *stats = timers->getObject("test.timer");
+  ASSERT_NE(stats, nullptr);
+  EXPECT_EQ(GetInteger(stats, "count"), 2);
+  const auto seconds = stats->getNumber("seconds");
+  ASSERT_TRUE(seconds);
+  EXPECT_GE(*seconds, 0.01);
+}
+
+}  // namespace
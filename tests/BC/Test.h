@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <gtest/gtest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <memory>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Name.h"
+#include "remill/BC/TraceLifter.h"
+#include "remill/BC/Util.h"
+#include "remill/OS/OS.h"
+
+namespace test {
+
+// Trace manager whose code and lifted traces live in maps. Tests that
+// devirtualize targets subclass it.
+class TraceManager : public remill::TraceManager {
+ public:
+  void SetLiftedTraceDefinition(uint64_t addr,
+                                llvm::Function *lifted_func) final {
+    traces[addr] = lifted_func;
+  }
+
+  llvm::Function *GetLiftedTraceDeclaration(uint64_t addr) final {
+    auto it = traces.find(addr);
+    return it != traces.end() ? it->second : nullptr;
+  }
+
+  llvm::Function *GetLiftedTraceDefinition(uint64_t addr) final {
+    return GetLiftedTraceDeclaration(addr);
+  }
+
+  // NOTE(pag): Code discovery calls this from many threads, but `code` is
+  //            only written before discovery starts.
+  bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) final {
+    auto it = code.find(addr);
+    if (it == code.end()) {
+      return false;
+    }
+    *byte = it->second;
+    return true;
+  }
+
+  void Load(uint64_t addr, std::initializer_list<uint8_t> bytes) {
+    for (auto byte : bytes) {
+      code[addr++] = byte;
+    }
+  }
+
+  // Load big-endian 32-bit instructions, e.g. for SPARC.
+  void LoadWords(uint64_t addr, std::initializer_list<uint32_t> words) {
+    for (auto word : words) {
+      for (auto i = 0u; i < 4u; ++i) {
+        code[addr++] = static_cast<uint8_t>(word >> (24u - (i * 8u)));
+      }
+    }
+  }
+
+  std::map<uint64_t, uint8_t> code;
+  std::map<uint64_t, llvm::Function *> traces;
+};
+
+// Fixture of tests that lift code using the semantics of an architecture.
+class ArchTest : public testing::Test {
+ protected:
+  // Get the Linux `arch_name` architecture, and load its semantics. Call
+  // this within `ASSERT_NO_FATAL_FAILURE`.
+  void LoadArch(remill::ArchName arch_name) {
+    arch = remill::Arch::Get(context, remill::kOSLinux, arch_name);
+    ASSERT_NE(arch, nullptr);
+    semantics = remill::LoadArchSemantics(arch.get());
+    ASSERT_NE(semantics, nullptr);
+  }
+
+  llvm::LLVMContext context;
+  remill::Arch::ArchPtr arch;
+  std::unique_ptr<llvm::Module> semantics;
+};
+
+}  // namespace test
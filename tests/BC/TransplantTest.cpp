@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/Interpreter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "remill/BC/Transplant.h"
+#include "remill/BC/Util.h"
+
+namespace {
+
+// Returns the callee of the first call in `func`.
+static llvm::Function *FirstCallee(llvm::Function *func) {
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+      return call->getCalledFunction();
+    }
+  }
+  return nullptr;
+}
+
+// Builds a module with:
+//
+//    @counter = internal global i32 5
+//    define internal i32 @helper()      ; `2 * counter`, using a loop
+//    define internal i32 @fact(i32)     ; recursive
+//    define internal i1 @even(i32)      ; mutually recursive with `@odd`
+//    define internal i1 @odd(i32)
+//    define i32 @f(i32 %n)              ; `fact(n) + helper()`
+//    define i32 @g(i32 %n)              ; `zext(even(n))`
+static std::unique_ptr<llvm::Module> BuildSourceModule(
+    llvm::LLVMContext &context) {
+  auto module = std::make_unique<llvm::Module>("source", context);
+  llvm::IRBuilder<> ir(context);
+  const auto i1_type = ir.getInt1Ty();
+  const auto i32_type = ir.getInt32Ty();
+  const auto unary_type = llvm::FunctionType::get(i32_type, {i32_type}, false);
+  const auto pred_type = llvm::FunctionType::get(i1_type, {i32_type}, false);
+
+  auto counter = new llvm::GlobalVariable(
+      *module, i32_type, false, llvm::GlobalValue::InternalLinkage,
+      ir.getInt32(5), "counter");
+
+  // `helper` loops twice, adding `counter` each time. The loop's branch has
+  // self-referential distinct metadata, like `!llvm.loop`.
+  auto helper = llvm::Function::Create(
+      llvm::FunctionType::get(i32_type, false),
+      llvm::GlobalValue::InternalLinkage, "helper", module.get());
+  auto entry = llvm::BasicBlock::Create(context, "", helper);
+  auto loop = llvm::BasicBlock::Create(context, "", helper);
+  auto exit = llvm::BasicBlock::Create(context, "", helper);
+  ir.SetInsertPoint(entry);
+  auto val = ir.CreateLoad(i32_type, counter);
+  ir.CreateBr(loop);
+  ir.SetInsertPoint(loop);
+  auto i = ir.CreatePHI(i32_type, 2);
+  auto acc = ir.CreatePHI(i32_type, 2);
+  auto next_acc = ir.CreateAdd(acc, val);
+  auto next_i = ir.CreateAdd(i, ir.getInt32(1));
+  auto br = ir.CreateCondBr(ir.CreateICmpEQ(next_i, ir.getInt32(2)), exit,
+                            loop);
+  i->addIncoming(ir.getInt32(0), entry);
+  i->addIncoming(next_i, loop);
+  acc->addIncoming(ir.getInt32(0), entry);
+  acc->addIncoming(next_acc, loop);
+  auto loop_md = llvm::MDTuple::getDistinct(context, {nullptr});
+  loop_md->replaceOperandWith(0, loop_md);
+  br->setMetadata("remill.loop", loop_md);
+  ir.SetInsertPoint(exit);
+  ir.CreateRet(next_acc);
+
+  auto fact = llvm::Function::Create(
+      unary_type, llvm::GlobalValue::InternalLinkage, "fact", module.get());
+  auto n = fact->getArg(0);
+  auto base = llvm::BasicBlock::Create(context, "", fact);
+  auto rec = llvm::BasicBlock::Create(context, "", fact);
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", fact, base));
+  ir.CreateCondBr(ir.CreateICmpSLE(n, ir.getInt32(1)), base, rec);
+  ir.SetInsertPoint(base);
+  ir.CreateRet(ir.getInt32(1));
+  ir.SetInsertPoint(rec);
+  ir.CreateRet(ir.CreateMul(
+      n, ir.CreateCall(fact, {ir.CreateSub(n, ir.getInt32(1))})));
+
+  auto even = llvm::Function::Create(
+      pred_type, llvm::GlobalValue::InternalLinkage, "even", module.get());
+  auto odd = llvm::Function::Create(
+      pred_type, llvm::GlobalValue::InternalLinkage, "odd", module.get());
+  for (auto [func, other, is_even] :
+       {std::make_tuple(even, odd, true), std::make_tuple(odd, even, false)}) {
+    auto arg = func->getArg(0);
+    auto zero = llvm::BasicBlock::Create(context, "", func);
+    auto non_zero = llvm::BasicBlock::Create(context, "", func);
+    ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", func, zero));
+    ir.CreateCondBr(ir.CreateICmpEQ(arg, ir.getInt32(0)), zero, non_zero);
+    ir.SetInsertPoint(zero);
+    ir.CreateRet(ir.getInt1(is_even));
+    ir.SetInsertPoint(non_zero);
+    ir.CreateRet(
+        ir.CreateCall(other, {ir.CreateSub(arg, ir.getInt32(1))}));
+  }
+
+  auto f = llvm::Function::Create(
+      unary_type, llvm::GlobalValue::ExternalLinkage, "f", module.get());
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", f));
+  ir.CreateRet(ir.CreateAdd(ir.CreateCall(fact, {f->getArg(0)}),
+                            ir.CreateCall(helper)));
+  f->setMetadata("remill.test",
+                 llvm::MDTuple::get(
+                     context, {llvm::MDString::get(context, "hello"),
+                               llvm::ConstantAsMetadata::get(
+                                   ir.getInt32(7))}));
+
+  auto g = llvm::Function::Create(
+      unary_type, llvm::GlobalValue::ExternalLinkage, "g", module.get());
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", g));
+  ir.CreateRet(ir.CreateZExt(ir.CreateCall(even, {g->getArg(0)}), i32_type));
+
+  CHECK(remill::VerifyModule(module.get()));
+  return module;
+}
+
+// Run `func_name` in `module` on each of `args`.
+static std::vector<uint64_t> RunEach(std::unique_ptr<llvm::Module> module,
+                                     const char *func_name,
+                                     std::initializer_list<uint32_t> args) {
+  std::string error;
+  std::unique_ptr<llvm::ExecutionEngine> engine(
+      llvm::EngineBuilder(std::move(module))
+          .setEngineKind(llvm::EngineKind::Interpreter)
+          .setErrorStr(&error)
+          .create());
+  CHECK(engine != nullptr) << error;
+
+  std::vector<uint64_t> rets;
+  for (auto arg : args) {
+    std::vector<llvm::GenericValue> gv_args(1);
+    gv_args[0].IntVal = llvm::APInt(32, arg);
+    rets.push_back(engine->runFunction(engine->FindFunctionNamed(func_name),
+                                       gv_args)
+                       .IntVal.getZExtValue());
+  }
+  return rets;
+}
+
+class TransplantTest : public testing::Test {
+ protected:
+  void SetUp(void) override {
+    source = BuildSourceModule(context);
+  }
+
+  // Check that `dest` has everything that `f` needs.
+  void ExpectCopyOfF(llvm::Module *dest) {
+    EXPECT_FALSE(llvm::verifyModule(*dest, &llvm::errs()));
+
+    auto f = dest->getFunction("f");
+    ASSERT_NE(f, nullptr);
+    EXPECT_FALSE(f->isDeclaration());
+    EXPECT_EQ(&(f->getContext()), &(dest->getContext()));
+
+    // Internal definitions are copied along with `f`.
+    auto helper = dest->getFunction("helper");
+    ASSERT_NE(helper, nullptr);
+    EXPECT_FALSE(helper->isDeclaration());
+    EXPECT_TRUE(helper->hasInternalLinkage());
+
+    auto counter = dest->getGlobalVariable("counter", true);
+    ASSERT_NE(counter, nullptr);
+    ASSERT_TRUE(counter->hasInitializer());
+    EXPECT_EQ(llvm::cast<llvm::ConstantInt>(counter->getInitializer())
+                  ->getZExtValue(),
+              5u);
+
+    // Recursive calls go to the copy.
+    auto fact = dest->getFunction("fact");
+    ASSERT_NE(fact, nullptr);
+    EXPECT_FALSE(fact->isDeclaration());
+    EXPECT_EQ(FirstCallee(fact), fact);
+
+    // Metadata is copied, including self-references.
+    auto md = f->getMetadata("remill.test");
+    ASSERT_NE(md, nullptr);
+    ASSERT_EQ(md->getNumOperands(), 2u);
+    auto str = llvm::dyn_cast<llvm::MDString>(md->getOperand(0));
+    ASSERT_NE(str, nullptr);
+    EXPECT_EQ(str->getString(), "hello");
+
+    llvm::MDNode *loop_md = nullptr;
+    for (auto &inst : llvm::instructions(helper)) {
+      if (auto node = inst.getMetadata("remill.loop")) {
+        loop_md = node;
+      }
+    }
+    ASSERT_NE(loop_md, nullptr);
+    EXPECT_TRUE(loop_md->isDistinct());
+    EXPECT_EQ(loop_md->getOperand(0), loop_md);
+  }
+
+  unsigned NumDefinitions(llvm::Module *module) {
+    auto num_defs = 0u;
+    for (auto &func : *module) {
+      num_defs += !func.isDeclaration();
+    }
+    for (auto &var : module->globals()) {
+      num_defs += !var.isDeclaration();
+    }
+    return num_defs;
+  }
+
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> source;
+};
+
+TEST_F(TransplantTest, SameContext) {
+  auto dest = std::make_unique<llvm::Module>("dest", context);
+  remill::FunctionTransplanter transplanter(dest.get());
+  transplanter.Copy(source->getFunction("f"));
+
+  ExpectCopyOfF(dest.get());
+
+  // The source is untouched.
+  EXPECT_FALSE(llvm::verifyModule(*source, &llvm::errs()));
+  EXPECT_FALSE(source->getFunction("f")->isDeclaration());
+  EXPECT_EQ(FirstCallee(dest->getFunction("f")), dest->getFunction("fact"));
+
+  EXPECT_EQ(RunEach(std::move(dest), "f", {1, 5}),
+            (std::vector<uint64_t>{11, 130}));
+}
+
+TEST_F(TransplantTest, CrossContext) {
+  llvm::LLVMContext dest_context;
+  auto dest = std::make_unique<llvm::Module>("dest", dest_context);
+  remill::FunctionTransplanter transplanter(dest.get());
+  transplanter.Copy(source->getFunction("f"));
+
+  ExpectCopyOfF(dest.get());
+  EXPECT_EQ(RunEach(std::move(dest), "f", {1, 5}),
+            (std::vector<uint64_t>{11, 130}));
+}
+
+// Only what `g` needs is copied, and mutually recursive functions refer to
+// each other's copies.
+TEST_F(TransplantTest, MutualRecursion) {
+  llvm::LLVMContext dest_context;
+  auto dest = std::make_unique<llvm::Module>("dest", dest_context);
+  remill::FunctionTransplanter transplanter(dest.get());
+  transplanter.Copy(source->getFunction("g"));
+
+  EXPECT_FALSE(llvm::verifyModule(*dest, &llvm::errs()));
+  EXPECT_EQ(NumDefinitions(dest.get()), 3u);  // `g`, `even`, and `odd`.
+  auto even = dest->getFunction("even");
+  auto odd = dest->getFunction("odd");
+  ASSERT_NE(even, nullptr);
+  ASSERT_NE(odd, nullptr);
+  EXPECT_EQ(FirstCallee(even), odd);
+  EXPECT_EQ(FirstCallee(odd), even);
+
+  EXPECT_EQ(RunEach(std::move(dest), "g", {0, 3, 4}),
+            (std::vector<uint64_t>{1, 0, 1}));
+}
+
+// Internal definitions shared by many copied functions are only copied once.
+TEST_F(TransplantTest, SharedDefinitions) {
+  llvm::LLVMContext dest_context;
+  llvm::Module dest("dest", dest_context);
+  remill::FunctionTransplanter transplanter(&dest);
+  auto f = transplanter.Copy(source->getFunction("f"));
+  transplanter.Copy(source->getFunction("g"));
+  EXPECT_EQ(transplanter.Copy(source->getFunction("f")), f);
+
+  EXPECT_FALSE(llvm::verifyModule(dest, &llvm::errs()));
+  EXPECT_EQ(NumDefinitions(&dest), 7u);
+}
+
+// Copies that are deleted from the destination module are copied again,
+// rather than being referenced after they are freed.
+TEST_F(TransplantTest, DeletedCopies) {
+  auto dest = std::make_unique<llvm::Module>("dest", context);
+  remill::FunctionTransplanter transplanter(dest.get());
+  transplanter.Copy(source->getFunction("f"));
+
+  for (auto name : {"f", "helper", "fact"}) {
+    auto func = dest->getFunction(name);
+    func->dropAllReferences();
+  }
+  for (auto name : {"f", "helper", "fact"}) {
+    dest->getFunction(name)->eraseFromParent();
+  }
+  dest->getGlobalVariable("counter", true)->eraseFromParent();
+  ASSERT_EQ(NumDefinitions(dest.get()), 0u);
+
+  transplanter.Copy(source->getFunction("f"));
+  ExpectCopyOfF(dest.get());
+  EXPECT_EQ(RunEach(std::move(dest), "f", {5}), (std::vector<uint64_t>{130}));
+}
+
+// Moving a function into a module of another context copies it, and leaves
+// it as a declaration in the source module.
+TEST_F(TransplantTest, MoveFunctionAcrossContexts) {
+  llvm::LLVMContext dest_context;
+  auto dest = std::make_unique<llvm::Module>("dest", dest_context);
+  auto f = source->getFunction("f");
+  remill::MoveFunctionIntoModule(f, dest.get());
+
+  EXPECT_EQ(source->getFunction("f"), f);
+  EXPECT_TRUE(f->isDeclaration());
+  EXPECT_FALSE(llvm::verifyModule(*source, &llvm::errs()));
+
+  ExpectCopyOfF(dest.get());
+  EXPECT_EQ(RunEach(std::move(dest), "f", {5}), (std::vector<uint64_t>{130}));
+}
+
+// Moving a function into a module of the same context moves it, and leaves a
+// declaration behind in the source module.
+TEST_F(TransplantTest, MoveFunctionInContext) {
+  llvm::IRBuilder<> ir(context);
+  const auto i32_type = ir.getInt32Ty();
+
+  // `h(n) = n ? h(n - 1) : ext_counter`
+  auto ext_counter = new llvm::GlobalVariable(
+      *source, i32_type, false, llvm::GlobalValue::ExternalLinkage, nullptr,
+      "ext_counter");
+  auto h = llvm::Function::Create(
+      llvm::FunctionType::get(i32_type, {i32_type}, false),
+      llvm::GlobalValue::ExternalLinkage, "h", source.get());
+  auto zero = llvm::BasicBlock::Create(context, "", h);
+  auto non_zero = llvm::BasicBlock::Create(context, "", h);
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", h, zero));
+  ir.CreateCondBr(ir.CreateICmpEQ(h->getArg(0), ir.getInt32(0)), zero,
+                  non_zero);
+  ir.SetInsertPoint(zero);
+  ir.CreateRet(ir.CreateLoad(i32_type, ext_counter));
+  ir.SetInsertPoint(non_zero);
+  ir.CreateRet(ir.CreateCall(h, {ir.CreateSub(h->getArg(0),
+                                              ir.getInt32(1))}));
+
+  llvm::Module dest("dest", context);
+  remill::MoveFunctionIntoModule(h, &dest);
+
+  EXPECT_EQ(h->getParent(), &dest);
+  EXPECT_EQ(FirstCallee(h), h);
+  auto decl = source->getFunction("h");
+  ASSERT_NE(decl, nullptr);
+  EXPECT_NE(decl, h);
+  EXPECT_TRUE(decl->isDeclaration());
+
+  auto dest_counter = dest.getGlobalVariable("ext_counter");
+  ASSERT_NE(dest_counter, nullptr);
+  EXPECT_TRUE(dest_counter->isDeclaration());
+
+  EXPECT_FALSE(llvm::verifyModule(*source, &llvm::errs()));
+  EXPECT_FALSE(llvm::verifyModule(dest, &llvm::errs()));
+}
+
+// The closure of some traces is every internal definition that they need.
+// Other traces are only declared.
+TEST_F(TransplantTest, TraceClosure) {
+  // `t` is another trace, which calls the traces `f` and `g`.
+  llvm::IRBuilder<> ir(context);
+  auto f = source->getFunction("f");
+  auto g = source->getFunction("g");
+  auto t = llvm::Function::Create(
+      f->getFunctionType(), llvm::GlobalValue::ExternalLinkage, "t",
+      source.get());
+  ir.SetInsertPoint(llvm::BasicBlock::Create(context, "", t));
+  ir.CreateRet(ir.CreateAdd(ir.CreateCall(f, {t->getArg(0)}),
+                            ir.CreateCall(g, {t->getArg(0)})));
+
+  remill::TraceClosureExtractor extractor;
+  auto closure = extractor.Closure({f, f});
+  ASSERT_EQ(closure.size(), 4u);
+  EXPECT_EQ(closure[0], f);
+  EXPECT_EQ(std::set<llvm::GlobalValue *>(closure.begin(), closure.end()),
+            (std::set<llvm::GlobalValue *>{
+                f, source->getFunction("fact"), source->getFunction("helper"),
+                source->getGlobalVariable("counter", true)}));
+  EXPECT_EQ(extractor.Closure({t}), std::vector<llvm::GlobalValue *>{t});
+
+  llvm::LLVMContext dest_context;
+  auto dest = std::make_unique<llvm::Module>("dest", dest_context);
+  const auto copies = extractor.Extract({t, g}, dest.get());
+  ASSERT_EQ(copies.size(), 2u);
+  EXPECT_EQ(copies[0], dest->getFunction("t"));
+  EXPECT_EQ(copies[1], dest->getFunction("g"));
+  EXPECT_FALSE(llvm::verifyModule(*dest, &llvm::errs()));
+  EXPECT_EQ(NumDefinitions(dest.get()), 4u);  // `t`, `g`, `even`, and `odd`.
+  ASSERT_NE(dest->getFunction("f"), nullptr);
+  EXPECT_TRUE(dest->getFunction("f")->isDeclaration());
+
+  // The source traces are left as they are.
+  EXPECT_FALSE(t->isDeclaration());
+  EXPECT_FALSE(g->isDeclaration());
+
+  // The same extractor can extract into many modules.
+  auto other = std::make_unique<llvm::Module>("other", dest_context);
+  EXPECT_EQ(extractor.Extract({f}, other.get()).size(), 1u);
+  EXPECT_EQ(NumDefinitions(other.get()), closure.size());
+  ExpectCopyOfF(other.get());
+  EXPECT_EQ(RunEach(std::move(other), "f", {5}),
+            (std::vector<uint64_t>{130}));
+}
+
+}  // namespace
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "remill/BC/Util.h"
+
+namespace {
+
+class TrustedModuleTest : public testing::Test {
+ protected:
+  void SetUp(void) override {
+    const auto *info = testing::UnitTest::GetInstance()->current_test_info();
+    dir = std::filesystem::path(testing::TempDir()) /
+          (std::string("remill_trusted_module_") + info->name());
+    std::filesystem::remove_all(dir);
+    stamp_dir = dir / "stamps";
+    ASSERT_TRUE(std::filesystem::create_directories(dir));
+  }
+
+  void TearDown(void) override {
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+  }
+
+  // Write a module with one function, `f`, to `file_name`, without verifying
+  // it. An invalid module has a declaration with internal linkage.
+  std::filesystem::path Write(const char *file_name, bool valid,
+                              int ret_val = 0) {
+    llvm::Module module("test", context);
+    const auto i32_type = llvm::Type::getInt32Ty(context);
+    const auto func = llvm::Function::Create(
+        llvm::FunctionType::get(i32_type, false),
+        valid ? llvm::GlobalValue::ExternalLinkage
+              : llvm::GlobalValue::InternalLinkage,
+        "f", &module);
+    if (valid) {
+      llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", func));
+      ir.CreateRet(ir.getInt32(ret_val));
+    }
+
+    const auto path = dir / file_name;
+    std::error_code ec;
+    llvm::raw_fd_ostream os(path.string(), ec, llvm::sys::fs::OF_None);
+    CHECK(!ec) << ec.message();
+    llvm::WriteBitcodeToFile(module, os);
+    return path;
+  }
+
+  std::unique_ptr<llvm::Module> Load(const std::filesystem::path &path) {
+    return remill::LoadTrustedModuleFromFile(&context, path, stamp_dir);
+  }
+
+  std::vector<std::filesystem::path> Stamps(void) {
+    std::vector<std::filesystem::path> stamps;
+    if (std::filesystem::exists(stamp_dir)) {
+      for (const auto &entry :
+           std::filesystem::directory_iterator(stamp_dir)) {
+        stamps.push_back(entry.path());
+      }
+    }
+    return stamps;
+  }
+
+  llvm::LLVMContext context;
+  std::filesystem::path dir;
+  std::filesystem::path stamp_dir;
+};
+
+// Verifying a module records a stamp, and loading it again reuses the
+// stamp.
+TEST_F(TrustedModuleTest, StampAfterVerifying) {
+  const auto path = Write("valid.bc", true);
+  ASSERT_NE(Load(path), nullptr);
+
+  const auto stamps = Stamps();
+  ASSERT_EQ(stamps.size(), 1u);
+  EXPECT_EQ(stamps[0].extension(), ".verified");
+
+  const auto module = Load(path);
+  ASSERT_NE(module, nullptr);
+  EXPECT_NE(module->getFunction("f"), nullptr);
+  EXPECT_EQ(Stamps(), stamps);
+}
+
+// Different bitcode gets a different stamp.
+TEST_F(TrustedModuleTest, StampPerBitcode) {
+  ASSERT_NE(Load(Write("a.bc", true, 1)), nullptr);
+  ASSERT_NE(Load(Write("b.bc", true, 2)), nullptr);
+  EXPECT_EQ(Stamps().size(), 2u);
+
+  // The same bitcode in another file shares the stamp.
+  ASSERT_NE(Load(Write("c.bc", true, 1)), nullptr);
+  EXPECT_EQ(Stamps().size(), 2u);
+}
+
+// Modules that fail to verify aren't stamped, and so fail every time.
+TEST_F(TrustedModuleTest, InvalidModule) {
+  const auto path = Write("invalid.bc", false);
+  EXPECT_EQ(Load(path), nullptr);
+  EXPECT_TRUE(Stamps().empty());
+  EXPECT_EQ(Load(path), nullptr);
+}
+
+// A stamp that wasn't written by this version of LLVM is ignored, and
+// replaced once the module is verified.
+TEST_F(TrustedModuleTest, ForeignStamp) {
+  const auto path = Write("valid.bc", true);
+  ASSERT_NE(Load(path), nullptr);
+  const auto stamps = Stamps();
+  ASSERT_EQ(stamps.size(), 1u);
+
+  std::ofstream(stamps[0]) << "LLVM 0.0.0\n";
+  ASSERT_NE(Load(path), nullptr);
+
+  std::ifstream stamp(stamps[0]);
+  std::string contents;
+  std::getline(stamp, contents);
+  EXPECT_NE(contents, "LLVM 0.0.0");
+}
+
+// Files that aren't bitcode aren't loaded, stamp or no stamp.
+TEST_F(TrustedModuleTest, NotBitcode) {
+  const auto path = dir / "garbage.bc";
+  std::ofstream(path) << "garbage";
+  EXPECT_EQ(Load(path), nullptr);
+  EXPECT_EQ(Load(dir / "missing.bc"), nullptr);
+  EXPECT_TRUE(Stamps().empty());
+}
+
+}  // namespace
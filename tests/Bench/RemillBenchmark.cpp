@@ -0,0 +1,1092 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <remill/Arch/Arch.h>
+#include <remill/Arch/Instruction.h>
+#include <remill/Arch/Name.h>
+#include <remill/BC/ABI.h>
+#include <remill/BC/Optimizer.h>
+#include <remill/BC/TraceLifter.h>
+#include <remill/BC/Transplant.h>
+#include <remill/BC/Util.h>
+#include <remill/OS/OS.h>
+#include <remill/Version/Version.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "lib/Arch/AArch64/Decode.h"
+
+DEFINE_string(archs, "",
+              "Comma-separated list of architectures to benchmark. Defaults "
+              "to every architecture with a corpus.");
+
+DEFINE_string(filter, "",
+              "Only run the benchmarks whose names contain this string, "
+              "e.g. `Decode/` or `/aarch64`.");
+
+DEFINE_double(min_time, 1.0,
+              "Minimum number of seconds to spend timing each benchmark.");
+
+DEFINE_uint32(trace_blocks, 64,
+              "Number of basic blocks in the synthetic control-flow graph "
+              "that is decoded and lifted.");
+
+DEFINE_string(corpus, "",
+              "Path to a file with the raw bytes of some code, e.g. the "
+              "contents of a `.text` section, to decode in the `Decode` and "
+              "`DecodeRange` benchmarks instead of the synthetic code. "
+              "Requires `--archs` to name one architecture.");
+
+DEFINE_uint64(transplant_functions, 100000,
+              "Total number of functions merged across all shards in the "
+              "`Transplant` benchmarks.");
+
+DEFINE_uint64(transplant_shards, 8,
+              "Number of source modules, each in its own context, merged in "
+              "the `Transplant` benchmarks.");
+
+DEFINE_uint64(aarch64_sweep_stride, 65537,
+              "Sweep every `stride`th 32-bit encoding through the AArch64 "
+              "decoder in the `DecoderSweep/aarch64` benchmark. Use 1 to "
+              "sweep all of them.");
+
+DEFINE_bool(aarch64_sweep_report, false,
+            "After the `DecoderSweep/aarch64` benchmark, list the AArch64 "
+            "instruction forms that extract but fail to decode, and those "
+            "that are the slowest to decode.");
+
+DEFINE_string(json_out, "",
+              "Path to a file where the results should be saved as JSON, in "
+              "the format used by Google Benchmark.");
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint64_t kImageAddress = 0x10000u;
+
+// Lift like `remill-lift` does by default, i.e. with idiom fusion.
+static remill::TraceLifterOptions LifterOptions(void) {
+  remill::TraceLifterOptions options;
+  options.fuse_idioms = true;
+  return options;
+}
+
+// Give up on reaching `--min_time` once this many times as much wall-clock
+// time has passed, e.g. because most of each iteration is untimed setup.
+static constexpr double kMaxWallTimeFactor = 10.0;
+
+static std::string LittleEndian(uint64_t val, unsigned size) {
+  std::string bytes;
+  for (auto i = 0u; i < size; ++i) {
+    bytes.push_back(static_cast<char>(val >> (i * 8u)));
+  }
+  return bytes;
+}
+
+static std::string BigEndian(uint64_t val, unsigned size) {
+  std::string bytes = LittleEndian(val, size);
+  std::reverse(bytes.begin(), bytes.end());
+  return bytes;
+}
+
+// Conditional branches, located at some `pc`, that branch to `pc + disp` if
+// the last comparison was equal.
+
+// `je rel32`
+static std::string X86Branch(uint64_t disp) {
+  return "\x0f\x84" + LittleEndian(disp - 6u, 4);
+}
+
+// `b.eq`
+static std::string AArch64Branch(uint64_t disp) {
+  return LittleEndian(0x54000000u | (((disp / 4u) & 0x7ffffu) << 5u), 4);
+}
+
+// `beq`
+static std::string AArch32Branch(uint64_t disp) {
+  return LittleEndian(0x0a000000u | (((disp - 8u) / 4u) & 0xffffffu), 4);
+}
+
+// `beq`, with a 16-bit encoding.
+static std::string Thumb2Branch(uint64_t disp) {
+  CHECK_LE(disp, 258u) << "Thumb2 corpus is too big for a short branch";
+  return LittleEndian(0xd000u | (((disp - 4u) / 2u) & 0xffu), 2);
+}
+
+// `be`, followed by a `nop` in its delay slot.
+static std::string SPARCBranch(uint64_t disp) {
+  return BigEndian(0x02800000u | ((disp / 4u) & 0x3fffffu), 4) +
+         BigEndian(0x01000000u, 4);
+}
+
+// `beq`
+static std::string PPCBranch(uint64_t disp) {
+  return BigEndian(0x41820000u | (disp & 0xfffcu), 4);
+}
+
+// Instructions representative of compiled code for an architecture.
+struct Corpus {
+  remill::ArchName arch_name;
+
+  // Hex-encoded straight-line code, e.g. a function prologue, loads, stores,
+  // integer and floating point arithmetic, and a function epilogue.
+  std::string body;
+
+  // Hex-encoded function return, along with its delay slot, if any.
+  std::string ret;
+
+  // Encodes a conditional branch.
+  std::string (*branch)(uint64_t disp);
+};
+
+static const char kAMD64Body[] =
+    "554889e54883ec20488b45f848897df04801d0480fafc6488d048e4863c70fb6c0"
+    "48c1e00431c94885c00f95c14883fa64480f4fc20f1006660ffec1f20f58c1f248"
+    "0f2ad05d";
+
+static const char kAArch64Body[] =
+    "fd7bbea9fd030091200040f9220840b90000018b43100051007c019b0408019b"
+    "05f07dd3a61c40924700032a1f0000f10800819ae00b00f9292840a90028611e"
+    "4108231e0200629e2084a24efd7bc2a8";
+
+static const std::vector<Corpus> &Corpora(void) {
+  static const std::vector<Corpus> corpora = {
+      {remill::kArchX86,
+       "5589e583ec108b45088b4d0c01c80fafc18d54880431c90fb6c8c1e20385c00f94"
+       "c08945fc83fa0a0f4cc241d3faf20f58c15d",
+       "c3", X86Branch},
+      {remill::kArchAMD64, kAMD64Body, "c3", X86Branch},
+      {remill::kArchAMD64_AVX512,
+       std::string(kAMD64Body) +
+           "c5fc58c1c5fe6f16c5f5efca62f17c4858c162f1fe486f1662f17548feda"
+           "62f26d48b8c1c5f893c1",
+       "c3", X86Branch},
+      {remill::kArchAArch64LittleEndian, kAArch64Body, "c0035fd6",
+       AArch64Branch},
+      {remill::kArchAArch64LittleEndian_SLEIGH, kAArch64Body, "c0035fd6",
+       AArch64Branch},
+      {remill::kArchThumb2LittleEndian,
+       "90b501af0868d1f808204018a2f10403484300fb0124c50005f0ff0642ea0307"
+       "0028012001904b78a1f80220bde89040",
+       "7047", Thumb2Branch},
+      {remill::kArchAArch32LittleEndian,
+       "10482de904b08de2000091e5082091e5010080e0043042e2900100e0902124e0"
+       "8051a0e1ff6005e2037082e1000050e30080a00104000de50190d1e5b220c1e1"
+       "0000a0e31048bde8",
+       "1eff2fe1", AArch32Branch},
+      {remill::kArchSparc32,
+       "9de3bfa0d0060000d2062008940200099622a004985a00099b2b2003a00b60ff"
+       "a214000980a2200025048d15a414a278d027bffce60e2001d236200289a00842"
+       "b010200081e80000",
+       "81c7e00801000000", SPARCBranch},
+      {remill::kArchSparc64,
+       "9de3bf50d05e0000d2062008940200099622a004984a00099b2b3003a00b60ff"
+       "a214000980a2200025048d15a414a278d077a7f7e60e2001d236200289a00842"
+       "b010200081e80000",
+       "81c7e00801000000", SPARCBranch},
+      {remill::kArchPPC,
+       "9421ffe07c0802a6900100248064000080a400087c632a1438c3fffc7ce329d6"
+       "54e81838710900ff7d2a2b782c0300003d601234616b56789061000889840001"
+       "b0a4000238600000800100247c0803a638210020",
+       "4e800020", PPCBranch},
+  };
+  return corpora;
+}
+
+// Lay out `num_blocks` copies of the body of `corpus`, each followed by a
+// conditional branch to the block after the next one, and then a return.
+// Every block is reachable, and all of them belong to one trace.
+static std::string BuildImage(const Corpus &corpus, uint64_t num_blocks) {
+  const auto body = llvm::fromHex(corpus.body);
+  const auto block_size = body.size() + corpus.branch(0u).size();
+
+  std::string image;
+  for (uint64_t i = 0u; i < num_blocks; ++i) {
+    const auto target = std::min<uint64_t>(i + 2u, num_blocks);
+    image += body;
+    image += corpus.branch((target - i) * block_size - body.size());
+  }
+  image += llvm::fromHex(corpus.ret);
+  return image;
+}
+
+// Serves the bytes of an image, and keeps track of the traces lifted from
+// it. Every generation of traces gets new names, so that repeatedly lifting
+// the same code never reuses a function.
+class ImageTraceManager : public remill::TraceManager {
+ public:
+  virtual ~ImageTraceManager(void) = default;
+
+  explicit ImageTraceManager(std::string_view image_) : image(image_) {}
+
+  // Delete the bodies of the lifted traces, and start a new generation.
+  //
+  // NOTE(pag): The trace declarations are kept around so that the lifters,
+  //            which cache things on a per-function basis, never see a new
+  //            function at the address of a deleted one.
+  void Reset(void) {
+    for (auto &[addr, func] : traces) {
+      func->deleteBody();
+    }
+    traces.clear();
+    generation += 1u;
+  }
+
+  std::unordered_map<uint64_t, llvm::Function *> traces;
+
+ protected:
+  std::string TraceName(uint64_t addr) override {
+    return "trace_" + std::to_string(generation) + "_" +
+           llvm::utohexstr(addr);
+  }
+
+  void SetLiftedTraceDefinition(uint64_t addr,
+                                llvm::Function *lifted_func) override {
+    traces[addr] = lifted_func;
+  }
+
+  llvm::Function *GetLiftedTraceDeclaration(uint64_t addr) override {
+    return GetLiftedTraceDefinition(addr);
+  }
+
+  llvm::Function *GetLiftedTraceDefinition(uint64_t addr) override {
+    auto trace_it = traces.find(addr);
+    if (trace_it != traces.end()) {
+      return trace_it->second;
+    } else {
+      return nullptr;
+    }
+  }
+
+  bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override {
+    const auto bytes = TryReadExecutableBytes(addr, 1u);
+    if (bytes.empty()) {
+      return false;
+    }
+    *byte = static_cast<uint8_t>(bytes.front());
+    return true;
+  }
+
+  std::string_view TryReadExecutableBytes(uint64_t addr,
+                                          size_t max_size) override {
+    if (addr < kImageAddress || addr >= kImageAddress + image.size()) {
+      return {};
+    }
+    return image.substr(addr - kImageAddress, max_size);
+  }
+
+ private:
+  const std::string_view image;
+  uint64_t generation{0u};
+};
+
+// Accumulates the time spent in the timed parts of the iterations of a
+// benchmark. Work that shouldn't be timed, e.g. setting up the inputs of an
+// iteration, goes between `Pause` and `Resume`.
+class IterationTimer {
+ public:
+  inline void Resume(void) {
+    real_start = Clock::now();
+    cpu_start = std::clock();
+  }
+
+  inline void Pause(void) {
+    real_seconds += std::chrono::duration<double>(Clock::now() - real_start)
+                        .count();
+    cpu_seconds += static_cast<double>(std::clock() - cpu_start) /
+                   static_cast<double>(CLOCKS_PER_SEC);
+  }
+
+  double real_seconds{0.0};
+  double cpu_seconds{0.0};
+
+ private:
+  Clock::time_point real_start;
+  std::clock_t cpu_start{0};
+};
+
+// An iteration of a benchmark. Returns the number of items, e.g.
+// instructions, processed by the iteration.
+using Iteration = std::function<uint64_t(IterationTimer &)>;
+
+struct Result {
+  std::string name;
+  uint64_t iterations{0u};
+  uint64_t items{0u};
+  double real_seconds{0.0};
+  double cpu_seconds{0.0};
+};
+
+static void RunBenchmark(const std::string &name, const Iteration &iteration,
+                         std::vector<Result> &results) {
+  if (!FLAGS_filter.empty() && name.find(FLAGS_filter) == std::string::npos) {
+    return;
+  }
+
+  IterationTimer timer;
+  Result result;
+  result.name = name;
+
+  const auto wall_start = Clock::now();
+  const auto max_wall_seconds = FLAGS_min_time * kMaxWallTimeFactor;
+  do {
+    timer.Resume();
+    result.items += iteration(timer);
+    timer.Pause();
+    result.iterations += 1u;
+  } while (timer.real_seconds < FLAGS_min_time &&
+           std::chrono::duration<double>(Clock::now() - wall_start).count() <
+               max_wall_seconds);
+
+  result.real_seconds = timer.real_seconds;
+  result.cpu_seconds = timer.cpu_seconds;
+
+  const auto iterations = static_cast<double>(result.iterations);
+  std::cout << std::left << std::setw(32) << name << std::right
+            << std::setw(14) << std::fixed << std::setprecision(0)
+            << (result.real_seconds * 1e9 / iterations) << " ns"
+            << std::setw(14) << (result.cpu_seconds * 1e9 / iterations)
+            << " ns" << std::setw(10) << result.iterations
+            << std::setw(14) << std::setprecision(1)
+            << (static_cast<double>(result.items) / result.real_seconds)
+            << " items/s" << std::endl;
+
+  results.emplace_back(std::move(result));
+}
+
+// Decode every instruction of `image`, one after the other. Returns the
+// number of instructions decoded.
+static uint64_t DecodeImage(const remill::Arch *arch, std::string_view image,
+                            std::function<void(remill::Instruction &)> with) {
+  const auto context = arch->CreateInitialContext();
+  const auto max_size = arch->MaxInstructionSize(context, true);
+  const auto min_align = arch->MinInstructionAlign(context);
+
+  remill::Instruction inst;
+  uint64_t num_insts = 0u;
+  for (uint64_t offset = 0u; offset < image.size(); ++num_insts) {
+    inst.Reset();
+    if (arch->DecodeInstruction(kImageAddress + offset,
+                                image.substr(offset, max_size), inst,
+                                context) &&
+        !inst.bytes.empty()) {
+      offset += inst.bytes.size();
+      with(inst);
+    } else {
+      offset += min_align;
+    }
+  }
+  return num_insts;
+}
+
+// Returns the contents of `--corpus`, or `image` if there is no corpus file.
+static std::string LoadDecodeImage(const std::string &image) {
+  if (FLAGS_corpus.empty()) {
+    return image;
+  }
+  auto buff = llvm::MemoryBuffer::getFile(FLAGS_corpus, false, false);
+  CHECK(buff) << "Unable to read corpus file " << FLAGS_corpus << ": "
+              << buff.getError().message();
+  return (*buff)->getBuffer().str();
+}
+
+// Run all of the benchmarks for the architecture of `corpus`.
+static void RunBenchmarks(llvm::LLVMContext &context, const Corpus &corpus,
+                          std::vector<Result> &results) {
+  const std::string arch_name(remill::GetArchName(corpus.arch_name));
+  const auto image = BuildImage(corpus, std::max(1u, FLAGS_trace_blocks));
+  const auto decode_image = LoadDecodeImage(image);
+
+  auto arch = remill::Arch::Get(context, remill::kOSLinux, corpus.arch_name);
+  CHECK(arch != nullptr) << "Unable to build architecture " << arch_name;
+
+  std::unique_ptr<llvm::Module> module(remill::LoadArchSemantics(arch.get()));
+  CHECK(module != nullptr) << "Unable to load semantics of " << arch_name;
+
+  const auto num_insts = DecodeImage(arch.get(), image,
+                                     [](remill::Instruction &) {});
+
+  RunBenchmark("Decode/" + arch_name,
+               [&](IterationTimer &) -> uint64_t {
+                 return DecodeImage(arch.get(), decode_image,
+                                    [](remill::Instruction &) {});
+               },
+               results);
+
+  // Sweep the code with `Arch::DecodeRange`, which skips operands.
+  RunBenchmark("DecodeRange/" + arch_name,
+               [&](IterationTimer &) -> uint64_t {
+                 uint64_t num_summaries = 0u;
+                 (void) arch->DecodeRange(
+                     kImageAddress, decode_image,
+                     [&num_summaries](const remill::InstructionSummary &) {
+                       ++num_summaries;
+                       return true;
+                     });
+                 return num_summaries;
+               },
+               results);
+
+  // Decode and lift each instruction into its own block.
+  uint64_t num_lifted_funcs = 0u;
+  RunBenchmark(
+      "DecodeAndLift/" + arch_name,
+      [&](IterationTimer &timer) -> uint64_t {
+        timer.Pause();
+        auto func = arch->DefineLiftedFunction(
+            "lift_" + std::to_string(num_lifted_funcs++), module.get());
+        auto state_ptr = remill::NthArgument(func, remill::kStatePointerArgNum);
+        timer.Resume();
+
+        const auto ret =
+            DecodeImage(arch.get(), image, [&](remill::Instruction &inst) {
+              auto block = llvm::BasicBlock::Create(context, "", func);
+              std::ignore = inst.GetLifter()->LiftIntoBlock(inst, block,
+                                                            state_ptr);
+            });
+
+        // NOTE(pag): Keep the declaration, so that the next function is never
+        //            allocated where this one was. See `ImageTraceManager`.
+        timer.Pause();
+        func->deleteBody();
+        timer.Resume();
+        return ret;
+      },
+      results);
+
+  // Recursively decode and lift the synthetic control-flow graph.
+  ImageTraceManager manager(image);
+  remill::TraceLifter trace_lifter(arch.get(), manager, LifterOptions());
+  RunBenchmark("LiftTrace/" + arch_name,
+               [&](IterationTimer &timer) -> uint64_t {
+                 timer.Pause();
+                 manager.Reset();
+                 timer.Resume();
+                 CHECK(trace_lifter.Lift(kImageAddress));
+                 return num_insts;
+               },
+               results);
+
+  // Optimize a freshly lifted trace. This needs a new semantics module every
+  // iteration, as optimizing changes the whole module, not just the trace.
+  // The second run also uses `RegisterAA`, so that its cost or benefit can be
+  // compared against the default pipeline.
+  for (auto register_alias_analysis : {false, true}) {
+    remill::OptimizationGuide guide = {};
+    guide.register_alias_analysis = register_alias_analysis;
+    RunBenchmark(
+        (register_alias_analysis ? "Optimize+RegisterAA/" : "Optimize/") +
+            arch_name,
+        [&](IterationTimer &timer) -> uint64_t {
+          timer.Pause();
+          auto iter_context = std::make_unique<llvm::LLVMContext>();
+          auto iter_arch =
+              remill::Arch::Get(*iter_context, remill::kOSLinux,
+                                corpus.arch_name);
+          std::unique_ptr<llvm::Module> iter_module(
+              remill::LoadArchSemantics(iter_arch.get()));
+          auto iter_manager = std::make_unique<ImageTraceManager>(image);
+          CHECK(remill::TraceLifter(iter_arch.get(), *iter_manager,
+                                    LifterOptions())
+                    .Lift(kImageAddress));
+          timer.Resume();
+
+          remill::OptimizeModule(iter_arch.get(), iter_module.get(),
+                                 iter_manager->traces, guide);
+
+          timer.Pause();
+          iter_manager.reset();
+          iter_module.reset();
+          iter_arch.reset();
+          iter_context.reset();
+          timer.Resume();
+          return num_insts;
+        },
+        results);
+  }
+
+  // Load the semantics into a new context, first verifying them every time,
+  // and then only verifying them if there is no stamp for them in a stamp
+  // directory. The stamp is recorded by a load that isn't timed.
+  //
+  // NOTE(pag): The semantics bitcode file will usually be in the page cache
+  //            after the first iteration, so this measures parsing,
+  //            verifying, and preparing the semantics module, rather than
+  //            disk I/O.
+  llvm::SmallString<128> stamp_dir;
+  CHECK(!llvm::sys::fs::createUniqueDirectory("remill-bench-stamps",
+                                              stamp_dir))
+      << "Unable to create a stamp directory";
+  (void) remill::LoadArchSemantics(arch.get(), {}, stamp_dir.str().str());
+
+  for (auto use_stamp : {false, true}) {
+    const std::filesystem::path iter_stamp_dir =
+        use_stamp ? stamp_dir.str().str() : std::string();
+    RunBenchmark(
+        (use_stamp ? "LoadSemantics+Stamp/" : "LoadSemantics/") + arch_name,
+        [&](IterationTimer &timer) -> uint64_t {
+          timer.Pause();
+          auto iter_context = std::make_unique<llvm::LLVMContext>();
+          auto iter_arch =
+              remill::Arch::Get(*iter_context, remill::kOSLinux,
+                                corpus.arch_name);
+          timer.Resume();
+
+          std::unique_ptr<llvm::Module> iter_module(remill::LoadArchSemantics(
+              iter_arch.get(), {}, iter_stamp_dir));
+
+          timer.Pause();
+          iter_module.reset();
+          iter_arch.reset();
+          iter_context.reset();
+          timer.Resume();
+          return 1u;
+        },
+        results);
+  }
+
+  std::error_code ec;
+  std::filesystem::remove_all(stamp_dir.str().str(), ec);
+}
+
+// A per-thread lifting shard.
+struct Shard {
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::unique_ptr<llvm::Module> module;
+};
+
+// Build a module whose functions look like lifted code: they take a `State`
+// structure pointer, a program counter, and a memory pointer, access
+// registers in the state structure, call memory intrinsics and internal
+// helpers, and call other lifted functions.
+static Shard BuildShard(uint64_t first_func, uint64_t num_funcs) {
+  Shard shard;
+  shard.context = std::make_unique<llvm::LLVMContext>();
+  auto &context = *shard.context;
+  shard.module = std::make_unique<llvm::Module>("shard", context);
+  auto module = shard.module.get();
+
+  auto i1_type = llvm::Type::getInt1Ty(context);
+  auto i32_type = llvm::Type::getInt32Ty(context);
+  auto i64_type = llvm::Type::getInt64Ty(context);
+  auto ptr_type = llvm::PointerType::get(context, 0);
+  auto regs_type = llvm::ArrayType::get(i64_type, 32);
+  auto state_type =
+      llvm::StructType::create(context, {regs_type, i64_type}, "struct.State");
+
+  auto lifted_type = llvm::FunctionType::get(
+      ptr_type, {ptr_type, i64_type, ptr_type}, false);
+  auto read_type =
+      llvm::FunctionType::get(i64_type, {ptr_type, i64_type}, false);
+  auto write_type = llvm::FunctionType::get(
+      ptr_type, {ptr_type, i64_type, i64_type}, false);
+  auto helper_type = llvm::FunctionType::get(i64_type, {i64_type}, false);
+
+  auto read_mem = llvm::Function::Create(
+      read_type, llvm::GlobalValue::ExternalLinkage,
+      "__remill_read_memory_64", module);
+  auto write_mem = llvm::Function::Create(
+      write_type, llvm::GlobalValue::ExternalLinkage,
+      "__remill_write_memory_64", module);
+
+  // Every shard has its own copy of an internal semantics helper.
+  auto helper = llvm::Function::Create(
+      helper_type, llvm::GlobalValue::InternalLinkage, "helper", module);
+  {
+    llvm::IRBuilder<> ir(llvm::BasicBlock::Create(context, "", helper));
+    auto arg = helper->getArg(0);
+    ir.CreateRet(ir.CreateXor(ir.CreateMul(arg, ir.getInt64(3)),
+                              ir.CreateLShr(arg, ir.getInt64(7))));
+  }
+
+  auto table = new llvm::GlobalVariable(
+      *module, llvm::ArrayType::get(i64_type, 4), true,
+      llvm::GlobalValue::InternalLinkage,
+      llvm::ConstantDataArray::get(
+          context, llvm::ArrayRef<uint64_t>({1, 2, 3, 4})),
+      "table");
+
+  auto md_kind = context.getMDKindID("remill.bench");
+  auto md = llvm::MDNode::get(context, llvm::MDString::get(context, "bench"));
+
+  llvm::Function *prev_func = nullptr;
+  for (auto i = first_func; i < first_func + num_funcs; ++i) {
+    auto func = llvm::Function::Create(
+        lifted_type, llvm::GlobalValue::ExternalLinkage,
+        "sub_" + llvm::utohexstr(0x1000 + i * 16), module);
+    auto state = func->getArg(0);
+    auto pc = func->getArg(1);
+    auto memory = func->getArg(2);
+
+    auto entry = llvm::BasicBlock::Create(context, "", func);
+    auto left = llvm::BasicBlock::Create(context, "", func);
+    auto right = llvm::BasicBlock::Create(context, "", func);
+    auto exit = llvm::BasicBlock::Create(context, "", func);
+
+    llvm::IRBuilder<> ir(entry);
+    auto reg = ir.CreateInBoundsGEP(
+        state_type, state,
+        {ir.getInt32(0), ir.getInt32(0), ir.getInt32(i % 32)});
+    auto val = ir.CreateLoad(i64_type, reg);
+    auto hashed = ir.CreateCall(helper, {val});
+    auto cond = ir.CreateICmpULT(hashed, pc);
+    ir.CreateCondBr(cond, left, right)->setMetadata(md_kind, md);
+
+    ir.SetInsertPoint(left);
+    auto read = ir.CreateCall(read_mem, {memory, ir.CreateAdd(pc, val)});
+    ir.CreateStore(read, reg);
+    ir.CreateBr(exit);
+
+    ir.SetInsertPoint(right);
+    auto entry_addr = ir.CreateGEP(
+        table->getValueType(), table,
+        {ir.getInt32(0), ir.CreateAnd(val, ir.getInt64(3))});
+    auto entry_val = ir.CreateLoad(i64_type, entry_addr);
+    llvm::Value *new_memory = ir.CreateCall(write_mem, {memory, pc, entry_val});
+    if (prev_func) {
+      new_memory = ir.CreateCall(prev_func, {state, entry_val, new_memory});
+    }
+    ir.CreateBr(exit);
+
+    ir.SetInsertPoint(exit);
+    auto phi = ir.CreatePHI(ptr_type, 2);
+    phi->addIncoming(memory, left);
+    phi->addIncoming(new_memory, right);
+    auto flag = ir.CreateTrunc(ir.CreateLoad(i64_type, reg), i1_type);
+    ir.CreateStore(ir.CreateZExt(flag, i32_type),
+                   ir.CreateStructGEP(state_type, state, 1));
+    ir.CreateRet(phi);
+
+    prev_func = func;
+  }
+
+  return shard;
+}
+
+static std::vector<Shard> BuildShards(void) {
+  std::vector<Shard> shards;
+  const auto num_shards = std::max<uint64_t>(1, FLAGS_transplant_shards);
+  const auto per_shard = FLAGS_transplant_functions / num_shards;
+  for (uint64_t i = 0; i < num_shards; ++i) {
+    auto count = per_shard;
+    if (i + 1 == num_shards) {
+      count = FLAGS_transplant_functions - per_shard * i;
+    }
+    shards.emplace_back(BuildShard(per_shard * i, count));
+  }
+  return shards;
+}
+
+// Merge the modules of many lifting shards, each in its own context, into a
+// single module, and compare that to round-tripping each shard through
+// bitcode. This doesn't depend on the architecture.
+static void RunTransplantBenchmarks(std::vector<Result> &results) {
+  RunBenchmark(
+      "Transplant/merge",
+      [&](IterationTimer &timer) -> uint64_t {
+        timer.Pause();
+        auto shards = BuildShards();
+        auto context = std::make_unique<llvm::LLVMContext>();
+        auto dest = std::make_unique<llvm::Module>("merged", *context);
+        timer.Resume();
+
+        remill::FunctionTransplanter transplanter(dest.get());
+        for (auto &shard : shards) {
+          transplanter.CopyAll(shard.module.get());
+        }
+
+        timer.Pause();
+        dest.reset();
+        context.reset();
+        shards.clear();
+        timer.Resume();
+        return FLAGS_transplant_functions;
+      },
+      results);
+
+  // NOTE(pag): This only serializes and parses each shard; linking the parsed
+  //            modules together would add to this.
+  RunBenchmark(
+      "Transplant/bitcode",
+      [&](IterationTimer &timer) -> uint64_t {
+        timer.Pause();
+        auto shards = BuildShards();
+        auto context = std::make_unique<llvm::LLVMContext>();
+        std::vector<std::unique_ptr<llvm::Module>> parsed;
+        timer.Resume();
+
+        for (auto &shard : shards) {
+          llvm::SmallVector<char, 0> buffer;
+          llvm::raw_svector_ostream os(buffer);
+          llvm::WriteBitcodeToFile(*shard.module, os);
+          auto module = llvm::parseBitcodeFile(
+              llvm::MemoryBufferRef(
+                  llvm::StringRef(buffer.data(), buffer.size()), "shard"),
+              *context);
+          CHECK(module) << "Unable to parse bitcode of shard";
+          parsed.emplace_back(std::move(*module));
+        }
+
+        timer.Pause();
+        parsed.clear();
+        context.reset();
+        shards.clear();
+        timer.Resume();
+        return FLAGS_transplant_functions;
+      },
+      results);
+}
+
+// NOTE(pag): `ZIP2_ASIMDPERM_ONLY` is the last instruction form.
+static constexpr unsigned kNumAArch64InstForms =
+    static_cast<unsigned>(remill::aarch64::InstForm::ZIP2_ASIMDPERM_ONLY) + 1u;
+
+// Number of decodable encodings of each instruction form that are timed for
+// `--aarch64_sweep_report`, how many times they are decoded, and how many
+// instruction forms are listed.
+static constexpr size_t kAArch64SamplesPerInstForm = 64u;
+static constexpr unsigned kAArch64SampleIterations = 100u;
+static constexpr unsigned kAArch64ReportSize = 50u;
+
+struct AArch64InstFormStats {
+  uint64_t num_extracted{0u};
+  uint64_t num_decoded{0u};
+  double ns_per_decode{0.0};
+  std::vector<uint32_t> samples;
+};
+
+// Decodes AArch64 encodings with `aarch64::TryExtract` followed by
+// `aarch64::TryDecode`, i.e. with what `AArch64Arch::ArchDecodeInstruction`
+// does, minus copying the instruction bytes.
+class AArch64Decoder {
+ public:
+  AArch64Decoder(void) : names(kNumAArch64InstForms) {
+    for (auto iform = 0u; iform < kNumAArch64InstForms; ++iform) {
+      names[iform] = remill::aarch64::InstFormToString(
+          static_cast<remill::aarch64::InstForm>(iform));
+    }
+  }
+
+  // Returns `true` if `bits` extracts. `Decode` then returns `true` if it
+  // also decodes.
+  bool Extract(uint32_t bits) {
+    uint8_t bytes[4] = {static_cast<uint8_t>(bits),
+                        static_cast<uint8_t>(bits >> 8u),
+                        static_cast<uint8_t>(bits >> 16u),
+                        static_cast<uint8_t>(bits >> 24u)};
+    data = {};
+    return remill::aarch64::TryExtract(bytes, data);
+  }
+
+  // NOTE(pag): Some decoders append to the ISEL name, so it has to be reset
+  //            for every instruction, but the names are formatted up front.
+  bool Decode(void) {
+    inst.Reset();
+    inst.arch_name = remill::kArchAArch64LittleEndian;
+    inst.sub_arch_name = remill::kArchAArch64LittleEndian;
+    inst.pc = kImageAddress;
+    inst.next_pc = kImageAddress + 4u;
+    inst.function = names[IForm()];
+    return remill::aarch64::TryDecode(data, inst);
+  }
+
+  unsigned IForm(void) const {
+    return static_cast<unsigned>(data.iform);
+  }
+
+  const std::string &Name(unsigned iform) const {
+    return names[iform];
+  }
+
+ private:
+  std::vector<std::string> names;
+  remill::aarch64::InstData data;
+  remill::Instruction inst;
+};
+
+// List the instruction forms that extract but fail to decode, which the
+// lifters treat as invalid instructions even though they are allocated
+// encodings, and the instruction forms that are the slowest to decode.
+static void ReportAArch64Sweep(AArch64Decoder &decoder) {
+  std::vector<AArch64InstFormStats> stats(kNumAArch64InstForms);
+  for (uint64_t enc = 0u; enc < 0x100000000ull;
+       enc += FLAGS_aarch64_sweep_stride) {
+    const auto bits = static_cast<uint32_t>(enc);
+    if (!decoder.Extract(bits)) {
+      continue;
+    }
+    auto &iform_stats = stats[decoder.IForm()];
+    iform_stats.num_extracted += 1u;
+    if (decoder.Decode()) {
+      iform_stats.num_decoded += 1u;
+      if (iform_stats.samples.size() < kAArch64SamplesPerInstForm) {
+        iform_stats.samples.push_back(bits);
+      }
+    }
+  }
+
+  for (auto &iform_stats : stats) {
+    if (iform_stats.samples.empty()) {
+      continue;
+    }
+    const auto start = Clock::now();
+    for (auto i = 0u; i < kAArch64SampleIterations; ++i) {
+      for (auto bits : iform_stats.samples) {
+        (void) decoder.Extract(bits);
+        (void) decoder.Decode();
+      }
+    }
+    iform_stats.ns_per_decode =
+        std::chrono::duration<double, std::nano>(Clock::now() - start)
+            .count() /
+        static_cast<double>(kAArch64SampleIterations *
+                            iform_stats.samples.size());
+  }
+
+  std::vector<unsigned> iforms;
+  for (auto iform = 1u; iform < kNumAArch64InstForms; ++iform) {
+    iforms.push_back(iform);
+  }
+
+  auto num_failed = [&stats](unsigned iform) {
+    return stats[iform].num_extracted - stats[iform].num_decoded;
+  };
+
+  std::sort(iforms.begin(), iforms.end(), [&](unsigned a, unsigned b) {
+    return num_failed(a) > num_failed(b);
+  });
+
+  std::cout << std::endl << "AArch64 instruction forms failing to decode:"
+            << std::endl;
+  for (auto i = 0u; i < iforms.size() && i < kAArch64ReportSize; ++i) {
+    if (!num_failed(iforms[i])) {
+      break;
+    }
+    std::cout << "  " << std::left << std::setw(40)
+              << decoder.Name(iforms[i]) << std::right << std::setw(12)
+              << num_failed(iforms[i]) << " of "
+              << stats[iforms[i]].num_extracted << std::endl;
+  }
+
+  std::sort(iforms.begin(), iforms.end(), [&](unsigned a, unsigned b) {
+    return stats[a].ns_per_decode > stats[b].ns_per_decode;
+  });
+
+  std::cout << std::endl << "Slowest AArch64 instruction forms to decode:"
+            << std::endl;
+  for (auto i = 0u; i < iforms.size() && i < kAArch64ReportSize; ++i) {
+    if (stats[iforms[i]].samples.empty()) {
+      break;
+    }
+    std::cout << "  " << std::left << std::setw(40)
+              << decoder.Name(iforms[i]) << std::right << std::setw(12)
+              << std::fixed << std::setprecision(1)
+              << stats[iforms[i]].ns_per_decode << " ns" << std::endl;
+  }
+  std::cout << std::endl;
+}
+
+// Sweep 32-bit encodings through the AArch64 decoder. Each item is one
+// encoding, whether or not it decodes.
+//
+// NOTE(pag): Some decoders log errors for encodings that they don't
+//            support, so you probably want `--minloglevel=3` too.
+static void RunAArch64SweepBenchmarks(std::vector<Result> &results) {
+  CHECK(FLAGS_aarch64_sweep_stride) << "Sweep stride must be non-zero";
+
+  AArch64Decoder decoder;
+  RunBenchmark("DecoderSweep/aarch64",
+               [&](IterationTimer &) -> uint64_t {
+                 uint64_t num_encodings = 0u;
+                 for (uint64_t enc = 0u; enc < 0x100000000ull;
+                      enc += FLAGS_aarch64_sweep_stride, ++num_encodings) {
+                   if (decoder.Extract(static_cast<uint32_t>(enc))) {
+                     (void) decoder.Decode();
+                   }
+                 }
+                 return num_encodings;
+               },
+               results);
+
+  if (FLAGS_aarch64_sweep_report) {
+    ReportAArch64Sweep(decoder);
+  }
+}
+
+// Save the results in the JSON format of Google Benchmark, so that its tools,
+// e.g. `compare.py`, can be used to compare two runs.
+static bool StoreResults(const std::vector<Result> &results,
+                         const char *executable) {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(FLAGS_json_out, ec, llvm::sys::fs::OF_Text);
+  if (ec) {
+    LOG(ERROR) << "Unable to open " << FLAGS_json_out << ": " << ec.message();
+    return false;
+  }
+
+  const auto now = std::time(nullptr);
+  char date[64] = {};
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z",
+                std::localtime(&now));
+
+  llvm::json::OStream json(os, 2);
+  json.object([&] {
+    json.attributeObject("context", [&] {
+      json.attribute("date", date);
+      json.attribute("executable", executable);
+      json.attribute("num_cpus",
+                     static_cast<int64_t>(std::thread::hardware_concurrency()));
+#ifdef NDEBUG
+      json.attribute("library_build_type", "release");
+#else
+      json.attribute("library_build_type", "debug");
+#endif
+      if (remill::version::HasVersionData()) {
+        json.attribute("remill_commit",
+                       llvm::StringRef(remill::version::GetCommitHash()));
+      }
+      json.attribute("trace_blocks",
+                     static_cast<int64_t>(FLAGS_trace_blocks));
+    });
+    json.attributeArray("benchmarks", [&] {
+      for (const auto &result : results) {
+        const auto iterations = static_cast<double>(result.iterations);
+        json.object([&] {
+          json.attribute("name", result.name);
+          json.attribute("run_name", result.name);
+          json.attribute("run_type", "iteration");
+          json.attribute("iterations",
+                         static_cast<int64_t>(result.iterations));
+          json.attribute("real_time", result.real_seconds * 1e9 / iterations);
+          json.attribute("cpu_time", result.cpu_seconds * 1e9 / iterations);
+          json.attribute("time_unit", "ns");
+          json.attribute("items_per_second",
+                         static_cast<double>(result.items) /
+                             result.real_seconds);
+        });
+      }
+    });
+  });
+  os << '\n';
+  os.close();
+  if (os.has_error()) {
+    LOG(ERROR) << "Unable to write " << FLAGS_json_out << ": "
+               << os.error().message();
+    os.clear_error();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+// Measures the hot paths of remill on a corpus of instructions for each
+// architecture: decoding, decoding and lifting single instructions, lifting
+// traces of a synthetic control-flow graph, optimizing lifted traces, and
+// loading the semantics. Also measures sweeping encodings through the AArch64
+// decoder, and merging the modules of many lifting shards with a
+// `FunctionTransplanter`.
+extern "C" int main(int argc, char *argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  llvm::SmallVector<llvm::StringRef, 8> arch_names;
+  llvm::StringRef(FLAGS_archs).split(arch_names, ',', -1, false);
+
+  std::vector<const Corpus *> corpora;
+  for (const auto &corpus : Corpora()) {
+    if (arch_names.empty()) {
+      corpora.push_back(&corpus);
+      continue;
+    }
+    for (auto arch_name : arch_names) {
+      if (remill::GetArchName(arch_name.trim().str()) == corpus.arch_name) {
+        corpora.push_back(&corpus);
+        break;
+      }
+    }
+  }
+
+  if (corpora.empty()) {
+    std::cerr << "None of the architectures passed to --archs have a corpus."
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (!FLAGS_corpus.empty() && corpora.size() != 1u) {
+    std::cerr << "The code in --corpus can only be decoded for one "
+              << "architecture; use --archs to pick it." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << std::left << std::setw(32) << "Benchmark" << std::right
+            << std::setw(17) << "Time" << std::setw(17) << "CPU"
+            << std::setw(10) << "Iters" << std::setw(22) << "Throughput"
+            << std::endl;
+
+  std::vector<Result> results;
+  for (auto corpus : corpora) {
+    llvm::LLVMContext context;
+    RunBenchmarks(context, *corpus, results);
+    if (corpus->arch_name == remill::kArchAArch64LittleEndian) {
+      RunAArch64SweepBenchmarks(results);
+    }
+  }
+  RunTransplantBenchmarks(results);
+
+  if (!FLAGS_json_out.empty() && !StoreResults(results, argv[0])) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
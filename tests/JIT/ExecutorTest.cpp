@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "remill/Arch/Arch.h"
+#include "remill/Arch/Name.h"
+#include "remill/JIT/Executor.h"
+#include "remill/JIT/GuestMemory.h"
+#include "remill/OS/OS.h"
+
+namespace {
+
+static constexpr uint64_t kMemoryBase = 0x10000;
+static constexpr uint64_t kMemorySize = 0x10000;
+static constexpr uint64_t kCodeAddr = 0x10000;
+static constexpr uint64_t kStackAddr = 0x1f000;
+static constexpr uint64_t kReturnAddr = 0xdead0000;
+
+// Runs small amd64 programs. The program at `kCodeAddr` is called with `RSP`
+// pointing to the return address `kReturnAddr`.
+class ExecutorTest : public testing::Test {
+ protected:
+  void Create(remill::ExecutorOptions options = {}) {
+    ASSERT_TRUE(memory.IsValid());
+    executor = remill::Executor::Create(remill::kOSLinux, remill::kArchAMD64,
+                                        memory, options);
+    ASSERT_NE(executor, nullptr);
+
+    const auto arch = executor->GetArch();
+    const auto size = arch->DataLayout().getTypeAllocSize(
+        arch->StateStructType());
+    state.reset(static_cast<uint8_t *>(
+        std::aligned_alloc(64, (size.getFixedValue() + 63u) & ~63ull)));
+    std::memset(state.get(), 0, size.getFixedValue());
+
+    SetReg("RSP", kStackAddr);
+    memory.Store<uint64_t>(kStackAddr, kReturnAddr);
+  }
+
+  void Load(std::initializer_list<uint8_t> code) {
+    std::vector<uint8_t> bytes(code);
+    ASSERT_TRUE(memory.Write(kCodeAddr, bytes.data(), bytes.size()));
+  }
+
+  remill::ExecutorStatus Run(void) {
+    return executor->Run(state.get(), kCodeAddr);
+  }
+
+  uint64_t Reg(const char *name) {
+    uint64_t val = 0;
+    std::memcpy(&val, &(state.get()[Offset(name)]), sizeof(val));
+    return val;
+  }
+
+  void SetReg(const char *name, uint64_t val) {
+    std::memcpy(&(state.get()[Offset(name)]), &val, sizeof(val));
+  }
+
+  uint64_t Offset(const char *name) {
+    const auto reg = executor->GetArch()->RegisterByName(name);
+    CHECK(reg != nullptr) << "Unknown register " << name;
+    return reg->offset;
+  }
+
+  remill::GuestMemory memory{kMemoryBase, kMemorySize,
+                             true /* little_endian */};
+  std::unique_ptr<remill::Executor> executor;
+  std::unique_ptr<uint8_t, decltype(&std::free)> state{nullptr, &std::free};
+};
+
+TEST(GuestMemoryTest, Bounds) {
+  remill::GuestMemory memory(kMemoryBase, kMemorySize, true);
+  ASSERT_TRUE(memory.IsValid());
+
+  const uint32_t val = 0x11223344;
+  EXPECT_TRUE(memory.Write(kMemoryBase, &val, sizeof(val)));
+  EXPECT_TRUE(memory.Contains(kMemoryBase + kMemorySize - 4, 4));
+  EXPECT_FALSE(memory.Contains(kMemoryBase + kMemorySize - 3, 4));
+  EXPECT_FALSE(memory.Contains(kMemoryBase - 1, 1));
+  EXPECT_FALSE(memory.Write(kMemoryBase + kMemorySize - 2, &val, sizeof(val)));
+
+  uint32_t read = 0;
+  EXPECT_TRUE(memory.Read(kMemoryBase, &read, sizeof(read)));
+  EXPECT_EQ(read, val);
+}
+
+TEST(GuestMemoryTest, ByteOrder) {
+  remill::GuestMemory memory(kMemoryBase, kMemorySize, false);
+  ASSERT_TRUE(memory.IsValid());
+
+  memory.Store<uint32_t>(kMemoryBase, 0x11223344u);
+  uint8_t bytes[4] = {};
+  ASSERT_TRUE(memory.Read(kMemoryBase, bytes, sizeof(bytes)));
+  EXPECT_EQ(bytes[0], 0x11u);
+  EXPECT_EQ(bytes[3], 0x44u);
+  EXPECT_EQ(memory.Load<uint32_t>(kMemoryBase), 0x11223344u);
+}
+
+TEST_F(ExecutorTest, Return) {
+  Create();
+  Load({
+      0xb8, 0x05, 0x00, 0x00, 0x00,  // mov eax, 5
+      0x83, 0xc0, 0x07,  // add eax, 7
+      0xc3,  // ret
+  });
+
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(executor->LastProgramCounter(), kReturnAddr);
+  EXPECT_EQ(Reg("RAX"), 12u);
+  EXPECT_EQ(Reg("RSP"), kStackAddr + 8u);
+}
+
+TEST_F(ExecutorTest, Loop) {
+  Create();
+  Load({
+      0xb9, 0x0a, 0x00, 0x00, 0x00,  // mov ecx, 10
+      0x31, 0xc0,  // xor eax, eax
+      0x01, 0xc8,  // loop: add eax, ecx
+      0xff, 0xc9,  // dec ecx
+      0x75, 0xfa,  // jnz loop
+      0xc3,  // ret
+  });
+
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(Reg("RAX"), 55u);
+  EXPECT_EQ(Reg("RCX"), 0u);
+}
+
+TEST_F(ExecutorTest, FunctionCall) {
+  Create();
+  Load({
+      0xe8, 0x04, 0x00, 0x00, 0x00,  // call func
+      0x83, 0xc0, 0x01,  // add eax, 1
+      0xc3,  // ret
+      0xb8, 0x29, 0x00, 0x00, 0x00,  // func: mov eax, 41
+      0xc3,  // ret
+  });
+
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(executor->LastProgramCounter(), kReturnAddr);
+  EXPECT_EQ(Reg("RAX"), 42u);
+  EXPECT_EQ(Reg("RSP"), kStackAddr + 8u);
+
+  // The traces are compiled once, and then reused.
+  const auto num_traces = executor->NumCachedTraces();
+  EXPECT_GT(num_traces, 0u);
+  SetReg("RSP", kStackAddr);
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(Reg("RAX"), 42u);
+  EXPECT_EQ(executor->NumCachedTraces(), num_traces);
+
+  executor->FlushTraceCache();
+  EXPECT_EQ(executor->NumCachedTraces(), 0u);
+}
+
+TEST_F(ExecutorTest, MemoryFault) {
+  Create();
+  Load({
+      0x48, 0x8b, 0x03,  // mov rax, [rbx]
+      0xc3,  // ret
+  });
+
+  SetReg("RBX", kMemoryBase + kMemorySize);
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kMemoryFault);
+  EXPECT_EQ(executor->LastFaultAddress(), kMemoryBase + kMemorySize);
+  EXPECT_EQ(executor->LastProgramCounter(), kCodeAddr);
+}
+
+// A fault leaves the trace right away, and so a loop inside of one trace
+// doesn't keep running after it faults.
+TEST_F(ExecutorTest, MemoryFaultInLoop) {
+  Create();
+  Load({
+      0x31, 0xc0,  // xor eax, eax
+      0x48, 0x8b, 0x03,  // loop: mov rax, [rbx]
+      0xeb, 0xfb,  // jmp loop
+  });
+
+  SetReg("RBX", kMemoryBase - 8u);
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kMemoryFault);
+  EXPECT_EQ(executor->LastFaultAddress(), kMemoryBase - 8u);
+  EXPECT_EQ(executor->LastProgramCounter(), kCodeAddr);
+
+  // The executor can still run code after a fault.
+  SetReg("RBX", kStackAddr);
+  Load({
+      0x48, 0x8b, 0x03,  // mov rax, [rbx]
+      0xc3,  // ret
+  });
+  executor->FlushTraceCache();
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(Reg("RAX"), kReturnAddr);
+}
+
+TEST_F(ExecutorTest, TraceLimit) {
+  remill::ExecutorOptions options;
+  options.max_traces = 5;
+  Create(options);
+  Load({
+      0xeb, 0xfe,  // loop: jmp loop
+  });
+
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kTraceLimit);
+  EXPECT_EQ(executor->LastProgramCounter(), kCodeAddr);
+}
+
+// The same programs give the same results when traces are optimized more
+// aggressively.
+TEST_F(ExecutorTest, PromotedRegistersAndInlineCaches) {
+  remill::ExecutorOptions options;
+  options.promote_registers = true;
+  options.inline_cache_size = 2;
+  Create(options);
+  Load({
+      0xe8, 0x09, 0x00, 0x00, 0x00,  // call func
+      0x83, 0xc0, 0x01,  // add eax, 1
+      0xc3,  // ret
+      0x90, 0x90, 0x90, 0x90, 0x90,  // nop * 5
+      0xb9, 0x0a, 0x00, 0x00, 0x00,  // func: mov ecx, 10
+      0x31, 0xc0,  // xor eax, eax
+      0x01, 0xc8,  // loop: add eax, ecx
+      0xff, 0xc9,  // dec ecx
+      0x75, 0xfa,  // jnz loop
+      0xc3,  // ret
+  });
+
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(executor->LastProgramCounter(), kReturnAddr);
+  EXPECT_EQ(Reg("RAX"), 56u);
+  EXPECT_EQ(Reg("RSP"), kStackAddr + 8u);
+}
+
+static remill::ExecutorOptions ShadowReturnStackOptions(void) {
+  remill::ExecutorOptions options;
+  options.shadow_return_stack_size = 4;
+  return options;
+}
+
+// Returns to the caller go directly through the shadow return stack.
+TEST_F(ExecutorTest, ShadowReturnStackHit) {
+  Create(ShadowReturnStackOptions());
+  Load({
+      0xe8, 0x04, 0x00, 0x00, 0x00,  // call f
+      0x83, 0xc0, 0x01,  // add eax, 1
+      0xc3,  // ret
+      0xe8, 0x03, 0x00, 0x00, 0x00,  // f: call g
+      0x01, 0xc0,  // add eax, eax
+      0xc3,  // ret
+      0xb8, 0x14, 0x00, 0x00, 0x00,  // g: mov eax, 20
+      0xc3,  // ret
+  });
+
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(executor->LastProgramCounter(), kReturnAddr);
+  EXPECT_EQ(Reg("RAX"), 41u);
+  EXPECT_EQ(Reg("RSP"), kStackAddr + 8u);
+}
+
+// A return to somewhere other than the caller doesn't match the top of the
+// shadow return stack, and so is handled like it would be without it.
+TEST_F(ExecutorTest, ShadowReturnStackMismatch) {
+  Create(ShadowReturnStackOptions());
+  Load({
+      0xe8, 0x0a, 0x00, 0x00, 0x00,  // call f
+      0x83, 0xc0, 0x01,  // add eax, 1
+      0xc3,  // ret
+      0xb8, 0x64, 0x00, 0x00, 0x00,  // other: mov eax, 100
+      0xc3,  // ret
+      0x48, 0xc7, 0x04, 0x24, 0x09, 0x00, 0x01, 0x00,  // f: mov [rsp], other
+      0xb8, 0x29, 0x00, 0x00, 0x00,  // mov eax, 41
+      0xc3,  // ret
+  });
+
+  const auto status = Run();
+  const auto rax = Reg("RAX");
+  const auto last_pc = executor->LastProgramCounter();
+
+  Create();
+  const auto expected_status = Run();
+  EXPECT_EQ(status, expected_status);
+  EXPECT_EQ(rax, Reg("RAX"));
+  EXPECT_EQ(last_pc, executor->LastProgramCounter());
+}
+
+// The entry function's return has no matching shadow return stack entry.
+TEST_F(ExecutorTest, ShadowReturnStackEmpty) {
+  Create(ShadowReturnStackOptions());
+  Load({
+      0xb8, 0x05, 0x00, 0x00, 0x00,  // mov eax, 5
+      0xc3,  // ret
+  });
+
+  EXPECT_EQ(Run(), remill::ExecutorStatus::kReturned);
+  EXPECT_EQ(executor->LastProgramCounter(), kReturnAddr);
+  EXPECT_EQ(Reg("RAX"), 5u);
+}
+
+}  // namespace
@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2024 Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/BinaryFormat/ELF.h>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "Binary.h"
+
+namespace {
+
+// Builds little-endian, 64-bit x86 ELF files.
+class ELFBuilder {
+ public:
+  explicit ELFBuilder(uint16_t type_) : type(type_) {}
+
+  // Add a section, and return its index.
+  unsigned AddSection(std::string name, uint32_t sh_type, uint64_t flags,
+                      uint64_t addr, uint64_t align, std::string data) {
+    sections.push_back({std::move(name), sh_type, flags, addr, align,
+                        std::move(data)});
+    return static_cast<unsigned>(sections.size());
+  }
+
+  // Add an executable section, and return its index.
+  unsigned AddText(std::string name, uint64_t addr, uint64_t align,
+                   std::string data) {
+    return AddSection(std::move(name), llvm::ELF::SHT_PROGBITS,
+                      llvm::ELF::SHF_ALLOC | llvm::ELF::SHF_EXECINSTR, addr,
+                      align, std::move(data));
+  }
+
+  // Add a global function symbol at `value` in the section `section`.
+  void AddFunction(std::string name, unsigned section, uint64_t value) {
+    symbols.push_back({std::move(name), section, value});
+  }
+
+  // Add an executable `PT_LOAD` program header that maps `section`.
+  void AddLoad(unsigned section) {
+    loads.push_back(section);
+  }
+
+  std::string Build(void) const {
+    std::string file(sizeof(llvm::ELF::Elf64_Ehdr), '\0');
+    const auto phoff = file.size();
+    file.resize(phoff + loads.size() * sizeof(llvm::ELF::Elf64_Phdr));
+
+    auto append = [&file](const std::string &data, uint64_t align) {
+      file.resize(Align(file.size(), align), '\0');
+      const auto offset = file.size();
+      file += data;
+      return offset;
+    };
+
+    std::string shstrtab(1, '\0');
+    auto add_name = [](std::string &table, const std::string &name) {
+      const auto offset = static_cast<uint32_t>(table.size());
+      table += name;
+      table.push_back('\0');
+      return offset;
+    };
+
+    std::vector<llvm::ELF::Elf64_Shdr> shdrs(1);
+    for (const auto &section : sections) {
+      auto &shdr = shdrs.emplace_back();
+      std::memset(&shdr, 0, sizeof(shdr));
+      shdr.sh_name = add_name(shstrtab, section.name);
+      shdr.sh_type = section.type;
+      shdr.sh_flags = section.flags;
+      shdr.sh_addr = section.addr;
+      shdr.sh_offset = append(section.data, section.align);
+      shdr.sh_size = section.data.size();
+      shdr.sh_addralign = section.align;
+    }
+
+    std::string strtab(1, '\0');
+    std::string symtab(sizeof(llvm::ELF::Elf64_Sym), '\0');
+    for (const auto &symbol : symbols) {
+      llvm::ELF::Elf64_Sym sym;
+      std::memset(&sym, 0, sizeof(sym));
+      sym.st_name = add_name(strtab, symbol.name);
+      sym.setBindingAndType(llvm::ELF::STB_GLOBAL, llvm::ELF::STT_FUNC);
+      sym.st_shndx = static_cast<uint16_t>(symbol.section);
+      sym.st_value = symbol.value;
+      sym.st_size = 1;
+      symtab.append(reinterpret_cast<const char *>(&sym), sizeof(sym));
+    }
+
+    const auto symtab_index = static_cast<uint32_t>(shdrs.size());
+    auto &symtab_shdr = shdrs.emplace_back();
+    std::memset(&symtab_shdr, 0, sizeof(symtab_shdr));
+    symtab_shdr.sh_name = add_name(shstrtab, ".symtab");
+    symtab_shdr.sh_type = llvm::ELF::SHT_SYMTAB;
+    symtab_shdr.sh_offset = append(symtab, 8);
+    symtab_shdr.sh_size = symtab.size();
+    symtab_shdr.sh_link = symtab_index + 1u;
+    symtab_shdr.sh_info = 1;  // Index of the first global symbol.
+    symtab_shdr.sh_addralign = 8;
+    symtab_shdr.sh_entsize = sizeof(llvm::ELF::Elf64_Sym);
+
+    auto &strtab_shdr = shdrs.emplace_back();
+    std::memset(&strtab_shdr, 0, sizeof(strtab_shdr));
+    strtab_shdr.sh_name = add_name(shstrtab, ".strtab");
+    strtab_shdr.sh_type = llvm::ELF::SHT_STRTAB;
+    strtab_shdr.sh_offset = append(strtab, 1);
+    strtab_shdr.sh_size = strtab.size();
+    strtab_shdr.sh_addralign = 1;
+
+    auto &shstrtab_shdr = shdrs.emplace_back();
+    std::memset(&shstrtab_shdr, 0, sizeof(shstrtab_shdr));
+    shstrtab_shdr.sh_name = add_name(shstrtab, ".shstrtab");
+    shstrtab_shdr.sh_type = llvm::ELF::SHT_STRTAB;
+    shstrtab_shdr.sh_offset = append(shstrtab, 1);
+    shstrtab_shdr.sh_size = shstrtab.size();
+    shstrtab_shdr.sh_addralign = 1;
+
+    const auto shoff = append(
+        std::string(reinterpret_cast<const char *>(shdrs.data()),
+                    shdrs.size() * sizeof(llvm::ELF::Elf64_Shdr)),
+        8);
+
+    for (size_t i = 0; i < loads.size(); ++i) {
+      const auto &shdr = shdrs[loads[i]];
+      llvm::ELF::Elf64_Phdr phdr;
+      std::memset(&phdr, 0, sizeof(phdr));
+      phdr.p_type = llvm::ELF::PT_LOAD;
+      phdr.p_flags = llvm::ELF::PF_R | llvm::ELF::PF_X;
+      phdr.p_offset = shdr.sh_offset;
+      phdr.p_vaddr = shdr.sh_addr;
+      phdr.p_paddr = shdr.sh_addr;
+      phdr.p_filesz = shdr.sh_size;
+      phdr.p_memsz = shdr.sh_size;
+      phdr.p_align = 1;
+      std::memcpy(&(file[phoff + i * sizeof(phdr)]), &phdr, sizeof(phdr));
+    }
+
+    llvm::ELF::Elf64_Ehdr ehdr;
+    std::memset(&ehdr, 0, sizeof(ehdr));
+    std::memcpy(ehdr.e_ident, llvm::ELF::ElfMagic, 4);
+    ehdr.e_ident[llvm::ELF::EI_CLASS] = llvm::ELF::ELFCLASS64;
+    ehdr.e_ident[llvm::ELF::EI_DATA] = llvm::ELF::ELFDATA2LSB;
+    ehdr.e_ident[llvm::ELF::EI_VERSION] = llvm::ELF::EV_CURRENT;
+    ehdr.e_type = type;
+    ehdr.e_machine = llvm::ELF::EM_X86_64;
+    ehdr.e_version = llvm::ELF::EV_CURRENT;
+    ehdr.e_entry = entry;
+    ehdr.e_phoff = loads.empty() ? 0u : phoff;
+    ehdr.e_shoff = shoff;
+    ehdr.e_ehsize = sizeof(ehdr);
+    ehdr.e_phentsize = sizeof(llvm::ELF::Elf64_Phdr);
+    ehdr.e_phnum = static_cast<uint16_t>(loads.size());
+    ehdr.e_shentsize = sizeof(llvm::ELF::Elf64_Shdr);
+    ehdr.e_shnum = static_cast<uint16_t>(shdrs.size());
+    ehdr.e_shstrndx = static_cast<uint16_t>(shdrs.size() - 1u);
+    std::memcpy(&(file[0]), &ehdr, sizeof(ehdr));
+
+    return file;
+  }
+
+  uint64_t entry{0};
+
+ private:
+  static uint64_t Align(uint64_t val, uint64_t align) {
+    align = align ? align : 1u;
+    return (val + align - 1u) / align * align;
+  }
+
+  struct Section {
+    std::string name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t align;
+    std::string data;
+  };
+
+  struct Symbol {
+    std::string name;
+    unsigned section;
+    uint64_t value;
+  };
+
+  const uint16_t type;
+  std::vector<Section> sections;
+  std::vector<Symbol> symbols;
+  std::vector<unsigned> loads;
+};
+
+// Builds little-endian, 64-bit `.eh_frame` sections located at `address`.
+class EHFrameBuilder {
+ public:
+  explicit EHFrameBuilder(uint64_t address_) : address(address_) {}
+
+  // Add a CIE whose FDEs encode their initial locations with `encoding`, one
+  // of the `DW_EH_PE_*` values, and return its offset. The encoding is only
+  // recorded if `augmentation` is `"zR"`.
+  uint64_t AddCIE(const std::string &augmentation, uint8_t encoding) {
+    std::string body;
+    AppendInt<uint32_t>(body, 0);  // CIE ID.
+    body.push_back(1);  // Version.
+    body += augmentation;
+    body.push_back('\0');
+    body.push_back(1);  // Code alignment factor.
+    body.push_back(0x78);  // Data alignment factor, i.e. `-8`.
+    body.push_back(16);  // Return address register.
+    if (augmentation == "zR") {
+      body.push_back(1);  // Augmentation data length.
+      body.push_back(static_cast<char>(encoding));
+    }
+    return AddRecord(std::move(body));
+  }
+
+  // Add an FDE that uses the CIE at `cie_offset`, and starts at `start`.
+  void AddFDE(uint64_t cie_offset, uint8_t encoding, uint64_t start) {
+    const auto id_offset = data.size() + 4u;
+    std::string body;
+    AppendInt<uint32_t>(body, static_cast<uint32_t>(id_offset - cie_offset));
+    if (encoding == llvm::dwarf::DW_EH_PE_absptr) {
+      AppendInt<uint64_t>(body, start);
+    } else {
+      const auto field_addr = address + id_offset + 4u;
+      AppendInt<int32_t>(body, static_cast<int32_t>(start - field_addr));
+    }
+    AppendInt<uint32_t>(body, 1);  // Address range.
+    if (encoding != llvm::dwarf::DW_EH_PE_absptr) {
+      body.push_back(0);  // Augmentation data length.
+    }
+    (void) AddRecord(std::move(body));
+  }
+
+  // Returns the section contents, ending with a terminator.
+  std::string Build(void) const {
+    auto section = data;
+    AppendInt<uint32_t>(section, 0);
+    return section;
+  }
+
+ private:
+  template <typename T>
+  static void AppendInt(std::string &out, T val) {
+    out.append(reinterpret_cast<const char *>(&val), sizeof(val));
+  }
+
+  uint64_t AddRecord(std::string body) {
+    body.resize((body.size() + 4u + 7u) / 8u * 8u - 4u, '\0');
+    const auto offset = data.size();
+    AppendInt<uint32_t>(data, static_cast<uint32_t>(body.size()));
+    data += body;
+    return offset;
+  }
+
+  const uint64_t address;
+  std::string data;
+};
+
+class BinaryTest : public testing::Test {
+ protected:
+  void SetUp(void) override {
+    const auto *info = testing::UnitTest::GetInstance()->current_test_info();
+    dir = std::filesystem::path(testing::TempDir()) /
+          (std::string("remill_binary_") + info->name());
+    std::filesystem::remove_all(dir);
+    ASSERT_TRUE(std::filesystem::create_directories(dir));
+  }
+
+  void TearDown(void) override {
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+  }
+
+  std::string Write(const char *file_name, const std::string &contents) {
+    const auto path = (dir / file_name).string();
+    std::ofstream(path, std::ios::binary) << contents;
+    return path;
+  }
+
+  std::filesystem::path dir;
+};
+
+// Executable segments are placed at their virtual addresses.
+TEST_F(BinaryTest, Executable) {
+  ELFBuilder elf(llvm::ELF::ET_EXEC);
+  elf.entry = 0x401000;
+  const auto text = elf.AddText(".text", 0x401000, 16, "\x90\xc3");
+  elf.AddLoad(text);
+  elf.AddFunction("main", text, 0x401000);
+
+  const auto binary = Binary::Open(Write("exe", elf.Build()), 0x1000);
+  ASSERT_NE(binary, nullptr);
+  EXPECT_TRUE(binary->IsELF());
+  EXPECT_EQ(binary->EntryPoint(), 0x401000u);
+
+  ASSERT_EQ(binary->Segments().size(), 1u);
+  EXPECT_EQ(binary->Segments()[0].address, 0x401000u);
+  EXPECT_EQ(binary->Read(0x401001, 16), "\xc3");
+  EXPECT_EQ(binary->Read(0x401002, 16), "");
+  EXPECT_EQ(binary->Read(0x1000, 16), "");
+
+  ASSERT_EQ(binary->FunctionSymbols().size(), 1u);
+  EXPECT_EQ(binary->FunctionSymbols()[0].address, 0x401000u);
+  EXPECT_EQ(binary->FunctionSymbols()[0].name, "main");
+}
+
+// The sections of relocatable files are all at address zero, so they are laid
+// out one after another, starting at the base address, and their symbols are
+// moved along with them.
+TEST_F(BinaryTest, Relocatable) {
+  ELFBuilder elf(llvm::ELF::ET_REL);
+  const auto f = elf.AddText(".text", 0, 4, "\x90\x90\xc3");
+  elf.AddSection(".data", llvm::ELF::SHT_PROGBITS,
+                 llvm::ELF::SHF_ALLOC | llvm::ELF::SHF_WRITE, 0, 8,
+                 std::string(8, '\0'));
+  const auto g = elf.AddText(".text.g", 0, 16, "\x90\xc3");
+  elf.AddFunction("f", f, 0);
+  elf.AddFunction("g", g, 1);
+
+  const auto binary = Binary::Open(Write("obj.o", elf.Build()), 0x1000);
+  ASSERT_NE(binary, nullptr);
+
+  const auto &segments = binary->Segments();
+  ASSERT_EQ(segments.size(), 2u);
+  EXPECT_EQ(segments[0].address, 0x1000u);
+  EXPECT_EQ(segments[0].data, "\x90\x90\xc3");
+  EXPECT_EQ(segments[1].address, 0x1010u);
+  EXPECT_EQ(segments[1].data, "\x90\xc3");
+
+  const auto &symbols = binary->FunctionSymbols();
+  ASSERT_EQ(symbols.size(), 2u);
+  EXPECT_EQ(symbols[0].address, 0x1000u);
+  EXPECT_EQ(symbols[0].name, "f");
+  EXPECT_EQ(symbols[1].address, 0x1011u);
+  EXPECT_EQ(symbols[1].name, "g");
+}
+
+// Overlapping executable segments are an error, rather than being dropped.
+TEST_F(BinaryTest, OverlappingSegments) {
+  ELFBuilder elf(llvm::ELF::ET_EXEC);
+  elf.AddLoad(elf.AddText(".text", 0x401000, 16, "\x90\x90\xc3"));
+  elf.AddLoad(elf.AddText(".text.hot", 0x401002, 16, "\xc3"));
+  EXPECT_EQ(Binary::Open(Write("exe", elf.Build()), 0), nullptr);
+}
+
+// Only ELF files are parsed, so other formats are rejected instead of being
+// lifted as raw flat binaries.
+TEST_F(BinaryTest, OtherFormats) {
+  std::string pe(0x40, '\0');
+  pe[0] = 'M';
+  pe[1] = 'Z';
+  pe[0x3c] = 0x40;  // Offset of the PE signature.
+  pe += std::string("PE\0\0", 4) + std::string(0x40, '\0');
+  EXPECT_EQ(Binary::Open(Write("pe.exe", pe), 0), nullptr);
+
+  std::string macho(0x20, '\0');
+  std::memcpy(&(macho[0]), "\xcf\xfa\xed\xfe", 4);  // `MH_MAGIC_64`.
+  macho[12] = 2;  // `MH_EXECUTE`.
+  EXPECT_EQ(Binary::Open(Write("macho", macho), 0), nullptr);
+
+  EXPECT_EQ(Binary::Open(Write("raw.bin", "\x90\x90\xc3"), 0), nullptr);
+  EXPECT_EQ(Binary::Open((dir / "missing").string(), 0), nullptr);
+}
+
+// Raw flat binaries must be opened as such, and are entirely executable.
+TEST_F(BinaryTest, Raw) {
+  const auto binary = Binary::OpenRaw(Write("raw.bin", "\x90\x90\xc3"), 0x2000);
+  ASSERT_NE(binary, nullptr);
+  EXPECT_FALSE(binary->IsELF());
+  EXPECT_EQ(binary->EntryPoint(), 0u);
+  ASSERT_EQ(binary->Segments().size(), 1u);
+  EXPECT_EQ(binary->Segments()[0].address, 0x2000u);
+  EXPECT_EQ(binary->Read(0x2001, 16), "\x90\xc3");
+
+  // Even ELF files.
+  ELFBuilder elf(llvm::ELF::ET_EXEC);
+  elf.AddLoad(elf.AddText(".text", 0x401000, 16, "\xc3"));
+  const auto contents = elf.Build();
+  const auto raw_elf = Binary::OpenRaw(Write("exe", contents), 0x2000);
+  ASSERT_NE(raw_elf, nullptr);
+  EXPECT_FALSE(raw_elf->IsELF());
+  EXPECT_EQ(raw_elf->Read(0x2000, contents.size()), contents);
+}
+
+// The initial location of each FDE in `.eh_frame` is a function start, whether
+// it is PC-relative or absolute.
+TEST_F(BinaryTest, EHFrame) {
+  constexpr uint64_t kEHFrameAddress = 0x402000;
+  constexpr uint8_t kPCRel =
+      llvm::dwarf::DW_EH_PE_pcrel | llvm::dwarf::DW_EH_PE_sdata4;
+  constexpr uint8_t kAbs = llvm::dwarf::DW_EH_PE_absptr;
+
+  EHFrameBuilder eh_frame(kEHFrameAddress);
+  const auto pcrel_cie = eh_frame.AddCIE("zR", kPCRel);
+  eh_frame.AddFDE(pcrel_cie, kPCRel, 0x401010);
+  eh_frame.AddFDE(pcrel_cie, kPCRel, 0x401000);
+  const auto abs_cie = eh_frame.AddCIE("", kAbs);
+  eh_frame.AddFDE(abs_cie, kAbs, 0x401020);
+  eh_frame.AddFDE(abs_cie, kAbs, 0x401000);  // Duplicate.
+  eh_frame.AddFDE(abs_cie, kAbs, 0);  // Discarded function.
+  eh_frame.AddFDE(pcrel_cie, kPCRel, 0x401030);
+
+  ELFBuilder elf(llvm::ELF::ET_EXEC);
+  elf.AddLoad(elf.AddText(".text", 0x401000, 16, std::string(0x40, '\xc3')));
+  elf.AddSection(".eh_frame", llvm::ELF::SHT_PROGBITS, llvm::ELF::SHF_ALLOC,
+                 kEHFrameAddress, 8, eh_frame.Build());
+
+  const auto binary = Binary::Open(Write("exe", elf.Build()), 0);
+  ASSERT_NE(binary, nullptr);
+  EXPECT_EQ(binary->EHFrameFunctionStarts(),
+            (std::vector<uint64_t>{0x401000, 0x401010, 0x401020, 0x401030}));
+}
+
+// Parsing stops at truncated records, but keeps what came before them.
+TEST_F(BinaryTest, TruncatedEHFrame) {
+  constexpr uint8_t kPCRel =
+      llvm::dwarf::DW_EH_PE_pcrel | llvm::dwarf::DW_EH_PE_sdata4;
+
+  EHFrameBuilder eh_frame(0x402000);
+  const auto cie = eh_frame.AddCIE("zR", kPCRel);
+  eh_frame.AddFDE(cie, kPCRel, 0x401000);
+  eh_frame.AddFDE(cie, kPCRel, 0x401010);
+  auto contents = eh_frame.Build();
+  contents.resize(contents.size() - 12u);
+
+  ELFBuilder elf(llvm::ELF::ET_EXEC);
+  elf.AddLoad(elf.AddText(".text", 0x401000, 16, std::string(0x20, '\xc3')));
+  elf.AddSection(".eh_frame", llvm::ELF::SHT_PROGBITS, llvm::ELF::SHF_ALLOC,
+                 0x402000, 8, contents);
+
+  const auto binary = Binary::Open(Write("exe", elf.Build()), 0);
+  ASSERT_NE(binary, nullptr);
+  EXPECT_EQ(binary->EHFrameFunctionStarts(), std::vector<uint64_t>{0x401000});
+}
+
+// The `.eh_frame` sections of relocatable files need relocating, and so they
+// aren't used.
+TEST_F(BinaryTest, RelocatableEHFrame) {
+  EHFrameBuilder eh_frame(0);
+  const auto cie = eh_frame.AddCIE("", llvm::dwarf::DW_EH_PE_absptr);
+  eh_frame.AddFDE(cie, llvm::dwarf::DW_EH_PE_absptr, 0x10);
+
+  ELFBuilder elf(llvm::ELF::ET_REL);
+  elf.AddText(".text", 0, 16, std::string(0x20, '\xc3'));
+  elf.AddSection(".eh_frame", llvm::ELF::SHT_PROGBITS, llvm::ELF::SHF_ALLOC, 0,
+                 8, eh_frame.Build());
+
+  const auto binary = Binary::Open(Write("obj.o", elf.Build()), 0x1000);
+  ASSERT_NE(binary, nullptr);
+  EXPECT_TRUE(binary->EHFrameFunctionStarts().empty());
+}
+
+}  // namespace
@@ -26,7 +26,11 @@
 #include <test_runner/TestOutputSpec.h>
 #include <test_runner/TestRunner.h>
 
+#include <atomic>
+#include <sstream>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace {
 
@@ -811,3 +815,74 @@ TEST(PPCVLELifts, PPCVLESyscall) {
   TestSpecRunner<PPCState> runner(curr_context);
   runner.RunTestSpec(spec, kVLEContext);
 }
+
+// Build one architecture per thread, each in its own `LLVMContext`, and lift
+// with all of them at once.
+TEST(PPCVLELifts, PPCVLEConcurrentArchs) {
+  static constexpr unsigned kNumThreads = 8u;
+  static constexpr unsigned kNumLifts = 16u;
+
+  // add r5, r4, r3
+  const std::string insn_data("\x7C\xA4\x1A\x14", 4);
+  std::atomic<unsigned> num_lifted{0u};
+  std::vector<std::thread> threads;
+  for (auto i = 0u; i < kNumThreads; ++i) {
+    threads.emplace_back([&insn_data, &num_lifted](void) {
+      llvm::LLVMContext context;
+      test_runner::LiftingTester lifter(context, remill::OSName::kOSLinux,
+                                        remill::kArchPPC);
+      for (auto j = 0u; j < kNumLifts; ++j) {
+        std::stringstream ss;
+        ss << "concurrent_func_" << j;
+        auto maybe_func = lifter.LiftInstructionFunction(
+            ss.str(), insn_data, 0x12 + j * 4u, kVLEContext);
+        if (maybe_func && maybe_func->second.category ==
+                              remill::Instruction::Category::kCategoryNormal) {
+          num_lifted.fetch_add(1u);
+        }
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(num_lifted.load(), kNumThreads * kNumLifts);
+}
+
+// Decode with one architecture from many threads at once.
+TEST(PPCVLELifts, PPCVLEConcurrentDecode) {
+  static constexpr unsigned kNumThreads = 8u;
+  static constexpr unsigned kNumDecodes = 64u;
+
+  llvm::LLVMContext context;
+  auto arch = remill::Arch::Build(&context, remill::OSName::kOSLinux,
+                                  remill::ArchName::kArchPPC);
+  auto sems = remill::LoadArchSemantics(arch.get());
+
+  // e_b 0x10
+  const std::string insn_data("\x78\x00\x00\x10", 4);
+  std::atomic<unsigned> num_decoded{0u};
+  std::vector<std::thread> threads;
+  for (auto i = 0u; i < kNumThreads; ++i) {
+    threads.emplace_back([&](void) {
+      for (auto j = 0u; j < kNumDecodes; ++j) {
+        const uint64_t address = 0x1000 + j * 4u;
+        remill::Instruction insn;
+        if (arch->DecodeInstruction(address, insn_data, insn, kVLEContext) &&
+            insn.category ==
+                remill::Instruction::Category::kCategoryDirectJump &&
+            insn.branch_taken_pc == address + 0x10) {
+          num_decoded.fetch_add(1u);
+        }
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(num_decoded.load(), kNumThreads * kNumDecodes);
+}
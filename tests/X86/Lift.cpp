@@ -25,11 +25,14 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 #include "remill/Arch/Arch.h"
 #include "remill/Arch/Instruction.h"
@@ -82,6 +85,10 @@ class TestTraceManager : public remill::TraceManager {
     return GetLiftedTraceDeclaration(addr);
   }
 
+  std::string TraceName(uint64_t addr) override {
+    return remill::TraceManager::TraceName(addr) + name_suffix;
+  }
+
   bool TryReadExecutableByte(uint64_t addr, uint8_t *byte) override {
     auto byte_it = memory.find(addr);
     if (byte_it != memory.end()) {
@@ -95,8 +102,29 @@ class TestTraceManager : public remill::TraceManager {
  public:
   std::unordered_map<uint64_t, uint8_t> memory;
   std::unordered_map<uint64_t, llvm::Function *> traces;
+  std::string name_suffix;
 };
 
+// Returns `true` if decoding the code of `test` with idiom fusion yields an
+// instruction with the semantics `isel_name`.
+static bool FusesIdiom(const remill::Arch *arch, const test::TestInfo *test,
+                       const std::string &isel_name) {
+  const auto context = arch->CreateInitialContext();
+  const auto max_size = arch->MaxInstructionSize(context, true);
+  remill::Instruction inst;
+  for (auto pc = test->test_begin; pc < test->test_end;
+       pc += inst.bytes.size()) {
+    std::string_view bytes(reinterpret_cast<const char *>(pc), max_size);
+    inst.Reset();
+    if (!arch->DecodeInstruction(pc, bytes, inst, context)) {
+      return false;
+    } else if (inst.function == isel_name) {
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 extern "C" int main(int argc, char *argv[]) {
@@ -114,15 +142,34 @@ extern "C" int main(int argc, char *argv[]) {
     tests.push_back(&test);
   }
 
+  // Tests that must fuse an idiom, and the semantics of the fused instruction.
+  std::unordered_map<uintptr_t, std::string> fused_tests;
+  for (auto i = 0U;; ++i) {
+    const auto &info = test::__x86_fuse_table_begin[i];
+    if (&info >= &(test::__x86_fuse_table_end[0])) {
+      break;
+    }
+    fused_tests[info.test_begin] = info.isel_name;
+  }
+
   TestTraceManager manager;
 
-  // Add all code byts from the test cases to the memory.
+  // Add all code byts from the test cases to the memory. Decoders only fuse
+  // idioms when they can see more than one instruction's worth of bytes, so
+  // also add the bytes following the test, starting with its `ud2`.
   for (auto test : tests) {
-    for (auto addr = test->test_begin; addr < test->test_end; ++addr) {
+    for (auto addr = test->test_begin;
+         addr < test->test_end + test::kMaxInstrLen; ++addr) {
       manager.memory[addr] = *reinterpret_cast<uint8_t *>(addr);
     }
   }
 
+  // Tests that fuse idioms are also lifted without fusion, into functions
+  // with their own names.
+  TestTraceManager unfused_manager;
+  unfused_manager.memory = manager.memory;
+  unfused_manager.name_suffix = "_unfused";
+
   llvm::LLVMContext context;
   auto os_name = remill::GetOSName(REMILL_OS);
   auto arch_name = remill::GetArchName(FLAGS_arch);
@@ -130,8 +177,16 @@ extern "C" int main(int argc, char *argv[]) {
   auto module = remill::LoadArchSemantics(arch.get());
 
   remill::IntrinsicTable intrinsics(module.get());
-  remill::TraceLifter trace_lifter(arch.get(), manager);
+  remill::TraceLifterOptions options;
+  options.fuse_idioms = true;
+  remill::TraceLifter trace_lifter(arch.get(), manager, options);
+
+  remill::TraceLifterOptions unfused_options;
+  unfused_options.fuse_idioms = false;
+  remill::TraceLifter unfused_trace_lifter(arch.get(), unfused_manager,
+                                           unfused_options);
 
+  auto num_errors = 0u;
   for (auto test : tests) {
     if (!trace_lifter.Lift(test->test_begin)) {
       LOG(ERROR) << "Unable to lift test " << test->test_name;
@@ -144,6 +199,28 @@ extern "C" int main(int argc, char *argv[]) {
 
     auto lifted_trace = manager.GetLiftedTraceDefinition(test->test_begin);
     lifted_trace->setName(ss.str());
+
+    auto fused_it = fused_tests.find(test->test_begin);
+    if (fused_it == fused_tests.end()) {
+      continue;
+    }
+
+    if (!FusesIdiom(arch.get(), test, fused_it->second)) {
+      LOG(ERROR) << "Test " << test->test_name
+                 << " does not fuse an idiom into " << fused_it->second;
+      ++num_errors;
+    }
+
+    if (!unfused_trace_lifter.Lift(test->test_begin)) {
+      LOG(ERROR) << "Unable to lift unfused test " << test->test_name;
+      ++num_errors;
+      continue;
+    }
+
+    std::stringstream unfused_ss;
+    unfused_ss << SYMBOL_PREFIX << test->test_name << "_unfused_lifted";
+    unfused_manager.GetLiftedTraceDefinition(test->test_begin)
+        ->setName(unfused_ss.str());
   }
 
   DLOG(INFO) << "Serializing bitcode to " << FLAGS_bc_out;
@@ -153,5 +230,5 @@ extern "C" int main(int argc, char *argv[]) {
   remill::StoreModuleToFile(module.get(), FLAGS_bc_out);
 
   DLOG(INFO) << "Done.";
-  return 0;
+  return num_errors ? EXIT_FAILURE : EXIT_SUCCESS;
 }
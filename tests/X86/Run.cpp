@@ -24,6 +24,7 @@
 #include <signal.h>
 #include <ucontext.h>
 
+#include <algorithm>
 #include <cmath>
 #include <cstdint>
 #include <cstdlib>
@@ -638,6 +639,10 @@ typedef Memory *(LiftedFunc) (State &, addr_t, Memory *);
 // Mapping of test name to translated function.
 static std::map<uint64_t, LiftedFunc *> gTranslatedFuncs;
 
+// Mapping of test name to the function translated without fusing idioms. Only
+// tests that fuse idioms have these.
+static std::map<uint64_t, LiftedFunc *> gUnfusedTranslatedFuncs;
+
 static std::vector<const test::TestInfo *> gTests;
 
 static void InitFlags(void) {
@@ -768,9 +773,9 @@ inline static bool operator!=(const T &a, const T &b) {
   return !!memcmp(&a, &b, sizeof(a));
 }
 
-static void RunWithFlags(const test::TestInfo *info, Flags flags,
-                         std::string desc, uint64_t arg1, uint64_t arg2,
-                         uint64_t arg3) {
+static void RunWithFlags(const test::TestInfo *info, LiftedFunc *lifted_func,
+                         Flags flags, std::string desc, uint64_t arg1,
+                         uint64_t arg2, uint64_t arg3) {
 
   // Can't fit a 64-bit stack address into a 32-bit register.
   auto stack_addr = reinterpret_cast<uintptr_t>(&(gLiftedStack.bytes[0]));
@@ -823,8 +828,6 @@ static void RunWithFlags(const test::TestInfo *info, Flags flags,
   memcpy(&gNativeStack, &gLiftedStack, sizeof(gLiftedStack));
   memcpy(&gLiftedStack, &gRandomStack, sizeof(gLiftedStack));
 
-  auto lifted_func = gTranslatedFuncs[info->test_begin];
-
   // This will execute on our stack but the lifted code will operate on
   // `gStack`. The mechanism behind this is that `gLiftedState` is the native
   // program state recorded before executing the native testcase, but after
@@ -1162,7 +1165,15 @@ TEST_P(InstrTest, SemanticsMatchNative) {
       flags.df = eflags.df;
       flags.of = eflags.of;
 
-      RunWithFlags(info, flags, ss2.str(), args[0], args[1], args[2]);
+      RunWithFlags(info, gTranslatedFuncs[info->test_begin], flags, ss2.str(),
+                   args[0], args[1], args[2]);
+
+      // The fused and unfused idioms must both behave like the native code.
+      auto unfused_it = gUnfusedTranslatedFuncs.find(info->test_begin);
+      if (unfused_it != gUnfusedTranslatedFuncs.end()) {
+        RunWithFlags(info, unfused_it->second, flags, ss2.str() + " unfused",
+                     args[0], args[1], args[2]);
+      }
     }
   }
 }
@@ -1298,6 +1309,33 @@ int main(int argc, char **argv) {
     gTranslatedFuncs[test.test_begin] = lifted_func;
   }
 
+  // Populate the unfused versions of the tests that fuse idioms.
+  for (auto i = 0U;; ++i) {
+    const auto &info = test::__x86_fuse_table_begin[i];
+    if (&info >= &(test::__x86_fuse_table_end[0]))
+      break;
+
+    auto test_it = std::find_if(gTests.begin(), gTests.end(),
+                                [&info](const test::TestInfo *test) {
+                                  return test->test_begin == info.test_begin;
+                                });
+    CHECK(test_it != gTests.end());
+
+    std::stringstream ss;
+    ss << (*test_it)->test_name << "_unfused_lifted";
+    auto sym_func = dlsym(this_exe, ss.str().c_str());
+    if (!sym_func) {
+      sym_func = dlsym(this_exe, (std::string("_") + ss.str()).c_str());
+    }
+
+    CHECK(nullptr != sym_func)
+        << "Could not find unfused code for test case "
+        << (*test_it)->test_name;
+
+    gUnfusedTranslatedFuncs[info.test_begin] =
+        reinterpret_cast<LiftedFunc *>(sym_func);
+  }
+
   // Populate the random stack.
   memset(&gRandomStack, 0, sizeof(gRandomStack));
   for (auto &b : gRandomStack.bytes) {
@@ -33,9 +33,18 @@ struct alignas(128) TestInfo {
   const uint64_t ignored_flags_mask;
 } __attribute__((packed));
 
+// Says that the decoder must fuse an idiom in the test starting at
+// `test_begin` into the instruction with the semantics `isel_name`.
+struct alignas(16) FusedTestInfo {
+  const uintptr_t test_begin;
+  const char *isel_name;
+} __attribute__((packed));
+
 extern "C" {
 extern const TestInfo __x86_test_table_begin[];
 extern const TestInfo __x86_test_table_end[];
+extern const FusedTestInfo __x86_fuse_table_begin[];
+extern const FusedTestInfo __x86_fuse_table_end[];
 }  // extern C
 
 }  // namespace test